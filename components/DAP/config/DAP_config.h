@@ -45,7 +45,9 @@
 #include <string.h>
 
 #include "components/DAP/include/cmsis_compiler.h"
+#if !defined(DAP_HOST_BUILD)
 #include "components/DAP/include/gpio_op.h"
+#endif
 #include "components/DAP/include/spi_switch.h"
 
 #include "main/dap_configuration.h"
@@ -114,7 +116,7 @@ This information includes:
 /// This configuration settings is used to optimize the communication performance with the
 /// debugger and depends on the USB peripheral. For devices with limited RAM or USB buffer the
 /// setting can be reduced (valid range is 1 .. 255).
-#define DAP_PACKET_COUNT 255 ///< Specifies number of packets buffered.
+#define DAP_PACKET_COUNT DAP_PACKET_WINDOW ///< Specifies number of packets buffered.
 
 /// Indicate that UART Serial Wire Output (SWO) trace is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
@@ -243,6 +245,11 @@ of the same I/O port. The following SWDIO I/O Pin functions are provided:
  - \ref PIN_SWDIO_OUT to write to the SWDIO I/O pin with utmost possible speed.
 */
 
+#if defined(DAP_HOST_BUILD)
+// Off-target build of the DAP core, the pins are driven through dap_hal.h
+#include "components/DAP/include/dap_hal.h"
+#else
+
 /**
  * @brief Setup JTAG I/O pins: TCK, TMS, TDI, TDO, nTRST, and nRESET.
  * Configures the DAP Hardware I/O pins for JTAG mode:
@@ -665,6 +672,8 @@ __STATIC_INLINE void DAP_SETUP(void)
   PORT_OFF();
 }
 
+#endif // DAP_HOST_BUILD
+
 /** Reset Target Device with custom specific I/O pin or command sequence.
 This function allows the optional implementation of a device specific reset sequence.
 It is called when the command \ref DAP_ResetTarget and is for example required
@@ -255,6 +255,9 @@ extern uint32_t JTAG_ReadIDCode (void);
 extern void     JTAG_WriteAbort (uint32_t data);
 extern uint8_t  JTAG_Transfer   (uint32_t request, uint32_t *data);
 extern uint8_t  SWD_Transfer    (uint32_t request, uint32_t *data);
+extern uint32_t SWD_WriteRun    (const uint8_t *data, uint32_t stride, uint32_t count, uint32_t request, uint8_t *ack);
+extern void     SWD_Calibrate   (uint32_t count, uint8_t need_delay);
+extern void     JTAG_Calibrate  (uint32_t count);
 
 extern void     Delayms         (uint32_t delay);
 
@@ -293,7 +296,11 @@ extern void     DAP_Setup (void);
 #define DELAY_SLOW_CYCLES       3U      // Number of cycles for one iteration
 #endif
 
+#if defined(__XTENSA__)
 #define USE_ASSEMBLY 1
+#else
+#define USE_ASSEMBLY 0
+#endif
 
 #if (USE_ASSEMBLY == 0)
   __STATIC_FORCEINLINE void PIN_DELAY_SLOW(uint32_t delay)
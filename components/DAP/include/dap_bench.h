@@ -0,0 +1,29 @@
+/**
+ * @file dap_bench.h
+ * @brief Microbenchmarks of the DAP commands, on the board and in the host build
+ *
+ * @version 0.1
+ * @date 2022-08-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __DAP_BENCH_H__
+#define __DAP_BENCH_H__
+
+#include <stdint.h>
+
+/**
+ * @brief Run the benchmark matrix and print it as CSV
+ *
+ * Every command of the matrix goes through DAP_ProcessCommand() on each of
+ * kTransfer_SPI, kTransfer_GPIO_fast and kTransfer_GPIO_normal. The time is
+ * counted in CPU cycles with CCOUNT on the ESP32, and in ns in the host build.
+ * Nothing else may drive the DAP while it runs.
+ *
+ * @param iterations Number of times each command is run
+ */
+void dap_bench_run(uint32_t iterations);
+
+#endif
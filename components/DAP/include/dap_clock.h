@@ -0,0 +1,100 @@
+/**
+ * @file dap_clock.h
+ * @brief SWJ clock planner, picking the engine and its setting for a requested clock
+ *
+ * DAP_SWJ_Clock() hands the requested clock to dap_clock_set(), which picks
+ * the setting reaching the highest clock not above it, the request being the
+ * fastest the target takes:
+ *  - up to the clock of the GPIO engine without delay, the GPIO engine, with
+ *    the PIN_DELAY_SLOW() delay that comes closest, or without delay.
+ *  - above, the SPI engine, at APB / ((clkdiv_pre + 1) * (clkcnt_n + 1)) and
+ *    up to DAP_SPI_MAX_CLOCK, or DAP_JTAG_SPI_MAX_CLOCK for JTAG. Without
+ *    USE_JTAG_SPI, a JTAG port stays on the fast GPIO engine.
+ *
+ * The GPIO clocks come from a calibration, which counts the CPU cycles of
+ * the clock cycles of SW_DP.c and JTAG_DP.c with CCOUNT, without delay and
+ * with two delays. It runs in DAP_Setup(), and again in dap_clock_set() for
+ * a CPU clock not calibrated yet. It toggles SWCLK/TCK, so while a port is
+ * connected the cycles of the last calibration stand in for the new ones.
+ * The host build has no CCOUNT, it takes the cycles of a model instead.
+ *
+ * ID_DAP_Vendor_Clock reports the clock reached, so that a debugger can trade
+ * speed against signal integrity:
+ *   request:  [ID, clock (uint32)]
+ *   response: [ID, DAP_OK, engine, requested (uint32), actual (uint32)], little endian
+ * With a clock of 0 it reports the current setting. Otherwise it reports the
+ * setting that clock would get, without applying it. The engine is one of
+ * enum transfer_type.
+ *
+ * @version 0.1
+ * @date 2022-08-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __DAP_CLOCK_H__
+#define __DAP_CLOCK_H__
+
+#include <stdint.h>
+
+#include "main/dap_configuration.h"
+
+#define ID_DAP_Vendor_Clock 0x82U // ID_DAP_Vendor2
+
+// Clock of the SPI peripheral
+#define DAP_CLOCK_APB 80000000U
+
+// CPU clocks with their own calibration
+#define DAP_CLOCK_CPU_COUNT 4U
+
+typedef struct
+{
+    uint32_t requested;
+    uint32_t hz;          // clock reached
+    uint8_t engine;       // enum transfer_type
+    uint8_t fast_clock;   // DAP_Data.fast_clock
+    uint32_t clock_delay; // DAP_Data.clock_delay
+    uint16_t spi_pre;     // clkdiv_pre, with clkcnt_n 0 for the APB clock itself
+    uint8_t spi_n;        // clkcnt_n
+} dap_clock_plan_t;
+
+/**
+ * @brief Plan a clock, without applying it
+ *
+ * @param clock Requested clock in Hz, not 0
+ * @param port DAP_PORT_* the clock is for
+ */
+void dap_clock_plan(uint32_t clock, uint32_t port, dap_clock_plan_t *plan);
+
+/**
+ * @brief Plan the clock for DAP_Data.debug_port, and switch the engine to it
+ *
+ */
+void dap_clock_set(uint32_t clock);
+
+/**
+ * @brief Plan the default clock at boot. Only DAP_Data is set, the pins are left alone.
+ *
+ */
+void dap_clock_init(void);
+
+const dap_clock_plan_t *dap_clock_current(void);
+
+/**
+ * @brief Calibrate the GPIO engine at the current CPU clock
+ *
+ */
+void dap_clock_calibrate(void);
+
+/**
+ * @brief Clock of the GPIO engine with a PIN_DELAY_SLOW(delay) every half period
+ *
+ * @param port DAP_PORT_JTAG, or the SWD engine for other ports
+ * @param delay 0 for the engine without delay
+ */
+uint32_t dap_clock_gpio_hz(uint32_t port, uint32_t delay);
+
+uint32_t dap_clock_vendor_command(const uint8_t *request, uint8_t *response);
+
+#endif
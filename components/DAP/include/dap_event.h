@@ -0,0 +1,123 @@
+/**
+ * @file dap_event.h
+ * @brief Timeline of the DAP path, recorded in a binary event ring per core
+ *
+ * Each event is a CCOUNT timestamp, a type, a phase and an argument. The
+ * rings are written without a lock: a slot is taken with an atomic add, so
+ * the tasks sharing a core may record concurrently. The oldest events are
+ * overwritten.
+ *
+ * CCOUNT is per core and wraps every 17s, so a ring also gets a SYNC event
+ * with the esp_timer time every DAP_EVENT_SYNC_EVENTS events, and before an
+ * event that comes after a long idle time. host/dap_event_convert maps the
+ * events of both cores on the esp_timer time with them, and writes a Chrome
+ * trace for chrome://tracing or ui.perfetto.dev.
+ *
+ * A dump is a dap_event_dump_header, then for each ring a
+ * dap_event_ring_header followed by its events, oldest first. All the
+ * fields are little-endian.
+ *
+ * @version 0.1
+ * @date 2022-08-15
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __DAP_EVENT_H__
+#define __DAP_EVENT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "main/dap_configuration.h"
+
+#define DAP_EVENT_MAGIC 0x54564544 // "DEVT"
+#define DAP_EVENT_VERSION 1
+#define DAP_EVENT_CORE_NUM 2
+
+typedef enum
+{
+    DAP_EVENT_SYNC = 0,      // arg: esp_timer time in us
+    DAP_EVENT_RECV,          // a TCP segment or UDP datagram dispatched, arg: bytes received
+    DAP_EVENT_QUEUE_PUSH,    // a command queued for DAP_Thread, arg: seqnum
+    DAP_EVENT_QUEUE_POP,     // DAP_Thread takes it, arg: seqnum
+    DAP_EVENT_EXECUTE,       // DAP_ExecuteCommand() of a packet, arg: seqnum
+    DAP_EVENT_COMMAND,       // a command of the packet, arg: command ID
+    DAP_EVENT_SWD_TRANSFER,  // arg: request | SWD_TransferSpeed << 8
+    DAP_EVENT_REPLY,         // the reply task sends responses, arg: count
+    DAP_EVENT_SEND,          // a TCP write or UDP datagram, arg: number of buffers
+    DAP_EVENT_TYPE_NUM,
+} dap_event_type_t;
+
+typedef enum
+{
+    DAP_EVENT_INSTANT = 0,
+    DAP_EVENT_BEGIN,
+    DAP_EVENT_END,
+} dap_event_phase_t;
+
+typedef struct
+{
+    uint32_t timestamp; // CCOUNT of the core
+    uint8_t type;
+    uint8_t phase;
+    uint16_t reserved;
+    uint32_t arg;
+} __attribute__((packed)) dap_event_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t ring_count;
+    uint32_t cpu_hz; // CCOUNT frequency
+} __attribute__((packed)) dap_event_dump_header;
+
+typedef struct
+{
+    uint16_t core;
+    uint16_t reserved;
+    uint32_t count; // events that follow
+    uint32_t dropped; // overwritten before the dump
+} __attribute__((packed)) dap_event_ring_header;
+
+/**
+ * @brief Called by dap_event_dump() for each part of the dump
+ *
+ * @return 0 to go on, -1 to stop the dump
+ */
+typedef int (*dap_event_write_t)(const void *data, size_t length, void *context);
+
+#if (USE_DAP_EVENT_TRACE == 1)
+
+void dap_event_record(dap_event_type_t type, dap_event_phase_t phase, uint32_t arg);
+
+/**
+ * @brief Write the rings. Recording is paused meanwhile.
+ *
+ * @return 0 on success, -1 if write failed
+ */
+int dap_event_dump(dap_event_write_t write, void *context);
+
+#if defined(DAP_HOST_BUILD)
+/**
+ * @brief Set the ring the calling thread records to, the core of its task
+ *
+ */
+void dap_event_set_core(uint32_t core);
+#endif
+
+#define DAP_EVENT_BEGIN(type, arg) dap_event_record((type), DAP_EVENT_BEGIN, (arg))
+#define DAP_EVENT_END(type, arg) dap_event_record((type), DAP_EVENT_END, (arg))
+#define DAP_EVENT_INSTANT(type, arg) dap_event_record((type), DAP_EVENT_INSTANT, (arg))
+
+#else
+
+#define DAP_EVENT_BEGIN(type, arg)
+#define DAP_EVENT_END(type, arg)
+#define DAP_EVENT_INSTANT(type, arg)
+
+#endif
+
+#endif
@@ -0,0 +1,177 @@
+/**
+ * @file dap_hal.h
+ * @brief Pin and timer access of the DAP core in a host build
+ *
+ * On the ESP32, DAP_config.h drives the pins through the GPIO registers.
+ * When DAP_HOST_BUILD is defined, the same functions call the HAL set with
+ * dap_hal_set() instead, so that DAP.c, SW_DP.c and JTAG_DP.c can run on a PC
+ * against a model of the wire. DAP_SPI_* are emulated on these pins, see
+ * host/spi_op_host.c.
+ *
+ * @version 0.1
+ * @date 2022-08-08
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __DAP_HAL_H__
+#define __DAP_HAL_H__
+
+#include <stdint.h>
+
+#include "components/DAP/include/cmsis_compiler.h"
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/spi_switch.h"
+
+/**
+ * @brief Pin access of the DAP. Every member must be set.
+ *
+ */
+typedef struct
+{
+    void (*port_setup)(uint32_t port); // DAP_PORT_DISABLED, DAP_PORT_SWD or DAP_PORT_JTAG
+    void (*swclk_tck_out)(uint32_t bit);
+    void (*swdio_tms_out)(uint32_t bit);
+    uint32_t (*swdio_tms_in)(void);
+    void (*swdio_out_enable)(uint32_t enable); // 0 while the target drives SWDIO
+    void (*tdi_out)(uint32_t bit);
+    uint32_t (*tdo_in)(void);
+    void (*ntrst_out)(uint32_t bit);
+    void (*nreset_out)(uint32_t bit);
+    uint32_t (*nreset_in)(void);
+    uint32_t (*timestamp_get)(void); // in TIMESTAMP_CLOCK ticks
+} dap_hal_t;
+
+extern const dap_hal_t *kDAPHal;
+
+/**
+ * @brief Route the pins to another HAL
+ *
+ * @param hal The HAL, or NULL for the default one, which has no target attached
+ */
+void dap_hal_set(const dap_hal_t *hal);
+
+
+__STATIC_INLINE void PORT_JTAG_SETUP(void)
+{
+  kDAPHal->port_setup(DAP_PORT_JTAG);
+}
+
+__STATIC_INLINE void PORT_SWD_SETUP(void)
+{
+  DAP_SPI_Deinit();
+  kDAPHal->port_setup(DAP_PORT_SWD);
+}
+
+__STATIC_INLINE void PORT_OFF(void)
+{
+  kDAPHal->port_setup(DAP_PORT_DISABLED);
+}
+
+__STATIC_FORCEINLINE uint32_t PIN_SWCLK_TCK_IN(void)
+{
+  return 0;
+}
+
+__STATIC_FORCEINLINE void PIN_SWCLK_TCK_SET(void)
+{
+  kDAPHal->swclk_tck_out(1);
+}
+
+__STATIC_FORCEINLINE void PIN_SWCLK_TCK_CLR(void)
+{
+  kDAPHal->swclk_tck_out(0);
+}
+
+__STATIC_FORCEINLINE uint32_t PIN_SWDIO_TMS_IN(void)
+{
+  return kDAPHal->swdio_tms_in() & 0x1;
+}
+
+__STATIC_FORCEINLINE void PIN_SWDIO_TMS_SET(void)
+{
+  kDAPHal->swdio_tms_out(1);
+}
+
+__STATIC_FORCEINLINE void PIN_SWDIO_TMS_CLR(void)
+{
+  kDAPHal->swdio_tms_out(0);
+}
+
+__STATIC_FORCEINLINE uint32_t PIN_SWDIO_IN(void)
+{
+  return kDAPHal->swdio_tms_in() & 0x1;
+}
+
+__STATIC_FORCEINLINE void PIN_SWDIO_OUT(uint32_t bit)
+{
+  kDAPHal->swdio_tms_out(bit & 1U);
+}
+
+__STATIC_FORCEINLINE void PIN_SWDIO_OUT_ENABLE(void)
+{
+  kDAPHal->swdio_out_enable(1);
+}
+
+__STATIC_FORCEINLINE void PIN_SWDIO_OUT_DISABLE(void)
+{
+  kDAPHal->swdio_out_enable(0);
+}
+
+__STATIC_FORCEINLINE uint32_t PIN_TDI_IN(void)
+{
+  return 0;
+}
+
+__STATIC_FORCEINLINE void PIN_TDI_OUT(uint32_t bit)
+{
+  kDAPHal->tdi_out(bit & 1U);
+}
+
+__STATIC_FORCEINLINE uint32_t PIN_TDO_IN(void)
+{
+  return kDAPHal->tdo_in() & 0x1;
+}
+
+__STATIC_FORCEINLINE uint32_t PIN_nTRST_IN(void)
+{
+  return 0; // not available
+}
+
+__STATIC_FORCEINLINE void PIN_nTRST_OUT(uint32_t bit)
+{
+  kDAPHal->ntrst_out(bit & 1U);
+}
+
+__STATIC_FORCEINLINE uint32_t PIN_nRESET_IN(void)
+{
+  return kDAPHal->nreset_in() & 0x1;
+}
+
+__STATIC_FORCEINLINE void PIN_nRESET_OUT(uint32_t bit)
+{
+  kDAPHal->nreset_out(bit & 1U);
+}
+
+__STATIC_INLINE void LED_CONNECTED_OUT(uint32_t bit)
+{
+  (void)bit;
+}
+
+__STATIC_INLINE void LED_RUNNING_OUT(uint32_t bit)
+{
+  (void)bit;
+}
+
+__STATIC_INLINE uint32_t TIMESTAMP_GET(void)
+{
+  return kDAPHal->timestamp_get();
+}
+
+__STATIC_INLINE void DAP_SETUP(void)
+{
+  PORT_OFF();
+}
+
+#endif
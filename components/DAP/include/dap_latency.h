@@ -0,0 +1,104 @@
+/**
+ * @file dap_latency.h
+ * @brief Latency histograms of the stages a DAP command goes through
+ *
+ * Each stage has a log-bucketed histogram of its latency in us, in the way
+ * of HdrHistogram: the values below 4 have a bucket each, then every power
+ * of two is split in 4 buckets, which keeps every value within 25% of the
+ * bottom of its bucket. The last bucket takes everything from
+ * 2^DAP_LATENCY_MAX_SHIFT us (16.8s) up. Recording a value is one atomic add
+ * and a compare, so the histograms stay on along with the metrics.
+ *
+ * The histograms are cleared when a session takes the DAP engine, and with
+ * ID_DAP_Vendor_Latency:
+ *   request:  [ID, stage, first bucket]
+ *   response: [ID, stage count, bucket count, n, max (uint32),
+ *              n * count (uint32)], little endian
+ * A stage of DAP_LATENCY_RESET clears them, the response is [ID, DAP_OK].
+ * The bucket i starts at dap_latency_bucket_floor(i) us.
+ *
+ * @version 0.1
+ * @date 2022-08-16
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __DAP_LATENCY_H__
+#define __DAP_LATENCY_H__
+
+#include <stdint.h>
+
+#include "main/dap_configuration.h"
+#include "components/DAP/include/dap_metrics.h"
+
+#define ID_DAP_Vendor_Latency 0x81U // ID_DAP_Vendor1
+
+#define DAP_LATENCY_RESET 0xFFU
+
+typedef enum
+{
+    DAP_LATENCY_ARRIVAL = 0, // the TCP segment or datagram received, to the command queued
+    DAP_LATENCY_QUEUE_WAIT,  // queued, to DAP_Thread starting it
+    DAP_LATENCY_EXECUTE,     // DAP_ExecuteCommand()
+    DAP_LATENCY_SEND,        // the response ready, to its TCP write done
+    DAP_LATENCY_STAGE_COUNT,
+} dap_latency_stage_t;
+
+#define DAP_LATENCY_SUB_BITS 2U
+#define DAP_LATENCY_MAX_SHIFT 24U
+#define DAP_LATENCY_BUCKET_COUNT (((DAP_LATENCY_MAX_SHIFT - 1U) << DAP_LATENCY_SUB_BITS) + 1U)
+
+typedef struct
+{
+    uint32_t max;
+    uint32_t count[DAP_LATENCY_BUCKET_COUNT];
+} dap_latency_histogram_t;
+
+extern dap_latency_histogram_t kDAPLatency[DAP_LATENCY_STAGE_COUNT];
+
+void dap_latency_reset(void);
+uint32_t dap_latency_bucket_floor(uint32_t bucket);
+uint32_t dap_latency_vendor_command(const uint8_t *request, uint8_t *response);
+
+static inline uint32_t dap_latency_bucket(uint32_t us)
+{
+    uint32_t shift;
+
+    if (us < (1U << DAP_LATENCY_SUB_BITS))
+    {
+        return us;
+    }
+    if (us >= (1U << DAP_LATENCY_MAX_SHIFT))
+    {
+        return DAP_LATENCY_BUCKET_COUNT - 1U;
+    }
+
+    shift = 31U - __builtin_clz(us) - DAP_LATENCY_SUB_BITS;
+    return ((shift + 1U) << DAP_LATENCY_SUB_BITS) + ((us >> shift) & ((1U << DAP_LATENCY_SUB_BITS) - 1U));
+}
+
+#if (USE_DAP_METRICS == 1)
+
+/**
+ * @brief Add a latency to the histogram of a stage, only one task may record a stage
+ *
+ */
+static inline void dap_latency_record(dap_latency_stage_t stage, uint32_t us)
+{
+    dap_latency_histogram_t *histogram = &kDAPLatency[stage];
+
+    __atomic_fetch_add(&histogram->count[dap_latency_bucket(us)], 1U, __ATOMIC_RELAXED);
+    if (us > __atomic_load_n(&histogram->max, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&histogram->max, us, __ATOMIC_RELAXED);
+    }
+}
+
+#else
+
+static inline void dap_latency_record(dap_latency_stage_t stage, uint32_t us) {}
+
+#endif
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @file dap_log.h
+ * @brief Deferred logging, formatted by a low priority task instead of the caller
+ *
+ * A message is stored in a ring as the address of its format string, which
+ * identifies it, and up to DAP_LOG_ARG_MAX integer arguments. Taking an
+ * entry is a compare-and-swap, so any task on either core may log without a
+ * lock and without waiting for the UART. When the ring is full the message
+ * is dropped and counted. main/log_server.c formats the messages and sends
+ * them to the console and to the clients of LOG_PORT.
+ *
+ * The format is a string literal that only converts integers (%d, %u, %x,
+ * %c...): a string argument could be gone by the time it is formatted.
+ * Messages above DAP_LOG_LEVEL are not compiled in.
+ *
+ * @version 0.1
+ * @date 2022-08-17
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __DAP_LOG_H__
+#define __DAP_LOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "main/dap_configuration.h"
+
+#define DAP_LOG_LEVEL_NONE 0
+#define DAP_LOG_LEVEL_ERROR 1
+#define DAP_LOG_LEVEL_WARN 2
+#define DAP_LOG_LEVEL_INFO 3
+#define DAP_LOG_LEVEL_DEBUG 4
+
+#define DAP_LOG_ARG_MAX 4
+
+/**
+ * @brief Called by dap_log_drain() with each message, formatted
+ *
+ */
+typedef void (*dap_log_output_t)(const char *text, size_t length, void *context);
+
+void dap_log_write(uint32_t level, const char *format, uint32_t argc, ...);
+
+/**
+ * @brief Format the messages logged so far, oldest first. Only one task may drain.
+ *
+ * @return Number of messages given to output
+ */
+uint32_t dap_log_drain(dap_log_output_t output, void *context);
+
+// Count the arguments, up to DAP_LOG_ARG_MAX, and pass each one as an uint32_t
+#define DAP_LOG_ARGC(...) DAP_LOG_ARGC_(0, ##__VA_ARGS__, too_many, 4, 3, 2, 1, 0)
+#define DAP_LOG_ARGC_(_0, _1, _2, _3, _4, _5, n, ...) n
+#define DAP_LOG_CAST(n, ...) DAP_LOG_CAST_(n, ##__VA_ARGS__)
+#define DAP_LOG_CAST_(n, ...) DAP_LOG_CAST_##n(__VA_ARGS__)
+#define DAP_LOG_CAST_0()
+#define DAP_LOG_CAST_1(a) , (uint32_t)(a)
+#define DAP_LOG_CAST_2(a, b) , (uint32_t)(a), (uint32_t)(b)
+#define DAP_LOG_CAST_3(a, b, c) , (uint32_t)(a), (uint32_t)(b), (uint32_t)(c)
+#define DAP_LOG_CAST_4(a, b, c, d) , (uint32_t)(a), (uint32_t)(b), (uint32_t)(c), (uint32_t)(d)
+
+#define DAP_LOG(level, format, ...)                                   \
+    dap_log_write((level), (format), DAP_LOG_ARGC(__VA_ARGS__)        \
+                  DAP_LOG_CAST(DAP_LOG_ARGC(__VA_ARGS__), ##__VA_ARGS__))
+
+#if (DAP_LOG_LEVEL >= DAP_LOG_LEVEL_ERROR)
+#define DAP_LOGE(format, ...) DAP_LOG(DAP_LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define DAP_LOGE(format, ...) ((void)0)
+#endif
+
+#if (DAP_LOG_LEVEL >= DAP_LOG_LEVEL_WARN)
+#define DAP_LOGW(format, ...) DAP_LOG(DAP_LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define DAP_LOGW(format, ...) ((void)0)
+#endif
+
+#if (DAP_LOG_LEVEL >= DAP_LOG_LEVEL_INFO)
+#define DAP_LOGI(format, ...) DAP_LOG(DAP_LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define DAP_LOGI(format, ...) ((void)0)
+#endif
+
+#if (DAP_LOG_LEVEL >= DAP_LOG_LEVEL_DEBUG)
+#define DAP_LOGD(format, ...) DAP_LOG(DAP_LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define DAP_LOGD(format, ...) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+/**
+ * @file dap_metrics.h
+ * @brief Counters and gauges of the firmware, read with a vendor command or over TCP
+ *
+ * Every metric is a 32-bit value updated without a lock, so that they can be
+ * bumped from DAP_Thread on core 1 as well as from the tasks on core 0.
+ * Counters are added to with relaxed atomics. Gauges with a single writer
+ * are stored, the high-water marks keep their largest value.
+ *
+ * ID_DAP_Vendor_Metrics reads them from a debugger:
+ *   request:  [ID, first index]
+ *   response: [ID, metric count, n, n * value (uint32, little endian)]
+ * The metrics are the dap_metric_t ones, then the DAP command counters in
+ * the order of dap_metrics_command_slot(). dap_metrics_format() writes them
+ * in the Prometheus text format, see main/metrics_server.c.
+ *
+ * @version 0.1
+ * @date 2022-08-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __DAP_METRICS_H__
+#define __DAP_METRICS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "main/dap_configuration.h"
+
+#if defined(DAP_HOST_BUILD)
+#include <time.h>
+#else
+#include "esp_timer.h"
+#endif
+
+#define ID_DAP_Vendor_Metrics 0x80U // ID_DAP_Vendor0
+
+typedef enum
+{
+    // USBIP stage 2 PDUs, and their bytes headers included
+    DAP_METRIC_URB_RX = 0,
+    DAP_METRIC_URB_TX,
+    DAP_METRIC_BYTES_RX,
+    DAP_METRIC_BYTES_TX,
+    // ACKs of the SWD and JTAG transfers. Each WAIT is an iteration of a retry loop of DAP.c.
+    DAP_METRIC_ACK_OK,
+    DAP_METRIC_ACK_WAIT,
+    DAP_METRIC_ACK_FAULT,
+    DAP_METRIC_ACK_PROTOCOL_ERROR,
+    // Most commands ever waiting in the DAP queues
+    DAP_METRIC_REQUEST_QUEUE_MAX,
+    DAP_METRIC_RESPONSE_QUEUE_MAX,
+    // Least free stack ever, in bytes, refreshed by the metrics server
+    DAP_METRIC_DAP_TASK_STACK_FREE,
+    DAP_METRIC_REPLY_TASK_STACK_FREE,
+    // Time in DAP_ExecuteCommand(), by the SWD engine selected, in us
+    DAP_METRIC_ENGINE_SPI_US,
+    DAP_METRIC_ENGINE_GPIO_US,
+    DAP_METRIC_COUNT,
+} dap_metric_t;
+
+// Commands 0x00..0x1F, ExecuteCommands, the vendor commands and the unknown
+// ones. QueueCommands are run as ExecuteCommands.
+#define DAP_METRICS_COMMAND_COUNT (0x20U + 1U + 1U + 1U)
+
+extern uint32_t kDAPMetrics[DAP_METRIC_COUNT];
+extern uint32_t kDAPMetricsCommand[DAP_METRICS_COMMAND_COUNT];
+
+uint32_t dap_metrics_command_slot(uint8_t id);
+
+/**
+ * @brief Write the metrics in the Prometheus text exposition format
+ *
+ * @return Number of characters written, the text is cut at size - 1
+ */
+size_t dap_metrics_format(char *buf, size_t size);
+
+uint32_t dap_metrics_vendor_command(const uint8_t *request, uint8_t *response);
+
+#if (USE_DAP_METRICS == 1)
+
+static inline void dap_metrics_add(dap_metric_t metric, uint32_t value)
+{
+    __atomic_fetch_add(&kDAPMetrics[metric], value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Set a gauge, only one task may write it
+ *
+ */
+static inline void dap_metrics_set(dap_metric_t metric, uint32_t value)
+{
+    __atomic_store_n(&kDAPMetrics[metric], value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Raise a high-water mark, only one task may write it
+ *
+ */
+static inline void dap_metrics_max(dap_metric_t metric, uint32_t value)
+{
+    if (value > __atomic_load_n(&kDAPMetrics[metric], __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&kDAPMetrics[metric], value, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void dap_metrics_command(uint8_t id)
+{
+    __atomic_fetch_add(&kDAPMetricsCommand[dap_metrics_command_slot(id)], 1U, __ATOMIC_RELAXED);
+}
+
+static inline void dap_metrics_ack(uint32_t ack)
+{
+    switch (ack)
+    {
+    case 1U: // DAP_TRANSFER_OK
+        dap_metrics_add(DAP_METRIC_ACK_OK, 1);
+        break;
+    case 2U: // DAP_TRANSFER_WAIT
+        dap_metrics_add(DAP_METRIC_ACK_WAIT, 1);
+        break;
+    case 4U: // DAP_TRANSFER_FAULT
+        dap_metrics_add(DAP_METRIC_ACK_FAULT, 1);
+        break;
+    default:
+        dap_metrics_add(DAP_METRIC_ACK_PROTOCOL_ERROR, 1);
+        break;
+    }
+}
+
+static inline uint32_t dap_metrics_time_us(void)
+{
+#if defined(DAP_HOST_BUILD)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000U + ts.tv_nsec / 1000U);
+#else
+    return (uint32_t)esp_timer_get_time();
+#endif
+}
+
+#else
+
+static inline void dap_metrics_add(dap_metric_t metric, uint32_t value) {}
+static inline void dap_metrics_set(dap_metric_t metric, uint32_t value) {}
+static inline void dap_metrics_max(dap_metric_t metric, uint32_t value) {}
+static inline void dap_metrics_command(uint8_t id) {}
+static inline void dap_metrics_ack(uint32_t ack) {}
+static inline uint32_t dap_metrics_time_us(void) { return 0; }
+
+#endif
+
+#endif
@@ -7,15 +7,20 @@
 void DAP_SPI_WriteBits(const uint8_t count, const uint8_t *buf);
 void DAP_SPI_ReadBits(const uint8_t count, uint8_t *buf);
 
-void DAP_SPI_Send_Header(const uint8_t packetHeaderData, uint8_t *ack, uint8_t TrnAfterACK);
-void DAP_SPI_Read_Data(uint32_t* resData, uint8_t* resParity);
+void DAP_SPI_Send_Header(const uint8_t packetHeaderData, uint8_t *ack, uint8_t Trn, uint8_t TrnAfterACK);
+void DAP_SPI_Read_Data(uint32_t* resData, uint8_t* resParity, uint8_t Trn);
 void DAP_SPI_Write_Data(uint32_t data, uint8_t parity);
+void DAP_SPI_Write_Data_Send_Header(uint32_t data, uint8_t parity, uint8_t idle,
+                                    const uint8_t packetHeaderData, uint8_t *ack, uint8_t Trn);
 
 void DAP_SPI_Generate_Cycle(uint8_t num);
+void DAP_SPI_Release_Cycle(uint8_t num);
 void DAP_SPI_Fast_Cycle();
 
-void DAP_SPI_Protocol_Error_Read();
+void DAP_SPI_Protocol_Error_Read(uint8_t Trn);
 void DAP_SPI_Protocol_Error_Write();
 
+void DAP_SPI_JTAG_Shift(uint32_t count, const uint8_t *tdi, uint8_t *tdo);
+
 
 #endif
@@ -1,8 +1,12 @@
 #ifndef __SPI_SWITCH_H__
 #define __SPI_SWITCH_H__
 
+#include <stdint.h>
+
 void DAP_SPI_Init();
+void DAP_SPI_Init_JTAG();
 void DAP_SPI_Deinit();
+void DAP_SPI_Set_Clock(uint16_t clkdiv_pre, uint8_t clkcnt_n);
 
 void DAP_SPI_Enable();
 void DAP_SPI_Disable();
@@ -10,4 +14,7 @@ void DAP_SPI_Disable();
 void DAP_SPI_Acquire();
 void DAP_SPI_Release();
 
+void DAP_SPI_JTAG_Acquire();
+void DAP_SPI_JTAG_Release();
+
 #endif
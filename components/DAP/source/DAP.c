@@ -30,6 +30,9 @@
 
 #include "components/DAP/config/DAP_config.h"
 #include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_metrics.h"
+#include "components/DAP/include/dap_event.h"
+#include "components/DAP/include/dap_clock.h"
 
 //// FIXME: esp32
 //#include "spi_switch.h"
@@ -218,12 +221,14 @@ static uint32_t DAP_Connect(const uint8_t *request, uint8_t *response) {
     case DAP_PORT_SWD:
       DAP_Data.debug_port = DAP_PORT_SWD;
       PORT_SWD_SETUP();
+      dap_clock_set(dap_clock_current()->requested);  // the engine depends on the port
       break;
 #endif
 #if (DAP_JTAG != 0)
     case DAP_PORT_JTAG:
       DAP_Data.debug_port = DAP_PORT_JTAG;
       PORT_JTAG_SETUP();
+      dap_clock_set(dap_clock_current()->requested);
       break;
 #endif
     default:
@@ -372,7 +377,6 @@ extern uint8_t SWD_TransferSpeed;
 static uint32_t DAP_SWJ_Clock(const uint8_t *request, uint8_t *response) {
 #if ((DAP_SWD != 0) || (DAP_JTAG != 0))
   uint32_t clock;
-  uint32_t delay;
 
   clock = (uint32_t)(*(request+0) <<  0) |
           (uint32_t)(*(request+1) <<  8) |
@@ -384,43 +388,8 @@ static uint32_t DAP_SWJ_Clock(const uint8_t *request, uint8_t *response) {
     return ((4U << 16) | 1U);
   }
 
-  // Note that the maximum IO frequency of esp8266 is less than 2MHz
-
-  // clock >= 10MHz -> use 40MHz SPI
-
-
-  if (clock >= 10000000) {
-    if (DAP_Data.debug_port != DAP_PORT_JTAG) {
-      DAP_SPI_Init();
-      SWD_TransferSpeed = kTransfer_SPI;
-    }
-    DAP_Data.fast_clock  = 1U;
-    DAP_Data.clock_delay = 1U;
-
-  } else if (clock >= 5000000) {
-    // clock >= 5MHz -> Use GPIO with no program delay
-    DAP_SPI_Deinit();
-    DAP_Data.fast_clock  = 1U;
-    DAP_Data.clock_delay = 1U;
-    SWD_TransferSpeed = kTransfer_GPIO_fast;
-  } else {
-    // clock < 2MHz -> Use GPIO with delay
-    DAP_SPI_Deinit();
-    DAP_Data.fast_clock  = 0U;
-    SWD_TransferSpeed = kTransfer_GPIO_normal;
-
-    #define CPU_CLOCK_FIXED 100000000
-
-    delay = ((CPU_CLOCK_FIXED/2U) + (clock - 1U)) / clock;
-    if (delay > IO_PORT_WRITE_CYCLES) {
-      delay -= IO_PORT_WRITE_CYCLES;
-      delay  = (delay + (DELAY_SLOW_CYCLES - 1U)) / DELAY_SLOW_CYCLES;
-    } else {
-      delay  = 1U;
-    }
-
-    DAP_Data.clock_delay = delay;
-  }
+  // SPI divider or GPIO delay, see dap_clock.h
+  dap_clock_set(clock);
 
   *response = DAP_OK;
 #else
@@ -675,6 +644,28 @@ static uint32_t DAP_TransferConfigure(const uint8_t *request, uint8_t *response)
 }
 
 
+#if ((DAP_SWD != 0) && (USE_SWD_WRITE_RUN != 0))
+// SWD_WriteRun() needs the SPI engine
+#define SWD_WRITE_RUN_READY() (SWD_TransferSpeed == kTransfer_SPI)
+
+// Count the writes of a SWD Transfer command that SWD_WriteRun() can do
+//   request: pointer to the request of the first write
+//   count:   number of requests left
+//   return:  number of consecutive writes without match mask or timestamp
+static uint32_t SWD_WriteRunLength(const uint8_t *request, uint32_t count) {
+  uint32_t n;
+
+  for (n = 0U; n < count; n++) {
+    if ((*request & (DAP_TRANSFER_RnW | DAP_TRANSFER_MATCH_MASK | DAP_TRANSFER_TIMESTAMP)) != 0U) {
+      break;
+    }
+    request += 5;
+  }
+  return n;
+}
+#endif
+
+
 // Process SWD Transfer command and prepare response
 //   request:  pointer to request data
 //   response: pointer to response data
@@ -698,6 +689,10 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
 #if (TIMESTAMP_CLOCK != 0U)
   uint32_t  timestamp;
 #endif
+#if (USE_SWD_WRITE_RUN != 0)
+  uint32_t  run;
+  uint8_t   ack;
+#endif
 
   request_head   = request;
 
@@ -858,6 +853,25 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
         *response++ = (uint8_t)(data >> 24);
         post_read = 0U;
       }
+#if (USE_SWD_WRITE_RUN != 0)
+      run = SWD_WRITE_RUN_READY() ? SWD_WriteRunLength(request - 1, request_count) : 0U;
+      if (run >= SWD_WRITE_RUN_MIN) {
+        // Write DP/AP registers, up to the last one of the run
+        run = SWD_WriteRun(request, 5U, run, request_value, &ack);
+        response_value = ack;
+        if (response_value == DAP_TRANSFER_OK) {
+          run--;
+        }
+        request        += (run * 5U) + 4U;
+        response_count += run;
+        request_count  -= run;
+        if (response_value != DAP_TRANSFER_OK) {
+          break;
+        }
+        check_write = 1U;
+        goto write_done;
+      }
+#endif
       // Load data
       data = (uint32_t)(*(request+0) <<  0) |
              (uint32_t)(*(request+1) <<  8) |
@@ -890,6 +904,9 @@ static uint32_t DAP_SWD_Transfer(const uint8_t *request, uint8_t *response) {
         check_write = 1U;
       }
     }
+#if (USE_SWD_WRITE_RUN != 0)
+write_done:
+#endif
     response_count++;
     if (DAP_TransferAbort) {
       break;
@@ -1299,6 +1316,9 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
   uint8_t  *response_head;
   uint32_t  retry;
   uint32_t  data;
+#if (USE_SWD_WRITE_RUN != 0)
+  uint8_t   ack;
+#endif
 
   response_count = 0U;
   response_value = 0U;
@@ -1351,6 +1371,16 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
     }
   } else {
     // Write register block
+#if (USE_SWD_WRITE_RUN != 0)
+    if (SWD_WRITE_RUN_READY()) {
+      response_count = SWD_WriteRun(request, 4U, request_count, request_value, &ack);
+      response_value = ack;
+      if (response_value != DAP_TRANSFER_OK) {
+        goto end;
+      }
+      request_count = 0U;
+    }
+#endif
     while (request_count--) {
       // Load data
       data = (uint32_t)(*(request+0) <<  0) |
@@ -1621,17 +1651,9 @@ static uint32_t DAP_WriteAbort(const uint8_t *request, uint8_t *response) {
 }
 
 
-// Process DAP Vendor command request and prepare response
-// Default function (can be overridden)
-//   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response (lower 16 bits)
-//             number of bytes in request (upper 16 bits)
-__WEAK uint32_t DAP_ProcessVendorCommand(const uint8_t *request, uint8_t *response) {
-  (void)request;
-  *response = ID_DAP_Invalid;
-  return ((1U << 16) | 1U);
-}
+// DAP_ProcessVendorCommand() is in DAP_vendor.c. There is no weak default here:
+// as the component is linked as a static library, the default would be taken
+// and DAP_vendor.o never pulled in.
 
 
 // Process DAP command request and prepare response
@@ -1642,6 +1664,8 @@ __WEAK uint32_t DAP_ProcessVendorCommand(const uint8_t *request, uint8_t *respon
 uint32_t DAP_ProcessCommand(const uint8_t *request, uint8_t *response) {
   uint32_t num;
 
+  dap_metrics_command(*request);
+
   if ((*request >= ID_DAP_Vendor0) && (*request <= ID_DAP_Vendor31)) {
     return DAP_ProcessVendorCommand(request, response);
   }
@@ -1756,12 +1780,15 @@ uint32_t DAP_ExecuteCommand(const uint8_t *request, uint8_t *response) {
   uint32_t cnt, num, n;
 
   if (*request == ID_DAP_ExecuteCommands) {
+    dap_metrics_command(*request);
     *response++ = *request++;
     cnt = *request++;
     *response++ = (uint8_t)cnt;
     num = (2U << 16) | 2U;
     while (cnt--) {
+      DAP_EVENT_BEGIN(DAP_EVENT_COMMAND, *request);
       n = DAP_ProcessCommand(request, response);
+      DAP_EVENT_END(DAP_EVENT_COMMAND, *response);
       num += n;
       request  += (uint16_t)(n >> 16);
       response += (uint16_t) n;
@@ -1769,7 +1796,10 @@ uint32_t DAP_ExecuteCommand(const uint8_t *request, uint8_t *response) {
     return (num);
   }
 
-  return DAP_ProcessCommand(request, response);
+  DAP_EVENT_BEGIN(DAP_EVENT_COMMAND, *request);
+  num = DAP_ProcessCommand(request, response);
+  DAP_EVENT_END(DAP_EVENT_COMMAND, *response);
+  return (num);
 }
 
 
@@ -1779,7 +1809,7 @@ void DAP_Setup(void) {
   // Default settings
   DAP_Data.debug_port  = 0U;
   DAP_Data.fast_clock  = 0U;
-  DAP_Data.clock_delay = CLOCK_DELAY(DAP_DEFAULT_SWJ_CLOCK);
+  dap_clock_init();
   DAP_Data.transfer.idle_cycles = 0U;
   DAP_Data.transfer.retry_count = 100U;
   DAP_Data.transfer.match_retry = 0U;
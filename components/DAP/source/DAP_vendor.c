@@ -27,6 +27,9 @@
 
 #include "components/DAP/config/DAP_config.h"
 #include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_metrics.h"
+#include "components/DAP/include/dap_latency.h"
+#include "components/DAP/include/dap_clock.h"
 
 //**************************************************************************************************
 /**
@@ -51,18 +54,18 @@ uint32_t DAP_ProcessVendorCommand(const uint8_t *request, uint8_t *response) {
   *response++ = *request;        // copy Command ID
 
   switch (*request++) {          // first byte in request is Command ID
-    case ID_DAP_Vendor0:
-#if 0                            // example user command
-      num += 1U << 16;           // increment request count
-      if (*request == 1U) {      // when first command data byte is 1
-        *response++ = 'X';       // send 'X' as response
-        num++;                   // increment response count
-      }
-#endif
+    case ID_DAP_Vendor_Metrics:
+      num = dap_metrics_vendor_command(request - 1U, response - 1U);
+      break;
+
+    case ID_DAP_Vendor_Latency:
+      num = dap_latency_vendor_command(request - 1U, response - 1U);
+      break;
+
+    case ID_DAP_Vendor_Clock:
+      num = dap_clock_vendor_command(request - 1U, response - 1U);
       break;
 
-    case ID_DAP_Vendor1:  break;
-    case ID_DAP_Vendor2:  break;
     case ID_DAP_Vendor3:  break;
     case ID_DAP_Vendor4:  break;
     case ID_DAP_Vendor5:  break;
@@ -28,6 +28,9 @@
 
 #include "components/DAP/config/DAP_config.h"
 #include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_metrics.h"
+#include "components/DAP/include/spi_op.h"
+#include "components/DAP/include/spi_switch.h"
 
 
 // JTAG Macros
@@ -93,6 +96,15 @@ void JTAG_Sequence (uint32_t info, const uint8_t *tdi, uint8_t *tdo) {
     PIN_TMS_CLR();
   }
 
+#if (USE_JTAG_SPI != 0)
+  if (SWD_TransferSpeed == kTransfer_SPI) {
+    DAP_SPI_JTAG_Acquire();
+    DAP_SPI_JTAG_Shift(n, tdi, (info & JTAG_SEQUENCE_TDO) ? tdo : NULL);
+    DAP_SPI_JTAG_Release();
+    return;
+  }
+#endif
+
   while (n) {
     i_val = *tdi++;
     o_val = 0U;
@@ -252,15 +264,151 @@ exit:
 }
 
 
+// JTAG clock cycles, for the calibration of dap_clock.c
+// The cycles shift TDI and TDO like the data phase of JTAG_Transfer().
+//   count:  number of clock cycles
+//   return: none
+#define JTAG_CalibrateFunction(speed) /**/                                      \
+static void JTAG_Calibrate_##speed (uint32_t count) {                           \
+  uint32_t bit;                                                                 \
+                                                                                \
+  while (count--) {                                                             \
+    JTAG_CYCLE_TDIO(1U, bit);                                                   \
+  }                                                                             \
+  (void)bit;                                                                    \
+}
+
+
 #undef  PIN_DELAY
 #define PIN_DELAY() PIN_DELAY_FAST()
 JTAG_IR_Function(Fast)
 JTAG_TransferFunction(Fast)
+JTAG_CalibrateFunction(Fast)
+
+#if (USE_JTAG_SPI != 0)
+// JTAG through the SPI
+// TCK and TDI are taken from the GPIO once per IR or DR scan, and every cycle
+// of the scan is clocked by DAP_SPI_JTAG_Shift(), which captures TDO in full
+// duplex. TMS stays on the GPIO, it is set between the shifts and holds for
+// the whole of each shift.
+
+// JTAG Set IR
+//   ir:     IR value
+//   return: none
+static void JTAG_IR_SPI (uint32_t ir) {
+  uint32_t before = DAP_Data.jtag_dev.ir_before[DAP_Data.jtag_dev.index];
+  uint32_t length = DAP_Data.jtag_dev.ir_length[DAP_Data.jtag_dev.index];
+  uint32_t after  = DAP_Data.jtag_dev.ir_after [DAP_Data.jtag_dev.index];
+  uint8_t  tdi[4];
+
+  tdi[0] = (uint8_t)(ir >>  0);
+  tdi[1] = (uint8_t)(ir >>  8);
+  tdi[2] = (uint8_t)(ir >> 16);
+  tdi[3] = (uint8_t)(ir >> 24);
+
+  DAP_SPI_JTAG_Acquire();
+
+  PIN_TMS_SET();
+  DAP_SPI_JTAG_Shift(2U, NULL, NULL);       /* Select-DR-Scan, Select-IR-Scan */
+  PIN_TMS_CLR();
+  DAP_SPI_JTAG_Shift(2U + before, NULL, NULL); /* Capture-IR, Shift-IR, Bypass before data */
+
+  if (after) {
+    DAP_SPI_JTAG_Shift(length, tdi, NULL);  /* Set IR bits */
+    if (after > 1U) {
+      DAP_SPI_JTAG_Shift(after - 1U, NULL, NULL); /* Bypass after data */
+    }
+    PIN_TMS_SET();
+    DAP_SPI_JTAG_Shift(2U, NULL, NULL);     /* Bypass & Exit1-IR, Update-IR */
+  } else {
+    if (length > 1U) {
+      DAP_SPI_JTAG_Shift(length - 1U, tdi, NULL); /* Set IR bits (except last) */
+    }
+    tdi[0] = (uint8_t)((ir >> (length - 1U)) & 1U);
+    PIN_TMS_SET();
+    DAP_SPI_JTAG_Shift(2U, tdi, NULL);      /* Set last IR bit & Exit1-IR, Update-IR */
+  }
+
+  PIN_TMS_CLR();
+  DAP_SPI_JTAG_Shift(1U, NULL, NULL);       /* Idle */
+
+  DAP_SPI_JTAG_Release();
+  PIN_TDI_OUT(1U);
+}
+
+
+// JTAG Transfer I/O
+//   request: A[3:2] RnW APnDP
+//   data:    DATA[31:0]
+//   return:  ACK[2:0]
+// The ACK is not looked at before the data is shifted: on WAIT the JTAG-DP
+// ignores the Update-DR, so the whole DR scan with TMS low is one shift.
+static uint8_t JTAG_Transfer_SPI (uint32_t request, uint32_t *data) {
+  uint32_t index  = DAP_Data.jtag_dev.index;
+  uint32_t length = 35U + DAP_Data.jtag_dev.count; /* up to D31 or the bypass bit before Exit1-DR */
+  uint64_t scan;
+  uint32_t ack;
+  uint32_t val;
+  uint32_t n;
+  uint8_t  tdi[8];
+  uint8_t  tdo[8] = {0U};
+  uint8_t  last;
+
+  /* Capture-DR, Shift-DR, Bypass before data, RnW A2 A3, D0..D31, Bypass after data */
+  scan  = ~(0x7ULL << (2U + index));
+  scan |= (uint64_t)((request >> 1) & 0x7U) << (2U + index);
+  if ((request & DAP_TRANSFER_RnW) == 0U) {
+    scan &= ~(0xFFFFFFFFULL << (5U + index));
+    scan |= (uint64_t)(*data) << (5U + index);
+  }
+  for (n = 0U; n < 8U; n++) {
+    tdi[n] = (uint8_t)(scan >> (n * 8U));
+  }
+  last = (uint8_t)(scan >> length);
+
+  DAP_SPI_JTAG_Acquire();
+
+  PIN_TMS_SET();
+  DAP_SPI_JTAG_Shift(1U, NULL, NULL);       /* Select-DR-Scan */
+  PIN_TMS_CLR();
+  DAP_SPI_JTAG_Shift(length, tdi, tdo);     /* Capture-DR .. Bypass after data (except last) */
+  PIN_TMS_SET();
+  DAP_SPI_JTAG_Shift(2U, &last, &last);     /* Last bit & Exit1-DR, Update-DR */
+
+  scan = (uint64_t)(last & 1U) << length;
+  for (n = 0U; n < 8U; n++) {
+    scan |= (uint64_t)tdo[n] << (n * 8U);
+  }
+  n    = (uint32_t)(scan >> (2U + index));
+  ack  = (n & 1U) << 1;
+  ack |= (n >> 1) & 1U;
+  ack |= n & 4U;
+  val  = (uint32_t)(scan >> (5U + index));
+
+  if ((ack == DAP_TRANSFER_OK) && (request & DAP_TRANSFER_RnW) && data) {
+    *data = val;
+  }
+
+  /* Capture Timestamp */
+  if (request & DAP_TRANSFER_TIMESTAMP) {
+    DAP_Data.timestamp = TIMESTAMP_GET();
+  }
+
+  PIN_TMS_CLR();
+  DAP_SPI_JTAG_Shift(1U + DAP_Data.transfer.idle_cycles, NULL, NULL); /* Idle, Idle cycles */
+
+  DAP_SPI_JTAG_Release();
+  PIN_TDI_OUT(1U);
+
+  return ((uint8_t)ack);
+}
+#endif  /* (USE_JTAG_SPI != 0) */
 
 #undef  PIN_DELAY
 #define PIN_DELAY() PIN_DELAY_SLOW(DAP_Data.clock_delay)
 JTAG_IR_Function(Slow)
 JTAG_TransferFunction(Slow)
+JTAG_CalibrateFunction(Slow)
 
 
 // JTAG Read IDCODE register
@@ -347,6 +495,12 @@ void JTAG_WriteAbort (uint32_t data) {
 //   ir:     IR value
 //   return: none
 void JTAG_IR (uint32_t ir) {
+#if (USE_JTAG_SPI != 0)
+  if (SWD_TransferSpeed == kTransfer_SPI) {
+    JTAG_IR_SPI(ir);
+    return;
+  }
+#endif
   if (DAP_Data.fast_clock) {
     JTAG_IR_Fast(ir);
   } else {
@@ -360,10 +514,32 @@ void JTAG_IR (uint32_t ir) {
 //   data:    DATA[31:0]
 //   return:  ACK[2:0]
 uint8_t  JTAG_Transfer(uint32_t request, uint32_t *data) {
+  uint8_t ack;
+
+#if (USE_JTAG_SPI != 0)
+  if (SWD_TransferSpeed == kTransfer_SPI) {
+    ack = JTAG_Transfer_SPI(request, data);
+  } else
+#endif
+  if (DAP_Data.fast_clock) {
+    ack = JTAG_TransferFast(request, data);
+  } else {
+    ack = JTAG_TransferSlow(request, data);
+  }
+
+  dap_metrics_ack(ack);
+  return ack;
+}
+
+
+// JTAG clock cycles, for the calibration of dap_clock.c
+//   count:  number of clock cycles
+//   return: none
+void JTAG_Calibrate (uint32_t count) {
   if (DAP_Data.fast_clock) {
-    return JTAG_TransferFast(request, data);
+    JTAG_Calibrate_Fast(count);
   } else {
-    return JTAG_TransferSlow(request, data);
+    JTAG_Calibrate_Slow(count);
   }
 }
 
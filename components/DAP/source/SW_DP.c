@@ -48,6 +48,9 @@
 #include "components/DAP/include/spi_switch.h"
 
 #include "components/DAP/include/dap_utility.h"
+#include "components/DAP/include/dap_metrics.h"
+#include "components/DAP/include/dap_event.h"
+#include "components/DAP/include/dap_log.h"
 
 // Debug
 #define PRINT_SWD_PROTOCOL 0
@@ -106,7 +109,8 @@ void SWJ_Sequence (uint32_t count, const uint8_t *data) {
   //   return;
   // }
 
-  if(SWD_TransferSpeed == kTransfer_SPI) {
+  // The JTAG SPI engine does not drive TMS, see DAP_SPI_Init_JTAG()
+  if(SWD_TransferSpeed == kTransfer_SPI && DAP_Data.debug_port != DAP_PORT_JTAG) {
     SWJ_Sequence_SPI(count, data);
   } else {
     SWJ_Sequence_GPIO(count, data, 1);
@@ -138,8 +142,16 @@ void SWJ_Sequence_GPIO (uint32_t count, const uint8_t *data, uint8_t need_delay)
 }
 
 void SWJ_Sequence_SPI (uint32_t count, const uint8_t *data) {
+  uint32_t n;
+
   DAP_SPI_Enable();
-  DAP_SPI_WriteBits(count, data);
+  // data_buf holds 64 bits, and a sequence can be 256 bits long
+  while (count) {
+    n = (count > 64U) ? 64U : count;
+    DAP_SPI_WriteBits(n, data);
+    data  += n >> 3;
+    count -= n;
+  }
 }
 #endif
 
@@ -215,13 +227,22 @@ void SWD_Sequence_SPI (uint32_t info, const uint8_t *swdo, uint8_t *swdi) {
 #if (DAP_SWD != 0)
 
 
+// Data phase of a write answered with WAIT or FAULT, the turnaround being done.
+// It is only sent with the Data Phase option, which overrun detection needs.
+static void SWD_Dummy_Write_SPI (void) {
+  if (DAP_Data.swd_conf.data_phase) {
+    DAP_SPI_Write_Data(0U, 0U);         /* Dummy Write WDATA[0:31] + Parity */
+  }
+}
+
+
 // SWD Transfer I/O
 //   request: A[3:2] RnW APnDP
 //   data:    DATA[31:0]
 //   return:  ACK[2:0]
 static uint8_t SWD_Transfer_SPI (uint32_t request, uint32_t *data) {
-  //// FIXME: overrun detection
   // SPI transfer mode does not require operations such as PIN_DELAY
+  const uint8_t turnaround = DAP_Data.swd_conf.turnaround;
   uint8_t ack;
   // uint32_t bit;
   uint32_t val;
@@ -243,44 +264,44 @@ static uint8_t SWD_Transfer_SPI (uint32_t request, uint32_t *data) {
   switch (requestByte)
     {
     case 0xA5U:
-      printf("IDCODE\r\n");
+      DAP_LOGD("IDCODE\r\n");
       break;
     case 0xA9U:
-      printf("W CTRL/STAT\r\n");
+      DAP_LOGD("W CTRL/STAT\r\n");
       break;
     case 0xBDU:
-      printf("RDBUFF\r\n");
+      DAP_LOGD("RDBUFF\r\n");
       break;
     case 0x8DU:
-      printf("R CTRL/STAT\r\n");
+      DAP_LOGD("R CTRL/STAT\r\n");
       break;
     case 0x81U:
-      printf("W ABORT\r\n");
+      DAP_LOGD("W ABORT\r\n");
       break;
     case 0xB1U:
-      printf("W SELECT\r\n");
+      DAP_LOGD("W SELECT\r\n");
       break;
     case 0xBBU:
-      printf("W APc\r\n");
+      DAP_LOGD("W APc\r\n");
       break;
     case 0x9FU:
-      printf("R APc\r\n");
+      DAP_LOGD("R APc\r\n");
       break;
     case 0x8BU:
-      printf("W AP4\r\n");
+      DAP_LOGD("W AP4\r\n");
       break;
     case 0xA3U:
-      printf("W AP0\r\n");
+      DAP_LOGD("W AP0\r\n");
       break;
     case 0X87U:
-      printf("R AP0\r\n");
+      DAP_LOGD("R AP0\r\n");
       break;
     case 0xB7U:
-      printf("R AP8\r\n");
+      DAP_LOGD("R AP8\r\n");
       break;
     default:
     //W AP8
-      printf("Unknown:%08x\r\n", requestByte);
+      DAP_LOGD("Unknown:%08x\r\n", requestByte);
       break;
     }
 #endif // PRINT_SWD_PROTOCOL == 1
@@ -288,9 +309,9 @@ static uint8_t SWD_Transfer_SPI (uint32_t request, uint32_t *data) {
   if (request & DAP_TRANSFER_RnW) {
     /* Read data */
 
-    DAP_SPI_Send_Header(requestByte, &ack, 0); // 0 Trn After ACK
+    DAP_SPI_Send_Header(requestByte, &ack, turnaround, 0); // 0 Trn After ACK
     if (ack == DAP_TRANSFER_OK) {
-      DAP_SPI_Read_Data(&val, &parity);
+      DAP_SPI_Read_Data(&val, &parity, turnaround);
       computedParity = ParityEvenUint32(val);
 
       if ((computedParity ^ parity) & 1U) {
@@ -302,12 +323,21 @@ static uint8_t SWD_Transfer_SPI (uint32_t request, uint32_t *data) {
       if (request & DAP_TRANSFER_TIMESTAMP) {
         DAP_Data.timestamp = TIMESTAMP_GET();
       }
+      /* Idle cycles */
+      n = DAP_Data.transfer.idle_cycles;
+      if (n) { DAP_SPI_Generate_Cycle(n); }
 
     }
     else if ((ack == DAP_TRANSFER_WAIT) || (ack == DAP_TRANSFER_FAULT)) {
-      DAP_SPI_Fast_Cycle();
+      if (DAP_Data.swd_conf.data_phase) {
+        DAP_SPI_Release_Cycle(32U + 1U + turnaround); /* Dummy Read RDATA[0:31] + Parity, Turnaround */
+      } else if (turnaround == 1U) {
+        DAP_SPI_Fast_Cycle();
+      } else {
+        DAP_SPI_Release_Cycle(turnaround);
+      }
 #if (PRINT_SWD_PROTOCOL == 1)
-      printf("WAIT\r\n");
+      DAP_LOGD("WAIT\r\n");
 #endif
 
       // return DAP_TRANSFER_WAIT;
@@ -318,12 +348,12 @@ static uint8_t SWD_Transfer_SPI (uint32_t request, uint32_t *data) {
       PIN_SWDIO_TMS_SET();
 
       DAP_SPI_Enable();
-      DAP_SPI_Protocol_Error_Read();
+      DAP_SPI_Protocol_Error_Read(turnaround);
 
       DAP_SPI_Disable();
       PIN_SWDIO_TMS_SET();
       #if (PRINT_SWD_PROTOCOL == 1)
-      printf("Protocol Error: Read\r\n");
+      DAP_LOGD("Protocol Error: Read\r\n");
       #endif
     }
 
@@ -332,7 +362,7 @@ static uint8_t SWD_Transfer_SPI (uint32_t request, uint32_t *data) {
   else {
     /* Write data */
     parity = ParityEvenUint32(*data);
-    DAP_SPI_Send_Header(requestByte, &ack, 1); // 1 Trn After ACK
+    DAP_SPI_Send_Header(requestByte, &ack, turnaround, turnaround);
     if (ack == DAP_TRANSFER_OK) {
       DAP_SPI_Write_Data(*data, parity);
       /* Capture Timestamp */
@@ -350,10 +380,9 @@ static uint8_t SWD_Transfer_SPI (uint32_t request, uint32_t *data) {
     }
     else if ((ack == DAP_TRANSFER_WAIT) || (ack == DAP_TRANSFER_FAULT)) {
       /* already turnaround. */
-
-      /* TODO: overrun transfer -> for read */
+      SWD_Dummy_Write_SPI();
 #if (PRINT_SWD_PROTOCOL == 1)
-      printf("WAIT\r\n");
+      DAP_LOGD("WAIT\r\n");
 #endif
 
     }
@@ -369,7 +398,7 @@ static uint8_t SWD_Transfer_SPI (uint32_t request, uint32_t *data) {
       PIN_SWDIO_TMS_SET();
 
 #if (PRINT_SWD_PROTOCOL == 1)
-      printf("Protocol Error: Write\r\n");
+      DAP_LOGD("Protocol Error: Write\r\n");
 #endif
     }
 
@@ -514,17 +543,144 @@ static uint8_t SWD_Transfer_GPIO (uint32_t request, uint32_t *data, uint8_t need
 //   data:    DATA[31:0]
 //   return:  ACK[2:0]
 uint8_t  SWD_Transfer(uint32_t request, uint32_t *data) {
+  uint8_t ack;
+
+  DAP_EVENT_BEGIN(DAP_EVENT_SWD_TRANSFER, request | (SWD_TransferSpeed << 8));
   switch (SWD_TransferSpeed) {
     case kTransfer_SPI:
-      return SWD_Transfer_SPI(request, data);
+      ack = SWD_Transfer_SPI(request, data);
+      break;
     case kTransfer_GPIO_fast:
-      return SWD_Transfer_GPIO(request, data, 0);
+      ack = SWD_Transfer_GPIO(request, data, 0);
+      break;
     case kTransfer_GPIO_normal:
-      return SWD_Transfer_GPIO(request, data, 1);
     default:
-      return SWD_Transfer_GPIO(request, data, 1);
+      ack = SWD_Transfer_GPIO(request, data, 1);
+      break;
+  }
+
+  DAP_EVENT_END(DAP_EVENT_SWD_TRANSFER, ack);
+
+  dap_metrics_ack(ack);
+  return ack;
+}
+
+
+// SWD clock cycles of the GPIO engine, for the calibration of dap_clock.c
+// The cycles read SWDIO like the data phase of SWD_Transfer_GPIO().
+//   count:      number of clock cycles
+//   need_delay: PIN_DELAY() every half period
+//   return:     none
+void SWD_Calibrate (uint32_t count, uint8_t need_delay) {
+  uint32_t bit;
+
+  while (count--) {
+    SW_READ_BIT(bit);
+  }
+  (void)bit;
+}
+
+
+#if (USE_SWD_WRITE_RUN != 0)
+// SWD Write Run, SPI mode only
+// Each SPI transaction sends the data phase of a write with the request of
+// the next write, and reads the ACK of that request. A run of n writes takes
+// n + 1 transactions instead of 2n, and each ACK is still checked.
+//   data:    DATA[31:0] of the first write, followed every stride bytes by
+//            the data of the next write
+//   stride:  4 when all writes use request, 5 when the data of each write
+//            but the first is preceded by its own request
+//   count:   number of writes
+//   request: A[3:2] APnDP of the first write
+//   ack:     ACK[2:0] of the last request sent
+//   return:  number of writes done, fewer than count with DAP_TRANSFER_OK
+//            when the transfer is aborted
+uint32_t SWD_WriteRun(const uint8_t *data, uint32_t stride, uint32_t count, uint32_t request, uint8_t *ack) {
+  const uint8_t constantBits = 0b10000001U; /* Start Bit  & Stop Bit & Park Bit is fixed. */
+  const uint8_t turnaround = DAP_Data.swd_conf.turnaround;
+  const uint8_t *pending;
+  uint8_t requestByte;
+  uint8_t result;
+  uint32_t done;
+  uint32_t retry;
+  uint32_t val;
+  uint32_t i;
+  uint32_t n;
+
+  DAP_SPI_Enable();
+
+  pending = NULL;
+  done    = 0U;
+  result  = DAP_TRANSFER_OK;
+  val     = 0U;
+  for (i = 0U; i < count; i++) {
+    if ((stride > 4U) && (i != 0U)) {
+      request = data[(i * stride) - 1U];
+    }
+    requestByte = constantBits | (((uint8_t)(request & 0xFU)) << 1U) | (ParityEvenUint8(request & 0xFU) << 5U);
+
+    retry = DAP_Data.transfer.retry_count;
+    do {
+      DAP_EVENT_BEGIN(DAP_EVENT_SWD_TRANSFER, request | (kTransfer_SPI << 8));
+      if (pending != NULL) {
+        /* Data of the previous write, idle cycles, then this request */
+        val = (uint32_t)(pending[0] <<  0) |
+              (uint32_t)(pending[1] <<  8) |
+              (uint32_t)(pending[2] << 16) |
+              (uint32_t)(pending[3] << 24);
+        DAP_SPI_Write_Data_Send_Header(val, ParityEvenUint32(val), DAP_Data.transfer.idle_cycles,
+                                       requestByte, &result, turnaround);
+        pending = NULL;
+        done++;
+      } else {
+        DAP_SPI_Send_Header(requestByte, &result, turnaround, turnaround);
+      }
+      if ((result == DAP_TRANSFER_WAIT) || (result == DAP_TRANSFER_FAULT)) {
+        SWD_Dummy_Write_SPI();
+      }
+      DAP_EVENT_END(DAP_EVENT_SWD_TRANSFER, result);
+      dap_metrics_ack(result);
+    } while ((result == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+
+    if (result != DAP_TRANSFER_OK) {
+      break;
+    }
+    pending = data + (i * stride);
+    if (DAP_TransferAbort) {
+      break;
+    }
   }
+
+  if (pending != NULL) {
+    /* Data of the last write */
+    val = (uint32_t)(pending[0] <<  0) |
+          (uint32_t)(pending[1] <<  8) |
+          (uint32_t)(pending[2] << 16) |
+          (uint32_t)(pending[3] << 24);
+    DAP_SPI_Write_Data(val, ParityEvenUint32(val));
+    /* Idle cycles */
+    n = DAP_Data.transfer.idle_cycles;
+    if (n) { DAP_SPI_Generate_Cycle(n); }
+    done++;
+
+    DAP_SPI_Disable();
+    PIN_SWDIO_TMS_SET();
+  } else if ((result != DAP_TRANSFER_WAIT) && (result != DAP_TRANSFER_FAULT)) {
+    /* Protocol error */
+    DAP_SPI_Disable();
+    PIN_SWDIO_TMS_SET();
+
+    DAP_SPI_Enable();
+    DAP_SPI_Protocol_Error_Write();
+
+    DAP_SPI_Disable();
+    PIN_SWDIO_TMS_SET();
+  }
+
+  *ack = result;
+  return done;
 }
+#endif
 
 
 #endif  /* (DAP_SWD != 0) */
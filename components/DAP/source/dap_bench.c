@@ -0,0 +1,297 @@
+/**
+ * @file dap_bench.c
+ * @brief Microbenchmarks of the DAP commands, on the board and in the host build
+ *
+ * Prints one CSV line per command of the matrix:
+ *
+ *   engine,clock_hz,command,items,item,iterations,mean,min,per_item,unit,status
+ *
+ * items is the number of SWD/JTAG transfers or clock bits of the command, and
+ * per_item is mean / items. min is the least disturbed run, as interrupts are
+ * not masked. status is "fail" when the target did not answer OK, the time
+ * is then the one of the error path.
+ *
+ * The command buffers are larger than a DAP packet, so that TransferBlock can
+ * move 1024 bytes and Transfer can carry 255 writes.
+ *
+ * @version 0.1
+ * @date 2022-08-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "components/DAP/config/DAP_config.h"
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_bench.h"
+
+#if defined(DAP_HOST_BUILD)
+#include <time.h>
+#define DAP_BENCH_UNIT "ns"
+#else
+#define DAP_BENCH_UNIT "cycles"
+#endif
+
+#define DAP_BENCH_BUFFER_SIZE 1536
+
+// AP registers of the MEM-AP
+#define DAP_BENCH_AP_CSW 0x00U
+#define DAP_BENCH_AP_TAR 0x04U
+#define DAP_BENCH_AP_DRW 0x0CU
+
+// Target RAM the MEM-AP accesses go to. TAR auto-increment wraps in its 1KB page.
+#define DAP_BENCH_RAM_ADDRESS 0x20000000U
+
+typedef struct
+{
+    const char *name;
+    uint32_t clock;
+    uint8_t speed; // SWD_TransferSpeed selected by the clock
+} dap_bench_engine_t;
+
+static const dap_bench_engine_t kDAPBenchEngine[] = {
+    {"SPI", 10000000U, kTransfer_SPI},
+    {"GPIO_fast", 5000000U, kTransfer_GPIO_fast},
+    {"GPIO_normal", 1000000U, kTransfer_GPIO_normal},
+};
+
+static const uint16_t kDAPBenchTransferCount[] = {1, 2, 4, 8, 16, 32, 64, 128, 255};
+static const uint16_t kDAPBenchBlockSize[] = {64, 256, 1024}; // bytes
+static const uint16_t kDAPBenchSWJBits[] = {8, 64, 256};
+static const uint8_t kDAPBenchJTAGSequences[] = {1, 4}; // of 64 bits each
+
+static uint8_t bench_request[DAP_BENCH_BUFFER_SIZE];
+static uint8_t bench_response[DAP_BENCH_BUFFER_SIZE];
+
+extern uint8_t SWD_TransferSpeed;
+
+static inline uint32_t dap_bench_counter(void)
+{
+#if defined(DAP_HOST_BUILD)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+    uint32_t ccount;
+
+    __asm__ volatile("rsr %0, ccount" : "=a"(ccount));
+    return ccount;
+#endif
+}
+
+static void dap_bench_command(const uint8_t *request, uint32_t length)
+{
+    memcpy(bench_request, request, length);
+    DAP_ProcessCommand(bench_request, bench_response);
+}
+
+#define DAP_BENCH_COMMAND(...)                                     \
+    do                                                             \
+    {                                                              \
+        const uint8_t _request[] = {__VA_ARGS__};                  \
+        dap_bench_command(_request, sizeof(_request));             \
+    } while (0)
+
+static void dap_bench_set_clock(uint32_t clock)
+{
+    DAP_BENCH_COMMAND(ID_DAP_SWJ_Clock, clock & 0xFF, (clock >> 8) & 0xFF, (clock >> 16) & 0xFF, clock >> 24);
+}
+
+/**
+ * @brief Connect in SWD, power up the debug port and point TAR at the RAM
+ *
+ */
+static void dap_bench_swd_setup(uint32_t clock)
+{
+    DAP_BENCH_COMMAND(ID_DAP_Connect, DAP_PORT_SWD);
+    dap_bench_set_clock(clock);
+    // line reset, JTAG to SWD, line reset, idle
+    DAP_BENCH_COMMAND(ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+    DAP_BENCH_COMMAND(ID_DAP_SWJ_Sequence, 16, 0x9E, 0xE7);
+    DAP_BENCH_COMMAND(ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+    DAP_BENCH_COMMAND(ID_DAP_SWJ_Sequence, 8, 0x00);
+    // IDCODE, clear the sticky errors, power up, SELECT AP 0 bank 0
+    DAP_BENCH_COMMAND(ID_DAP_Transfer, 0, 4,
+                      DAP_TRANSFER_RnW | DP_IDCODE,
+                      DP_ABORT, 0x1E, 0x00, 0x00, 0x00,
+                      DP_CTRL_STAT, 0x00, 0x00, 0x00, 0x50,
+                      DP_SELECT, 0x00, 0x00, 0x00, 0x00);
+    // 32-bit accesses with auto-increment
+    DAP_BENCH_COMMAND(ID_DAP_Transfer, 0, 2,
+                      DAP_TRANSFER_APnDP | DAP_BENCH_AP_CSW, 0x12, 0x00, 0x00, 0x23,
+                      DAP_TRANSFER_APnDP | DAP_BENCH_AP_TAR,
+                      DAP_BENCH_RAM_ADDRESS & 0xFF, (DAP_BENCH_RAM_ADDRESS >> 8) & 0xFF,
+                      (DAP_BENCH_RAM_ADDRESS >> 16) & 0xFF, DAP_BENCH_RAM_ADDRESS >> 24);
+}
+
+static void dap_bench_jtag_setup(uint32_t clock)
+{
+    DAP_BENCH_COMMAND(ID_DAP_Connect, DAP_PORT_JTAG);
+    dap_bench_set_clock(clock);
+    // a single TAP with a 4 bit IR, reset it and go to Run-Test/Idle
+    DAP_BENCH_COMMAND(ID_DAP_JTAG_Configure, 1, 4);
+    DAP_BENCH_COMMAND(ID_DAP_SWJ_Sequence, 8, 0xFF);
+    DAP_BENCH_COMMAND(ID_DAP_SWJ_Sequence, 1, 0x00);
+}
+
+/**
+ * @brief Time the command in bench_request and print its CSV line
+ *
+ * @param status_offset Where the response holds DAP_TRANSFER_OK or DAP_OK
+ * @param status_ok The value there when the command succeeded
+ */
+static void dap_bench_measure(const char *engine, uint32_t clock, const char *command,
+                              uint32_t items, const char *item, uint32_t iterations,
+                              uint32_t status_offset, uint8_t status_ok)
+{
+    uint64_t total = 0;
+    uint32_t min = UINT32_MAX;
+    uint32_t start, elapsed, mean;
+    uint32_t i;
+    int ok;
+
+    // warm up the caches, and see if the target answers
+    DAP_ProcessCommand(bench_request, bench_response);
+    ok = bench_response[status_offset] == status_ok;
+
+    for (i = 0; i < iterations; i++)
+    {
+        start = dap_bench_counter();
+        DAP_ProcessCommand(bench_request, bench_response);
+        elapsed = dap_bench_counter() - start;
+
+        total += elapsed;
+        if (elapsed < min)
+        {
+            min = elapsed;
+        }
+    }
+    mean = (uint32_t)(total / iterations);
+
+    printf("%s,%u,%s,%u,%s,%u,%u,%u,%.1f,%s,%s\n",
+           engine, (unsigned)clock, command, (unsigned)items, item, (unsigned)iterations,
+           (unsigned)mean, (unsigned)min, (double)mean / items, DAP_BENCH_UNIT, ok ? "ok" : "fail");
+}
+
+static void dap_bench_swd(const dap_bench_engine_t *engine, uint32_t iterations)
+{
+    uint32_t i, j, count;
+    uint8_t *p;
+
+    for (i = 0; i < sizeof(kDAPBenchTransferCount) / sizeof(kDAPBenchTransferCount[0]); i++)
+    {
+        count = kDAPBenchTransferCount[i];
+        bench_request[0] = ID_DAP_Transfer;
+        bench_request[1] = 0;
+        bench_request[2] = count;
+        memset(&bench_request[3], DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_BENCH_AP_DRW, count);
+        dap_bench_measure(engine->name, engine->clock, "Transfer_read", count, "transfer", iterations, 2,
+                          DAP_TRANSFER_OK);
+    }
+
+    for (i = 0; i < sizeof(kDAPBenchTransferCount) / sizeof(kDAPBenchTransferCount[0]); i++)
+    {
+        count = kDAPBenchTransferCount[i];
+        bench_request[0] = ID_DAP_Transfer;
+        bench_request[1] = 0;
+        bench_request[2] = count;
+        p = &bench_request[3];
+        for (j = 0; j < count; j++)
+        {
+            *p++ = DAP_TRANSFER_APnDP | DAP_BENCH_AP_DRW;
+            *p++ = j;
+            *p++ = 0x55;
+            *p++ = 0xAA;
+            *p++ = 0x00;
+        }
+        dap_bench_measure(engine->name, engine->clock, "Transfer_write", count, "transfer", iterations, 2,
+                          DAP_TRANSFER_OK);
+    }
+
+    for (i = 0; i < sizeof(kDAPBenchBlockSize) / sizeof(kDAPBenchBlockSize[0]); i++)
+    {
+        count = kDAPBenchBlockSize[i] / 4;
+        bench_request[0] = ID_DAP_TransferBlock;
+        bench_request[1] = 0;
+        bench_request[2] = count & 0xFF;
+        bench_request[3] = count >> 8;
+        bench_request[4] = DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_BENCH_AP_DRW;
+        dap_bench_measure(engine->name, engine->clock, "TransferBlock_read", count, "transfer", iterations, 3,
+                          DAP_TRANSFER_OK);
+
+        bench_request[4] = DAP_TRANSFER_APnDP | DAP_BENCH_AP_DRW;
+        for (j = 0; j < count * 4; j++)
+        {
+            bench_request[5 + j] = j;
+        }
+        dap_bench_measure(engine->name, engine->clock, "TransferBlock_write", count, "transfer", iterations, 3,
+                          DAP_TRANSFER_OK);
+    }
+
+    // idle cycles, which leave the target as it is
+    for (i = 0; i < sizeof(kDAPBenchSWJBits) / sizeof(kDAPBenchSWJBits[0]); i++)
+    {
+        count = kDAPBenchSWJBits[i];
+        bench_request[0] = ID_DAP_SWJ_Sequence;
+        bench_request[1] = count & 0xFF; // 0 is 256
+        memset(&bench_request[2], 0x00, (count + 7) / 8);
+        dap_bench_measure(engine->name, engine->clock, "SWJ_Sequence", count, "bit", iterations, 1, DAP_OK);
+    }
+}
+
+static void dap_bench_jtag(const dap_bench_engine_t *engine, uint32_t iterations)
+{
+    const char *name = SWD_TransferSpeed == kTransfer_SPI ? "SPI" : DAP_Data.fast_clock ? "GPIO_fast" : "GPIO_normal";
+    uint32_t i, j, count;
+    uint8_t *p;
+
+    for (i = 0; i < sizeof(kDAPBenchJTAGSequences) / sizeof(kDAPBenchJTAGSequences[0]); i++)
+    {
+        count = kDAPBenchJTAGSequences[i];
+        bench_request[0] = ID_DAP_JTAG_Sequence;
+        bench_request[1] = count;
+        p = &bench_request[2];
+        for (j = 0; j < count; j++)
+        {
+            // 64 TCKs with TMS low, TDO captured
+            *p++ = JTAG_SEQUENCE_TDO | 0U;
+            memset(p, 0xA5, 8);
+            p += 8;
+        }
+        dap_bench_measure(name, engine->clock, "JTAG_Sequence", count * 64, "bit", iterations, 1, DAP_OK);
+    }
+}
+
+void dap_bench_run(uint32_t iterations)
+{
+    const dap_bench_engine_t *engine;
+    uint32_t i;
+
+    if (iterations == 0)
+    {
+        iterations = 1;
+    }
+
+    printf("engine,clock_hz,command,items,item,iterations,mean,min,per_item,unit,status\n");
+    for (i = 0; i < sizeof(kDAPBenchEngine) / sizeof(kDAPBenchEngine[0]); i++)
+    {
+        engine = &kDAPBenchEngine[i];
+
+        dap_bench_swd_setup(engine->clock);
+        if (SWD_TransferSpeed != engine->speed)
+        {
+            printf("# %s is not selected at %u Hz\n", engine->name, (unsigned)engine->clock);
+            continue;
+        }
+        dap_bench_swd(engine, iterations);
+
+        dap_bench_jtag_setup(engine->clock);
+        dap_bench_jtag(engine, iterations);
+    }
+
+    DAP_BENCH_COMMAND(ID_DAP_Disconnect);
+}
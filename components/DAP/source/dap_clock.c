@@ -0,0 +1,389 @@
+/**
+ * @file dap_clock.c
+ * @brief SWJ clock planner, see dap_clock.h
+ *
+ * @version 0.1
+ * @date 2022-08-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdint.h>
+
+#include "components/DAP/config/DAP_config.h"
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_clock.h"
+#include "components/DAP/include/spi_switch.h"
+
+#if !defined(DAP_HOST_BUILD)
+#include "esp32/rom/ets_sys.h"
+#endif
+
+// SPI_CLOCK_REG field limits
+#define DAP_CLOCK_SPI_PRE_MAX 8192U // clkdiv_pre + 1
+#define DAP_CLOCK_SPI_N_MAX 64U     // clkcnt_n + 1
+
+// Ports the SPI engine serves
+#if (USE_JTAG_SPI != 0)
+#define DAP_CLOCK_SPI_PORT(port) (1)
+#else
+#define DAP_CLOCK_SPI_PORT(port) ((port) != DAP_PORT_JTAG)
+#endif
+
+// CPU cycles are kept in 1/16 of a cycle
+#define DAP_CLOCK_CYCLE_FRAC 16U
+
+// Clock cycles of a measure, and the best of how many measures counts
+#define DAP_CLOCK_CALIBRATE_CYCLES 256U
+#define DAP_CLOCK_CALIBRATE_RUNS 4U
+// The second delay of the calibration, the first is 1
+#define DAP_CLOCK_CALIBRATE_DELAY 33U
+
+#if defined(DAP_HOST_BUILD)
+// The model of the host build: a 100MHz CPU, 5MHz without delay
+#define DAP_CLOCK_HOST_CPU 100000000U
+#define DAP_CLOCK_HOST_FAST_CYCLES 20U
+#endif
+
+// CPU cycles of a clock cycle of one GPIO engine
+typedef struct
+{
+    uint32_t fast;      // without delay
+    uint32_t base;      // with PIN_DELAY_SLOW(delay), base + delay * per_delay
+    uint32_t per_delay;
+} dap_clock_gpio_cycles_t;
+
+typedef struct
+{
+    uint32_t cpu_hz; // 0 for an unused entry
+    dap_clock_gpio_cycles_t swd;
+    dap_clock_gpio_cycles_t jtag;
+} dap_clock_gpio_t;
+
+static dap_clock_plan_t dap_clock_now;
+
+static dap_clock_gpio_t dap_clock_gpio[DAP_CLOCK_CPU_COUNT];
+static const dap_clock_gpio_t *dap_clock_gpio_now = &dap_clock_gpio[0];
+static uint32_t dap_clock_gpio_next = 0; // entry the next calibration replaces
+static uint32_t dap_clock_cpu_hz;
+
+
+static inline uint32_t dap_clock_cpu(void)
+{
+#if defined(DAP_HOST_BUILD)
+    return DAP_CLOCK_HOST_CPU;
+#else
+    return ets_get_cpu_frequency() * 1000000U;
+#endif
+}
+
+#if !defined(DAP_HOST_BUILD)
+static inline uint32_t dap_clock_ccount(void)
+{
+    uint32_t ccount;
+
+    __asm__ volatile("rsr %0, ccount" : "=a"(ccount));
+    return ccount;
+}
+#endif
+
+/**
+ * @brief CPU cycles of a clock cycle of the engine, with fast_clock and clock_delay
+ *
+ * The best of several measures is kept, the others may have been interrupted.
+ */
+static uint32_t dap_clock_measure(uint32_t port, uint8_t fast_clock, uint32_t delay)
+{
+#if defined(DAP_HOST_BUILD)
+    (void)port;
+    if (fast_clock)
+    {
+        return DAP_CLOCK_HOST_FAST_CYCLES * DAP_CLOCK_CYCLE_FRAC;
+    }
+    return 2U * (IO_PORT_WRITE_CYCLES + delay * DELAY_SLOW_CYCLES) * DAP_CLOCK_CYCLE_FRAC;
+#else
+    uint32_t best = UINT32_MAX;
+    uint32_t start, cycles;
+    uint32_t i;
+
+    DAP_Data.fast_clock = fast_clock;
+    DAP_Data.clock_delay = delay;
+    for (i = 0; i < DAP_CLOCK_CALIBRATE_RUNS; i++)
+    {
+        start = dap_clock_ccount();
+#if (DAP_JTAG != 0)
+        if (port == DAP_PORT_JTAG)
+        {
+            JTAG_Calibrate(DAP_CLOCK_CALIBRATE_CYCLES);
+        }
+        else
+#endif
+        {
+            SWD_Calibrate(DAP_CLOCK_CALIBRATE_CYCLES, !fast_clock);
+        }
+        cycles = dap_clock_ccount() - start;
+        if (cycles < best)
+        {
+            best = cycles;
+        }
+    }
+    return best * DAP_CLOCK_CYCLE_FRAC / DAP_CLOCK_CALIBRATE_CYCLES;
+#endif
+}
+
+static void dap_clock_calibrate_port(uint32_t port, dap_clock_gpio_cycles_t *cycles)
+{
+    uint32_t first = dap_clock_measure(port, 0U, 1U);
+    uint32_t second = dap_clock_measure(port, 0U, DAP_CLOCK_CALIBRATE_DELAY);
+
+    cycles->fast = dap_clock_measure(port, 1U, 1U);
+    cycles->per_delay = second > first ? (second - first) / (DAP_CLOCK_CALIBRATE_DELAY - 1U) : 1U;
+    if (cycles->per_delay == 0)
+    {
+        cycles->per_delay = 1U;
+    }
+    cycles->base = first > cycles->per_delay ? first - cycles->per_delay : 0U;
+}
+
+void dap_clock_calibrate(void)
+{
+    dap_clock_gpio_t *entry;
+    uint8_t fast_clock = DAP_Data.fast_clock;
+    uint32_t clock_delay = DAP_Data.clock_delay;
+    uint32_t i;
+
+    dap_clock_cpu_hz = dap_clock_cpu();
+    for (i = 0; i < DAP_CLOCK_CPU_COUNT; i++)
+    {
+        if (dap_clock_gpio[i].cpu_hz == dap_clock_cpu_hz)
+        {
+            break;
+        }
+    }
+    if (i == DAP_CLOCK_CPU_COUNT)
+    {
+        i = dap_clock_gpio_next;
+        dap_clock_gpio_next = (dap_clock_gpio_next + 1U) % DAP_CLOCK_CPU_COUNT;
+    }
+    entry = &dap_clock_gpio[i];
+
+    dap_clock_calibrate_port(DAP_PORT_SWD, &entry->swd);
+    dap_clock_calibrate_port(DAP_PORT_JTAG, &entry->jtag);
+    entry->cpu_hz = dap_clock_cpu_hz;
+    dap_clock_gpio_now = entry;
+
+    DAP_Data.fast_clock = fast_clock;
+    DAP_Data.clock_delay = clock_delay;
+}
+
+/**
+ * @brief Follow a change of the CPU clock
+ *
+ * A CPU clock seen before takes its entry. A new one is calibrated, unless a
+ * port is connected, which keeps the cycles of the current entry meanwhile.
+ */
+static void dap_clock_check_cpu(void)
+{
+    uint32_t cpu_hz = dap_clock_cpu();
+    uint32_t i;
+
+    if (cpu_hz == dap_clock_cpu_hz)
+    {
+        return;
+    }
+    for (i = 0; i < DAP_CLOCK_CPU_COUNT; i++)
+    {
+        if (dap_clock_gpio[i].cpu_hz == cpu_hz)
+        {
+            dap_clock_gpio_now = &dap_clock_gpio[i];
+            dap_clock_cpu_hz = cpu_hz;
+            return;
+        }
+    }
+    if (DAP_Data.debug_port == DAP_PORT_DISABLED)
+    {
+        dap_clock_calibrate();
+    }
+    else
+    {
+        dap_clock_cpu_hz = cpu_hz;
+    }
+}
+
+static const dap_clock_gpio_cycles_t *dap_clock_gpio_port(uint32_t port)
+{
+    return port == DAP_PORT_JTAG ? &dap_clock_gpio_now->jtag : &dap_clock_gpio_now->swd;
+}
+
+uint32_t dap_clock_gpio_hz(uint32_t port, uint32_t delay)
+{
+    const dap_clock_gpio_cycles_t *cycles = dap_clock_gpio_port(port);
+    uint32_t n = delay == 0 ? cycles->fast : cycles->base + delay * cycles->per_delay;
+
+    return (uint32_t)((uint64_t)dap_clock_cpu_hz * DAP_CLOCK_CYCLE_FRAC / (n != 0 ? n : 1U));
+}
+
+/**
+ * @brief Smallest PIN_DELAY_SLOW() delay that keeps the GPIO engine at or below clock
+ *
+ */
+static uint32_t dap_clock_gpio_delay(uint32_t port, uint32_t clock)
+{
+    const dap_clock_gpio_cycles_t *cycles = dap_clock_gpio_port(port);
+    uint64_t n = ((uint64_t)dap_clock_cpu_hz * DAP_CLOCK_CYCLE_FRAC + clock - 1U) / clock;
+
+    if (n <= cycles->base + cycles->per_delay)
+    {
+        return 1U;
+    }
+    return (uint32_t)((n - cycles->base + cycles->per_delay - 1U) / cycles->per_delay);
+}
+
+/**
+ * @brief Smallest SPI divider that keeps the clock at or below the request
+ *
+ * @return The clock reached
+ */
+static uint32_t dap_clock_spi_divider(uint32_t clock, uint32_t max, uint16_t *pre, uint8_t *n)
+{
+    uint32_t divider;
+    uint32_t best;
+    uint32_t k, p;
+
+    if (clock > max)
+    {
+        clock = max;
+    }
+    divider = (DAP_CLOCK_APB + clock - 1U) / clock;
+    if (divider <= 1U)
+    {
+        *pre = 0;
+        *n = 0;
+        return DAP_CLOCK_APB;
+    }
+
+    // clkcnt_n and clkdiv_pre multiply, the product closest above the divider wins
+    best = DAP_CLOCK_SPI_PRE_MAX * DAP_CLOCK_SPI_N_MAX;
+    *pre = DAP_CLOCK_SPI_PRE_MAX - 1U;
+    *n = DAP_CLOCK_SPI_N_MAX - 1U;
+    for (k = 2U; k <= DAP_CLOCK_SPI_N_MAX && best != divider; k++)
+    {
+        p = (divider + k - 1U) / k;
+        if (p <= DAP_CLOCK_SPI_PRE_MAX && p * k < best)
+        {
+            best = p * k;
+            *pre = p - 1U;
+            *n = k - 1U;
+        }
+    }
+    return DAP_CLOCK_APB / best;
+}
+
+void dap_clock_plan(uint32_t clock, uint32_t port, dap_clock_plan_t *plan)
+{
+    uint32_t fast_hz = dap_clock_gpio_hz(port, 0);
+
+    plan->requested = clock;
+    plan->spi_pre = 0;
+    plan->spi_n = 0;
+
+    if (clock > fast_hz && DAP_CLOCK_SPI_PORT(port))
+    {
+        plan->engine = kTransfer_SPI;
+        plan->fast_clock = 1U;
+        plan->clock_delay = 1U;
+        plan->hz = dap_clock_spi_divider(clock, port == DAP_PORT_JTAG ? DAP_JTAG_SPI_MAX_CLOCK : DAP_SPI_MAX_CLOCK,
+                                         &plan->spi_pre, &plan->spi_n);
+    }
+    else if (clock >= fast_hz)
+    {
+        plan->engine = kTransfer_GPIO_fast;
+        plan->fast_clock = 1U;
+        plan->clock_delay = 1U;
+        plan->hz = fast_hz;
+    }
+    else
+    {
+        plan->engine = kTransfer_GPIO_normal;
+        plan->fast_clock = 0U;
+        plan->clock_delay = dap_clock_gpio_delay(port, clock);
+        plan->hz = dap_clock_gpio_hz(port, plan->clock_delay);
+    }
+}
+
+void dap_clock_set(uint32_t clock)
+{
+    dap_clock_check_cpu();
+    dap_clock_plan(clock, DAP_Data.debug_port, &dap_clock_now);
+
+    if (dap_clock_now.engine == kTransfer_SPI)
+    {
+        if (DAP_Data.debug_port == DAP_PORT_JTAG)
+        {
+            DAP_SPI_Init_JTAG();
+        }
+        else
+        {
+            DAP_SPI_Init();
+        }
+        DAP_SPI_Set_Clock(dap_clock_now.spi_pre, dap_clock_now.spi_n);
+    }
+    else
+    {
+        DAP_SPI_Deinit();
+    }
+    SWD_TransferSpeed = dap_clock_now.engine;
+    DAP_Data.fast_clock = dap_clock_now.fast_clock;
+    DAP_Data.clock_delay = dap_clock_now.clock_delay;
+}
+
+void dap_clock_init(void)
+{
+    dap_clock_calibrate();
+    dap_clock_plan(DAP_DEFAULT_SWJ_CLOCK, DAP_PORT_DISABLED, &dap_clock_now);
+    DAP_Data.fast_clock = dap_clock_now.fast_clock;
+    DAP_Data.clock_delay = dap_clock_now.clock_delay;
+}
+
+const dap_clock_plan_t *dap_clock_current(void)
+{
+    return &dap_clock_now;
+}
+
+static uint8_t *dap_clock_put(uint8_t *p, uint32_t value)
+{
+    *p++ = (uint8_t)(value >> 0);
+    *p++ = (uint8_t)(value >> 8);
+    *p++ = (uint8_t)(value >> 16);
+    *p++ = (uint8_t)(value >> 24);
+    return p;
+}
+
+/**
+ * @brief ID_DAP_Vendor_Clock, see dap_clock.h
+ *
+ */
+uint32_t dap_clock_vendor_command(const uint8_t *request, uint8_t *response)
+{
+    dap_clock_plan_t plan;
+    const dap_clock_plan_t *reported = &dap_clock_now;
+    uint32_t clock;
+    uint8_t *p;
+
+    clock = (uint32_t)(request[1] << 0) |
+            (uint32_t)(request[2] << 8) |
+            (uint32_t)(request[3] << 16) |
+            (uint32_t)(request[4] << 24);
+    if (clock != 0U)
+    {
+        dap_clock_plan(clock, DAP_Data.debug_port, &plan);
+        reported = &plan;
+    }
+
+    response[0] = request[0];
+    response[1] = DAP_OK;
+    response[2] = reported->engine;
+    p = dap_clock_put(&response[3], reported->requested);
+    dap_clock_put(p, reported->hz);
+    return (5U << 16) | 11U;
+}
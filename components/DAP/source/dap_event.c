@@ -0,0 +1,191 @@
+/**
+ * @file dap_event.c
+ * @brief Event rings of the DAP path, see dap_event.h
+ *
+ * @version 0.1
+ * @date 2022-08-15
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <string.h>
+#include <stdint.h>
+
+#include "components/DAP/config/DAP_config.h"
+#include "components/DAP/include/dap_event.h"
+
+#if (USE_DAP_EVENT_TRACE == 1)
+
+#if defined(DAP_HOST_BUILD)
+#include <time.h>
+#define DAP_EVENT_CPU_HZ 1000000000U // the timestamps are in ns
+#else
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#define DAP_EVENT_CPU_HZ CPU_CLOCK
+#endif
+
+_Static_assert((DAP_EVENT_RING_SIZE & (DAP_EVENT_RING_SIZE - 1)) == 0,
+               "DAP_EVENT_RING_SIZE must be a power of 2");
+
+// A SYNC event at least that often, so that the converter can always place
+// an event within 2^31 CCOUNT ticks of a SYNC
+#define DAP_EVENT_SYNC_EVENTS 64U
+#define DAP_EVENT_SYNC_TICKS (1U << 28)
+
+typedef struct
+{
+    uint32_t head;        // events recorded since boot, taken with an atomic add
+    uint32_t last_sync;   // timestamp of the last SYNC
+    uint32_t since_sync;  // events recorded since
+    dap_event_t event[DAP_EVENT_RING_SIZE];
+} dap_event_ring_t;
+
+static dap_event_ring_t dap_event_ring[DAP_EVENT_CORE_NUM];
+static uint32_t dap_event_paused = 0;
+
+#if defined(DAP_HOST_BUILD)
+static __thread uint32_t dap_event_core = 0;
+
+void dap_event_set_core(uint32_t core)
+{
+    dap_event_core = core < DAP_EVENT_CORE_NUM ? core : 0;
+}
+#endif
+
+
+static inline uint32_t dap_event_timestamp(void)
+{
+#if defined(DAP_HOST_BUILD)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec);
+#else
+    uint32_t ccount;
+
+    __asm__ volatile("rsr %0, ccount" : "=a"(ccount));
+    return ccount;
+#endif
+}
+
+static inline uint32_t dap_event_time_us(void)
+{
+#if defined(DAP_HOST_BUILD)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000U + ts.tv_nsec / 1000U);
+#else
+    return (uint32_t)esp_timer_get_time();
+#endif
+}
+
+static inline dap_event_ring_t *dap_event_current_ring(void)
+{
+#if defined(DAP_HOST_BUILD)
+    return &dap_event_ring[dap_event_core];
+#else
+    return &dap_event_ring[xPortGetCoreID()];
+#endif
+}
+
+static inline void dap_event_write(dap_event_ring_t *ring, uint32_t timestamp, uint8_t type, uint8_t phase,
+                                   uint32_t arg)
+{
+    uint32_t slot = __atomic_fetch_add(&ring->head, 1U, __ATOMIC_RELAXED) % DAP_EVENT_RING_SIZE;
+    dap_event_t *event = &ring->event[slot];
+
+    event->timestamp = timestamp;
+    event->type = type;
+    event->phase = phase;
+    event->reserved = 0;
+    event->arg = arg;
+}
+
+void dap_event_record(dap_event_type_t type, dap_event_phase_t phase, uint32_t arg)
+{
+    dap_event_ring_t *ring;
+    uint32_t now;
+
+    if (__atomic_load_n(&dap_event_paused, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+
+    ring = dap_event_current_ring();
+    now = dap_event_timestamp();
+    if (ring->since_sync >= DAP_EVENT_SYNC_EVENTS || now - ring->last_sync >= DAP_EVENT_SYNC_TICKS)
+    {
+        // two tasks may both add one, which does no harm
+        ring->last_sync = now;
+        ring->since_sync = 0;
+        dap_event_write(ring, now, DAP_EVENT_SYNC, DAP_EVENT_INSTANT, dap_event_time_us());
+    }
+    ring->since_sync++;
+    dap_event_write(ring, now, type, phase, arg);
+}
+
+int dap_event_dump(dap_event_write_t write, void *context)
+{
+    const dap_event_dump_header header = {
+        .magic = DAP_EVENT_MAGIC,
+        .version = DAP_EVENT_VERSION,
+        .ring_count = DAP_EVENT_CORE_NUM,
+        .cpu_hz = DAP_EVENT_CPU_HZ,
+    };
+    dap_event_ring_header ring_header;
+    dap_event_ring_t *ring;
+    uint32_t head, first, count, offset, length;
+    uint32_t i;
+    int ret = 0;
+
+    // An event being written when recording stops may be torn, the converter skips it
+    __atomic_store_n(&dap_event_paused, 1U, __ATOMIC_RELAXED);
+
+    if (write(&header, sizeof(header), context) < 0)
+    {
+        ret = -1;
+    }
+
+    for (i = 0; i < DAP_EVENT_CORE_NUM && ret == 0; i++)
+    {
+        ring = &dap_event_ring[i];
+        head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        count = head < DAP_EVENT_RING_SIZE ? head : DAP_EVENT_RING_SIZE;
+        first = head - count;
+
+        ring_header.core = i;
+        ring_header.reserved = 0;
+        ring_header.count = count;
+        ring_header.dropped = first;
+        if (write(&ring_header, sizeof(ring_header), context) < 0)
+        {
+            ret = -1;
+            break;
+        }
+
+        // oldest first, in up to two parts
+        while (count > 0)
+        {
+            offset = first % DAP_EVENT_RING_SIZE;
+            length = DAP_EVENT_RING_SIZE - offset;
+            if (length > count)
+            {
+                length = count;
+            }
+            if (write(&ring->event[offset], length * sizeof(dap_event_t), context) < 0)
+            {
+                ret = -1;
+                break;
+            }
+            first += length;
+            count -= length;
+        }
+    }
+
+    __atomic_store_n(&dap_event_paused, 0U, __ATOMIC_RELAXED);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file dap_latency.c
+ * @brief Latency histograms, see dap_latency.h
+ *
+ * @version 0.1
+ * @date 2022-08-16
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdint.h>
+
+#include "components/DAP/config/DAP_config.h"
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_latency.h"
+
+dap_latency_histogram_t kDAPLatency[DAP_LATENCY_STAGE_COUNT];
+
+
+void dap_latency_reset(void)
+{
+    uint32_t i, j;
+
+    // a value recorded meanwhile may survive, which does no harm
+    for (i = 0; i < DAP_LATENCY_STAGE_COUNT; i++)
+    {
+        __atomic_store_n(&kDAPLatency[i].max, 0U, __ATOMIC_RELAXED);
+        for (j = 0; j < DAP_LATENCY_BUCKET_COUNT; j++)
+        {
+            __atomic_store_n(&kDAPLatency[i].count[j], 0U, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+uint32_t dap_latency_bucket_floor(uint32_t bucket)
+{
+    const uint32_t sub_count = 1U << DAP_LATENCY_SUB_BITS;
+
+    if (bucket < sub_count)
+    {
+        return bucket;
+    }
+    if (bucket >= DAP_LATENCY_BUCKET_COUNT - 1U)
+    {
+        return 1U << DAP_LATENCY_MAX_SHIFT;
+    }
+    return (sub_count + (bucket & (sub_count - 1U))) << ((bucket >> DAP_LATENCY_SUB_BITS) - 1U);
+}
+
+static uint8_t *dap_latency_put(uint8_t *p, uint32_t value)
+{
+    *p++ = value & 0xFF;
+    *p++ = (value >> 8) & 0xFF;
+    *p++ = (value >> 16) & 0xFF;
+    *p++ = value >> 24;
+    return p;
+}
+
+/**
+ * @brief ID_DAP_Vendor_Latency, see dap_latency.h
+ *
+ * @return number of bytes in response (lower 16 bits)
+ *         number of bytes in request (upper 16 bits)
+ */
+uint32_t dap_latency_vendor_command(const uint8_t *request, uint8_t *response)
+{
+    const dap_latency_histogram_t *histogram;
+    uint32_t stage = request[1];
+    uint32_t first = request[2];
+    uint32_t count = 0;
+    uint8_t *p = &response[8];
+
+    response[0] = request[0];
+    if (stage == DAP_LATENCY_RESET)
+    {
+        dap_latency_reset();
+        response[1] = DAP_OK;
+        return (3U << 16) | 2U;
+    }
+    if (stage >= DAP_LATENCY_STAGE_COUNT)
+    {
+        response[1] = DAP_ERROR;
+        return (3U << 16) | 2U;
+    }
+
+    histogram = &kDAPLatency[stage];
+    while (first + count < DAP_LATENCY_BUCKET_COUNT && count < (DAP_PACKET_SIZE - 8U) / 4U)
+    {
+        p = dap_latency_put(p, __atomic_load_n(&histogram->count[first + count], __ATOMIC_RELAXED));
+        count++;
+    }
+
+    response[1] = DAP_LATENCY_STAGE_COUNT;
+    response[2] = DAP_LATENCY_BUCKET_COUNT;
+    response[3] = count;
+    dap_latency_put(&response[4], __atomic_load_n(&histogram->max, __ATOMIC_RELAXED));
+    return (3U << 16) | (8U + count * 4U);
+}
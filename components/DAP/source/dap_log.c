@@ -0,0 +1,156 @@
+/**
+ * @file dap_log.c
+ * @brief Deferred logging ring, see dap_log.h
+ *
+ * The ring has many producers and one consumer. A producer takes the entry
+ * at head with a compare-and-swap, fills it, then publishes it by storing
+ * its position + 1 in its sequence. The consumer reads the entry at tail
+ * once its sequence says it is complete, and frees it by moving tail.
+ *
+ * @version 0.1
+ * @date 2022-08-17
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "components/DAP/include/dap_log.h"
+
+#if defined(DAP_HOST_BUILD)
+#include <time.h>
+#else
+#include "esp_timer.h"
+#endif
+
+_Static_assert((DAP_LOG_RING_SIZE & (DAP_LOG_RING_SIZE - 1)) == 0,
+               "DAP_LOG_RING_SIZE must be a power of 2");
+
+#define DAP_LOG_TEXT_SIZE 160
+
+typedef struct
+{
+    uint32_t sequence;  // position + 1 once complete
+    uint32_t timestamp; // ms
+    const char *format;
+    uint16_t level;
+    uint16_t argc;
+    uint32_t arg[DAP_LOG_ARG_MAX];
+} dap_log_entry_t;
+
+static dap_log_entry_t dap_log_ring[DAP_LOG_RING_SIZE];
+static uint32_t dap_log_head = 0;
+static uint32_t dap_log_tail = 0;
+static uint32_t dap_log_dropped = 0;
+static uint32_t dap_log_dropped_reported = 0; // by the consumer
+
+static const char kDAPLogLevel[] = {'-', 'E', 'W', 'I', 'D'};
+
+
+static inline uint32_t dap_log_time_ms(void)
+{
+#if defined(DAP_HOST_BUILD)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000U + ts.tv_nsec / 1000000U);
+#else
+    return (uint32_t)(esp_timer_get_time() / 1000);
+#endif
+}
+
+void dap_log_write(uint32_t level, const char *format, uint32_t argc, ...)
+{
+    dap_log_entry_t *entry;
+    uint32_t head;
+    uint32_t i;
+    va_list ap;
+
+    head = __atomic_load_n(&dap_log_head, __ATOMIC_RELAXED);
+    do
+    {
+        if (head - __atomic_load_n(&dap_log_tail, __ATOMIC_ACQUIRE) >= DAP_LOG_RING_SIZE)
+        {
+            __atomic_fetch_add(&dap_log_dropped, 1U, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&dap_log_head, &head, head + 1U, 1, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+
+    entry = &dap_log_ring[head % DAP_LOG_RING_SIZE];
+    entry->timestamp = dap_log_time_ms();
+    entry->format = format;
+    entry->level = level;
+    entry->argc = argc;
+    va_start(ap, argc);
+    for (i = 0; i < DAP_LOG_ARG_MAX; i++)
+    {
+        entry->arg[i] = i < argc ? va_arg(ap, uint32_t) : 0;
+    }
+    va_end(ap);
+
+    __atomic_store_n(&entry->sequence, head + 1U, __ATOMIC_RELEASE);
+}
+
+static void dap_log_output_entry(const dap_log_entry_t *entry, dap_log_output_t output, void *context)
+{
+    char text[DAP_LOG_TEXT_SIZE];
+    int length;
+    int n;
+
+    length = snprintf(text, sizeof(text), "%c (%u) ",
+                      kDAPLogLevel[entry->level < sizeof(kDAPLogLevel) ? entry->level : 0],
+                      (unsigned)entry->timestamp);
+    // the arguments the format does not use are ignored
+    n = snprintf(text + length, sizeof(text) - length, entry->format,
+                 entry->arg[0], entry->arg[1], entry->arg[2], entry->arg[3]);
+    if (n > 0)
+    {
+        length += n;
+    }
+    if (length >= (int)sizeof(text))
+    {
+        length = sizeof(text) - 1; // cut
+    }
+    output(text, length, context);
+}
+
+uint32_t dap_log_drain(dap_log_output_t output, void *context)
+{
+    dap_log_entry_t entry;
+    dap_log_entry_t *slot;
+    uint32_t tail = __atomic_load_n(&dap_log_tail, __ATOMIC_RELAXED);
+    uint32_t dropped;
+    uint32_t count = 0;
+
+    for (;;)
+    {
+        slot = &dap_log_ring[tail % DAP_LOG_RING_SIZE];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != tail + 1U)
+        {
+            break;
+        }
+        entry = *slot;
+        tail++;
+        __atomic_store_n(&dap_log_tail, tail, __ATOMIC_RELEASE);
+
+        dap_log_output_entry(&entry, output, context);
+        count++;
+    }
+
+    dropped = __atomic_load_n(&dap_log_dropped, __ATOMIC_RELAXED);
+    if (dropped != dap_log_dropped_reported)
+    {
+        entry.timestamp = dap_log_time_ms();
+        entry.format = "%u log messages dropped\r\n";
+        entry.level = DAP_LOG_LEVEL_WARN;
+        entry.arg[0] = dropped - dap_log_dropped_reported;
+        entry.arg[1] = entry.arg[2] = entry.arg[3] = 0;
+        dap_log_dropped_reported = dropped;
+        dap_log_output_entry(&entry, output, context);
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file dap_metrics.c
+ * @brief Metrics registry, see dap_metrics.h
+ *
+ * @version 0.1
+ * @date 2022-08-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "components/DAP/config/DAP_config.h"
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_metrics.h"
+
+typedef enum
+{
+    DAP_METRIC_COUNTER = 0,
+    DAP_METRIC_GAUGE,
+} dap_metric_type_t;
+
+typedef struct
+{
+    const char *name;
+    const char *help;
+    dap_metric_type_t type;
+} dap_metric_info_t;
+
+static const dap_metric_info_t kDAPMetricInfo[DAP_METRIC_COUNT] = {
+    [DAP_METRIC_URB_RX] = {"dap_usbip_urbs_received_total", "USBIP stage 2 PDUs received", DAP_METRIC_COUNTER},
+    [DAP_METRIC_URB_TX] = {"dap_usbip_urbs_sent_total", "USBIP stage 2 PDUs sent", DAP_METRIC_COUNTER},
+    [DAP_METRIC_BYTES_RX] = {"dap_usbip_received_bytes_total", "Bytes of the USBIP PDUs received", DAP_METRIC_COUNTER},
+    [DAP_METRIC_BYTES_TX] = {"dap_usbip_sent_bytes_total", "Bytes of the USBIP PDUs sent", DAP_METRIC_COUNTER},
+    [DAP_METRIC_ACK_OK] = {"dap_ack_ok_total", "Transfers answered with OK", DAP_METRIC_COUNTER},
+    [DAP_METRIC_ACK_WAIT] = {"dap_ack_wait_total", "Transfers answered with WAIT, each one retried", DAP_METRIC_COUNTER},
+    [DAP_METRIC_ACK_FAULT] = {"dap_ack_fault_total", "Transfers answered with FAULT", DAP_METRIC_COUNTER},
+    [DAP_METRIC_ACK_PROTOCOL_ERROR] = {"dap_ack_protocol_error_total", "Transfers with no valid ACK or a parity error", DAP_METRIC_COUNTER},
+    [DAP_METRIC_REQUEST_QUEUE_MAX] = {"dap_request_queue_max", "Most commands waiting for DAP_Thread", DAP_METRIC_GAUGE},
+    [DAP_METRIC_RESPONSE_QUEUE_MAX] = {"dap_response_queue_max", "Most responses waiting for the reply task", DAP_METRIC_GAUGE},
+    [DAP_METRIC_DAP_TASK_STACK_FREE] = {"dap_task_stack_free_min_bytes", "Least free stack of DAP_Thread", DAP_METRIC_GAUGE},
+    [DAP_METRIC_REPLY_TASK_STACK_FREE] = {"dap_reply_task_stack_free_min_bytes", "Least free stack of DAP_Reply_Thread", DAP_METRIC_GAUGE},
+    [DAP_METRIC_ENGINE_SPI_US] = {"dap_engine_spi_us_total", "Time executing commands with the SPI engine", DAP_METRIC_COUNTER},
+    [DAP_METRIC_ENGINE_GPIO_US] = {"dap_engine_gpio_us_total", "Time executing commands with a GPIO engine", DAP_METRIC_COUNTER},
+};
+
+uint32_t kDAPMetrics[DAP_METRIC_COUNT];
+uint32_t kDAPMetricsCommand[DAP_METRICS_COMMAND_COUNT];
+
+#define DAP_METRICS_SLOT_EXECUTE_COMMANDS 0x20U
+#define DAP_METRICS_SLOT_VENDOR           0x21U
+#define DAP_METRICS_SLOT_UNKNOWN          0x22U
+
+
+uint32_t dap_metrics_command_slot(uint8_t id)
+{
+    if (id < 0x20U)
+    {
+        return id;
+    }
+    if (id == ID_DAP_ExecuteCommands)
+    {
+        return DAP_METRICS_SLOT_EXECUTE_COMMANDS;
+    }
+    if (id >= ID_DAP_Vendor0 && id <= ID_DAP_Vendor31)
+    {
+        return DAP_METRICS_SLOT_VENDOR;
+    }
+    return DAP_METRICS_SLOT_UNKNOWN;
+}
+
+static uint32_t dap_metrics_get(uint32_t index)
+{
+    if (index < DAP_METRIC_COUNT)
+    {
+        return __atomic_load_n(&kDAPMetrics[index], __ATOMIC_RELAXED);
+    }
+    return __atomic_load_n(&kDAPMetricsCommand[index - DAP_METRIC_COUNT], __ATOMIC_RELAXED);
+}
+
+static const char *dap_metrics_command_label(uint32_t slot, char *buf, size_t size)
+{
+    switch (slot)
+    {
+    case DAP_METRICS_SLOT_EXECUTE_COMMANDS:
+        return "0x7F";
+    case DAP_METRICS_SLOT_VENDOR:
+        return "vendor";
+    case DAP_METRICS_SLOT_UNKNOWN:
+        return "unknown";
+    default:
+        snprintf(buf, size, "0x%02X", (unsigned)slot);
+        return buf;
+    }
+}
+
+size_t dap_metrics_format(char *buf, size_t size)
+{
+    const dap_metric_info_t *info;
+    char label[8];
+    size_t length = 0;
+    uint32_t i;
+    int n;
+
+#define DAP_METRICS_PRINT(...)                                                   \
+    do                                                                           \
+    {                                                                            \
+        n = snprintf(buf + length, size - length, __VA_ARGS__);                  \
+        if (n < 0 || (size_t)n >= size - length)                                 \
+        {                                                                        \
+            return size > 0 ? size - 1 : 0;                                      \
+        }                                                                        \
+        length += n;                                                             \
+    } while (0)
+
+    if (size == 0)
+    {
+        return 0;
+    }
+    buf[0] = '\0';
+
+    for (i = 0; i < DAP_METRIC_COUNT; i++)
+    {
+        info = &kDAPMetricInfo[i];
+        DAP_METRICS_PRINT("# HELP %s %s\n# TYPE %s %s\n%s %u\n", info->name, info->help, info->name,
+                          info->type == DAP_METRIC_COUNTER ? "counter" : "gauge",
+                          info->name, (unsigned)dap_metrics_get(i));
+    }
+
+    DAP_METRICS_PRINT("# HELP dap_commands_total DAP commands processed, by ID\n"
+                      "# TYPE dap_commands_total counter\n");
+    for (i = 0; i < DAP_METRICS_COMMAND_COUNT; i++)
+    {
+        if (kDAPMetricsCommand[i] == 0)
+        {
+            continue;
+        }
+        DAP_METRICS_PRINT("dap_commands_total{command=\"%s\"} %u\n",
+                          dap_metrics_command_label(i, label, sizeof(label)),
+                          (unsigned)dap_metrics_get(DAP_METRIC_COUNT + i));
+    }
+
+#undef DAP_METRICS_PRINT
+    return length;
+}
+
+/**
+ * @brief ID_DAP_Vendor_Metrics, see dap_metrics.h
+ *
+ * @return number of bytes in response (lower 16 bits)
+ *         number of bytes in request (upper 16 bits)
+ */
+uint32_t dap_metrics_vendor_command(const uint8_t *request, uint8_t *response)
+{
+    const uint32_t total = DAP_METRIC_COUNT + DAP_METRICS_COMMAND_COUNT;
+    uint32_t first = request[1];
+    uint32_t count = 0;
+    uint32_t value;
+    uint8_t *p = &response[3];
+
+    while (first + count < total && count < (DAP_PACKET_SIZE - 3U) / 4U)
+    {
+        value = dap_metrics_get(first + count);
+        *p++ = value & 0xFF;
+        *p++ = (value >> 8) & 0xFF;
+        *p++ = (value >> 16) & 0xFF;
+        *p++ = value >> 24;
+        count++;
+    }
+
+    response[0] = request[0];
+    response[1] = total;
+    response[2] = count;
+    return (2U << 16) | (3U + count * 4U);
+}
@@ -11,6 +11,7 @@
  *
  */
 #include <stdio.h>
+#include <string.h>
 
 
 #include "components/DAP/include/cmsis_compiler.h"
@@ -87,7 +88,10 @@ void DAP_SPI_WriteBits(const uint8_t count, const uint8_t *buf)
             pData[i] = buf[i];
         }
         // last byte use mask:
-        pData[i-1] = pData[i-1] & ((2U >> (count % 8)) - 1U);
+        if (count % 8)
+        {
+            pData[i-1] = pData[i-1] & ((1U << (count % 8)) - 1U);
+        }
 
         DAP_SPI.data_buf[0] = data_buf[0];
         DAP_SPI.data_buf[1] = data_buf[1];
@@ -144,9 +148,10 @@ void DAP_SPI_ReadBits(const uint8_t count, uint8_t *buf) {
  *
  * @param packetHeaderData data from host
  * @param ack ack from target
+ * @param Trn num of trn before ack
  * @param TrnAfterACK num of trn after ack
  */
-__FORCEINLINE void DAP_SPI_Send_Header(const uint8_t packetHeaderData, uint8_t *ack, uint8_t TrnAfterACK)
+__FORCEINLINE void DAP_SPI_Send_Header(const uint8_t packetHeaderData, uint8_t *ack, uint8_t Trn, uint8_t TrnAfterACK)
 {
     volatile uint32_t dataBuf;
 
@@ -158,8 +163,8 @@ __FORCEINLINE void DAP_SPI_Send_Header(const uint8_t packetHeaderData, uint8_t *
 
     DAP_SPI.user.sio = true;
 
-    // 1 bit Trn(Before ACK) + 3bits ACK + TrnAferACK  - 1(prescribed)
-    DAP_SPI.miso_dlen.usr_miso_dbitlen = 1U + 3U + TrnAfterACK - 1U;
+    // Trn(Before ACK) + 3bits ACK + TrnAferACK  - 1(prescribed)
+    DAP_SPI.miso_dlen.usr_miso_dbitlen = Trn + 3U + TrnAfterACK - 1U;
 
     // copy data to reg
     DAP_SPI.data_buf[0] = (packetHeaderData << 0) | (0U << 8) | (0U << 16) | (0U << 24);
@@ -172,7 +177,7 @@ __FORCEINLINE void DAP_SPI_Send_Header(const uint8_t packetHeaderData, uint8_t *
     DAP_SPI.user.sio = false;
 
     dataBuf = DAP_SPI.data_buf[0];
-    *ack = (dataBuf >> 1) & 0b111;
+    *ack = (dataBuf >> Trn) & 0b111;
 }
 
 
@@ -181,8 +186,9 @@ __FORCEINLINE void DAP_SPI_Send_Header(const uint8_t packetHeaderData, uint8_t *
  *
  * @param resData data from target
  * @param resParity parity from target
+ * @param Trn num of trn after the data
  */
-__FORCEINLINE void DAP_SPI_Read_Data(uint32_t *resData, uint8_t *resParity)
+__FORCEINLINE void DAP_SPI_Read_Data(uint32_t *resData, uint8_t *resParity, uint8_t Trn)
 {
     volatile uint64_t dataBuf;
     uint32_t *pU32Data = (uint32_t *)&dataBuf;
@@ -192,8 +198,8 @@ __FORCEINLINE void DAP_SPI_Read_Data(uint32_t *resData, uint8_t *resParity)
 
     DAP_SPI.user.sio = true;
 
-    // 1 bit Trn(End) + 3bits ACK + 32bis data + 1bit parity - 1(prescribed)
-    DAP_SPI.miso_dlen.usr_miso_dbitlen = 1U + 32U + 1U - 1U;
+    // 32bis data + 1bit parity + Trn(End) - 1(prescribed)
+    DAP_SPI.miso_dlen.usr_miso_dbitlen = 32U + 1U + Trn - 1U;
 
     // Start transmission
     DAP_SPI.cmd.usr = 1;
@@ -232,6 +238,61 @@ __FORCEINLINE void DAP_SPI_Write_Data(uint32_t data, uint8_t parity)
     while (DAP_SPI.cmd.usr) continue;
 }
 
+/**
+ * @brief Step2 of a write and Step1 of the next packet, in one transaction
+ *        The data phase, the idle cycles and the next request are sent, then
+ *        the ACK of that request is read. The MOSI phase precedes the MISO
+ *        phase, so the line is only released for the turnarounds and the ACK.
+ *
+ * @param data data from host
+ * @param parity parity from host
+ * @param idle num of idle cycles after the data
+ * @param packetHeaderData next request from host
+ * @param ack ack from target
+ * @param Trn num of trn before and after ack
+ */
+__FORCEINLINE void DAP_SPI_Write_Data_Send_Header(uint32_t data, uint8_t parity, uint8_t idle,
+                                                  const uint8_t packetHeaderData, uint8_t *ack, uint8_t Trn)
+{
+    // 32bits data + 1bit parity + up to 255 idle cycles + 8bits request, in the 64 bytes of data_buf
+    uint32_t dataBuf[10] = {0};
+    uint32_t n = 32U + 1U + idle;
+    int i;
+
+    dataBuf[0] = data;
+    dataBuf[1] = parity & 1U;
+    dataBuf[n / 32U] |= (uint32_t)packetHeaderData << (n % 32U);
+    if ((n % 32U) > 24U)
+    {
+        dataBuf[n / 32U + 1U] = (uint32_t)packetHeaderData >> (32U - n % 32U);
+    }
+
+    DAP_SPI.user.usr_mosi = 1;
+    DAP_SPI.mosi_dlen.usr_mosi_dbitlen = n + 8U - 1U;
+
+    DAP_SPI.user.usr_miso = 1;
+
+    DAP_SPI.user.sio = true;
+
+    // Trn(Before ACK) + 3bits ACK + Trn(After ACK) - 1(prescribed)
+    DAP_SPI.miso_dlen.usr_miso_dbitlen = Trn + 3U + Trn - 1U;
+
+    // copy data to reg
+    for (i = 0; i < div_round_up(n + 8U, 32); i++)
+    {
+        DAP_SPI.data_buf[i] = dataBuf[i];
+    }
+
+    // Start transmission
+    DAP_SPI.cmd.usr = 1;
+    // Wait for sending to complete
+    while (DAP_SPI.cmd.usr) continue;
+
+    DAP_SPI.user.sio = false;
+
+    *ack = (DAP_SPI.data_buf[0] >> Trn) & 0b111;
+}
+
 /**
  * @brief Generate Clock Cycle
  *
@@ -253,6 +314,27 @@ __FORCEINLINE void DAP_SPI_Generate_Cycle(uint8_t num)
     // 200us reduce
 }
 
+/**
+ * @brief Generate Clock Cycle with the line released, e.g. for turnaround
+ *
+ * @param num Cycle Num
+ */
+__FORCEINLINE void DAP_SPI_Release_Cycle(uint8_t num)
+{
+    DAP_SPI.user.usr_mosi = 0;
+    DAP_SPI.user.usr_miso = 1;
+
+    DAP_SPI.user.sio = true;
+    DAP_SPI.miso_dlen.usr_miso_dbitlen = num - 1U;
+
+    // Start transmission
+    DAP_SPI.cmd.usr = 1;
+    // Wait for reading to complete
+    while (DAP_SPI.cmd.usr) continue;
+
+    DAP_SPI.user.sio = false;
+}
+
 /**
  * @brief Quickly generate 1 clock
  *
@@ -267,12 +349,13 @@ __FORCEINLINE void DAP_SPI_Fast_Cycle()
 /**
  * @brief Generate Protocol Error Cycle
  *
+ * @param Trn num of trn
  */
-__FORCEINLINE void DAP_SPI_Protocol_Error_Read()
+__FORCEINLINE void DAP_SPI_Protocol_Error_Read(uint8_t Trn)
 {
     DAP_SPI.user.usr_mosi = 1;
     DAP_SPI.user.usr_miso = 0;
-    DAP_SPI.mosi_dlen.usr_mosi_dbitlen = 32U + 1U - 1; // 32bit ignore data + 1 bit - 1(prescribed)
+    DAP_SPI.mosi_dlen.usr_mosi_dbitlen = Trn + 32U + 1U - 1; // Trn + 32bit ignore data + 1 bit - 1(prescribed)
 
     DAP_SPI.data_buf[0] = 0xFFFFFFFFU;
     DAP_SPI.data_buf[1] = 0xFFFFFFFFU;
@@ -292,7 +375,7 @@ __FORCEINLINE void DAP_SPI_Protocol_Error_Write()
 {
     DAP_SPI.user.usr_mosi = 1;
     DAP_SPI.user.usr_miso = 0;
-    DAP_SPI.mosi_dlen.usr_mosi_dbitlen = 1U + 32U + 1U - 1; // 1bit Trn + 32bit ignore data + 1 bit - 1(prescribed)
+    DAP_SPI.mosi_dlen.usr_mosi_dbitlen = 32U + 1U - 1; // 32bit ignore data + 1 bit - 1(prescribed), Trn already done
 
     DAP_SPI.data_buf[0] = 0xFFFFFFFFU;
     DAP_SPI.data_buf[1] = 0xFFFFFFFFU;
@@ -302,3 +385,68 @@ __FORCEINLINE void DAP_SPI_Protocol_Error_Write()
     // Wait for sending to complete
     while (DAP_SPI.cmd.usr) continue;
 }
+
+
+/**
+ * @brief Shift JTAG bits in full duplex, TDI out and TDO in. LSB & little-endian
+ *        TMS is left to the caller, it holds for the whole shift.
+ *        Note: DAP_SPI_Init_JTAG() must have been called, and the caller holds
+ *        TCK and TDI with DAP_SPI_JTAG_Acquire() around its shifts.
+ * @param count Number of bits
+ * @param tdi TDI data, or NULL to shift ones
+ * @param tdo TDO data, or NULL. The bits past count are cleared. It may be tdi.
+ */
+void DAP_SPI_JTAG_Shift(uint32_t count, const uint8_t *tdi, uint8_t *tdo)
+{
+    uint32_t n, bytes, words, i;
+    uint32_t data_buf[16];
+    uint8_t *pData = (uint8_t *)data_buf;
+
+    DAP_SPI.user.usr_mosi = 1;
+    DAP_SPI.user.usr_miso = 1;
+
+    while (count)
+    {
+        // The 64 bytes of the buffer go out and come back in one transaction
+        n = count > 512U ? 512U : count;
+        bytes = div_round_up(n, 8);
+        words = div_round_up(bytes, 4);
+
+        if (tdi)
+        {
+            memcpy(pData, tdi, bytes);
+            tdi += bytes;
+        }
+        else
+        {
+            memset(pData, 0xFF, bytes);
+        }
+        for (i = 0; i < words; i++)
+        {
+            DAP_SPI.data_buf[i] = data_buf[i];
+        }
+
+        DAP_SPI.mosi_dlen.usr_mosi_dbitlen = n - 1U;
+        DAP_SPI.miso_dlen.usr_miso_dbitlen = n - 1U;
+
+        // Start transmission
+        DAP_SPI.cmd.usr = 1;
+        // Wait for sending to complete
+        while (DAP_SPI.cmd.usr) continue;
+
+        if (tdo)
+        {
+            for (i = 0; i < words; i++)
+            {
+                data_buf[i] = DAP_SPI.data_buf[i];
+            }
+            memcpy(tdo, pData, bytes);
+            if (n % 8U)
+            {
+                tdo[bytes - 1U] &= (1U << (n % 8U)) - 1U;
+            }
+            tdo += bytes;
+        }
+        count -= n;
+    }
+}
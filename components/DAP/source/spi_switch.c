@@ -14,6 +14,7 @@
 
 #include "components/DAP/include/cmsis_compiler.h"
 #include "components/DAP/include/spi_switch.h"
+#include "components/DAP/config/DAP_config.h"
 
 // soc register
 #include "esp32/rom/gpio.h"
@@ -25,6 +26,7 @@
 #include "esp32/include/soc/periph_defs.h"
 #include "esp32/include/soc/spi_struct.h"
 #include "esp32/include/soc/spi_reg.h"
+#include "esp32/include/soc/gpio_sig_map.h"
 
 //// FIXME: esp32
 #define DAP_SPI SPI2
@@ -42,7 +44,6 @@
 
 typedef enum {
     SPI_40MHz_DIV = 2,
-    // SPI_80MHz_DIV = 1, //// FIXME: high speed clock
 } spi_clk_div_t;
 
 
@@ -157,6 +158,52 @@ void DAP_SPI_Init()
 }
 
 
+/**
+ * @brief Initialize for the JTAG shifts of DAP_SPI_JTAG_Shift()
+ * TCK and TMS stay on GPIO, TCK and TDI only go to the SPI during a scan.
+ * The SPI runs in full duplex, MOSI to TDI and TDO to MISO through the GPIO matrix.
+ */
+void DAP_SPI_Init_JTAG()
+{
+    // DAP_SPI_Init() clears TCK and TMS, keep their levels for the TAP
+    uint32_t out = GPIO.out & ((0x1 << 13) | (0x1 << 14));
+
+    DAP_SPI_Init();
+    GPIO.out_w1ts = out;
+    DAP_SPI_Deinit();
+
+    DAP_SPI.user.doutdin = true;  // full duplex
+
+    GPIO.func_in_sel_cfg[HSPIQ_IN_IDX].func_sel = PIN_TDO;
+    GPIO.func_in_sel_cfg[HSPIQ_IN_IDX].sig_in_sel = 1;   // through the GPIO matrix
+    GPIO.func_out_sel_cfg[PIN_TDI].oen_sel = 1;          // TDI output enable stays with the GPIO
+}
+
+
+/**
+ * @brief Set the SPI clock to APB / ((clkdiv_pre + 1) * (clkcnt_n + 1)), see dap_clock.c
+ *
+ * @param clkdiv_pre Prescaler, 0 ~ 8191
+ * @param clkcnt_n Divider, 1 ~ 63, or 0 with clkdiv_pre 0 for the APB clock itself
+ */
+void DAP_SPI_Set_Clock(uint16_t clkdiv_pre, uint8_t clkcnt_n)
+{
+    if (clkdiv_pre == 0 && clkcnt_n == 0)
+    {
+        DAP_SPI.clock.val = 0;
+        DAP_SPI.clock.clk_equ_sysclk = true;
+        return;
+    }
+
+    // See esp32 TRM `SPI_CLOCK_REG`, high for the first half of the period
+    DAP_SPI.clock.clk_equ_sysclk = false;
+    DAP_SPI.clock.clkdiv_pre = clkdiv_pre;
+    DAP_SPI.clock.clkcnt_n = clkcnt_n;
+    DAP_SPI.clock.clkcnt_h = (clkcnt_n + 1) / 2 - 1;
+    DAP_SPI.clock.clkcnt_l = clkcnt_n;
+}
+
+
 /**
  * @brief Switch to GPIO
  * Note: You may be able to pull the pin high in SPI mode, though you cannot set it to LOW
@@ -206,6 +253,29 @@ __FORCEINLINE void DAP_SPI_Release()
 }
 
 
+/**
+ * @brief Gain control of TCK and TDI for the shifts of a JTAG scan or sequence
+ *
+ */
+__FORCEINLINE void DAP_SPI_JTAG_Acquire()
+{
+    PIN_FUNC_SELECT(IO_MUX_GPIO14_REG, FUNC_SPI);
+    GPIO.func_out_sel_cfg[PIN_TDI].func_sel = HSPID_OUT_IDX;
+}
+
+
+/**
+ * @brief Give TCK and TDI back to the GPIO after a JTAG scan or sequence
+ *
+ */
+__FORCEINLINE void DAP_SPI_JTAG_Release()
+{
+    GPIO.func_out_sel_cfg[PIN_TDI].func_sel = SIG_GPIO_OUT_IDX;
+    PIN_FUNC_SELECT(GPIO_PIN_MUX_REG[14], PIN_FUNC_GPIO);
+    GPIO.enable_w1ts = (0x01 << 14);
+}
+
+
 /**
  * @brief Use SPI acclerate
  *
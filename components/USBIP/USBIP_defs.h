@@ -48,6 +48,13 @@ enum usbip_stage2_direction
     USBIP_DIR_IN = 0x01,
 };
 
+// Linux errno values used in the status field of ret_submit / ret_unlink
+enum usbip_stage2_status
+{
+    USBIP_EPIPE = 32,
+    USBIP_ECONNRESET = 104,
+};
+
 typedef struct
 {
     uint16_t version;
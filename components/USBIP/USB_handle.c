@@ -20,6 +20,8 @@
 #include "components/USBIP/MSOS20_descriptor.h"
 
 #include "main/usbip_server.h"
+#include "main/tcp_server.h"
+#include "components/DAP/include/dap_log.h"
 
 
 
@@ -43,27 +45,27 @@ void handleUSBControlRequest(usbip_stage2_header *header)
         switch (header->u.cmd_submit.request.bRequest)
         {
         case USB_REQ_CLEAR_FEATURE:
-            printf("* CLEAR FEATURE\r\n");
+            DAP_LOGD("* CLEAR FEATURE\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         case USB_REQ_SET_FEATURE:
-            printf("* SET FEATURE\r\n");
+            DAP_LOGD("* SET FEATURE\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         case USB_REQ_SET_ADDRESS:
-            printf("* SET ADDRESS\r\n");
+            DAP_LOGD("* SET ADDRESS\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         case USB_REQ_SET_DESCRIPTOR:
-            printf("* SET DESCRIPTOR\r\n");
+            DAP_LOGD("* SET DESCRIPTOR\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         case USB_REQ_SET_CONFIGURATION:
-            printf("* SET CONFIGURATION\r\n");
+            DAP_LOGD("* SET CONFIGURATION\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         default:
-            printf("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
+            DAP_LOGW("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
                       header->u.cmd_submit.request.bmRequestType, header->u.cmd_submit.request.bRequest);
             break;
         }
@@ -72,20 +74,20 @@ void handleUSBControlRequest(usbip_stage2_header *header)
         switch (header->u.cmd_submit.request.bRequest)
         {
         case USB_REQ_CLEAR_FEATURE:
-            printf("* CLEAR FEATURE\r\n");
+            DAP_LOGD("* CLEAR FEATURE\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         case USB_REQ_SET_FEATURE:
-            printf("* SET FEATURE\r\n");
+            DAP_LOGD("* SET FEATURE\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         case USB_REQ_SET_INTERFACE:
-            printf("* SET INTERFACE\r\n");
+            DAP_LOGD("* SET INTERFACE\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
 
         default:
-            printf("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
+            DAP_LOGW("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
                       header->u.cmd_submit.request.bmRequestType, header->u.cmd_submit.request.bRequest);
             break;
         }
@@ -94,16 +96,16 @@ void handleUSBControlRequest(usbip_stage2_header *header)
         switch (header->u.cmd_submit.request.bRequest)
         {
         case USB_REQ_CLEAR_FEATURE:
-            printf("* CLEAR FEATURE\r\n");
+            DAP_LOGD("* CLEAR FEATURE\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         case USB_REQ_SET_FEATURE:
-            printf("* SET INTERFACE\r\n");
+            DAP_LOGD("* SET INTERFACE\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
 
         default:
-            printf("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
+            DAP_LOGW("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
                       header->u.cmd_submit.request.bmRequestType, header->u.cmd_submit.request.bRequest);
             break;
         }
@@ -117,18 +119,18 @@ void handleUSBControlRequest(usbip_stage2_header *header)
         switch (header->u.cmd_submit.request.bRequest)
         {
         case USB_REQ_GET_CONFIGURATION:
-            printf("* GET CONIFGTRATION\r\n");
+            DAP_LOGD("* GET CONIFGTRATION\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         case USB_REQ_GET_DESCRIPTOR:
             handleGetDescriptor(header); ////TODO: device_qualifier
             break;
         case USB_REQ_GET_STATUS:
-            printf("* GET STATUS\r\n");
+            DAP_LOGD("* GET STATUS\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         default:
-            printf("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
+            DAP_LOGW("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
                       header->u.cmd_submit.request.bmRequestType, header->u.cmd_submit.request.bRequest);
             break;
         }
@@ -139,20 +141,20 @@ void handleUSBControlRequest(usbip_stage2_header *header)
         switch (header->u.cmd_submit.request.bRequest)
         {
         case USB_REQ_GET_INTERFACE:
-            printf("* GET INTERFACE\r\n");
+            DAP_LOGD("* GET INTERFACE\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         case USB_REQ_SET_SYNCH_FRAME:
-            printf("* SET SYNCH FRAME\r\n");
+            DAP_LOGD("* SET SYNCH FRAME\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
         case USB_REQ_GET_STATUS:
-            printf("* GET STATUS\r\n");
+            DAP_LOGD("* GET STATUS\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
 
         default:
-            printf("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
+            DAP_LOGW("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
                       header->u.cmd_submit.request.bmRequestType, header->u.cmd_submit.request.bRequest);
             break;
         }
@@ -162,34 +164,35 @@ void handleUSBControlRequest(usbip_stage2_header *header)
         switch (header->u.cmd_submit.request.bRequest)
         {
         case USB_REQ_GET_STATUS:
-            printf("* GET STATUS\r\n");
+            DAP_LOGD("* GET STATUS\r\n");
             send_stage2_submit_data(header, 0, 0, 0);
             break;
 
         default:
-            printf("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
+            DAP_LOGW("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
                       header->u.cmd_submit.request.bmRequestType, header->u.cmd_submit.request.bRequest);
             break;
         }
         break;
     case 0xC0: // Microsoft OS 2.0 vendor-specific descriptor
     {
-        uint16_t *wIndex = (uint16_t *)(&(header->u.cmd_submit.request.wIndex));
-        switch (*wIndex)
+        // by value: a pointer to the packed member may be misaligned
+        uint16_t wIndex = header->u.cmd_submit.request.wIndex.u16;
+        switch (wIndex)
         {
         case MS_OS_20_DESCRIPTOR_INDEX:
-            printf("* GET MSOS 2.0 vendor-specific descriptor\r\n");
+            DAP_LOGD("* GET MSOS 2.0 vendor-specific descriptor\r\n");
             send_stage2_submit_data(header, 0, msOs20DescriptorSetHeader, sizeof(msOs20DescriptorSetHeader));
             break;
         case MS_OS_20_SET_ALT_ENUMERATION:
             // set alternate enumeration command
             // bAltEnumCode set to 0
-            printf("Set alternate enumeration.This should not happen.\r\n");
+            DAP_LOGW("Set alternate enumeration.This should not happen.\r\n");
             break;
 
         default:
-            printf("USB unknown request, bmRequestType:%d,bRequest:%d,wIndex:%d\r\n",
-                      header->u.cmd_submit.request.bmRequestType, header->u.cmd_submit.request.bRequest, *wIndex);
+            DAP_LOGW("USB unknown request, bmRequestType:%d,bRequest:%d,wIndex:%d\r\n",
+                      header->u.cmd_submit.request.bmRequestType, header->u.cmd_submit.request.bRequest, wIndex);
             break;
         }
         break;
@@ -198,18 +201,18 @@ void handleUSBControlRequest(usbip_stage2_header *header)
         switch (header->u.cmd_submit.request.bRequest)
         {
         case USB_REQ_SET_IDLE:
-            printf("* SET IDLE\r\n");
+            DAP_LOGD("* SET IDLE\r\n");
             send_stage2_submit(header, 0, 0);
             break;
 
         default:
-            printf("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
+            DAP_LOGW("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
                       header->u.cmd_submit.request.bmRequestType, header->u.cmd_submit.request.bRequest);
             break;
         }
         break;
     default:
-        printf("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
+        DAP_LOGW("USB unknown request, bmRequestType:%d,bRequest:%d\r\n",
                   header->u.cmd_submit.request.bmRequestType, header->u.cmd_submit.request.bRequest);
         break;
     }
@@ -221,26 +224,28 @@ static void handleGetDescriptor(usbip_stage2_header *header)
     switch (header->u.cmd_submit.request.wValue.u8hi)
     {
     case USB_DT_DEVICE: // get device descriptor
-        printf("* GET 0x01 DEVICE DESCRIPTOR\r\n");
+        DAP_LOGD("* GET 0x01 DEVICE DESCRIPTOR\r\n");
         send_stage2_submit_data(header, 0, &kUSBd0DeviceDescriptor[0], sizeof(kUSBd0DeviceDescriptor));
         break;
 
     case USB_DT_CONFIGURATION: // get configuration descriptor
-        printf("* GET 0x02 CONFIGURATION DESCRIPTOR\r\n");
+        DAP_LOGD("* GET 0x02 CONFIGURATION DESCRIPTOR\r\n");
         ////TODO: ?
         if (header->u.cmd_submit.data_length == USB_DT_CONFIGURATION_SIZE)
         {
-            printf("Sending only first part of CONFIG\r\n");
+            DAP_LOGD("Sending only first part of CONFIG\r\n");
 
             send_stage2_submit(header, 0, header->u.cmd_submit.data_length);
-            send(kSock, kUSBd0ConfigDescriptor, sizeof(kUSBd0ConfigDescriptor), 0);
+            flush_usbip_tx();
+            usbip_network_send(kUSBd0ConfigDescriptor, sizeof(kUSBd0ConfigDescriptor));
         }
         else
         {
-            printf("Sending ALL CONFIG\r\n");
+            DAP_LOGD("Sending ALL CONFIG\r\n");
             send_stage2_submit(header, 0, sizeof(kUSBd0ConfigDescriptor) + sizeof(kUSBd0InterfaceDescriptor));
-            send(kSock, kUSBd0ConfigDescriptor, sizeof(kUSBd0ConfigDescriptor), 0);
-            send(kSock, kUSBd0InterfaceDescriptor, sizeof(kUSBd0InterfaceDescriptor), 0);
+            flush_usbip_tx();
+            usbip_network_send(kUSBd0ConfigDescriptor, sizeof(kUSBd0ConfigDescriptor));
+            usbip_network_send(kUSBd0InterfaceDescriptor, sizeof(kUSBd0InterfaceDescriptor));
         }
         break;
 
@@ -249,7 +254,7 @@ static void handleGetDescriptor(usbip_stage2_header *header)
 
         if (header->u.cmd_submit.request.wValue.u8lo == 0)
         {
-            printf("** REQUESTED list of supported languages\r\n");
+            DAP_LOGD("** REQUESTED list of supported languages\r\n");
             send_stage2_submit_data(header, 0, kLangDescriptor, sizeof(kLangDescriptor));
         }
         else if (header->u.cmd_submit.request.wValue.u8lo != 0xee)
@@ -272,27 +277,27 @@ static void handleGetDescriptor(usbip_stage2_header *header)
         }
         else
         {
-            printf("low bit : %d\r\n", (int)header->u.cmd_submit.request.wValue.u8lo);
-            printf("high bit : %d\r\n", (int)header->u.cmd_submit.request.wValue.u8hi);
-            printf("***Unsupported String descriptor***\r\n");
+            DAP_LOGD("low bit : %d\r\n", (int)header->u.cmd_submit.request.wValue.u8lo);
+            DAP_LOGD("high bit : %d\r\n", (int)header->u.cmd_submit.request.wValue.u8hi);
+            DAP_LOGW("***Unsupported String descriptor***\r\n");
             send_stage2_submit(header, 0, 0);
         }
         break;
 
     case USB_DT_INTERFACE:
-        printf("* GET 0x04 INTERFACE DESCRIPTOR (UNIMPLEMENTED)\r\n");
+        DAP_LOGW("* GET 0x04 INTERFACE DESCRIPTOR (UNIMPLEMENTED)\r\n");
         ////TODO:UNIMPLEMENTED
         send_stage2_submit(header, 0, 0);
         break;
 
     case USB_DT_ENDPOINT:
-        printf("* GET 0x05 ENDPOINT DESCRIPTOR (UNIMPLEMENTED)\r\n");
+        DAP_LOGW("* GET 0x05 ENDPOINT DESCRIPTOR (UNIMPLEMENTED)\r\n");
         ////TODO:UNIMPLEMENTED
         send_stage2_submit(header, 0, 0);
         break;
 
     case USB_DT_DEVICE_QUALIFIER:
-        printf("* GET 0x06 DEVICE QUALIFIER DESCRIPTOR\r\n");
+        DAP_LOGD("* GET 0x06 DEVICE QUALIFIER DESCRIPTOR\r\n");
 
         usb_device_qualifier_descriptor desc;
 
@@ -302,32 +307,32 @@ static void handleGetDescriptor(usbip_stage2_header *header)
         break;
 
     case USB_DT_OTHER_SPEED_CONFIGURATION:
-        printf("GET 0x07 [UNIMPLEMENTED] USB_DT_OTHER_SPEED_CONFIGURATION\r\n");
+        DAP_LOGW("GET 0x07 [UNIMPLEMENTED] USB_DT_OTHER_SPEED_CONFIGURATION\r\n");
         ////TODO:UNIMPLEMENTED
         send_stage2_submit(header, 0, 0);
         break;
 
     case USB_DT_INTERFACE_POWER:
-        printf("GET 0x08 [UNIMPLEMENTED] USB_DT_INTERFACE_POWER\r\n");
+        DAP_LOGW("GET 0x08 [UNIMPLEMENTED] USB_DT_INTERFACE_POWER\r\n");
         ////TODO:UNIMPLEMENTED
         send_stage2_submit(header, 0, 0);
         break;
 #if (USE_WINUSB == 1)
     case USB_DT_BOS:
-        printf("* GET 0x0F BOS DESCRIPTOR\r\n");
+        DAP_LOGD("* GET 0x0F BOS DESCRIPTOR\r\n");
         send_stage2_submit_data(header, 0, bosDescriptor, sizeof(bosDescriptor));
         break;
 #else
     case USB_DT_HID_REPORT:
-        printf("* GET 0x22 HID REPORT DESCRIPTOR\r\n");
+        DAP_LOGD("* GET 0x22 HID REPORT DESCRIPTOR\r\n");
         send_stage2_submit_data(header, 0, (void *)kHidReportDescriptor, sizeof(kHidReportDescriptor));
         break;
 #endif
     default:
         //// TODO: ms os 1.0 descriptor
-        printf("USB unknown Get Descriptor requested:%d\r\n", header->u.cmd_submit.request.wValue.u8lo);
-        printf("low bit :%d\r\n",header->u.cmd_submit.request.wValue.u8lo);
-        printf("high bit :%d\r\n",header->u.cmd_submit.request.wValue.u8hi);
+        DAP_LOGW("USB unknown Get Descriptor requested:%d\r\n", header->u.cmd_submit.request.wValue.u8lo);
+        DAP_LOGD("low bit :%d\r\n",header->u.cmd_submit.request.wValue.u8lo);
+        DAP_LOGD("high bit :%d\r\n",header->u.cmd_submit.request.wValue.u8hi);
         break;
     }
 }
@@ -0,0 +1,44 @@
+/**
+ * @file dap_bench_main.c
+ * @brief Runs the DAP command matrix of dap_bench.c against the target model
+ *
+ *   dap_bench [iterations] > dap_bench.csv
+ *
+ * @version 0.1
+ * @date 2022-08-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_hal.h"
+#include "components/DAP/include/dap_bench.h"
+
+#include "host/target_sim.h"
+
+#define DAP_BENCH_DEFAULT_ITERATIONS 100
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = DAP_BENCH_DEFAULT_ITERATIONS;
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 2;
+    }
+    if (argc == 2)
+    {
+        iterations = strtoul(argv[1], NULL, 0);
+    }
+
+    target_sim_init(NULL);
+    dap_hal_set(&kTargetSimHal);
+    DAP_Setup();
+
+    dap_bench_run(iterations);
+    return 0;
+}
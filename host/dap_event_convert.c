@@ -0,0 +1,356 @@
+/**
+ * @file dap_event_convert.c
+ * @brief Converts a dump of the event rings of dap_event.h to a Chrome trace
+ *
+ *   dap_event_convert events.bin > trace.json
+ *
+ * The trace opens in chrome://tracing or https://ui.perfetto.dev. Each core
+ * is a process, with a track for the USBIP receive path, DAP_Thread, the
+ * reply task and the TCP writes. A flow arrow goes from each command being
+ * queued to DAP_Thread starting it, which is where the two cores hand over.
+ *
+ * @version 0.1
+ * @date 2022-08-15
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_event.h"
+
+#define CONVERT_STACK_DEPTH 16
+
+typedef enum
+{
+    TRACK_RX = 1,
+    TRACK_DAP,
+    TRACK_REPLY,
+    TRACK_SEND,
+    TRACK_NUM,
+} convert_track_t;
+
+static const char *const kTrackName[TRACK_NUM] = {
+    [TRACK_RX] = "transport rx",
+    [TRACK_DAP] = "DAP_Thread",
+    [TRACK_REPLY] = "DAP_Reply",
+    [TRACK_SEND] = "network write",
+};
+
+static const convert_track_t kEventTrack[DAP_EVENT_TYPE_NUM] = {
+    [DAP_EVENT_SYNC] = TRACK_RX,
+    [DAP_EVENT_RECV] = TRACK_RX,
+    [DAP_EVENT_QUEUE_PUSH] = TRACK_RX,
+    [DAP_EVENT_QUEUE_POP] = TRACK_DAP,
+    [DAP_EVENT_EXECUTE] = TRACK_DAP,
+    [DAP_EVENT_COMMAND] = TRACK_DAP,
+    [DAP_EVENT_SWD_TRANSFER] = TRACK_DAP,
+    [DAP_EVENT_REPLY] = TRACK_REPLY,
+    [DAP_EVENT_SEND] = TRACK_SEND,
+};
+
+static const char *const kEventName[DAP_EVENT_TYPE_NUM] = {
+    [DAP_EVENT_SYNC] = "sync",
+    [DAP_EVENT_RECV] = "recv",
+    [DAP_EVENT_QUEUE_PUSH] = "queue push",
+    [DAP_EVENT_QUEUE_POP] = "queue pop",
+    [DAP_EVENT_EXECUTE] = "execute",
+    [DAP_EVENT_COMMAND] = "command",
+    [DAP_EVENT_SWD_TRANSFER] = "SWD transfer",
+    [DAP_EVENT_REPLY] = "reply",
+    [DAP_EVENT_SEND] = "send",
+};
+
+static const char *const kCommandName[0x20] = {
+    [ID_DAP_Info] = "DAP_Info",
+    [ID_DAP_HostStatus] = "DAP_HostStatus",
+    [ID_DAP_Connect] = "DAP_Connect",
+    [ID_DAP_Disconnect] = "DAP_Disconnect",
+    [ID_DAP_TransferConfigure] = "DAP_TransferConfigure",
+    [ID_DAP_Transfer] = "DAP_Transfer",
+    [ID_DAP_TransferBlock] = "DAP_TransferBlock",
+    [ID_DAP_TransferAbort] = "DAP_TransferAbort",
+    [ID_DAP_WriteABORT] = "DAP_WriteABORT",
+    [ID_DAP_Delay] = "DAP_Delay",
+    [ID_DAP_ResetTarget] = "DAP_ResetTarget",
+    [ID_DAP_SWJ_Pins] = "DAP_SWJ_Pins",
+    [ID_DAP_SWJ_Clock] = "DAP_SWJ_Clock",
+    [ID_DAP_SWJ_Sequence] = "DAP_SWJ_Sequence",
+    [ID_DAP_SWD_Configure] = "DAP_SWD_Configure",
+    [ID_DAP_SWD_Sequence] = "DAP_SWD_Sequence",
+    [ID_DAP_JTAG_Sequence] = "DAP_JTAG_Sequence",
+    [ID_DAP_JTAG_Configure] = "DAP_JTAG_Configure",
+    [ID_DAP_JTAG_IDCODE] = "DAP_JTAG_IDCODE",
+    [ID_DAP_SWO_Transport] = "DAP_SWO_Transport",
+    [ID_DAP_SWO_Mode] = "DAP_SWO_Mode",
+    [ID_DAP_SWO_Baudrate] = "DAP_SWO_Baudrate",
+    [ID_DAP_SWO_Control] = "DAP_SWO_Control",
+    [ID_DAP_SWO_Status] = "DAP_SWO_Status",
+    [ID_DAP_SWO_ExtendedStatus] = "DAP_SWO_ExtendedStatus",
+    [ID_DAP_SWO_Data] = "DAP_SWO_Data",
+};
+
+typedef struct
+{
+    uint8_t type;
+    uint32_t arg;
+    double ts; // us
+} convert_open_t;
+
+typedef struct
+{
+    convert_open_t open[CONVERT_STACK_DEPTH];
+    uint32_t depth;
+} convert_stack_t;
+
+static int first_event = 1;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s events.bin > trace.json\n", name);
+}
+
+static void emit_begin(void)
+{
+    printf(first_event ? "\n" : ",\n");
+    first_event = 0;
+}
+
+static const char *command_name(uint32_t id, char *buf, size_t size)
+{
+    if (id < 0x20 && kCommandName[id] != NULL)
+    {
+        return kCommandName[id];
+    }
+    snprintf(buf, size, "DAP 0x%02X", (unsigned)id);
+    return buf;
+}
+
+static void emit_complete(uint32_t core, convert_track_t track, const convert_open_t *open, double end,
+                          uint32_t end_arg)
+{
+    char name[32];
+
+    emit_begin();
+    switch (open->type)
+    {
+    case DAP_EVENT_COMMAND:
+        printf("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+               command_name(open->arg, name, sizeof(name)), (unsigned)core, (unsigned)track, open->ts, end - open->ts);
+        break;
+    case DAP_EVENT_SWD_TRANSFER:
+        printf("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+               "\"args\":{\"request\":\"0x%02X\",\"engine\":%u,\"ack\":%u}}",
+               kEventName[open->type], (unsigned)core, (unsigned)track, open->ts, end - open->ts,
+               (unsigned)(open->arg & 0xFF), (unsigned)(open->arg >> 8), (unsigned)end_arg);
+        break;
+    default:
+        printf("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":%u}}",
+               kEventName[open->type], (unsigned)core, (unsigned)track, open->ts, end - open->ts,
+               (unsigned)open->arg);
+        break;
+    }
+}
+
+/**
+ * @brief Convert the events of a ring
+ *
+ * @param time Filled with the time of each event in us, from the SYNC events
+ * @return 0 on success, -1 if the ring has no SYNC event
+ */
+static int convert_ring(uint32_t core, const dap_event_t *event, uint32_t count, uint32_t cpu_hz, double *time)
+{
+    convert_stack_t stack[TRACK_NUM];
+    double ticks_per_us = cpu_hz / 1e6;
+    uint64_t sync_us = 0;
+    uint32_t last_sync_us = 0;
+    int64_t sync = -1;
+    convert_track_t track;
+    convert_open_t *open;
+    uint32_t i;
+    int first_sync = 1;
+
+    // the time of each event from the closest SYNC before it, or the first one after it
+    for (i = 0; i < count; i++)
+    {
+        if (event[i].type != DAP_EVENT_SYNC)
+        {
+            continue;
+        }
+        // the esp_timer time of the SYNC events wraps every 71 minutes
+        if (!first_sync && event[i].arg < last_sync_us)
+        {
+            sync_us += 1ULL << 32;
+        }
+        first_sync = 0;
+        last_sync_us = event[i].arg;
+
+        if (sync < 0)
+        {
+            uint32_t j;
+
+            for (j = 0; j < i; j++)
+            {
+                time[j] = sync_us + event[i].arg + (int32_t)(event[j].timestamp - event[i].timestamp) / ticks_per_us;
+            }
+        }
+        sync = i;
+        time[i] = sync_us + event[i].arg;
+    }
+    if (sync < 0)
+    {
+        return -1;
+    }
+    sync = -1;
+    for (i = 0; i < count; i++)
+    {
+        if (event[i].type == DAP_EVENT_SYNC)
+        {
+            sync = i;
+        }
+        else if (sync >= 0)
+        {
+            time[i] = time[sync] + (int32_t)(event[i].timestamp - event[sync].timestamp) / ticks_per_us;
+        }
+    }
+
+    memset(stack, 0, sizeof(stack));
+    for (i = 0; i < count; i++)
+    {
+        if (event[i].type >= DAP_EVENT_TYPE_NUM || event[i].phase > DAP_EVENT_END)
+        {
+            continue; // torn by the dump
+        }
+        if (event[i].type == DAP_EVENT_SYNC)
+        {
+            continue;
+        }
+        track = kEventTrack[event[i].type];
+
+        switch (event[i].phase)
+        {
+        case DAP_EVENT_INSTANT:
+            emit_begin();
+            printf("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"args\":{\"arg\":%u}}",
+                   kEventName[event[i].type], (unsigned)core, (unsigned)track, time[i], (unsigned)event[i].arg);
+            if (event[i].type == DAP_EVENT_QUEUE_PUSH)
+            {
+                // handed over to DAP_Thread, the flow ends at its execute
+                emit_begin();
+                printf("{\"name\":\"handoff\",\"cat\":\"dap\",\"ph\":\"s\",\"id\":%u,\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+                       (unsigned)event[i].arg, (unsigned)core, (unsigned)track, time[i]);
+            }
+            break;
+
+        case DAP_EVENT_BEGIN:
+            if (stack[track].depth < CONVERT_STACK_DEPTH)
+            {
+                open = &stack[track].open[stack[track].depth++];
+                open->type = event[i].type;
+                open->arg = event[i].arg;
+                open->ts = time[i];
+            }
+            if (event[i].type == DAP_EVENT_EXECUTE)
+            {
+                emit_begin();
+                printf("{\"name\":\"handoff\",\"cat\":\"dap\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%u,\"pid\":%u,\"tid\":%u,\"ts\":%.3f}",
+                       (unsigned)event[i].arg, (unsigned)core, (unsigned)track, time[i]);
+            }
+            break;
+
+        case DAP_EVENT_END:
+            // close the slice it ends, an unmatched end is from before the ring
+            while (stack[track].depth > 0)
+            {
+                open = &stack[track].open[--stack[track].depth];
+                if (open->type == event[i].type)
+                {
+                    emit_complete(core, track, open, time[i], event[i].arg);
+                    break;
+                }
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    dap_event_dump_header header;
+    dap_event_ring_header ring;
+    dap_event_t *event;
+    double *time;
+    FILE *file;
+    uint32_t core, track;
+
+    if (argc != 2)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Unable to open %s\n", argv[1]);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != DAP_EVENT_MAGIC ||
+        header.version != DAP_EVENT_VERSION || header.cpu_hz == 0)
+    {
+        fprintf(stderr, "%s is not an event dump\n", argv[1]);
+        return 1;
+    }
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (core = 0; core < header.ring_count; core++)
+    {
+        if (fread(&ring, sizeof(ring), 1, file) != 1)
+        {
+            fprintf(stderr, "Truncated dump\n");
+            return 1;
+        }
+
+        emit_begin();
+        printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"core %u\"}}",
+               (unsigned)ring.core, (unsigned)ring.core);
+        for (track = 1; track < TRACK_NUM; track++)
+        {
+            emit_begin();
+            printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                   (unsigned)ring.core, (unsigned)track, kTrackName[track]);
+        }
+
+        if (ring.count == 0)
+        {
+            continue;
+        }
+        event = malloc(ring.count * sizeof(dap_event_t));
+        time = malloc(ring.count * sizeof(double));
+        if (event == NULL || time == NULL || fread(event, sizeof(dap_event_t), ring.count, file) != ring.count)
+        {
+            fprintf(stderr, "Truncated dump\n");
+            return 1;
+        }
+        if (convert_ring(ring.core, event, ring.count, header.cpu_hz, time) < 0)
+        {
+            fprintf(stderr, "Core %u has no SYNC event, skipped\n", (unsigned)ring.core);
+        }
+        if (ring.dropped > 0)
+        {
+            fprintf(stderr, "Core %u: %u older events were overwritten\n", (unsigned)ring.core,
+                    (unsigned)ring.dropped);
+        }
+        free(event);
+        free(time);
+    }
+    printf("\n]}\n");
+
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file dap_hal.c
+ * @brief Default HAL of the host build, no target is attached
+ *
+ * SWDIO and TDO read as 1, as on a floating line with the pull-up of the
+ * target, so every SWD transfer ends with a protocol error.
+ *
+ * @version 0.1
+ * @date 2022-08-08
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "components/DAP/config/DAP_config.h"
+#include "components/DAP/include/dap_hal.h"
+
+static void dap_hal_null_port_setup(uint32_t port)
+{
+    (void)port;
+}
+
+static void dap_hal_null_out(uint32_t bit)
+{
+    (void)bit;
+}
+
+static uint32_t dap_hal_null_in(void)
+{
+    return 1;
+}
+
+static uint32_t dap_hal_host_timestamp_get(void)
+{
+    struct timespec ts;
+    uint64_t ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ns = (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+    return (uint32_t)(ns / (1000000000U / TIMESTAMP_CLOCK));
+}
+
+static const dap_hal_t dap_hal_null = {
+    .port_setup = dap_hal_null_port_setup,
+    .swclk_tck_out = dap_hal_null_out,
+    .swdio_tms_out = dap_hal_null_out,
+    .swdio_tms_in = dap_hal_null_in,
+    .swdio_out_enable = dap_hal_null_out,
+    .tdi_out = dap_hal_null_out,
+    .tdo_in = dap_hal_null_in,
+    .ntrst_out = dap_hal_null_out,
+    .nreset_out = dap_hal_null_out,
+    .nreset_in = dap_hal_null_in,
+    .timestamp_get = dap_hal_host_timestamp_get,
+};
+
+const dap_hal_t *kDAPHal = &dap_hal_null;
+
+
+void dap_hal_set(const dap_hal_t *hal)
+{
+    kDAPHal = (hal != NULL) ? hal : &dap_hal_null;
+}
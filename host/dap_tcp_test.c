@@ -0,0 +1,229 @@
+/**
+ * @file dap_tcp_test.c
+ * @brief Host test of main/dap_tcp_server.c on the loopback interface
+ *
+ * Sends length-prefixed DAP commands and checks that:
+ *       - more commands than the packet count, sent at once, are answered
+ *         in order
+ *       - DAP_TransferAbort gets through a window full of commands stuck in
+ *         WAIT retries, and ends them one by one
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "components/DAP/include/DAP.h"
+#include "main/wifi_configuration.h"
+#include "main/dap_tcp_server.h"
+
+#include "host/dap_test.h"
+#include "host/target_sim.h"
+
+#define DAP_TCP_TEST_HEADER_SIZE 2
+#define DAP_TCP_TEST_TIMEOUT_MS 2000
+#define DAP_TCP_TEST_PIPELINE (DAP_PACKET_WINDOW * 3)
+#define DAP_TCP_TEST_WAIT_RETRY 0xFFFF
+#define DAP_TCP_TEST_ABORT_POLL_MS 2
+// As many as the host may have in flight, see DAP_ID_PACKET_COUNT
+#define DAP_TCP_TEST_STUCK DAP_PACKET_WINDOW
+
+static int dap_tcp_test_fd = -1;
+
+static void dap_tcp_test_connect()
+{
+    struct sockaddr_in addr;
+    struct timeval timeout = {DAP_TCP_TEST_TIMEOUT_MS / 1000, (DAP_TCP_TEST_TIMEOUT_MS % 1000) * 1000};
+    uint64_t deadline = dap_test_now_ms() + DAP_TCP_TEST_TIMEOUT_MS;
+    int flag = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(DAP_TCP_PORT);
+
+    // the server may not be listening yet
+    for (;;)
+    {
+        dap_tcp_test_fd = socket(AF_INET, SOCK_STREAM, 0);
+        DAP_TEST_CHECK(dap_tcp_test_fd >= 0);
+        if (connect(dap_tcp_test_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            break;
+        }
+        close(dap_tcp_test_fd);
+        DAP_TEST_CHECK(dap_test_now_ms() < deadline);
+        usleep(10000);
+    }
+    setsockopt(dap_tcp_test_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    setsockopt(dap_tcp_test_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+static void dap_tcp_test_read(uint8_t *data, size_t length)
+{
+    ssize_t ret;
+
+    while (length > 0)
+    {
+        ret = recv(dap_tcp_test_fd, data, length, 0);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        DAP_TEST_CHECK(ret > 0);
+        data += ret;
+        length -= ret;
+    }
+}
+
+static size_t dap_tcp_test_build(uint8_t *packet, const uint8_t *request, uint32_t length)
+{
+    packet[0] = length & 0xFF;
+    packet[1] = length >> 8;
+    memcpy(&packet[DAP_TCP_TEST_HEADER_SIZE], request, length);
+    return DAP_TCP_TEST_HEADER_SIZE + length;
+}
+
+static void dap_tcp_test_write(const uint8_t *data, size_t length)
+{
+    DAP_TEST_CHECK(send(dap_tcp_test_fd, data, length, MSG_NOSIGNAL) == (ssize_t)length);
+}
+
+static int dap_tcp_test_response(uint8_t *response)
+{
+    uint8_t header[DAP_TCP_TEST_HEADER_SIZE];
+    int length;
+
+    dap_tcp_test_read(header, sizeof(header));
+    length = header[0] | (header[1] << 8);
+    DAP_TEST_CHECK(length > 0 && length <= (int)DAP_PACKET_SIZE);
+    dap_tcp_test_read(response, length);
+    return length;
+}
+
+static int dap_tcp_test_command(const uint8_t *request, uint32_t length, uint8_t *response)
+{
+    uint8_t packet[DAP_TCP_TEST_HEADER_SIZE + DAP_PACKET_SIZE];
+
+    dap_tcp_test_write(packet, dap_tcp_test_build(packet, request, length));
+    return dap_tcp_test_response(response);
+}
+
+static uint32_t dap_tcp_test_word(uint32_t index)
+{
+    return 0x5A000000 | (index * 0x10203);
+}
+
+/**
+ * @brief Read back words put in the RAM, one command each, all sent at once
+ *
+ */
+static void dap_tcp_test_pipeline()
+{
+    static uint8_t packets[DAP_TCP_TEST_PIPELINE * 8];
+    const uint8_t tar[] = {ID_DAP_Transfer, 0, 1, DAP_TRANSFER_APnDP | DAP_TEST_AP_TAR, 0x00, 0x00, 0x00, 0x20};
+    const uint8_t read[] = {ID_DAP_Transfer, 0, 1, DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TEST_AP_DRW};
+    uint8_t response[DAP_PACKET_SIZE];
+    uint8_t *ram = target_sim_memory();
+    size_t length = 0;
+    uint32_t value, i;
+
+    for (i = 0; i < DAP_TCP_TEST_PIPELINE; i++)
+    {
+        value = dap_tcp_test_word(i);
+        memcpy(&ram[i * 4], &value, 4);
+        length += dap_tcp_test_build(&packets[length], read, sizeof(read));
+    }
+    DAP_TEST_CHECK(dap_tcp_test_command(tar, sizeof(tar), response) == 3 && response[2] == DAP_TRANSFER_OK);
+
+    dap_tcp_test_write(packets, length);
+    for (i = 0; i < DAP_TCP_TEST_PIPELINE; i++)
+    {
+        DAP_TEST_CHECK(dap_tcp_test_response(response) == 7);
+        DAP_TEST_CHECK(response[0] == ID_DAP_Transfer && response[1] == 1 && response[2] == DAP_TRANSFER_OK);
+        value = response[3] | (response[4] << 8) | (response[5] << 16) | ((uint32_t)response[6] << 24);
+        DAP_TEST_CHECK(value == dap_tcp_test_word(i));
+    }
+}
+
+/**
+ * @brief Fill the window with reads the target keeps answering with WAIT,
+ * then end each one with DAP_TransferAbort
+ *
+ */
+static void dap_tcp_test_abort()
+{
+    static uint8_t packets[DAP_TCP_TEST_STUCK * 8];
+    const uint8_t configure[] = {ID_DAP_TransferConfigure, 0, DAP_TCP_TEST_WAIT_RETRY & 0xFF,
+                                 DAP_TCP_TEST_WAIT_RETRY >> 8, 0, 0};
+    const uint8_t read[] = {ID_DAP_Transfer, 0, 1, DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TEST_AP_DRW};
+    const uint8_t abort[] = {ID_DAP_TransferAbort};
+    const uint8_t clear[] = {ID_DAP_Transfer, 0, 1, DP_ABORT, 0x1F, 0x00, 0x00, 0x00};
+    uint8_t response[DAP_PACKET_SIZE];
+    uint8_t packet[8];
+    size_t length = 0;
+    struct pollfd ready = {dap_tcp_test_fd, POLLIN, 0};
+    uint32_t waits;
+    uint32_t i;
+
+    DAP_TEST_CHECK(dap_tcp_test_command(configure, sizeof(configure), response) == 2 && response[1] == DAP_OK);
+    for (i = 0; i < DAP_TCP_TEST_STUCK; i++)
+    {
+        length += dap_tcp_test_build(&packets[length], read, sizeof(read));
+    }
+
+    waits = target_sim_stats()->wait;
+    target_sim_inject(TARGET_SIM_WAIT, 0, 0xFFFFFFFF);
+    dap_tcp_test_write(packets, length);
+
+    // An abort only ends the read being retried, one that lands between two
+    // commands is cleared by the next one: send it again until the read ends.
+    for (i = 0; i < DAP_TCP_TEST_STUCK; i++)
+    {
+        do
+        {
+            dap_tcp_test_write(packet, dap_tcp_test_build(packet, abort, sizeof(abort)));
+        } while (poll(&ready, 1, DAP_TCP_TEST_ABORT_POLL_MS) == 0);
+        DAP_TEST_CHECK(dap_tcp_test_response(response) == 3);
+        DAP_TEST_CHECK(response[0] == ID_DAP_Transfer && response[1] == 0 && response[2] == DAP_TRANSFER_WAIT);
+
+        // An abort that waited for a free slot would let the first read run all its retries
+        DAP_TEST_CHECK(target_sim_stats()->wait - waits < DAP_TCP_TEST_WAIT_RETRY);
+        waits = target_sim_stats()->wait;
+    }
+
+    // DAPABORT gives up the stalled AP access, as a debugger does after the abort
+    DAP_TEST_CHECK(dap_tcp_test_command(clear, sizeof(clear), response) == 3 && response[2] == DAP_TRANSFER_OK);
+}
+
+int main(int argc, char **argv)
+{
+    const uint8_t request[] = {ID_DAP_Info, DAP_ID_PACKET_COUNT};
+    uint8_t response[DAP_PACKET_SIZE];
+
+    dap_test_start(dap_tcp_server_task, "dap_tcp_server");
+    dap_tcp_test_connect();
+
+    DAP_TEST_CHECK(dap_tcp_test_command(request, sizeof(request), response) == 3);
+    DAP_TEST_CHECK(response[2] == DAP_PACKET_WINDOW);
+    dap_test_target_setup(dap_tcp_test_command);
+
+    dap_tcp_test_pipeline();
+    dap_tcp_test_abort();
+
+    close(dap_tcp_test_fd);
+    printf("dap_tcp_test: OK\n");
+    return 0;
+}
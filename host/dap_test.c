@@ -0,0 +1,109 @@
+/**
+ * @file dap_test.c
+ * @brief Helpers of the host tests of the DAP servers of main/
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "host/dap_test.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "components/DAP/include/DAP.h"
+
+#include "host/target_sim.h"
+#include "host/usbip_host.h"
+
+#define DAP_TEST_LOG_SIZE 65536
+
+static pthread_mutex_t dap_test_log_lock = PTHREAD_MUTEX_INITIALIZER;
+static char dap_test_log[DAP_TEST_LOG_SIZE];
+static size_t dap_test_log_length = 0;
+
+uint64_t dap_test_now_ms()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void dap_test_log_hook(const char *text, size_t length, void *context)
+{
+    pthread_mutex_lock(&dap_test_log_lock);
+    if (dap_test_log_length + length < sizeof(dap_test_log))
+    {
+        memcpy(&dap_test_log[dap_test_log_length], text, length);
+        dap_test_log_length += length;
+        dap_test_log[dap_test_log_length] = '\0';
+    }
+    pthread_mutex_unlock(&dap_test_log_lock);
+}
+
+int dap_test_wait_log(const char *text, uint32_t timeout_ms)
+{
+    uint64_t deadline = dap_test_now_ms() + timeout_ms;
+    int found;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&dap_test_log_lock);
+        found = strstr(dap_test_log, text) != NULL;
+        pthread_mutex_unlock(&dap_test_log_lock);
+        if (found || dap_test_now_ms() >= deadline)
+        {
+            return found;
+        }
+        usleep(10000);
+    }
+}
+
+void dap_test_start(void (*server_task)(), const char *name)
+{
+    target_sim_init(NULL);
+    dap_hal_set(&kTargetSimHal);
+    usbip_host_set_log_hook(dap_test_log_hook, NULL);
+    DAP_TEST_CHECK(usbip_host_start(0) > 0);
+    usbip_host_start_task(server_task, name);
+}
+
+#define DAP_TEST_COMMAND(response, ...)                             \
+    do                                                              \
+    {                                                               \
+        const uint8_t _request[] = {__VA_ARGS__};                   \
+        DAP_TEST_CHECK(command(_request, sizeof(_request), response) > 0); \
+        DAP_TEST_CHECK(response[0] == _request[0]);                 \
+    } while (0)
+
+void dap_test_target_setup(dap_test_command_t command)
+{
+    uint8_t response[DAP_PACKET_SIZE];
+
+    DAP_TEST_COMMAND(response, ID_DAP_Connect, DAP_PORT_SWD);
+    DAP_TEST_CHECK(response[1] == DAP_PORT_SWD);
+    // line reset, JTAG to SWD, line reset, idle
+    DAP_TEST_COMMAND(response, ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+    DAP_TEST_COMMAND(response, ID_DAP_SWJ_Sequence, 16, 0x9E, 0xE7);
+    DAP_TEST_COMMAND(response, ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+    DAP_TEST_COMMAND(response, ID_DAP_SWJ_Sequence, 8, 0x00);
+
+    // IDCODE, clear the sticky errors, power up, SELECT AP 0 bank 0
+    DAP_TEST_COMMAND(response, ID_DAP_Transfer, 0, 4,
+                     DAP_TRANSFER_RnW | DP_IDCODE,
+                     DP_ABORT, 0x1E, 0x00, 0x00, 0x00,
+                     DP_CTRL_STAT, 0x00, 0x00, 0x00, 0x50,
+                     DP_SELECT, 0x00, 0x00, 0x00, 0x00);
+    DAP_TEST_CHECK(response[1] == 4 && response[2] == DAP_TRANSFER_OK);
+
+    // 32-bit accesses with auto-increment, from the start of the RAM
+    DAP_TEST_COMMAND(response, ID_DAP_Transfer, 0, 2,
+                     DAP_TRANSFER_APnDP | DAP_TEST_AP_CSW, 0x12, 0x00, 0x00, 0x23,
+                     DAP_TRANSFER_APnDP | DAP_TEST_AP_TAR, 0x00, 0x00, 0x00, 0x20);
+    DAP_TEST_CHECK(response[1] == 2 && response[2] == DAP_TRANSFER_OK);
+}
@@ -0,0 +1,66 @@
+/**
+ * @file dap_test.h
+ * @brief Helpers of the host tests of the DAP servers of main/
+ *
+ * A test runs the server under test with usbip_host_start_task(), against
+ * the target model, and talks to it on the loopback interface. It exits
+ * with a non-zero status at the first failed check.
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __DAP_TEST_H__
+#define __DAP_TEST_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DAP_TEST_CHECK(condition)                                                   \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+// AP register addresses of DAP_Transfer requests
+#define DAP_TEST_AP_CSW 0x00
+#define DAP_TEST_AP_TAR 0x04
+#define DAP_TEST_AP_DRW 0x0C
+
+/**
+ * @brief Send a command over the transport under test and wait for its response
+ *
+ * @return Length of the response
+ */
+typedef int (*dap_test_command_t)(const uint8_t *request, uint32_t length, uint8_t *response);
+
+/**
+ * @brief Power up the target model, and start the DAP engine and the server task on it
+ *
+ */
+void dap_test_start(void (*server_task)(), const char *name);
+
+/**
+ * @brief Connect in SWD, power up the debug port and point TAR at the RAM
+ *
+ */
+void dap_test_target_setup(dap_test_command_t command);
+
+/**
+ * @brief Wait for a log message of main/ that contains text
+ *
+ * @return 1 if it has been logged since dap_test_start(), 0 on timeout
+ */
+int dap_test_wait_log(const char *text, uint32_t timeout_ms);
+
+uint64_t dap_test_now_ms();
+
+#endif
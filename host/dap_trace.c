@@ -0,0 +1,400 @@
+/**
+ * @file dap_trace.c
+ * @brief Tracing HAL and VCD writer, see dap_trace.h
+ *
+ * @version 0.1
+ * @date 2022-08-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "components/DAP/config/DAP_config.h"
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_clock.h"
+#include "host/dap_trace.h"
+
+#define DAP_TRACE_PS 1000000000000ULL
+
+#define DAP_TRACE_Z 2U // SWDIO released by the probe and not sampled yet
+
+typedef enum
+{
+    DAP_TRACE_SWCLK_TCK = 0,
+    DAP_TRACE_SWDIO_TMS,
+    DAP_TRACE_SWDIO_OE,
+    DAP_TRACE_TDI,
+    DAP_TRACE_TDO,
+    DAP_TRACE_NRESET,
+    DAP_TRACE_NTRST,
+    DAP_TRACE_PORT,
+    DAP_TRACE_SPI,
+    DAP_TRACE_SIGNAL_COUNT,
+} dap_trace_signal_t;
+
+typedef struct
+{
+    uint64_t time_ps;
+    uint8_t signal;
+    uint8_t value;
+} dap_trace_event_t;
+
+typedef struct
+{
+    const char *name;
+    uint32_t width;
+} dap_trace_signal_info_t;
+
+static const dap_trace_signal_info_t kDAPTraceSignal[DAP_TRACE_SIGNAL_COUNT] = {
+    [DAP_TRACE_SWCLK_TCK] = {"swclk_tck", 1},
+    [DAP_TRACE_SWDIO_TMS] = {"swdio_tms", 1},
+    [DAP_TRACE_SWDIO_OE] = {"swdio_oe", 1},
+    [DAP_TRACE_TDI] = {"tdi", 1},
+    [DAP_TRACE_TDO] = {"tdo", 1},
+    [DAP_TRACE_NRESET] = {"nreset", 1},
+    [DAP_TRACE_NTRST] = {"ntrst", 1},
+    [DAP_TRACE_PORT] = {"port", 2},
+    [DAP_TRACE_SPI] = {"spi", 4},
+};
+
+static const char *const kDAPTraceSpiName[] = {
+    [DAP_TRACE_SPI_NONE] = "none",
+    [DAP_TRACE_SPI_WRITE_BITS] = "WriteBits",
+    [DAP_TRACE_SPI_READ_BITS] = "ReadBits",
+    [DAP_TRACE_SPI_SEND_HEADER] = "Send_Header",
+    [DAP_TRACE_SPI_READ_DATA] = "Read_Data",
+    [DAP_TRACE_SPI_WRITE_DATA] = "Write_Data",
+    [DAP_TRACE_SPI_GENERATE_CYCLE] = "Generate_Cycle",
+    [DAP_TRACE_SPI_FAST_CYCLE] = "Fast_Cycle",
+    [DAP_TRACE_SPI_PROTOCOL_ERROR_READ] = "Protocol_Error_Read",
+    [DAP_TRACE_SPI_PROTOCOL_ERROR_WRITE] = "Protocol_Error_Write",
+    [DAP_TRACE_SPI_WRITE_DATA_SEND_HEADER] = "Write_Data_Send_Header",
+    [DAP_TRACE_SPI_RELEASE_CYCLE] = "Release_Cycle",
+    [DAP_TRACE_SPI_JTAG_SHIFT] = "JTAG_Shift",
+};
+
+static const dap_hal_t *trace_target = NULL;
+static dap_trace_config_t trace_config;
+static dap_trace_stats_t trace_stats;
+static dap_trace_event_t *trace_events = NULL;
+
+static uint8_t trace_value[DAP_TRACE_SIGNAL_COUNT];
+static uint8_t trace_swdio_out = 1;
+static dap_trace_spi_op_t trace_spi_op = DAP_TRACE_SPI_NONE;
+
+
+static void trace_record(dap_trace_signal_t signal, uint32_t value)
+{
+    dap_trace_event_t *event;
+
+    if (trace_value[signal] == value)
+    {
+        return;
+    }
+    trace_value[signal] = value;
+
+    if (trace_stats.events >= trace_config.max_events)
+    {
+        trace_stats.dropped++;
+        return;
+    }
+    event = &trace_events[trace_stats.events++];
+    event->time_ps = trace_stats.time_ps;
+    event->signal = signal;
+    event->value = value;
+}
+
+/**
+ * @brief Half a period of SWCLK/TCK for the engine driving it now
+ *
+ */
+static uint64_t trace_half_period_ps(void)
+{
+    const dap_clock_plan_t *plan = dap_clock_current();
+
+    if (trace_spi_op != DAP_TRACE_SPI_NONE && trace_spi_op != DAP_TRACE_SPI_FAST_CYCLE)
+    {
+        if (trace_config.spi_clock_hz != 0)
+        {
+            return DAP_TRACE_PS / 2U / trace_config.spi_clock_hz;
+        }
+        // before the first SWJ_Clock(), DAP_SPI_Init() leaves it at 40MHz
+        return DAP_TRACE_PS / 2U / (plan->engine == kTransfer_SPI ? plan->hz : 40000000U);
+    }
+    if (DAP_Data.fast_clock)
+    {
+        if (trace_config.gpio_fast_hz != 0)
+        {
+            return DAP_TRACE_PS / 2U / trace_config.gpio_fast_hz;
+        }
+        return DAP_TRACE_PS / 2U / dap_clock_gpio_hz(DAP_Data.debug_port, 0);
+    }
+    return DAP_TRACE_PS / 2U / dap_clock_gpio_hz(DAP_Data.debug_port, DAP_Data.clock_delay);
+}
+
+static void trace_port_setup(uint32_t port)
+{
+    trace_target->port_setup(port);
+    trace_record(DAP_TRACE_PORT, port);
+    // the setup makes SWDIO/TMS an output, and PORT_OFF releases everything
+    trace_record(DAP_TRACE_SWDIO_OE, port != DAP_PORT_DISABLED);
+    trace_record(DAP_TRACE_SWDIO_TMS, port != DAP_PORT_DISABLED ? trace_swdio_out : DAP_TRACE_Z);
+}
+
+static void trace_swclk_tck_out(uint32_t bit)
+{
+    trace_stats.time_ps += trace_half_period_ps();
+    trace_target->swclk_tck_out(bit);
+    if (bit && trace_value[DAP_TRACE_SWCLK_TCK] == 0)
+    {
+        trace_stats.clocks++;
+        if (trace_spi_op != DAP_TRACE_SPI_NONE && trace_spi_op != DAP_TRACE_SPI_FAST_CYCLE)
+        {
+            trace_stats.spi_clocks++;
+        }
+    }
+    trace_record(DAP_TRACE_SWCLK_TCK, bit);
+}
+
+static void trace_swdio_tms_out(uint32_t bit)
+{
+    trace_target->swdio_tms_out(bit);
+    trace_swdio_out = bit;
+    if (trace_value[DAP_TRACE_SWDIO_OE])
+    {
+        trace_record(DAP_TRACE_SWDIO_TMS, bit);
+    }
+}
+
+static uint32_t trace_swdio_tms_in(void)
+{
+    uint32_t bit = trace_target->swdio_tms_in() & 1U;
+
+    // while the probe drives the line, it reads back its own value
+    if (!trace_value[DAP_TRACE_SWDIO_OE])
+    {
+        trace_record(DAP_TRACE_SWDIO_TMS, bit);
+    }
+    return bit;
+}
+
+static void trace_swdio_out_enable(uint32_t enable)
+{
+    trace_target->swdio_out_enable(enable);
+    trace_record(DAP_TRACE_SWDIO_OE, enable != 0);
+    trace_record(DAP_TRACE_SWDIO_TMS, enable ? trace_swdio_out : DAP_TRACE_Z);
+}
+
+static void trace_tdi_out(uint32_t bit)
+{
+    trace_target->tdi_out(bit);
+    trace_record(DAP_TRACE_TDI, bit);
+}
+
+static uint32_t trace_tdo_in(void)
+{
+    uint32_t bit = trace_target->tdo_in() & 1U;
+
+    trace_record(DAP_TRACE_TDO, bit);
+    return bit;
+}
+
+static void trace_ntrst_out(uint32_t bit)
+{
+    trace_target->ntrst_out(bit);
+    trace_record(DAP_TRACE_NTRST, bit);
+}
+
+static void trace_nreset_out(uint32_t bit)
+{
+    trace_target->nreset_out(bit);
+    trace_record(DAP_TRACE_NRESET, bit);
+}
+
+static uint32_t trace_nreset_in(void)
+{
+    return trace_target->nreset_in();
+}
+
+static uint32_t trace_timestamp_get(void)
+{
+    // the virtual time, so that the timestamps of the DAP agree with the trace
+    return (uint32_t)(trace_stats.time_ps / (DAP_TRACE_PS / TIMESTAMP_CLOCK));
+}
+
+static const dap_hal_t dap_trace_hal = {
+    .port_setup = trace_port_setup,
+    .swclk_tck_out = trace_swclk_tck_out,
+    .swdio_tms_out = trace_swdio_tms_out,
+    .swdio_tms_in = trace_swdio_tms_in,
+    .swdio_out_enable = trace_swdio_out_enable,
+    .tdi_out = trace_tdi_out,
+    .tdo_in = trace_tdo_in,
+    .ntrst_out = trace_ntrst_out,
+    .nreset_out = trace_nreset_out,
+    .nreset_in = trace_nreset_in,
+    .timestamp_get = trace_timestamp_get,
+};
+
+
+int dap_trace_start(const dap_hal_t *target, const dap_trace_config_t *config)
+{
+    uint32_t i;
+
+    memset(&trace_config, 0, sizeof(trace_config));
+    if (config != NULL)
+    {
+        trace_config = *config;
+    }
+    if (trace_config.max_events == 0)
+    {
+        trace_config.max_events = 1U << 20;
+    }
+
+    free(trace_events);
+    trace_events = malloc(sizeof(dap_trace_event_t) * trace_config.max_events);
+    if (trace_events == NULL)
+    {
+        return -1;
+    }
+
+    memset(&trace_stats, 0, sizeof(trace_stats));
+    // unknown until first driven, so that the first value is always recorded
+    for (i = 0; i < DAP_TRACE_SIGNAL_COUNT; i++)
+    {
+        trace_value[i] = 0xFF;
+    }
+    trace_spi_op = DAP_TRACE_SPI_NONE;
+    trace_record(DAP_TRACE_SPI, DAP_TRACE_SPI_NONE);
+
+    trace_target = target != NULL ? target : kDAPHal;
+    dap_hal_set(&dap_trace_hal);
+    return 0;
+}
+
+void dap_trace_stop(void)
+{
+    if (trace_target != NULL)
+    {
+        dap_hal_set(trace_target);
+        trace_target = NULL;
+    }
+}
+
+const dap_trace_stats_t *dap_trace_stats(void)
+{
+    return &trace_stats;
+}
+
+void dap_trace_spi_begin(dap_trace_spi_op_t op)
+{
+    if (trace_target == NULL)
+    {
+        return;
+    }
+    if (op != DAP_TRACE_SPI_FAST_CYCLE)
+    {
+        trace_stats.time_ps += trace_config.spi_gap_ps;
+    }
+    trace_spi_op = op;
+    trace_record(DAP_TRACE_SPI, op);
+}
+
+void dap_trace_spi_end(void)
+{
+    if (trace_target == NULL)
+    {
+        return;
+    }
+    trace_spi_op = DAP_TRACE_SPI_NONE;
+    trace_record(DAP_TRACE_SPI, DAP_TRACE_SPI_NONE);
+}
+
+
+static void vcd_write_value(FILE *file, uint32_t signal, uint32_t value)
+{
+    uint32_t width = kDAPTraceSignal[signal].width;
+    uint32_t i;
+
+    if (width == 1)
+    {
+        fprintf(file, "%c%c\n", value == DAP_TRACE_Z ? 'z' : (value ? '1' : '0'), '!' + signal);
+        return;
+    }
+    fputc('b', file);
+    for (i = width; i > 0; i--)
+    {
+        fputc((value >> (i - 1)) & 1U ? '1' : '0', file);
+    }
+    fprintf(file, " %c\n", '!' + signal);
+}
+
+int dap_trace_write_vcd(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    time_t now = time(NULL);
+    uint64_t time_ps = UINT64_MAX;
+    uint32_t i;
+    int ret;
+
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    fprintf(file, "$date %s$end\n", ctime(&now));
+    fprintf(file, "$version esp32-dap host trace $end\n");
+    fprintf(file, "$comment\n  virtual time, SPI at %u Hz\n  spi:", (unsigned)(trace_config.spi_clock_hz != 0 ? trace_config.spi_clock_hz : dap_clock_current()->hz));
+    for (i = 0; i < sizeof(kDAPTraceSpiName) / sizeof(kDAPTraceSpiName[0]); i++)
+    {
+        fprintf(file, " %u=%s", (unsigned)i, kDAPTraceSpiName[i]);
+    }
+    fprintf(file, "\n  port: 0=off 1=SWD 2=JTAG\n$end\n");
+    fprintf(file, "$timescale 1ps $end\n");
+    fprintf(file, "$scope module dap $end\n");
+    for (i = 0; i < DAP_TRACE_SIGNAL_COUNT; i++)
+    {
+        fprintf(file, "$var wire %u %c %s $end\n", (unsigned)kDAPTraceSignal[i].width, '!' + i,
+                kDAPTraceSignal[i].name);
+    }
+    fprintf(file, "$upscope $end\n$enddefinitions $end\n");
+
+    // the signals not driven at the start are unknown
+    fprintf(file, "$dumpvars\n");
+    for (i = 0; i < DAP_TRACE_SIGNAL_COUNT; i++)
+    {
+        if (kDAPTraceSignal[i].width == 1)
+        {
+            fprintf(file, "x%c\n", '!' + i);
+        }
+        else
+        {
+            fprintf(file, "bx %c\n", '!' + i);
+        }
+    }
+    fprintf(file, "$end\n");
+
+    for (i = 0; i < trace_stats.events; i++)
+    {
+        const dap_trace_event_t *event = &trace_events[i];
+
+        if (event->time_ps != time_ps)
+        {
+            time_ps = event->time_ps;
+            fprintf(file, "#%llu\n", (unsigned long long)time_ps);
+        }
+        vcd_write_value(file, event->signal, event->value);
+    }
+    fprintf(file, "#%llu\n", (unsigned long long)trace_stats.time_ps);
+
+    ret = ferror(file) ? -1 : 0;
+    if (fclose(file) != 0)
+    {
+        ret = -1;
+    }
+    return ret;
+}
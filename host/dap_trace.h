@@ -0,0 +1,99 @@
+/**
+ * @file dap_trace.h
+ * @brief Pin-level tracing of the DAP core in the host build, written as VCD
+ *
+ * The tracing HAL sits between the DAP core and another HAL, usually the
+ * target model. It records every pin change and every DAP_SPI_* transaction
+ * of spi_op_host.c with a virtual timestamp, which dap_trace_write_vcd()
+ * writes as a VCD file for GTKWave.
+ *
+ * The time is a model of the board, not of the PC:
+ *  - a SWCLK/TCK edge in a DAP_SPI_* transaction takes half a period of the
+ *    SPI clock, and each transaction starts after spi_gap_ps.
+ *  - other edges take half a period of the GPIO engine, the one dap_clock.c
+ *    computed clock_delay for, or gpio_fast_hz with fast_clock.
+ *
+ * @version 0.1
+ * @date 2022-08-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __DAP_TRACE_H__
+#define __DAP_TRACE_H__
+
+#include <stdint.h>
+
+#include "components/DAP/include/dap_hal.h"
+
+/**
+ * @brief Transactions of spi_op.h, shown on the "spi" signal of the trace
+ *
+ */
+typedef enum
+{
+    DAP_TRACE_SPI_NONE = 0,
+    DAP_TRACE_SPI_WRITE_BITS,
+    DAP_TRACE_SPI_READ_BITS,
+    DAP_TRACE_SPI_SEND_HEADER,
+    DAP_TRACE_SPI_READ_DATA,
+    DAP_TRACE_SPI_WRITE_DATA,
+    DAP_TRACE_SPI_GENERATE_CYCLE,
+    DAP_TRACE_SPI_FAST_CYCLE, // SWCLK is toggled by the GPIO
+    DAP_TRACE_SPI_PROTOCOL_ERROR_READ,
+    DAP_TRACE_SPI_PROTOCOL_ERROR_WRITE,
+    DAP_TRACE_SPI_WRITE_DATA_SEND_HEADER,
+    DAP_TRACE_SPI_RELEASE_CYCLE, // SWDIO released
+    DAP_TRACE_SPI_JTAG_SHIFT,    // TCK/TDI/TDO, TMS on the GPIO
+} dap_trace_spi_op_t;
+
+typedef struct
+{
+    uint32_t max_events;   // the events past it are dropped
+    uint32_t spi_clock_hz; // 0 for the clock dap_clock.c planned
+    uint32_t spi_gap_ps;   // idle time before each DAP_SPI_* transaction
+    uint32_t gpio_fast_hz; // 0 for the clock dap_clock.c calibrated of the fast GPIO path
+} dap_trace_config_t;
+
+typedef struct
+{
+    uint64_t time_ps;     // virtual time since dap_trace_start()
+    uint64_t clocks;      // rising edges of SWCLK/TCK
+    uint64_t spi_clocks;  // of them, in DAP_SPI_* transactions
+    uint32_t events;
+    uint32_t dropped;
+} dap_trace_stats_t;
+
+/**
+ * @brief Start tracing the pins, and route them to the tracing HAL
+ *
+ * @param target The HAL the pins go to, e.g. &kTargetSimHal
+ * @param config The configuration, or NULL for the defaults
+ * @return 0 on success, -1 when the event buffer cannot be allocated
+ */
+int dap_trace_start(const dap_hal_t *target, const dap_trace_config_t *config);
+
+/**
+ * @brief Stop tracing, and route the pins back to the target HAL
+ *
+ */
+void dap_trace_stop(void);
+
+/**
+ * @brief Write the events recorded since dap_trace_start()
+ *
+ * @return 0 on success, -1 on an I/O error
+ */
+int dap_trace_write_vcd(const char *path);
+
+const dap_trace_stats_t *dap_trace_stats(void);
+
+/**
+ * @brief Called by spi_op_host.c around each DAP_SPI_* transaction
+ *
+ */
+void dap_trace_spi_begin(dap_trace_spi_op_t op);
+void dap_trace_spi_end(void);
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * @file dap_trace_main.c
+ * @brief Traces a short debug session against the target model into a VCD file
+ *
+ *   dap_trace [-k swj_clock_hz] [-w wait_count] [-g spi_gap_ns] [-j] out.vcd
+ *
+ * The session connects, powers up the debug port and reads and writes the
+ * target RAM with Transfer and TransferBlock. With -w, the first AP accesses
+ * are answered with WAIT. With -j, it runs in JTAG instead of SWD.
+ *
+ * @version 0.1
+ * @date 2022-08-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_hal.h"
+
+#include "host/dap_trace.h"
+#include "host/target_sim.h"
+
+#define TRACE_DEFAULT_CLOCK 10000000U
+
+static uint8_t trace_response[DAP_PACKET_SIZE];
+
+#define TRACE_COMMAND(...)                                          \
+    do                                                              \
+    {                                                               \
+        const uint8_t _request[] = {__VA_ARGS__};                   \
+        DAP_ProcessCommand(_request, trace_response);               \
+    } while (0)
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-k swj_clock_hz] [-w wait_count] [-g spi_gap_ns] [-j] out.vcd\n", name);
+}
+
+static void trace_session(uint32_t clock, uint32_t waits, int jtag)
+{
+    TRACE_COMMAND(ID_DAP_Connect, jtag ? DAP_PORT_JTAG : DAP_PORT_SWD);
+    TRACE_COMMAND(ID_DAP_SWJ_Clock, clock & 0xFF, (clock >> 8) & 0xFF, (clock >> 16) & 0xFF, clock >> 24);
+    if (jtag)
+    {
+        // SWD to JTAG, and Test-Logic-Reset to Run-Test/Idle
+        TRACE_COMMAND(ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+        TRACE_COMMAND(ID_DAP_SWJ_Sequence, 16, 0x3C, 0xE7);
+        TRACE_COMMAND(ID_DAP_SWJ_Sequence, 8, 0x7F);
+        TRACE_COMMAND(ID_DAP_JTAG_Configure, 1, 4);
+    }
+    else
+    {
+        // line reset, JTAG to SWD, line reset, idle
+        TRACE_COMMAND(ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+        TRACE_COMMAND(ID_DAP_SWJ_Sequence, 16, 0x9E, 0xE7);
+        TRACE_COMMAND(ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+        TRACE_COMMAND(ID_DAP_SWJ_Sequence, 8, 0x00);
+    }
+
+    // IDCODE, clear the sticky errors, power up, SELECT AP 0 bank 0
+    TRACE_COMMAND(ID_DAP_Transfer, 0, 4,
+                  DAP_TRANSFER_RnW | DP_IDCODE,
+                  DP_ABORT, 0x1E, 0x00, 0x00, 0x00,
+                  DP_CTRL_STAT, 0x00, 0x00, 0x00, 0x50,
+                  DP_SELECT, 0x00, 0x00, 0x00, 0x00);
+    // CSW 32-bit auto-increment, TAR at the RAM
+    TRACE_COMMAND(ID_DAP_Transfer, 0, 2,
+                  DAP_TRANSFER_APnDP | 0x00, 0x12, 0x00, 0x00, 0x23,
+                  DAP_TRANSFER_APnDP | 0x04, 0x00, 0x00, 0x00, 0x20);
+
+    target_sim_inject(TARGET_SIM_WAIT, 0, waits);
+    TRACE_COMMAND(ID_DAP_Transfer, 0, 3,
+                  DAP_TRANSFER_APnDP | 0x0C, 0x78, 0x56, 0x34, 0x12,
+                  DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | 0x0C,
+                  DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | 0x0C);
+    TRACE_COMMAND(ID_DAP_TransferBlock, 0, 4, 0,
+                  DAP_TRANSFER_APnDP | 0x0C,
+                  0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00,
+                  0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00);
+    TRACE_COMMAND(ID_DAP_Transfer, 0, 1,
+                  DAP_TRANSFER_APnDP | 0x04, 0x04, 0x00, 0x00, 0x20);
+    TRACE_COMMAND(ID_DAP_TransferBlock, 0, 4, 0,
+                  DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | 0x0C);
+    TRACE_COMMAND(ID_DAP_Disconnect);
+}
+
+int main(int argc, char **argv)
+{
+    dap_trace_config_t config;
+    const dap_trace_stats_t *stats;
+    uint32_t clock = TRACE_DEFAULT_CLOCK;
+    uint32_t waits = 0;
+    int jtag = 0;
+    int opt;
+
+    memset(&config, 0, sizeof(config));
+    while ((opt = getopt(argc, argv, "k:w:g:j")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k':
+            clock = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            waits = strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            config.spi_gap_ps = strtoul(optarg, NULL, 0) * 1000U;
+            break;
+        case 'j':
+            jtag = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1 || clock == 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    target_sim_init(NULL);
+    dap_hal_set(&kTargetSimHal);
+    DAP_Setup();
+
+    if (dap_trace_start(&kTargetSimHal, &config) < 0)
+    {
+        fprintf(stderr, "Unable to allocate the trace\n");
+        return 1;
+    }
+    trace_session(clock, waits, jtag);
+    dap_trace_stop();
+
+    if (dap_trace_write_vcd(argv[optind]) < 0)
+    {
+        fprintf(stderr, "Unable to write %s\n", argv[optind]);
+        return 1;
+    }
+
+    stats = dap_trace_stats();
+    printf("events %u, dropped %u\n", (unsigned)stats->events, (unsigned)stats->dropped);
+    printf("time %.3f us, clocks %llu (%llu by SPI)\n", stats->time_ps / 1e6,
+           (unsigned long long)stats->clocks, (unsigned long long)stats->spi_clocks);
+    if (stats->time_ps > 0)
+    {
+        printf("effective clock %.3f MHz\n", stats->clocks * 1e6 / stats->time_ps);
+    }
+    printf("target: %u OK, %u WAIT, %u FAULT, %u protocol errors\n",
+           (unsigned)target_sim_stats()->ok, (unsigned)target_sim_stats()->wait,
+           (unsigned)target_sim_stats()->fault, (unsigned)target_sim_stats()->protocol_error);
+    return 0;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file freertos_host.c
+ * @brief Tasks, notifications, ticks and mutexes of host/port/freertos on pthreads
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "components/DAP/include/dap_event.h"
+
+struct host_task
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify_count;
+    TaskFunction_t function;
+    void *argument;
+    BaseType_t core_id;
+};
+
+struct host_mutex
+{
+    pthread_mutex_t lock;
+};
+
+static __thread struct host_task *current_task = NULL;
+
+static void *host_task_entry(void *argument)
+{
+    struct host_task *task = argument;
+
+    current_task = task;
+#if (USE_DAP_EVENT_TRACE == 1)
+    // the events are recorded in the ring of the core the task is pinned to
+    dap_event_set_core(task->core_id);
+#endif
+    task->function(task->argument);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth,
+                                   void *argument, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core_id)
+{
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+
+    if (task == NULL)
+    {
+        return pdFAIL;
+    }
+
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->cond, NULL);
+    task->function = function;
+    task->argument = argument;
+    task->core_id = core_id;
+
+    // the handle may be notified by the task itself as soon as it runs
+    if (handle != NULL)
+    {
+        *handle = task;
+    }
+
+    if (pthread_create(&task->thread, NULL, host_task_entry, task) != 0)
+    {
+        if (handle != NULL)
+        {
+            *handle = NULL;
+        }
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // only a task deleting itself is used
+    if (task == NULL || task == current_task)
+    {
+        pthread_exit(NULL);
+    }
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify_count++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    struct host_task *task = current_task;
+    uint32_t count;
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify_count == 0 && ticks_to_wait != 0)
+    {
+        // only the blocking and the polling forms are used
+        pthread_cond_wait(&task->cond, &task->lock);
+    }
+    count = task->notify_count;
+    if (count > 0)
+    {
+        task->notify_count = clear_on_exit ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return count;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)((uint64_t)now.tv_sec * configTICK_RATE_HZ +
+                        (uint64_t)now.tv_nsec * configTICK_RATE_HZ / 1000000000U);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec delay;
+
+    delay.tv_sec = ticks / configTICK_RATE_HZ;
+    delay.tv_nsec = (long)(ticks % configTICK_RATE_HZ) * (1000000000L / configTICK_RATE_HZ);
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+    {
+    }
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    struct host_mutex *mutex = malloc(sizeof(struct host_mutex));
+
+    if (mutex != NULL)
+    {
+        pthread_mutex_init(&mutex->lock, NULL);
+    }
+    return mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks_to_wait)
+{
+    if (ticks_to_wait == 0)
+    {
+        return pthread_mutex_trylock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+    }
+    pthread_mutex_lock(&mutex->lock);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    pthread_mutex_unlock(&mutex->lock);
+    return pdTRUE;
+}
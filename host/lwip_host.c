@@ -0,0 +1,456 @@
+/**
+ * @file lwip_host.c
+ * @brief netconn, netbuf and pbuf of host/port/lwip on POSIX sockets
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "host/lwip_host.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "lwip/err.h"
+#include "lwip/api.h"
+#include "lwip/tcp.h"
+
+// As much as lwIP hands over at once with the default MSS
+#define LWIP_HOST_RECV_SIZE 1460
+#define LWIP_HOST_DATAGRAM_SIZE 2048
+
+const ip_addr_t ip_addr_any = {0};
+
+int lwip_host_sendmsg(int fd, const struct netvector *vectors, uint16_t count)
+{
+    struct iovec iov[count];
+    struct msghdr msg;
+    int first = 0;
+    ssize_t ret;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        iov[i].iov_base = (void *)vectors[i].ptr;
+        iov[i].iov_len = vectors[i].len;
+    }
+
+    while (first < count)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov[first];
+        msg.msg_iovlen = count - first;
+
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        // skip what has been written, a vector may be cut in the middle
+        while (first < count && (size_t)ret >= iov[first].iov_len)
+        {
+            ret -= iov[first].iov_len;
+            first++;
+        }
+        if (first < count)
+        {
+            iov[first].iov_base = (uint8_t *)iov[first].iov_base + ret;
+            iov[first].iov_len -= ret;
+        }
+    }
+    return 0;
+}
+
+static struct pbuf *pbuf_new(uint16_t length)
+{
+    struct pbuf *p = malloc(sizeof(struct pbuf) + length);
+
+    if (p != NULL)
+    {
+        p->next = NULL;
+        p->payload = p + 1;
+        p->tot_len = length;
+        p->len = length;
+    }
+    return p;
+}
+
+void pbuf_cat(struct pbuf *head, struct pbuf *tail)
+{
+    struct pbuf *p;
+
+    for (p = head; p->next != NULL; p = p->next)
+    {
+        p->tot_len += tail->tot_len;
+    }
+    p->tot_len += tail->tot_len;
+    p->next = tail;
+}
+
+uint16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, uint16_t len, uint16_t offset)
+{
+    uint16_t copied = 0;
+    uint16_t n;
+
+    for (; p != NULL && copied < len; p = p->next)
+    {
+        if (offset >= p->len)
+        {
+            offset -= p->len;
+            continue;
+        }
+        n = MIN(p->len - offset, len - copied);
+        memcpy((uint8_t *)dataptr + copied, (const uint8_t *)p->payload + offset, n);
+        copied += n;
+        offset = 0;
+    }
+    return copied;
+}
+
+struct pbuf *pbuf_free_header(struct pbuf *q, uint16_t size)
+{
+    struct pbuf *next;
+
+    while (q != NULL && size >= q->len)
+    {
+        size -= q->len;
+        next = q->next;
+        free(q);
+        q = next;
+    }
+    if (q != NULL && size > 0)
+    {
+        // the tot_len of the pbufs before it are gone with them
+        q->payload = (uint8_t *)q->payload + size;
+        q->len -= size;
+        q->tot_len -= size;
+    }
+    return q;
+}
+
+static int pbuf_get_at(const struct pbuf *p, uint16_t offset)
+{
+    for (; p != NULL; p = p->next)
+    {
+        if (offset < p->len)
+        {
+            return ((const uint8_t *)p->payload)[offset];
+        }
+        offset -= p->len;
+    }
+    return -1;
+}
+
+uint16_t pbuf_memfind(const struct pbuf *p, const void *mem, uint16_t mem_len, uint16_t start_offset)
+{
+    uint32_t i, j;
+
+    for (i = start_offset; i + mem_len <= p->tot_len; i++)
+    {
+        for (j = 0; j < mem_len; j++)
+        {
+            if (pbuf_get_at(p, i + j) != ((const uint8_t *)mem)[j])
+            {
+                break;
+            }
+        }
+        if (j == mem_len)
+        {
+            return i;
+        }
+    }
+    return 0xFFFF;
+}
+
+uint8_t pbuf_free(struct pbuf *p)
+{
+    struct pbuf *next;
+    uint8_t count = 0;
+
+    for (; p != NULL; p = next)
+    {
+        next = p->next;
+        free(p);
+        count++;
+    }
+    return count;
+}
+
+struct netbuf *netbuf_new(void)
+{
+    return calloc(1, sizeof(struct netbuf));
+}
+
+void netbuf_delete(struct netbuf *buf)
+{
+    if (buf != NULL)
+    {
+        free(buf->owned);
+        free(buf);
+    }
+}
+
+err_t netbuf_ref(struct netbuf *buf, const void *dataptr, uint16_t size)
+{
+    free(buf->owned);
+    buf->owned = NULL;
+    buf->data = dataptr;
+    buf->len = size;
+    return ERR_OK;
+}
+
+uint16_t netbuf_copy_partial(const struct netbuf *buf, void *dataptr, uint16_t len, uint16_t offset)
+{
+    if (offset >= buf->len)
+    {
+        return 0;
+    }
+    len = MIN(len, buf->len - offset);
+    memcpy(dataptr, buf->data + offset, len);
+    return len;
+}
+
+static struct netconn *netconn_wrap(enum netconn_type type, int fd)
+{
+    struct netconn *conn = calloc(1, sizeof(struct netconn));
+
+    if (conn == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    conn->type = type;
+    conn->socket.fd = fd;
+    conn->pcb.tcp = &conn->socket;
+    return conn;
+}
+
+static err_t netconn_err(int error)
+{
+    switch (error)
+    {
+    case EAGAIN:
+        return ERR_TIMEOUT;
+    case EADDRINUSE:
+        return ERR_USE;
+    case ECONNRESET:
+        return ERR_RST;
+    case ENOMEM:
+    case ENOBUFS:
+        return ERR_MEM;
+    default:
+        return ERR_CONN;
+    }
+}
+
+/**
+ * @brief Apply the receive timeout before each receive, it may have changed
+ *
+ */
+static void netconn_set_socket_timeout(struct netconn *conn)
+{
+    struct timeval timeout;
+
+    timeout.tv_sec = conn->recv_timeout / 1000;
+    timeout.tv_usec = (conn->recv_timeout % 1000) * 1000;
+    setsockopt(conn->socket.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+struct netconn *netconn_new(enum netconn_type type)
+{
+    int fd = socket(AF_INET, type == NETCONN_UDP ? SOCK_DGRAM : SOCK_STREAM, 0);
+    int flag = 1;
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    // the tests restart the servers on the same ports
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    return netconn_wrap(type, fd);
+}
+
+err_t netconn_delete(struct netconn *conn)
+{
+    close(conn->socket.fd);
+    free(conn);
+    return ERR_OK;
+}
+
+err_t netconn_bind(struct netconn *conn, const ip_addr_t *addr, uint16_t port)
+{
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = addr->addr == ip_addr_any.addr ? htonl(INADDR_LOOPBACK) : addr->addr;
+    sin.sin_port = htons(port);
+    if (bind(conn->socket.fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+    {
+        return netconn_err(errno);
+    }
+    return ERR_OK;
+}
+
+err_t netconn_listen(struct netconn *conn)
+{
+    return listen(conn->socket.fd, 1) < 0 ? netconn_err(errno) : ERR_OK;
+}
+
+err_t netconn_accept(struct netconn *conn, struct netconn **new_conn)
+{
+    int fd;
+
+    do
+    {
+        fd = accept(conn->socket.fd, NULL, NULL);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0)
+    {
+        return ERR_ABRT;
+    }
+
+    *new_conn = netconn_wrap(conn->type, fd);
+    return *new_conn == NULL ? ERR_MEM : ERR_OK;
+}
+
+err_t netconn_close(struct netconn *conn)
+{
+    shutdown(conn->socket.fd, SHUT_RDWR);
+    return ERR_OK;
+}
+
+err_t netconn_recv(struct netconn *conn, struct netbuf **new_buf)
+{
+    struct sockaddr_in sin;
+    socklen_t sin_length = sizeof(sin);
+    struct netbuf *buf;
+    ssize_t ret;
+
+    buf = netbuf_new();
+    if (buf == NULL || (buf->owned = malloc(LWIP_HOST_DATAGRAM_SIZE)) == NULL)
+    {
+        netbuf_delete(buf);
+        return ERR_MEM;
+    }
+
+    netconn_set_socket_timeout(conn);
+    do
+    {
+        ret = recvfrom(conn->socket.fd, buf->owned, LWIP_HOST_DATAGRAM_SIZE, 0, (struct sockaddr *)&sin, &sin_length);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+    {
+        netbuf_delete(buf);
+        return netconn_err(errno);
+    }
+
+    buf->data = buf->owned;
+    buf->len = ret;
+    buf->addr.addr = sin.sin_addr.s_addr;
+    buf->port = ntohs(sin.sin_port);
+    *new_buf = buf;
+    return ERR_OK;
+}
+
+err_t netconn_recv_tcp_pbuf(struct netconn *conn, struct pbuf **new_buf)
+{
+    struct pbuf *p;
+    ssize_t ret;
+
+    p = pbuf_new(LWIP_HOST_RECV_SIZE);
+    if (p == NULL)
+    {
+        return ERR_MEM;
+    }
+
+    netconn_set_socket_timeout(conn);
+    do
+    {
+        ret = recv(conn->socket.fd, p->payload, LWIP_HOST_RECV_SIZE, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0)
+    {
+        pbuf_free(p);
+        return ret == 0 ? ERR_CLSD : netconn_err(errno);
+    }
+
+    p->tot_len = p->len = ret;
+    *new_buf = p;
+    return ERR_OK;
+}
+
+err_t netconn_sendto(struct netconn *conn, struct netbuf *buf, const ip_addr_t *addr, uint16_t port)
+{
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = addr->addr;
+    sin.sin_port = htons(port);
+    if (sendto(conn->socket.fd, buf->data, buf->len, 0, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+    {
+        return netconn_err(errno);
+    }
+    return ERR_OK;
+}
+
+err_t netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size, uint8_t apiflags,
+                           size_t *bytes_written)
+{
+    struct netvector vector = {dataptr, size};
+
+    return netconn_write_vectors_partly(conn, &vector, 1, apiflags, bytes_written);
+}
+
+err_t netconn_write_vectors_partly(struct netconn *conn, struct netvector *vectors, uint16_t vectorcnt,
+                                   uint8_t apiflags, size_t *bytes_written)
+{
+    size_t total = 0;
+    uint16_t i;
+
+    if (lwip_host_sendmsg(conn->socket.fd, vectors, vectorcnt) < 0)
+    {
+        return ERR_RST;
+    }
+    if (bytes_written != NULL)
+    {
+        for (i = 0; i < vectorcnt; i++)
+        {
+            total += vectors[i].len;
+        }
+        *bytes_written = total;
+    }
+    return ERR_OK;
+}
+
+void tcp_nagle_disable(struct tcp_pcb *pcb)
+{
+    int flag = 1;
+
+    setsockopt(pcb->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+void ip_set_option(struct tcp_pcb *pcb, uint8_t option)
+{
+    int flag = 1;
+
+    if (option & SOF_KEEPALIVE)
+    {
+        setsockopt(pcb->fd, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag));
+    }
+}
@@ -0,0 +1,26 @@
+/**
+ * @file lwip_host.h
+ * @brief Socket helpers shared by the lwIP shim and usbip_host.c
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __LWIP_HOST_H__
+#define __LWIP_HOST_H__
+
+#include <stdint.h>
+
+#include "lwip/api.h"
+
+/**
+ * @brief Write the buffers to a stream socket, going on after partial writes
+ *
+ * @return 0 on success, -1 if the connection is gone
+ */
+int lwip_host_sendmsg(int fd, const struct netvector *vectors, uint16_t count);
+
+#endif
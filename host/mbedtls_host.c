@@ -0,0 +1,143 @@
+/**
+ * @file mbedtls_host.c
+ * @brief SHA-1 and base64 of host/port/mbedtls, for the WebSocket handshake
+ *
+ * Plain implementations of FIPS 180-4 and RFC 4648, so that the host build
+ * does not need mbed TLS.
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+
+static uint32_t sha1_rol(uint32_t value, uint32_t bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1_block(uint32_t state[5], const uint8_t *block)
+{
+    uint32_t w[80];
+    uint32_t a, b, c, d, e, f, k, t;
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for (i = 16; i < 80; i++)
+    {
+        w[i] = sha1_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    for (i = 0; i < 80; i++)
+    {
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        t = sha1_rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = sha1_rol(b, 30);
+        b = a;
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+int mbedtls_sha1_ret(const unsigned char *input, size_t ilen, unsigned char output[20])
+{
+    uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint8_t block[64];
+    uint64_t bits = (uint64_t)ilen * 8;
+    size_t rest;
+    int i;
+
+    for (; ilen >= 64; ilen -= 64, input += 64)
+    {
+        sha1_block(state, input);
+    }
+
+    // the padding and the length in bits, in one or two blocks
+    rest = ilen;
+    memset(block, 0, sizeof(block));
+    memcpy(block, input, rest);
+    block[rest] = 0x80;
+    if (rest >= 56)
+    {
+        sha1_block(state, block);
+        memset(block, 0, sizeof(block));
+    }
+    for (i = 0; i < 8; i++)
+    {
+        block[63 - i] = (bits >> (i * 8)) & 0xFF;
+    }
+    sha1_block(state, block);
+
+    for (i = 0; i < 20; i++)
+    {
+        output[i] = (state[i / 4] >> (24 - (i % 4) * 8)) & 0xFF;
+    }
+    return 0;
+}
+
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t length = (slen + 2) / 3 * 4;
+    uint32_t triple;
+    size_t i, j;
+
+    if (dlen < length + 1)
+    {
+        *olen = length + 1;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+
+    for (i = 0, j = 0; i < slen; i += 3, j += 4)
+    {
+        triple = src[i] << 16;
+        triple |= (i + 1 < slen) ? src[i + 1] << 8 : 0;
+        triple |= (i + 2 < slen) ? src[i + 2] : 0;
+        dst[j] = alphabet[(triple >> 18) & 0x3F];
+        dst[j + 1] = alphabet[(triple >> 12) & 0x3F];
+        dst[j + 2] = (i + 1 < slen) ? alphabet[(triple >> 6) & 0x3F] : '=';
+        dst[j + 3] = (i + 2 < slen) ? alphabet[triple & 0x3F] : '=';
+    }
+    dst[length] = '\0';
+    *olen = length;
+    return 0;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file FreeRTOS.h
+ * @brief The part of FreeRTOS used by main/, on pthreads
+ *
+ * Lets dap_handle.c and usbip_server.c be built unchanged in the host build.
+ * Tasks are threads, the core and priority arguments are ignored, and the
+ * critical sections of DAP_Thread are no-ops.
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __HOST_FREERTOS_H__
+#define __HOST_FREERTOS_H__
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+
+// As configured for the board, the tick count runs on CLOCK_MONOTONIC
+#define configTICK_RATE_HZ 100
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000U))
+
+typedef int portMUX_TYPE;
+#define vPortCPUInitializeMutex(mux) ((void)(mux))
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+#define IRAM_ATTR
+
+#endif
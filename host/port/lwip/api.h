@@ -0,0 +1,117 @@
+/**
+ * @file api.h
+ * @brief The part of the lwIP netconn API used by main/, on POSIX sockets
+ *
+ * Lets the DAP servers of main/ be built unchanged in the host build, see
+ * host/lwip_host.c. Only IPv4 is supported, and IP_ADDR_ANY binds to the
+ * loopback interface: the host build only serves the tests on the same machine.
+ * A received pbuf or netbuf owns its data, there is no zero copy.
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __HOST_LWIP_API_H__
+#define __HOST_LWIP_API_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lwip/err.h"
+
+// As in lwIP, written with writev() by host/usbip_host.c
+struct netvector
+{
+    const void *ptr;
+    size_t len;
+};
+
+typedef struct
+{
+    uint32_t addr; // network byte order
+} ip_addr_t;
+
+extern const ip_addr_t ip_addr_any;
+#define IP_ADDR_ANY (&ip_addr_any)
+
+#define ip_addr_copy(dest, src) ((dest) = (src))
+#define ip_addr_cmp(addr1, addr2) ((addr1)->addr == (addr2)->addr)
+
+struct pbuf
+{
+    struct pbuf *next;
+    void *payload;
+    uint16_t tot_len; // of this pbuf and the ones after it
+    uint16_t len;
+};
+
+void pbuf_cat(struct pbuf *head, struct pbuf *tail);
+uint16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, uint16_t len, uint16_t offset);
+struct pbuf *pbuf_free_header(struct pbuf *q, uint16_t size);
+uint16_t pbuf_memfind(const struct pbuf *p, const void *mem, uint16_t mem_len, uint16_t start_offset);
+uint8_t pbuf_free(struct pbuf *p);
+
+// A received datagram, or a reference to the data of one to send
+struct netbuf
+{
+    const uint8_t *data;
+    uint16_t len;
+    uint8_t *owned; // freed by netbuf_delete()
+    ip_addr_t addr;
+    uint16_t port;
+};
+
+struct netbuf *netbuf_new(void);
+void netbuf_delete(struct netbuf *buf);
+err_t netbuf_ref(struct netbuf *buf, const void *dataptr, uint16_t size);
+uint16_t netbuf_copy_partial(const struct netbuf *buf, void *dataptr, uint16_t len, uint16_t offset);
+#define netbuf_len(buf) ((buf)->len)
+#define netbuf_fromaddr(buf) (&(buf)->addr)
+#define netbuf_fromport(buf) ((buf)->port)
+
+enum netconn_type
+{
+    NETCONN_TCP = 0x10,
+    NETCONN_UDP = 0x20,
+};
+
+#define NETCONN_NOCOPY 0x00
+#define NETCONN_COPY 0x01
+
+// Stands for the protocol control block, so that its options can be set
+struct tcp_pcb
+{
+    int fd;
+};
+
+struct netconn
+{
+    enum netconn_type type;
+    union
+    {
+        struct tcp_pcb *tcp;
+    } pcb;
+    struct tcp_pcb socket;
+    int recv_timeout; // ms, 0 to wait forever
+};
+
+struct netconn *netconn_new(enum netconn_type type);
+err_t netconn_delete(struct netconn *conn);
+err_t netconn_bind(struct netconn *conn, const ip_addr_t *addr, uint16_t port);
+err_t netconn_listen(struct netconn *conn);
+err_t netconn_accept(struct netconn *conn, struct netconn **new_conn);
+err_t netconn_close(struct netconn *conn);
+err_t netconn_recv(struct netconn *conn, struct netbuf **new_buf);
+err_t netconn_recv_tcp_pbuf(struct netconn *conn, struct pbuf **new_buf);
+err_t netconn_sendto(struct netconn *conn, struct netbuf *buf, const ip_addr_t *addr, uint16_t port);
+err_t netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size, uint8_t apiflags,
+                           size_t *bytes_written);
+err_t netconn_write_vectors_partly(struct netconn *conn, struct netvector *vectors, uint16_t vectorcnt,
+                                   uint8_t apiflags, size_t *bytes_written);
+#define netconn_write(conn, dataptr, size, apiflags) netconn_write_partly(conn, dataptr, size, apiflags, NULL)
+#define netconn_set_recvtimeout(conn, timeout) ((conn)->recv_timeout = (timeout))
+
+#endif
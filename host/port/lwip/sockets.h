@@ -0,0 +1,9 @@
+#ifndef __HOST_LWIP_SOCKETS_H__
+#define __HOST_LWIP_SOCKETS_H__
+
+// htonl() and friends, and printf() which the lwIP headers bring in on the ESP32
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef __HOST_LWIP_TCP_H__
+#define __HOST_LWIP_TCP_H__
+
+#include "lwip/api.h"
+
+#define SOF_KEEPALIVE 0x08
+
+// Set on the socket at once, as lwIP does on the pcb
+void tcp_nagle_disable(struct tcp_pcb *pcb);
+void ip_set_option(struct tcp_pcb *pcb, uint8_t option);
+
+#endif
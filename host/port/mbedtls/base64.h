@@ -0,0 +1,11 @@
+#ifndef __HOST_MBEDTLS_BASE64_H__
+#define __HOST_MBEDTLS_BASE64_H__
+
+#include <stddef.h>
+
+#define MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL -0x002A
+
+// As in mbed TLS, the output is terminated and olen does not count the terminator
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef __HOST_MBEDTLS_SHA1_H__
+#define __HOST_MBEDTLS_SHA1_H__
+
+#include <stddef.h>
+
+// One-shot SHA-1 of mbed TLS 2, see host/mbedtls_host.c
+int mbedtls_sha1_ret(const unsigned char *input, size_t ilen, unsigned char output[20]);
+
+#endif
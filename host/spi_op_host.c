@@ -0,0 +1,261 @@
+/**
+ * @file spi_op_host.c
+ * @brief DAP_SPI_* of the host build, emulated on the pins of dap_hal.h
+ *
+ * The ESP32 runs SWD through SPI2 in 3-wire mode, MOSI being the SWDIO pin.
+ * Here the same bits are clocked out on SWCLK/SWDIO through the HAL, so a
+ * target model sees the transfers of SWD_Transfer_SPI() as it would see them
+ * on the wire. The JTAG shifts go out on TCK/TDI and come back from TDO the
+ * same way. Each transaction is reported to dap_trace.c.
+ *
+ * @version 0.1
+ * @date 2022-08-08
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "components/DAP/config/DAP_config.h"
+#include "components/DAP/include/spi_op.h"
+#include "components/DAP/include/spi_switch.h"
+#include "components/DAP/include/dap_hal.h"
+
+#include "host/dap_trace.h"
+
+/**
+ * @brief Write bits on SWDIO, LSB first
+ *
+ */
+static void spi_host_write(uint32_t count, const uint8_t *buf)
+{
+    uint32_t i;
+
+    PIN_SWDIO_OUT_ENABLE();
+    for (i = 0; i < count; i++)
+    {
+        PIN_SWDIO_OUT(buf[i / 8] >> (i % 8));
+        PIN_SWCLK_TCK_CLR();
+        PIN_SWCLK_TCK_SET();
+    }
+}
+
+/**
+ * @brief Read bits from SWDIO, LSB first. The bits past count are cleared.
+ *
+ */
+static void spi_host_read(uint32_t count, uint8_t *buf)
+{
+    uint32_t i;
+
+    PIN_SWDIO_OUT_DISABLE();
+    memset(buf, 0, (count + 7) / 8);
+    for (i = 0; i < count; i++)
+    {
+        PIN_SWCLK_TCK_CLR();
+        buf[i / 8] |= PIN_SWDIO_IN() << (i % 8);
+        PIN_SWCLK_TCK_SET();
+    }
+}
+
+static void spi_host_write_fill(uint32_t count, uint8_t value)
+{
+    uint8_t buf[8];
+
+    memset(buf, value, sizeof(buf));
+    while (count > 0)
+    {
+        uint32_t n = count > 64 ? 64 : count;
+        spi_host_write(n, buf);
+        count -= n;
+    }
+}
+
+void DAP_SPI_WriteBits(const uint8_t count, const uint8_t *buf)
+{
+    dap_trace_spi_begin(DAP_TRACE_SPI_WRITE_BITS);
+    spi_host_write(count, buf);
+    dap_trace_spi_end();
+}
+
+void DAP_SPI_ReadBits(const uint8_t count, uint8_t *buf)
+{
+    dap_trace_spi_begin(DAP_TRACE_SPI_READ_BITS);
+    spi_host_read(count, buf);
+    dap_trace_spi_end();
+}
+
+void DAP_SPI_Send_Header(const uint8_t packetHeaderData, uint8_t *ack, uint8_t Trn, uint8_t TrnAfterACK)
+{
+    uint8_t response[2] = {0};
+
+    dap_trace_spi_begin(DAP_TRACE_SPI_SEND_HEADER);
+    spi_host_write(8, &packetHeaderData);
+    // Trn(Before ACK) + 3bits ACK + TrnAferACK
+    spi_host_read(Trn + 3U + TrnAfterACK, response);
+    dap_trace_spi_end();
+    *ack = (((response[1] << 8) | response[0]) >> Trn) & 0b111;
+}
+
+void DAP_SPI_Read_Data(uint32_t *resData, uint8_t *resParity, uint8_t Trn)
+{
+    uint8_t response[5];
+
+    // 32bis data + 1bit parity + Trn(End)
+    dap_trace_spi_begin(DAP_TRACE_SPI_READ_DATA);
+    spi_host_read(32U + 1U + Trn, response);
+    dap_trace_spi_end();
+    *resData = response[0] | (response[1] << 8) | (response[2] << 16) | ((uint32_t)response[3] << 24);
+    *resParity = response[4] & 1U;
+}
+
+void DAP_SPI_Write_Data(uint32_t data, uint8_t parity)
+{
+    uint8_t buf[5];
+
+    buf[0] = data & 0xFF;
+    buf[1] = (data >> 8) & 0xFF;
+    buf[2] = (data >> 16) & 0xFF;
+    buf[3] = (data >> 24) & 0xFF;
+    buf[4] = parity;
+    dap_trace_spi_begin(DAP_TRACE_SPI_WRITE_DATA);
+    spi_host_write(32U + 1U, buf);
+    dap_trace_spi_end();
+}
+
+void DAP_SPI_Write_Data_Send_Header(uint32_t data, uint8_t parity, uint8_t idle,
+                                    const uint8_t packetHeaderData, uint8_t *ack, uint8_t Trn)
+{
+    uint8_t buf[5];
+    uint8_t response[2] = {0};
+
+    buf[0] = data & 0xFF;
+    buf[1] = (data >> 8) & 0xFF;
+    buf[2] = (data >> 16) & 0xFF;
+    buf[3] = (data >> 24) & 0xFF;
+    buf[4] = parity;
+    dap_trace_spi_begin(DAP_TRACE_SPI_WRITE_DATA_SEND_HEADER);
+    spi_host_write(32U + 1U, buf);
+    spi_host_write_fill(idle, 0x00);
+    spi_host_write(8, &packetHeaderData);
+    // Trn(Before ACK) + 3bits ACK + Trn(After ACK)
+    spi_host_read(Trn + 3U + Trn, response);
+    dap_trace_spi_end();
+    *ack = (((response[1] << 8) | response[0]) >> Trn) & 0b111;
+}
+
+void DAP_SPI_Generate_Cycle(uint8_t num)
+{
+    dap_trace_spi_begin(DAP_TRACE_SPI_GENERATE_CYCLE);
+    spi_host_write_fill(num, 0x00);
+    dap_trace_spi_end();
+}
+
+void DAP_SPI_Release_Cycle(uint8_t num)
+{
+    uint8_t response[32];
+
+    dap_trace_spi_begin(DAP_TRACE_SPI_RELEASE_CYCLE);
+    spi_host_read(num, response);
+    dap_trace_spi_end();
+}
+
+void DAP_SPI_Fast_Cycle()
+{
+    // The ESP32 hands SWCLK to the GPIO, which holds it low, and takes it back
+    dap_trace_spi_begin(DAP_TRACE_SPI_FAST_CYCLE);
+    PIN_SWCLK_TCK_CLR();
+    PIN_SWCLK_TCK_SET();
+    dap_trace_spi_end();
+}
+
+void DAP_SPI_Protocol_Error_Read(uint8_t Trn)
+{
+    dap_trace_spi_begin(DAP_TRACE_SPI_PROTOCOL_ERROR_READ);
+    spi_host_write_fill(Trn + 32U + 1U, 0xFF);
+    dap_trace_spi_end();
+}
+
+void DAP_SPI_Protocol_Error_Write()
+{
+    dap_trace_spi_begin(DAP_TRACE_SPI_PROTOCOL_ERROR_WRITE);
+    spi_host_write_fill(32U + 1U, 0xFF);
+    dap_trace_spi_end();
+}
+
+void DAP_SPI_JTAG_Shift(uint32_t count, const uint8_t *tdi, uint8_t *tdo)
+{
+    uint32_t i;
+    uint8_t in = 0xFF;
+    uint8_t out = 0;
+
+    // tdo may be tdi, as on the ESP32 each byte is read before it is written
+    dap_trace_spi_begin(DAP_TRACE_SPI_JTAG_SHIFT);
+    for (i = 0; i < count; i++)
+    {
+        if (i % 8 == 0 && tdi)
+        {
+            in = tdi[i / 8];
+        }
+        PIN_TDI_OUT(in >> (i % 8));
+        PIN_SWCLK_TCK_CLR();
+        out |= PIN_TDO_IN() << (i % 8);
+        PIN_SWCLK_TCK_SET();
+        if (i % 8 == 7 || i == count - 1)
+        {
+            if (tdo)
+            {
+                tdo[i / 8] = out;
+            }
+            out = 0;
+        }
+    }
+    dap_trace_spi_end();
+}
+
+
+void DAP_SPI_Init()
+{
+}
+
+void DAP_SPI_Init_JTAG()
+{
+    // TMS stays on the GPIO, as an output, as after DAP_SPI_Deinit()
+    PIN_SWDIO_OUT_ENABLE();
+}
+
+void DAP_SPI_Set_Clock(uint16_t clkdiv_pre, uint8_t clkcnt_n)
+{
+    // dap_trace.c times the transactions with dap_clock_current()
+}
+
+void DAP_SPI_Deinit()
+{
+    // Back to GPIO, SWDIO is an output again
+    PIN_SWDIO_OUT_ENABLE();
+}
+
+void DAP_SPI_Enable()
+{
+}
+
+void DAP_SPI_Disable()
+{
+}
+
+void DAP_SPI_Acquire()
+{
+}
+
+void DAP_SPI_Release()
+{
+}
+
+void DAP_SPI_JTAG_Acquire()
+{
+}
+
+void DAP_SPI_JTAG_Release()
+{
+}
@@ -0,0 +1,957 @@
+/**
+ * @file target_sim.c
+ * @brief Bit-level model of a Cortex-M debug port, for the host build
+ *
+ * Every rising edge of SWCLK/TCK ends a bit. The host bit is sampled on the
+ * edge, and the bit the target drives next is set up right after it, so that
+ * the DAP reads it while the clock is low, as SW_READ_BIT() and
+ * JTAG_CYCLE_TDO() do.
+ *
+ * @version 0.1
+ * @date 2022-08-09
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "host/target_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_utility.h"
+
+// DP CTRL/STAT
+#define CTRL_ORUNDETECT (1U << 0)
+#define CTRL_STICKYORUN (1U << 1)
+#define CTRL_STICKYCMP (1U << 4)
+#define CTRL_STICKYERR (1U << 5)
+#define CTRL_WDATAERR (1U << 7)
+#define CTRL_CDBGRSTREQ (1U << 26)
+#define CTRL_CDBGPWRUPREQ (1U << 28)
+#define CTRL_CSYSPWRUPREQ (1U << 30)
+#define CTRL_STICKY (CTRL_STICKYORUN | CTRL_STICKYCMP | CTRL_STICKYERR | CTRL_WDATAERR)
+#define CTRL_WRITABLE (CTRL_ORUNDETECT | CTRL_CDBGRSTREQ | CTRL_CDBGPWRUPREQ | CTRL_CSYSPWRUPREQ | (0xFU << 8))
+
+// DP ABORT
+#define ABORT_DAPABORT (1U << 0)
+#define ABORT_STKCMPCLR (1U << 1)
+#define ABORT_STKERRCLR (1U << 2)
+#define ABORT_WDERRCLR (1U << 3)
+#define ABORT_ORUNERRCLR (1U << 4)
+
+// MEM-AP
+#define AP_CSW 0x00U
+#define AP_TAR 0x04U
+#define AP_DRW 0x0CU
+#define AP_BD0 0x10U
+#define AP_BD3 0x1CU
+#define AP_BASE 0xF8U
+#define AP_IDR 0xFCU
+#define CSW_DEVICEEN (1U << 6)
+#define CSW_TRINPROG (1U << 7)
+#define TAR_INCREMENT_MASK 0x3FFU // auto-increment wraps at 1KB
+
+#define LINE_RESET_ONES 50
+#define SWJ_JTAG_TO_SWD 0xE79EU
+#define SWJ_SWD_TO_JTAG 0xE73CU
+
+// JTAG-DP
+#define JTAG_ACK_OK_FAULT 0x2U
+#define JTAG_ACK_WAIT 0x1U
+#define JTAG_ACC_LENGTH 35
+
+enum swd_state
+{
+    SWD_LOCKOUT = 0, // protocol error, waiting for a line reset
+    SWD_IDLE,
+    SWD_REQUEST,
+    SWD_TURNAROUND_ACK,
+    SWD_ACK,
+    SWD_READ_DATA,
+    SWD_TURNAROUND_WRITE,
+    SWD_WRITE_DATA,
+    SWD_SKIP, // cycles the target does not take part in
+};
+
+enum tap_state
+{
+    TAP_RESET = 0,
+    TAP_IDLE,
+    TAP_SELECT_DR,
+    TAP_CAPTURE_DR,
+    TAP_SHIFT_DR,
+    TAP_EXIT1_DR,
+    TAP_PAUSE_DR,
+    TAP_EXIT2_DR,
+    TAP_UPDATE_DR,
+    TAP_SELECT_IR,
+    TAP_CAPTURE_IR,
+    TAP_SHIFT_IR,
+    TAP_EXIT1_IR,
+    TAP_PAUSE_IR,
+    TAP_EXIT2_IR,
+    TAP_UPDATE_IR,
+};
+
+// Next TAP state, by the TMS value
+static const uint8_t kTapNext[16][2] = {
+    [TAP_RESET] = {TAP_IDLE, TAP_RESET},
+    [TAP_IDLE] = {TAP_IDLE, TAP_SELECT_DR},
+    [TAP_SELECT_DR] = {TAP_CAPTURE_DR, TAP_SELECT_IR},
+    [TAP_CAPTURE_DR] = {TAP_SHIFT_DR, TAP_EXIT1_DR},
+    [TAP_SHIFT_DR] = {TAP_SHIFT_DR, TAP_EXIT1_DR},
+    [TAP_EXIT1_DR] = {TAP_PAUSE_DR, TAP_UPDATE_DR},
+    [TAP_PAUSE_DR] = {TAP_PAUSE_DR, TAP_EXIT2_DR},
+    [TAP_EXIT2_DR] = {TAP_SHIFT_DR, TAP_UPDATE_DR},
+    [TAP_UPDATE_DR] = {TAP_IDLE, TAP_SELECT_DR},
+    [TAP_SELECT_IR] = {TAP_CAPTURE_IR, TAP_RESET},
+    [TAP_CAPTURE_IR] = {TAP_SHIFT_IR, TAP_EXIT1_IR},
+    [TAP_SHIFT_IR] = {TAP_SHIFT_IR, TAP_EXIT1_IR},
+    [TAP_EXIT1_IR] = {TAP_PAUSE_IR, TAP_UPDATE_IR},
+    [TAP_PAUSE_IR] = {TAP_PAUSE_IR, TAP_EXIT2_IR},
+    [TAP_EXIT2_IR] = {TAP_SHIFT_IR, TAP_UPDATE_IR},
+    [TAP_UPDATE_IR] = {TAP_IDLE, TAP_SELECT_DR},
+};
+
+static const target_sim_config_t kTargetSimDefaultConfig = {
+    .mode = TARGET_SIM_SWD,
+    .dpidr = 0x2BA01477,
+    .jtag_idcode = 0x4BA00477,
+    .ap_idr = 0x24770011,
+    .ram_base = 0x20000000,
+    .ram_size = 0x10000,
+};
+
+static struct
+{
+    target_sim_config_t config;
+    target_sim_mode_t mode;
+    uint8_t *ram;
+    target_sim_stats_t stats;
+
+    // Pins
+    uint32_t swclk;
+    uint32_t host_swdio;
+    uint32_t host_drive;
+    uint32_t target_swdio;
+    uint32_t target_drive;
+    uint32_t tdi;
+    uint32_t tdo;
+    uint32_t nreset;
+
+    // SWJ-DP line reset and select sequence
+    uint32_t ones;
+    uint32_t select_bits;
+    uint32_t select_count;
+
+    // SW-DP wire state
+    enum swd_state swd_state;
+    uint32_t bit_count;
+    uint32_t request;
+    uint32_t ack;
+    uint32_t data;
+    uint32_t turnaround;
+    uint32_t reset_state; // after a line reset, until IDCODE is read
+
+    // DP and AP registers
+    uint32_t ctrl_stat;
+    uint32_t select;
+    uint32_t read_buffer; // result of the last AP read, RDBUFF
+    uint32_t last_read;   // RESEND
+    uint32_t csw;
+    uint32_t tar;
+
+    // Injected errors
+    target_sim_error_t inject_error;
+    uint32_t inject_after;
+    uint32_t inject_count;
+
+    // JTAG TAP
+    enum tap_state tap_state;
+    uint32_t ir;
+    uint32_t ir_shift;
+    uint64_t dr_shift;
+    uint32_t dr_length;
+    uint32_t jtag_wait; // the current scan was answered with WAIT
+    uint32_t jtag_result;
+} sim;
+
+
+static uint32_t mem_size()
+{
+    uint32_t size = sim.csw & 0x7;
+    return size <= 2 ? (1U << size) : 4;
+}
+
+static int mem_access(uint32_t address, uint32_t *data, int write)
+{
+    uint32_t size = mem_size();
+    uint32_t offset, lane, i;
+
+    address &= ~(size - 1);
+    lane = address & 0x3;
+    if (address < sim.config.ram_base || address - sim.config.ram_base + size > sim.config.ram_size)
+    {
+        sim.stats.bus_error++;
+        sim.ctrl_stat |= CTRL_STICKYERR;
+        return -1;
+    }
+
+    offset = address - sim.config.ram_base;
+    if (write)
+    {
+        for (i = 0; i < size; i++)
+        {
+            sim.ram[offset + i] = (*data >> (8 * (lane + i))) & 0xFF;
+        }
+        sim.stats.mem_write++;
+    }
+    else
+    {
+        *data = 0;
+        for (i = 0; i < size; i++)
+        {
+            *data |= (uint32_t)sim.ram[offset + i] << (8 * (lane + i));
+        }
+        sim.stats.mem_read++;
+    }
+    return 0;
+}
+
+static void mem_increment()
+{
+    if ((sim.csw >> 4) & 0x3)
+    {
+        sim.tar = (sim.tar & ~TAR_INCREMENT_MASK) | ((sim.tar + mem_size()) & TAR_INCREMENT_MASK);
+    }
+}
+
+static uint32_t ap_read(uint32_t addr)
+{
+    uint32_t reg = (sim.select & 0xF0) | addr;
+    uint32_t data = 0;
+
+    if ((sim.select >> 24) != 0)
+    {
+        return 0; // no such AP
+    }
+
+    switch (reg)
+    {
+    case AP_CSW:
+        return sim.csw | CSW_DEVICEEN;
+    case AP_TAR:
+        return sim.tar;
+    case AP_DRW:
+        mem_access(sim.tar, &data, 0);
+        mem_increment();
+        return data;
+    case AP_BASE:
+        return 0xE00FF003;
+    case AP_IDR:
+        return sim.config.ap_idr;
+    default:
+        if (reg >= AP_BD0 && reg <= AP_BD3)
+        {
+            mem_access((sim.tar & ~0xFU) | (reg & 0xC), &data, 0);
+        }
+        return data;
+    }
+}
+
+static void ap_write(uint32_t addr, uint32_t data)
+{
+    uint32_t reg = (sim.select & 0xF0) | addr;
+
+    if ((sim.select >> 24) != 0)
+    {
+        return;
+    }
+
+    switch (reg)
+    {
+    case AP_CSW:
+        sim.csw = data & ~(CSW_DEVICEEN | CSW_TRINPROG);
+        break;
+    case AP_TAR:
+        sim.tar = data;
+        break;
+    case AP_DRW:
+        mem_access(sim.tar, &data, 1);
+        mem_increment();
+        break;
+    default:
+        if (reg >= AP_BD0 && reg <= AP_BD3)
+        {
+            mem_access((sim.tar & ~0xFU) | (reg & 0xC), &data, 1);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Check an AP access against the sticky errors and the injected errors
+ *
+ * @return DAP_TRANSFER_OK, DAP_TRANSFER_WAIT or DAP_TRANSFER_FAULT
+ */
+static uint32_t ap_check()
+{
+    uint32_t ack = DAP_TRANSFER_OK;
+
+    if (sim.ctrl_stat & CTRL_STICKY)
+    {
+        ack = DAP_TRANSFER_FAULT;
+    }
+    else if (sim.inject_count > 0)
+    {
+        if (sim.inject_after > 0)
+        {
+            sim.inject_after--;
+        }
+        else
+        {
+            sim.inject_count--;
+            if (sim.inject_error == TARGET_SIM_FAULT)
+            {
+                sim.ctrl_stat |= CTRL_STICKYERR;
+                ack = DAP_TRANSFER_FAULT;
+            }
+            else
+            {
+                ack = DAP_TRANSFER_WAIT;
+            }
+        }
+    }
+
+    if (ack != DAP_TRANSFER_OK && (sim.ctrl_stat & CTRL_ORUNDETECT))
+    {
+        sim.ctrl_stat |= CTRL_STICKYORUN;
+    }
+    return ack;
+}
+
+static uint32_t dp_ctrl_stat()
+{
+    // every power up and reset request is acknowledged at once
+    return sim.ctrl_stat | ((sim.ctrl_stat & (CTRL_CDBGRSTREQ | CTRL_CDBGPWRUPREQ | CTRL_CSYSPWRUPREQ)) << 1);
+}
+
+static void dp_abort(uint32_t data)
+{
+    if (data & ABORT_DAPABORT)
+    {
+        // the stalled AP transfer is given up
+        if (sim.inject_error == TARGET_SIM_WAIT && sim.inject_after == 0)
+        {
+            sim.inject_count = 0;
+        }
+    }
+    if (data & ABORT_STKCMPCLR)
+    {
+        sim.ctrl_stat &= ~CTRL_STICKYCMP;
+    }
+    if (data & ABORT_STKERRCLR)
+    {
+        sim.ctrl_stat &= ~CTRL_STICKYERR;
+    }
+    if (data & ABORT_WDERRCLR)
+    {
+        sim.ctrl_stat &= ~CTRL_WDATAERR;
+    }
+    if (data & ABORT_ORUNERRCLR)
+    {
+        sim.ctrl_stat &= ~CTRL_STICKYORUN;
+    }
+}
+
+static uint32_t dp_read(uint32_t addr)
+{
+    switch (addr)
+    {
+    case DP_IDCODE:
+        return sim.mode == TARGET_SIM_SWD ? sim.config.dpidr : 0;
+    case DP_CTRL_STAT:
+        if ((sim.select & 0xF) == 1)
+        {
+            return (sim.turnaround - 1) << 8; // DLCR
+        }
+        return (sim.select & 0xF) == 0 ? dp_ctrl_stat() : 0;
+    case DP_RESEND:
+        return sim.mode == TARGET_SIM_SWD ? sim.last_read : sim.select;
+    default: // DP_RDBUFF
+        return sim.mode == TARGET_SIM_SWD ? sim.read_buffer : 0;
+    }
+}
+
+static void dp_write(uint32_t addr, uint32_t data)
+{
+    switch (addr)
+    {
+    case DP_ABORT:
+        if (sim.mode == TARGET_SIM_SWD)
+        {
+            dp_abort(data);
+        }
+        break;
+    case DP_CTRL_STAT:
+        if ((sim.select & 0xF) == 1)
+        {
+            sim.turnaround = ((data >> 8) & 0x3) + 1; // DLCR
+        }
+        else if ((sim.select & 0xF) == 0)
+        {
+            if (sim.mode == TARGET_SIM_JTAG)
+            {
+                sim.ctrl_stat &= ~(data & CTRL_STICKY); // write 1 to clear
+            }
+            sim.ctrl_stat = (sim.ctrl_stat & ~CTRL_WRITABLE) | (data & CTRL_WRITABLE);
+        }
+        break;
+    case DP_SELECT:
+        sim.select = data;
+        break;
+    default: // DP_RDBUFF
+        break;
+    }
+}
+
+
+static void swd_line_reset()
+{
+    sim.stats.line_reset++;
+    sim.swd_state = SWD_IDLE;
+    sim.target_drive = 0;
+    sim.reset_state = 1;
+}
+
+static void swd_skip(uint32_t count)
+{
+    sim.target_drive = 0;
+    sim.bit_count = count;
+    sim.swd_state = count ? SWD_SKIP : SWD_IDLE;
+}
+
+/**
+ * @brief Decode the 8 bit packet request and get the response ready
+ *
+ */
+static void swd_request()
+{
+    uint32_t apndp = (sim.request >> 1) & 0x1;
+    uint32_t rnw = (sim.request >> 2) & 0x1;
+    uint32_t addr = ((sim.request >> 3) & 0x3) << 2;
+    uint32_t parity = (sim.request >> 5) & 0x1;
+
+    if (!(sim.request & 0x01) || (sim.request & 0x40) || !(sim.request & 0x80) ||
+        ParityEvenUint8((sim.request >> 1) & 0xF) != parity ||
+        (sim.reset_state && (apndp || !rnw || addr != DP_IDCODE)))
+    {
+        // no response, until the next line reset
+        sim.stats.protocol_error++;
+        sim.swd_state = SWD_LOCKOUT;
+        return;
+    }
+
+    sim.ack = apndp ? ap_check() : DAP_TRANSFER_OK;
+    if (sim.ack == DAP_TRANSFER_OK && rnw)
+    {
+        if (apndp)
+        {
+            // posted, the data of the previous AP read is returned
+            sim.data = sim.read_buffer;
+            sim.read_buffer = ap_read(addr);
+        }
+        else
+        {
+            sim.data = dp_read(addr);
+        }
+        sim.last_read = sim.data;
+        sim.reset_state = 0;
+    }
+
+    switch (sim.ack)
+    {
+    case DAP_TRANSFER_OK:
+        sim.stats.ok++;
+        break;
+    case DAP_TRANSFER_WAIT:
+        sim.stats.wait++;
+        break;
+    default:
+        sim.stats.fault++;
+        break;
+    }
+
+    sim.bit_count = 0;
+    sim.swd_state = SWD_TURNAROUND_ACK;
+}
+
+static void swd_write_done(uint32_t parity)
+{
+    uint32_t apndp = (sim.request >> 1) & 0x1;
+    uint32_t addr = ((sim.request >> 3) & 0x3) << 2;
+
+    if (ParityEvenUint32(sim.data) != parity)
+    {
+        sim.ctrl_stat |= CTRL_WDATAERR;
+        return;
+    }
+
+    if (apndp)
+    {
+        ap_write(addr, sim.data);
+    }
+    else
+    {
+        dp_write(addr, sim.data);
+    }
+}
+
+static void swd_clock(uint32_t bit)
+{
+    switch (sim.swd_state)
+    {
+    case SWD_LOCKOUT:
+        break;
+
+    case SWD_IDLE:
+        if (sim.host_drive && bit && sim.ones < LINE_RESET_ONES)
+        {
+            sim.request = 1; // start bit
+            sim.bit_count = 1;
+            sim.swd_state = SWD_REQUEST;
+        }
+        break;
+
+    case SWD_REQUEST:
+        sim.request |= bit << sim.bit_count;
+        if (++sim.bit_count == 8)
+        {
+            swd_request();
+        }
+        break;
+
+    case SWD_TURNAROUND_ACK:
+        if (++sim.bit_count == sim.turnaround)
+        {
+            sim.bit_count = 0;
+            sim.target_drive = 1;
+            sim.target_swdio = sim.ack & 0x1;
+            sim.swd_state = SWD_ACK;
+        }
+        break;
+
+    case SWD_ACK:
+        if (++sim.bit_count < 3)
+        {
+            sim.target_swdio = (sim.ack >> sim.bit_count) & 0x1;
+            break;
+        }
+
+        sim.bit_count = 0;
+        if (sim.ack != DAP_TRANSFER_OK)
+        {
+            // With overrun detection the data phase is always there
+            swd_skip(sim.turnaround + ((sim.ctrl_stat & CTRL_ORUNDETECT) ? 33 : 0));
+        }
+        else if (sim.request & 0x4)
+        {
+            sim.target_swdio = sim.data & 0x1;
+            sim.swd_state = SWD_READ_DATA;
+        }
+        else
+        {
+            sim.target_drive = 0;
+            sim.swd_state = SWD_TURNAROUND_WRITE;
+        }
+        break;
+
+    case SWD_READ_DATA:
+        if (++sim.bit_count < 32)
+        {
+            sim.target_swdio = (sim.data >> sim.bit_count) & 0x1;
+        }
+        else if (sim.bit_count == 32)
+        {
+            sim.target_swdio = ParityEvenUint32(sim.data);
+        }
+        else
+        {
+            swd_skip(sim.turnaround);
+        }
+        break;
+
+    case SWD_TURNAROUND_WRITE:
+        if (++sim.bit_count == sim.turnaround)
+        {
+            sim.bit_count = 0;
+            sim.data = 0;
+            sim.swd_state = SWD_WRITE_DATA;
+        }
+        break;
+
+    case SWD_WRITE_DATA:
+        if (sim.bit_count < 32)
+        {
+            sim.data |= bit << sim.bit_count;
+            sim.bit_count++;
+        }
+        else
+        {
+            swd_write_done(bit);
+            sim.swd_state = SWD_IDLE;
+        }
+        break;
+
+    case SWD_SKIP:
+        if (--sim.bit_count == 0)
+        {
+            sim.swd_state = SWD_IDLE;
+        }
+        break;
+    }
+}
+
+
+static void jtag_capture_dr()
+{
+    uint32_t ack = JTAG_ACK_OK_FAULT;
+
+    switch (sim.ir)
+    {
+    case JTAG_IDCODE:
+        sim.dr_shift = sim.config.jtag_idcode;
+        sim.dr_length = 32;
+        break;
+
+    case JTAG_DPACC:
+    case JTAG_APACC:
+        sim.jtag_wait = 0;
+        if (sim.ir == JTAG_APACC)
+        {
+            switch (ap_check())
+            {
+            case DAP_TRANSFER_WAIT:
+                sim.jtag_wait = 1;
+                ack = JTAG_ACK_WAIT;
+                sim.stats.wait++;
+                break;
+            case DAP_TRANSFER_FAULT:
+                sim.stats.fault++;
+                break;
+            default:
+                sim.stats.ok++;
+                break;
+            }
+        }
+        else
+        {
+            sim.stats.ok++;
+        }
+        sim.dr_shift = ((uint64_t)sim.jtag_result << 3) | ack;
+        sim.dr_length = JTAG_ACC_LENGTH;
+        break;
+
+    case JTAG_ABORT:
+        sim.dr_shift = 0;
+        sim.dr_length = JTAG_ACC_LENGTH;
+        break;
+
+    default: // BYPASS
+        sim.dr_shift = 0;
+        sim.dr_length = 1;
+        break;
+    }
+}
+
+static void jtag_update_dr()
+{
+    uint32_t rnw = sim.dr_shift & 0x1;
+    uint32_t addr = ((sim.dr_shift >> 1) & 0x3) << 2;
+    uint32_t data = (uint32_t)(sim.dr_shift >> 3);
+
+    switch (sim.ir)
+    {
+    case JTAG_DPACC:
+        if (rnw)
+        {
+            sim.jtag_result = dp_read(addr);
+        }
+        else
+        {
+            dp_write(addr, data);
+        }
+        break;
+
+    case JTAG_APACC:
+        if (sim.jtag_wait || (sim.ctrl_stat & CTRL_STICKY))
+        {
+            break; // the access is dropped
+        }
+        if (rnw)
+        {
+            sim.jtag_result = ap_read(addr);
+        }
+        else
+        {
+            ap_write(addr, data);
+        }
+        break;
+
+    case JTAG_ABORT:
+        dp_abort(data);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void jtag_clock(uint32_t tms, uint32_t tdi)
+{
+    switch (sim.tap_state)
+    {
+    case TAP_CAPTURE_DR:
+        jtag_capture_dr();
+        break;
+    case TAP_SHIFT_DR:
+        sim.dr_shift = (sim.dr_shift >> 1) | ((uint64_t)tdi << (sim.dr_length - 1));
+        break;
+    case TAP_UPDATE_DR:
+        jtag_update_dr();
+        break;
+    case TAP_CAPTURE_IR:
+        sim.ir_shift = 0x1;
+        break;
+    case TAP_SHIFT_IR:
+        sim.ir_shift = (sim.ir_shift >> 1) | (tdi << 3);
+        break;
+    case TAP_UPDATE_IR:
+        sim.ir = sim.ir_shift;
+        break;
+    default:
+        break;
+    }
+
+    sim.tap_state = kTapNext[sim.tap_state][tms];
+    if (sim.tap_state == TAP_RESET)
+    {
+        sim.ir = JTAG_IDCODE;
+    }
+    else if (sim.tap_state == TAP_SHIFT_DR)
+    {
+        sim.tdo = sim.dr_shift & 0x1;
+    }
+    else if (sim.tap_state == TAP_SHIFT_IR)
+    {
+        sim.tdo = sim.ir_shift & 0x1;
+    }
+}
+
+
+/**
+ * @brief Follow the line resets and the SWJ select sequences on SWDIO/TMS
+ *
+ */
+static void swj_clock(uint32_t bit)
+{
+    if (sim.select_count > 0 || (bit == 0 && sim.ones >= LINE_RESET_ONES))
+    {
+        sim.select_bits |= bit << sim.select_count;
+        if (++sim.select_count == 16)
+        {
+            if (sim.select_bits == SWJ_JTAG_TO_SWD)
+            {
+                sim.mode = TARGET_SIM_SWD;
+                sim.swd_state = SWD_LOCKOUT;
+            }
+            else if (sim.select_bits == SWJ_SWD_TO_JTAG)
+            {
+                sim.mode = TARGET_SIM_JTAG;
+                sim.tap_state = TAP_RESET;
+                sim.ir = JTAG_IDCODE;
+            }
+            sim.select_bits = 0;
+            sim.select_count = 0;
+        }
+    }
+
+    if (!bit)
+    {
+        sim.ones = 0;
+    }
+    else if (++sim.ones == LINE_RESET_ONES && sim.mode == TARGET_SIM_SWD)
+    {
+        swd_line_reset();
+    }
+}
+
+static void target_sim_rising_edge()
+{
+    uint32_t bit;
+
+    sim.stats.clocks++;
+
+    if (sim.mode == TARGET_SIM_JTAG)
+    {
+        swj_clock(sim.host_swdio);
+        if (sim.mode == TARGET_SIM_JTAG)
+        {
+            jtag_clock(sim.host_swdio, sim.tdi);
+        }
+        return;
+    }
+
+    if (sim.target_drive)
+    {
+        bit = sim.target_swdio;
+        sim.ones = 0;
+    }
+    else if (sim.host_drive)
+    {
+        bit = sim.host_swdio;
+        swj_clock(bit);
+    }
+    else
+    {
+        bit = 1; // pull-up
+    }
+
+    if (sim.mode == TARGET_SIM_SWD)
+    {
+        swd_clock(bit);
+    }
+}
+
+
+static void target_sim_port_setup(uint32_t port)
+{
+    (void)port;
+}
+
+static void target_sim_swclk_tck_out(uint32_t bit)
+{
+    if (bit && !sim.swclk)
+    {
+        target_sim_rising_edge();
+    }
+    sim.swclk = bit;
+}
+
+static void target_sim_swdio_tms_out(uint32_t bit)
+{
+    sim.host_swdio = bit;
+}
+
+static uint32_t target_sim_swdio_tms_in(void)
+{
+    if (sim.target_drive)
+    {
+        return sim.target_swdio;
+    }
+    return sim.host_drive ? sim.host_swdio : 1;
+}
+
+static void target_sim_swdio_out_enable(uint32_t enable)
+{
+    sim.host_drive = enable;
+}
+
+static void target_sim_tdi_out(uint32_t bit)
+{
+    sim.tdi = bit;
+}
+
+static uint32_t target_sim_tdo_in(void)
+{
+    return sim.mode == TARGET_SIM_JTAG ? sim.tdo : 1;
+}
+
+static void target_sim_ntrst_out(uint32_t bit)
+{
+    if (!bit && sim.mode == TARGET_SIM_JTAG)
+    {
+        sim.tap_state = TAP_RESET;
+        sim.ir = JTAG_IDCODE;
+    }
+}
+
+static void target_sim_nreset_out(uint32_t bit)
+{
+    sim.nreset = bit;
+}
+
+static uint32_t target_sim_nreset_in(void)
+{
+    return sim.nreset;
+}
+
+static uint32_t target_sim_timestamp_get(void)
+{
+    // one tick per clock, so that the timestamps do not depend on the host
+    return (uint32_t)sim.stats.clocks;
+}
+
+const dap_hal_t kTargetSimHal = {
+    .port_setup = target_sim_port_setup,
+    .swclk_tck_out = target_sim_swclk_tck_out,
+    .swdio_tms_out = target_sim_swdio_tms_out,
+    .swdio_tms_in = target_sim_swdio_tms_in,
+    .swdio_out_enable = target_sim_swdio_out_enable,
+    .tdi_out = target_sim_tdi_out,
+    .tdo_in = target_sim_tdo_in,
+    .ntrst_out = target_sim_ntrst_out,
+    .nreset_out = target_sim_nreset_out,
+    .nreset_in = target_sim_nreset_in,
+    .timestamp_get = target_sim_timestamp_get,
+};
+
+
+void target_sim_init(const target_sim_config_t *config)
+{
+    uint8_t *ram = sim.ram;
+
+    if (config == NULL)
+    {
+        config = &kTargetSimDefaultConfig;
+    }
+    if (ram == NULL || sim.config.ram_size != config->ram_size)
+    {
+        free(ram);
+        ram = malloc(config->ram_size);
+    }
+
+    memset(&sim, 0, sizeof(sim));
+    sim.config = *config;
+    sim.mode = config->mode;
+    sim.ram = ram;
+    memset(sim.ram, 0, config->ram_size);
+
+    sim.swclk = 1;
+    sim.host_swdio = 1;
+    sim.host_drive = 1;
+    sim.nreset = 1;
+    sim.swd_state = SWD_LOCKOUT;
+    sim.turnaround = 1;
+    sim.reset_state = 1;
+    sim.tap_state = TAP_RESET;
+    sim.ir = JTAG_IDCODE;
+}
+
+void target_sim_inject(target_sim_error_t error, uint32_t after, uint32_t count)
+{
+    sim.inject_error = error;
+    sim.inject_after = after;
+    sim.inject_count = count;
+}
+
+uint8_t *target_sim_memory()
+{
+    return sim.ram;
+}
+
+const target_sim_stats_t *target_sim_stats()
+{
+    return &sim.stats;
+}
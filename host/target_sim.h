@@ -0,0 +1,88 @@
+/**
+ * @file target_sim.h
+ * @brief Bit-level model of a Cortex-M debug port, for the host build
+ *
+ * Plugged under the DAP core with dap_hal_set(&kTargetSimHal), it answers on
+ * SWCLK/SWDIO and TCK/TMS/TDI/TDO as an SWJ-DP would:
+ *       - SW-DP with IDCODE, ABORT, CTRL/STAT, DLCR, SELECT, RESEND and RDBUFF,
+ *         line reset, protocol error lockout, sticky errors and overrun detection
+ *       - JTAG TAP with a 4 bit IR and the ABORT, DPACC, APACC, IDCODE and
+ *         BYPASS chains
+ *       - a MEM-AP at APSEL 0, with TAR auto-increment and a RAM array
+ *       - WAIT and FAULT responses injected at a given AP access
+ *
+ * The model runs on the clock edges driven by the DAP, so the GPIO and the
+ * emulated SPI transfers are checked the same way, and every run is
+ * deterministic.
+ *
+ * @version 0.1
+ * @date 2022-08-09
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __TARGET_SIM_H__
+#define __TARGET_SIM_H__
+
+#include <stdint.h>
+
+#include "components/DAP/config/DAP_config.h"
+
+typedef enum
+{
+    TARGET_SIM_SWD = 0,
+    TARGET_SIM_JTAG,
+} target_sim_mode_t;
+
+typedef enum
+{
+    TARGET_SIM_WAIT = 0,
+    TARGET_SIM_FAULT, // answered with FAULT, and STICKYERR is set as after a bus error
+} target_sim_error_t;
+
+typedef struct
+{
+    target_sim_mode_t mode; // protocol at power up, switched by the SWJ select sequences
+    uint32_t dpidr;         // SW-DP IDCODE
+    uint32_t jtag_idcode;   // JTAG-DP IDCODE
+    uint32_t ap_idr;
+    uint32_t ram_base;
+    uint32_t ram_size;
+} target_sim_config_t;
+
+typedef struct
+{
+    uint64_t clocks;         // rising edges of SWCLK/TCK
+    uint32_t ok;             // transfers answered with OK
+    uint32_t wait;
+    uint32_t fault;
+    uint32_t protocol_error; // requests that were not answered
+    uint32_t line_reset;
+    uint32_t mem_read;       // MEM-AP data accesses
+    uint32_t mem_write;
+    uint32_t bus_error;
+} target_sim_stats_t;
+
+extern const dap_hal_t kTargetSimHal;
+
+/**
+ * @brief Power up the target. The RAM is cleared.
+ *
+ * @param config The configuration, or NULL for a Cortex-M4 with 64KB of RAM at 0x20000000
+ */
+void target_sim_init(const target_sim_config_t *config);
+
+/**
+ * @brief Answer AP accesses with WAIT or FAULT
+ *
+ * @param error The response
+ * @param after Number of AP accesses to let through first
+ * @param count Number of AP accesses to answer with the error, retries included
+ */
+void target_sim_inject(target_sim_error_t error, uint32_t after, uint32_t count);
+
+uint8_t *target_sim_memory();
+const target_sim_stats_t *target_sim_stats();
+
+#endif
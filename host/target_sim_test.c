@@ -0,0 +1,636 @@
+/**
+ * @file target_sim_test.c
+ * @brief Test of the DAP engines against the target model, without a server
+ *
+ * Runs DAP commands straight through DAP_ExecuteCommand() with each engine,
+ * SPI, GPIO fast and GPIO normal, and checks the responses against what the
+ * target model holds in its RAM:
+ *       - words written with DAP_Transfer and DAP_TransferBlock are in the RAM,
+ *         and read back the same
+ *       - WAIT answers are retried, the data is not changed by them
+ *       - a FAULT ends the command at the access that got it, the accesses
+ *         before it are done and the ones after it are not
+ *       - a run of 255 writes in one DAP_Transfer, which SWD_WriteRun() sends
+ *         in SPI mode, with WAIT in the middle, FAULT on the last write, and
+ *         DAP_TransferAbort while a write is held in WAIT
+ *       - every SWD turnaround, with and without the data phase on WAIT and
+ *         FAULT, and with idle cycles after each transfer
+ *       - the same transfers through the JTAG-DP, and the IDCODE read with
+ *         DAP_JTAG_IDCODE and with a DAP_JTAG_Sequence capturing TDO
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_hal.h"
+
+#include "host/dap_test.h"
+#include "host/target_sim.h"
+
+// Larger than any command of the tests, which do not go through a transport
+#define TARGET_SIM_TEST_BUFFER_SIZE 2048
+#define TARGET_SIM_TEST_RAM_ADDRESS 0x20000000U
+// TAR auto-increment wraps in its 1KB page
+#define TARGET_SIM_TEST_RAM_WORDS 256
+// The longest write run, the count of a DAP_Transfer is 8-bit
+#define TARGET_SIM_TEST_RUN 255
+#define TARGET_SIM_TEST_WAIT_RETRY 0xFFFF
+// WAIT answers seen before the abort is raised
+#define TARGET_SIM_TEST_ABORT_WAITS 1000
+
+typedef struct
+{
+    const char *name;
+    uint32_t clock;
+    uint8_t speed; // SWD_TransferSpeed selected by the clock
+} target_sim_test_engine_t;
+
+static const target_sim_test_engine_t kTargetSimTestEngine[] = {
+    {"SPI", 10000000U, kTransfer_SPI},
+    {"GPIO_fast", 5000000U, kTransfer_GPIO_fast},
+    {"GPIO_normal", 1000000U, kTransfer_GPIO_normal},
+};
+
+static uint8_t target_sim_test_request[TARGET_SIM_TEST_BUFFER_SIZE];
+static uint8_t target_sim_test_response[TARGET_SIM_TEST_BUFFER_SIZE];
+
+static int target_sim_test_command(const uint8_t *request, uint32_t length, uint8_t *response)
+{
+    memcpy(target_sim_test_request, request, length);
+    return DAP_ExecuteCommand(target_sim_test_request, response) & 0xFFFF;
+}
+
+/**
+ * @brief Run the command built in target_sim_test_request
+ *
+ */
+static void target_sim_test_run()
+{
+    DAP_ExecuteCommand(target_sim_test_request, target_sim_test_response);
+}
+
+static uint32_t target_sim_test_word(uint32_t index, uint32_t seed)
+{
+    return seed ^ (index * 0x9E3779B1U);
+}
+
+static uint32_t target_sim_test_ram_word(uint32_t index)
+{
+    const uint8_t *ram = target_sim_memory() + index * 4;
+
+    return ram[0] | (ram[1] << 8) | (ram[2] << 16) | ((uint32_t)ram[3] << 24);
+}
+
+static uint32_t target_sim_test_get_le32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void target_sim_test_put_le32(uint8_t *data, uint32_t value)
+{
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+    data[2] = (value >> 16) & 0xFF;
+    data[3] = value >> 24;
+}
+
+static void target_sim_test_set_tar(uint32_t index)
+{
+    uint8_t response[8];
+    uint8_t request[8] = {ID_DAP_Transfer, 0, 1, DAP_TRANSFER_APnDP | DAP_TEST_AP_TAR};
+
+    target_sim_test_put_le32(&request[4], TARGET_SIM_TEST_RAM_ADDRESS + index * 4);
+    DAP_TEST_CHECK(target_sim_test_command(request, sizeof(request), response) == 3);
+    DAP_TEST_CHECK(response[1] == 1 && response[2] == DAP_TRANSFER_OK);
+}
+
+/**
+ * @brief Clear the sticky errors a FAULT leaves behind
+ *
+ */
+static void target_sim_test_clear_errors()
+{
+    const uint8_t request[] = {ID_DAP_Transfer, 0, 1, DP_ABORT, 0x1E, 0x00, 0x00, 0x00};
+    uint8_t response[8];
+
+    DAP_TEST_CHECK(target_sim_test_command(request, sizeof(request), response) == 3);
+    DAP_TEST_CHECK(response[1] == 1 && response[2] == DAP_TRANSFER_OK);
+}
+
+/**
+ * @brief Build a DAP_Transfer of count writes to DRW, of the words from index
+ *
+ */
+static void target_sim_test_build_writes(uint32_t count, uint32_t index, uint32_t seed)
+{
+    uint8_t *p = target_sim_test_request;
+    uint32_t i;
+
+    *p++ = ID_DAP_Transfer;
+    *p++ = 0;
+    *p++ = count;
+    for (i = 0; i < count; i++)
+    {
+        *p++ = DAP_TRANSFER_APnDP | DAP_TEST_AP_DRW;
+        target_sim_test_put_le32(p, target_sim_test_word(index + i, seed));
+        p += 4;
+    }
+}
+
+static void target_sim_test_build_block_write(uint32_t count, uint32_t seed)
+{
+    uint32_t i;
+
+    target_sim_test_request[0] = ID_DAP_TransferBlock;
+    target_sim_test_request[1] = 0;
+    target_sim_test_request[2] = count & 0xFF;
+    target_sim_test_request[3] = count >> 8;
+    target_sim_test_request[4] = DAP_TRANSFER_APnDP | DAP_TEST_AP_DRW;
+    for (i = 0; i < count; i++)
+    {
+        target_sim_test_put_le32(&target_sim_test_request[5 + i * 4], target_sim_test_word(i, seed));
+    }
+}
+
+static void target_sim_test_check_ram(uint32_t count, uint32_t seed)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        DAP_TEST_CHECK(target_sim_test_ram_word(i) == target_sim_test_word(i, seed));
+    }
+}
+
+/**
+ * @brief Read the first count words of the RAM back with DAP_TransferBlock
+ *
+ */
+static void target_sim_test_check_block_read(uint32_t count, uint32_t seed)
+{
+    uint32_t i;
+
+    target_sim_test_set_tar(0);
+    target_sim_test_request[0] = ID_DAP_TransferBlock;
+    target_sim_test_request[1] = 0;
+    target_sim_test_request[2] = count & 0xFF;
+    target_sim_test_request[3] = count >> 8;
+    target_sim_test_request[4] = DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TEST_AP_DRW;
+    target_sim_test_run();
+
+    DAP_TEST_CHECK((uint32_t)(target_sim_test_response[1] | (target_sim_test_response[2] << 8)) == count);
+    DAP_TEST_CHECK(target_sim_test_response[3] == DAP_TRANSFER_OK);
+    for (i = 0; i < count; i++)
+    {
+        DAP_TEST_CHECK(target_sim_test_get_le32(&target_sim_test_response[4 + i * 4]) == target_sim_test_word(i, seed));
+    }
+}
+
+/**
+ * @brief Words written one request each with DAP_Transfer, and read back the same way
+ *
+ */
+static void target_sim_test_transfer(uint32_t seed)
+{
+    const uint32_t count = 48;
+    uint32_t i;
+
+    memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+    target_sim_test_set_tar(0);
+    target_sim_test_build_writes(count, 0, seed);
+    target_sim_test_run();
+    DAP_TEST_CHECK(target_sim_test_response[1] == count && target_sim_test_response[2] == DAP_TRANSFER_OK);
+    target_sim_test_check_ram(count, seed);
+
+    target_sim_test_set_tar(0);
+    target_sim_test_request[0] = ID_DAP_Transfer;
+    target_sim_test_request[1] = 0;
+    target_sim_test_request[2] = count;
+    memset(&target_sim_test_request[3], DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TEST_AP_DRW, count);
+    target_sim_test_run();
+    DAP_TEST_CHECK(target_sim_test_response[1] == count && target_sim_test_response[2] == DAP_TRANSFER_OK);
+    for (i = 0; i < count; i++)
+    {
+        DAP_TEST_CHECK(target_sim_test_get_le32(&target_sim_test_response[3 + i * 4]) == target_sim_test_word(i, seed));
+    }
+}
+
+/**
+ * @brief A whole page of the RAM written and read back with DAP_TransferBlock
+ *
+ */
+static void target_sim_test_block(uint32_t seed)
+{
+    memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+    target_sim_test_set_tar(0);
+    target_sim_test_build_block_write(TARGET_SIM_TEST_RAM_WORDS, seed);
+    target_sim_test_run();
+    DAP_TEST_CHECK((target_sim_test_response[1] | (target_sim_test_response[2] << 8)) == TARGET_SIM_TEST_RAM_WORDS);
+    DAP_TEST_CHECK(target_sim_test_response[3] == DAP_TRANSFER_OK);
+    target_sim_test_check_ram(TARGET_SIM_TEST_RAM_WORDS, seed);
+
+    target_sim_test_check_block_read(TARGET_SIM_TEST_RAM_WORDS, seed);
+}
+
+/**
+ * @brief WAIT in the middle of block writes and reads is retried, nothing is lost
+ *
+ */
+static void target_sim_test_wait(uint32_t seed)
+{
+    const uint32_t count = 32;
+    uint32_t waits;
+
+    memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+    target_sim_test_set_tar(0);
+    waits = target_sim_stats()->wait;
+    target_sim_inject(TARGET_SIM_WAIT, 5, 3);
+    target_sim_test_build_block_write(count, seed);
+    target_sim_test_run();
+    DAP_TEST_CHECK(target_sim_test_response[1] == count && target_sim_test_response[3] == DAP_TRANSFER_OK);
+    DAP_TEST_CHECK(target_sim_stats()->wait == waits + 3);
+    target_sim_test_check_ram(count, seed);
+
+    // the block read sets TAR first, the WAIT lands on the reads
+    target_sim_inject(TARGET_SIM_WAIT, 1 + 7, 3);
+    target_sim_test_check_block_read(count, seed);
+    DAP_TEST_CHECK(target_sim_stats()->wait == waits + 6);
+}
+
+/**
+ * @brief A FAULT stops DAP_Transfer and DAP_TransferBlock at the write that got it
+ *
+ */
+static void target_sim_test_fault(uint32_t seed)
+{
+    const uint32_t count = 16;
+    const uint32_t good = 10;
+    uint32_t i;
+
+    memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+    target_sim_test_set_tar(0);
+    target_sim_inject(TARGET_SIM_FAULT, good, 1);
+    target_sim_test_build_writes(count, 0, seed);
+    target_sim_test_run();
+    DAP_TEST_CHECK(target_sim_test_response[1] == good && target_sim_test_response[2] == DAP_TRANSFER_FAULT);
+    target_sim_test_check_ram(good, seed);
+    for (i = good; i < count; i++)
+    {
+        DAP_TEST_CHECK(target_sim_test_ram_word(i) == 0);
+    }
+    target_sim_test_clear_errors();
+
+    memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+    target_sim_test_set_tar(0);
+    target_sim_inject(TARGET_SIM_FAULT, good, 1);
+    target_sim_test_build_block_write(count, seed);
+    target_sim_test_run();
+    DAP_TEST_CHECK(target_sim_test_response[1] == good && target_sim_test_response[3] == DAP_TRANSFER_FAULT);
+    target_sim_test_check_ram(good, seed);
+    for (i = good; i < count; i++)
+    {
+        DAP_TEST_CHECK(target_sim_test_ram_word(i) == 0);
+    }
+    target_sim_test_clear_errors();
+}
+
+static void target_sim_test_set_retry(uint32_t retry)
+{
+    const uint8_t request[] = {ID_DAP_TransferConfigure, 0, retry & 0xFF, retry >> 8, 0, 0};
+    uint8_t response[8];
+
+    DAP_TEST_CHECK(target_sim_test_command(request, sizeof(request), response) == 2 && response[1] == DAP_OK);
+}
+
+static void target_sim_test_set_idle(uint32_t idle)
+{
+    const uint8_t request[] = {ID_DAP_TransferConfigure, idle, 100, 0, 0, 0};
+    uint8_t response[8];
+
+    DAP_TEST_CHECK(target_sim_test_command(request, sizeof(request), response) == 2 && response[1] == DAP_OK);
+}
+
+/**
+ * @brief Raise DAP_TransferAbort once the write held in WAIT has been retried
+ * for a while, as the transport does when the host sends DAP_TransferAbort
+ *
+ */
+static void *target_sim_test_abort_thread(void *argument)
+{
+    uint32_t waits = *(uint32_t *)argument;
+
+    while (target_sim_stats()->wait - waits < TARGET_SIM_TEST_ABORT_WAITS)
+    {
+        usleep(100);
+    }
+    DAP_TransferAbort = 1U;
+    return NULL;
+}
+
+/**
+ * @brief Runs of 255 writes, through SWD_WriteRun() with the SPI engine and
+ * one write at a time with the others, give the same results
+ *
+ */
+static void target_sim_test_write_run(uint32_t seed)
+{
+    const uint32_t middle = 100;
+    pthread_t abort_thread;
+    uint32_t waits;
+    uint32_t i;
+
+    // the whole run
+    memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+    target_sim_test_set_tar(0);
+    target_sim_test_build_writes(TARGET_SIM_TEST_RUN, 0, seed);
+    target_sim_test_run();
+    DAP_TEST_CHECK(target_sim_test_response[1] == TARGET_SIM_TEST_RUN);
+    DAP_TEST_CHECK(target_sim_test_response[2] == DAP_TRANSFER_OK);
+    target_sim_test_check_ram(TARGET_SIM_TEST_RUN, seed);
+
+    // WAIT in the middle is retried, the run goes on
+    memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+    target_sim_test_set_tar(0);
+    waits = target_sim_stats()->wait;
+    target_sim_inject(TARGET_SIM_WAIT, middle, 3);
+    target_sim_test_build_writes(TARGET_SIM_TEST_RUN, 0, seed);
+    target_sim_test_run();
+    DAP_TEST_CHECK(target_sim_test_response[1] == TARGET_SIM_TEST_RUN);
+    DAP_TEST_CHECK(target_sim_test_response[2] == DAP_TRANSFER_OK);
+    DAP_TEST_CHECK(target_sim_stats()->wait == waits + 3);
+    target_sim_test_check_ram(TARGET_SIM_TEST_RUN, seed);
+
+    // FAULT on the last write, which is not counted
+    memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+    target_sim_test_set_tar(0);
+    target_sim_inject(TARGET_SIM_FAULT, TARGET_SIM_TEST_RUN - 1, 1);
+    target_sim_test_build_writes(TARGET_SIM_TEST_RUN, 0, seed);
+    target_sim_test_run();
+    DAP_TEST_CHECK(target_sim_test_response[1] == TARGET_SIM_TEST_RUN - 1);
+    DAP_TEST_CHECK(target_sim_test_response[2] == DAP_TRANSFER_FAULT);
+    target_sim_test_check_ram(TARGET_SIM_TEST_RUN - 1, seed);
+    DAP_TEST_CHECK(target_sim_test_ram_word(TARGET_SIM_TEST_RUN - 1) == 0);
+    target_sim_test_clear_errors();
+
+    // aborted while a write in the middle is held in WAIT
+    memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+    target_sim_test_set_retry(TARGET_SIM_TEST_WAIT_RETRY);
+    target_sim_test_set_tar(0);
+    waits = target_sim_stats()->wait;
+    target_sim_inject(TARGET_SIM_WAIT, middle, 0xFFFFFFFF);
+    target_sim_test_build_writes(TARGET_SIM_TEST_RUN, 0, seed);
+    DAP_TEST_CHECK(pthread_create(&abort_thread, NULL, target_sim_test_abort_thread, &waits) == 0);
+    target_sim_test_run();
+    pthread_join(abort_thread, NULL);
+    DAP_TEST_CHECK(target_sim_test_response[1] == middle);
+    DAP_TEST_CHECK(target_sim_test_response[2] == DAP_TRANSFER_WAIT);
+    DAP_TEST_CHECK(target_sim_stats()->wait - waits < TARGET_SIM_TEST_WAIT_RETRY);
+    target_sim_test_check_ram(middle, seed);
+    for (i = middle; i < TARGET_SIM_TEST_RUN; i++)
+    {
+        DAP_TEST_CHECK(target_sim_test_ram_word(i) == 0);
+    }
+
+    // DAPABORT gives up the stalled AP access, as a debugger does after the abort
+    target_sim_test_request[0] = ID_DAP_Transfer;
+    target_sim_test_request[1] = 0;
+    target_sim_test_request[2] = 1;
+    target_sim_test_request[3] = DP_ABORT;
+    target_sim_test_put_le32(&target_sim_test_request[4], 0x1F);
+    target_sim_test_run();
+    DAP_TEST_CHECK(target_sim_test_response[1] == 1 && target_sim_test_response[2] == DAP_TRANSFER_OK);
+    target_sim_test_set_retry(100);
+}
+
+#define TARGET_SIM_TEST_COMMAND(...)                                          \
+    do                                                                    \
+    {                                                                     \
+        const uint8_t _request[] = {__VA_ARGS__};                         \
+        memcpy(target_sim_test_request, _request, sizeof(_request));      \
+        target_sim_test_run();                                            \
+        DAP_TEST_CHECK(target_sim_test_response[0] == _request[0]);       \
+    } while (0)
+
+/**
+ * @brief Give the target and the probe the same SWD configuration
+ *
+ * @param turnaround 1 to 4 cycles
+ * @param data_phase Whether WAIT and FAULT have a data phase, ORUNDETECT on the target
+ */
+static void target_sim_test_swd_configure(uint32_t turnaround, uint32_t data_phase)
+{
+    // DLCR. The write is taken, but the RDBUFF read the probe checks it
+    // with already sees the new turnaround on the target
+    TARGET_SIM_TEST_COMMAND(ID_DAP_Transfer, 0, 2,
+                            DP_SELECT, 0x01, 0x00, 0x00, 0x00,
+                            DP_CTRL_STAT, 0x00, turnaround - 1, 0x00, 0x00);
+    DAP_TEST_CHECK(target_sim_test_response[1] == 2);
+    TARGET_SIM_TEST_COMMAND(ID_DAP_SWD_Configure, (turnaround - 1) | (data_phase << 2));
+    DAP_TEST_CHECK(target_sim_test_response[1] == DAP_OK);
+
+    // line reset, idle, and IDCODE to get back in step
+    TARGET_SIM_TEST_COMMAND(ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+    TARGET_SIM_TEST_COMMAND(ID_DAP_SWJ_Sequence, 8, 0x00);
+    TARGET_SIM_TEST_COMMAND(ID_DAP_Transfer, 0, 2,
+                            DAP_TRANSFER_RnW | DP_IDCODE,
+                            DP_ABORT, 0x1E, 0x00, 0x00, 0x00);
+    DAP_TEST_CHECK(target_sim_test_response[1] == 2 && target_sim_test_response[2] == DAP_TRANSFER_OK);
+
+    // DLCR read back, then bank 0, with the power up requests kept
+    TARGET_SIM_TEST_COMMAND(ID_DAP_Transfer, 0, 3,
+                            DAP_TRANSFER_RnW | DP_CTRL_STAT,
+                            DP_SELECT, 0x00, 0x00, 0x00, 0x00,
+                            DP_CTRL_STAT, data_phase, 0x00, 0x00, 0x50);
+    DAP_TEST_CHECK(target_sim_test_response[1] == 3 && target_sim_test_response[2] == DAP_TRANSFER_OK);
+    DAP_TEST_CHECK(target_sim_test_get_le32(&target_sim_test_response[3]) == (turnaround - 1) << 8);
+}
+
+/**
+ * @brief The engine keeps in step with the target for every turnaround and
+ * data phase, through WAIT and FAULT answers, and clocks the idle cycles
+ *
+ */
+static void target_sim_test_swd_turnaround(uint32_t seed)
+{
+    const uint32_t count = 64;
+    const uint32_t idle = 3;
+    uint32_t turnaround, data_phase;
+    uint32_t protocol_error;
+    uint64_t clocks;
+    uint32_t i;
+
+    for (turnaround = 1; turnaround <= 4; turnaround++)
+    {
+        for (data_phase = 0; data_phase <= 1; data_phase++)
+        {
+            target_sim_test_swd_configure(turnaround, data_phase);
+            protocol_error = target_sim_stats()->protocol_error;
+
+            memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+            target_sim_test_set_tar(0);
+            target_sim_test_build_block_write(count, seed + turnaround);
+            clocks = target_sim_stats()->clocks;
+            target_sim_test_run();
+            clocks = target_sim_stats()->clocks - clocks;
+            DAP_TEST_CHECK(target_sim_test_response[1] == count && target_sim_test_response[3] == DAP_TRANSFER_OK);
+            target_sim_test_check_ram(count, seed + turnaround);
+
+            // the same writes again, with idle cycles after each transfer and the RDBUFF check
+            target_sim_test_set_idle(idle);
+            target_sim_test_set_tar(0);
+            target_sim_test_build_block_write(count, seed + turnaround);
+            clocks += (count + 1) * idle + target_sim_stats()->clocks;
+            target_sim_test_run();
+            DAP_TEST_CHECK(target_sim_stats()->clocks == clocks);
+            DAP_TEST_CHECK(target_sim_test_response[1] == count && target_sim_test_response[3] == DAP_TRANSFER_OK);
+            target_sim_test_check_block_read(count, seed + turnaround);
+            target_sim_test_set_idle(0);
+
+            if (!data_phase)
+            {
+                // with overrun detection a WAIT sets STICKYORUN, and the retry gets FAULT
+                memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+                target_sim_test_set_tar(0);
+                target_sim_inject(TARGET_SIM_WAIT, 10, 2);
+                target_sim_test_build_block_write(count, seed);
+                target_sim_test_run();
+                DAP_TEST_CHECK(target_sim_test_response[1] == count && target_sim_test_response[3] == DAP_TRANSFER_OK);
+                target_sim_test_check_ram(count, seed);
+            }
+
+            // a FAULT on a write, then the next request must still be understood
+            memset(target_sim_memory(), 0, TARGET_SIM_TEST_RAM_WORDS * 4);
+            target_sim_test_set_tar(0);
+            target_sim_inject(TARGET_SIM_FAULT, 10, 1);
+            target_sim_test_build_writes(16, 0, seed);
+            target_sim_test_run();
+            DAP_TEST_CHECK(target_sim_test_response[1] == 10 && target_sim_test_response[2] == DAP_TRANSFER_FAULT);
+            target_sim_test_check_ram(10, seed);
+            for (i = 10; i < 16; i++)
+            {
+                DAP_TEST_CHECK(target_sim_test_ram_word(i) == 0);
+            }
+            target_sim_test_clear_errors();
+
+            // and on a read
+            target_sim_test_set_tar(0);
+            target_sim_inject(TARGET_SIM_FAULT, 10, 1);
+            TARGET_SIM_TEST_COMMAND(ID_DAP_TransferBlock, 0, 16, 0, DAP_TRANSFER_RnW | DAP_TRANSFER_APnDP | DAP_TEST_AP_DRW);
+            // the reads are posted, the data of the tenth is lost with the FAULT
+            DAP_TEST_CHECK(target_sim_test_response[1] == 9 && target_sim_test_response[2] == 0);
+            DAP_TEST_CHECK(target_sim_test_response[3] == DAP_TRANSFER_FAULT);
+            for (i = 0; i < 9; i++)
+            {
+                DAP_TEST_CHECK(target_sim_test_get_le32(&target_sim_test_response[4 + i * 4]) == target_sim_test_word(i, seed));
+            }
+            target_sim_test_clear_errors();
+
+            DAP_TEST_CHECK(target_sim_stats()->protocol_error == protocol_error);
+        }
+    }
+
+    target_sim_test_swd_configure(1, 0);
+}
+
+static void target_sim_test_set_clock(uint32_t clock)
+{
+    const uint8_t request[] = {ID_DAP_SWJ_Clock, clock & 0xFF, (clock >> 8) & 0xFF, (clock >> 16) & 0xFF, clock >> 24};
+    uint8_t response[8];
+
+    DAP_TEST_CHECK(target_sim_test_command(request, sizeof(request), response) == 2 && response[1] == DAP_OK);
+}
+
+/**
+ * @brief Transfers, block transfers and WAIT through the JTAG-DP, with the
+ * scans shifted by the engine of the clock
+ *
+ */
+static void target_sim_test_jtag(const target_sim_test_engine_t *engine, uint32_t seed)
+{
+    const uint32_t idcode = 0x4BA00477;
+
+    TARGET_SIM_TEST_COMMAND(ID_DAP_Connect, DAP_PORT_JTAG);
+    DAP_TEST_CHECK(target_sim_test_response[1] == DAP_PORT_JTAG);
+    // DAP_Connect plans the clock again, the engine depends on the port
+    target_sim_test_set_clock(engine->clock);
+    DAP_TEST_CHECK(SWD_TransferSpeed == engine->speed);
+
+    // SWD to JTAG, and Test-Logic-Reset to Run-Test/Idle
+    TARGET_SIM_TEST_COMMAND(ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+    TARGET_SIM_TEST_COMMAND(ID_DAP_SWJ_Sequence, 16, 0x3C, 0xE7);
+    TARGET_SIM_TEST_COMMAND(ID_DAP_SWJ_Sequence, 8, 0x7F);
+    TARGET_SIM_TEST_COMMAND(ID_DAP_JTAG_Configure, 1, 4);
+    DAP_TEST_CHECK(target_sim_test_response[1] == DAP_OK);
+
+    TARGET_SIM_TEST_COMMAND(ID_DAP_JTAG_IDCODE, 0);
+    DAP_TEST_CHECK(target_sim_test_response[1] == DAP_OK);
+    DAP_TEST_CHECK(target_sim_test_get_le32(&target_sim_test_response[2]) == idcode);
+
+    // IDCODE is still in the IR, scan it again from Run-Test/Idle
+    TARGET_SIM_TEST_COMMAND(ID_DAP_JTAG_Sequence, 6,
+                            JTAG_SEQUENCE_TMS | 1, 0xFF,
+                            2, 0xFF,
+                            JTAG_SEQUENCE_TDO | 31, 0xFF, 0xFF, 0xFF, 0xFF,
+                            JTAG_SEQUENCE_TDO | JTAG_SEQUENCE_TMS | 1, 0xFF,
+                            JTAG_SEQUENCE_TMS | 1, 0xFF,
+                            1, 0xFF);
+    DAP_TEST_CHECK(target_sim_test_response[1] == DAP_OK);
+    DAP_TEST_CHECK((target_sim_test_get_le32(&target_sim_test_response[2]) | (target_sim_test_response[6] << 31)) == idcode);
+
+    // clear the sticky errors, power up, SELECT AP 0 bank 0
+    TARGET_SIM_TEST_COMMAND(ID_DAP_Transfer, 0, 3,
+                            DP_ABORT, 0x1E, 0x00, 0x00, 0x00,
+                            DP_CTRL_STAT, 0x00, 0x00, 0x00, 0x50,
+                            DP_SELECT, 0x00, 0x00, 0x00, 0x00);
+    DAP_TEST_CHECK(target_sim_test_response[1] == 3 && target_sim_test_response[2] == DAP_TRANSFER_OK);
+    TARGET_SIM_TEST_COMMAND(ID_DAP_Transfer, 0, 1,
+                            DAP_TRANSFER_APnDP | DAP_TEST_AP_CSW, 0x12, 0x00, 0x00, 0x23);
+    DAP_TEST_CHECK(target_sim_test_response[1] == 1 && target_sim_test_response[2] == DAP_TRANSFER_OK);
+
+    target_sim_test_transfer(seed);
+    target_sim_test_block(seed + 1);
+    target_sim_test_wait(seed + 2);
+}
+
+int main(int argc, char **argv)
+{
+    const target_sim_test_engine_t *engine;
+    uint32_t protocol_error;
+    uint32_t i;
+
+    target_sim_init(NULL);
+    dap_hal_set(&kTargetSimHal);
+    DAP_Setup();
+
+    for (i = 0; i < sizeof(kTargetSimTestEngine) / sizeof(kTargetSimTestEngine[0]); i++)
+    {
+        engine = &kTargetSimTestEngine[i];
+        dap_test_target_setup(target_sim_test_command);
+        target_sim_test_set_clock(engine->clock);
+        DAP_TEST_CHECK(SWD_TransferSpeed == engine->speed);
+        // the JTAG to SWD sequence is not a request to the SW-DP already selected
+        protocol_error = target_sim_stats()->protocol_error;
+
+        target_sim_test_transfer(0xC0DE0000 + i);
+        target_sim_test_block(0xB10C0000 + i);
+        target_sim_test_wait(0x3A170000 + i);
+        target_sim_test_fault(0xFA170000 + i);
+        target_sim_test_write_run(0x7E570000 + i);
+        DAP_TEST_CHECK(target_sim_stats()->protocol_error == protocol_error);
+        target_sim_test_swd_turnaround(0x7A000000 + i);
+        target_sim_test_jtag(engine, 0x37A60000 + i);
+        printf("%s: OK\n", engine->name);
+    }
+
+    printf("target_sim_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,384 @@
+/**
+ * @file udp_test.c
+ * @brief Host test of main/udp_server.c on the loopback interface
+ *
+ * Loses, duplicates and reorders datagrams the way a Wi-Fi link does, and checks
+ * what the response cache promises:
+ *       - a retransmitted command whose response is cached gets the cached
+ *         response, and is not executed again
+ *       - a write is executed once, however many times it arrives
+ *       - a command from beyond a lost one is held until the lost one is
+ *         sent again, the commands are executed in order
+ *       - a stale retransmit is executed again only if it can be replayed,
+ *         otherwise it is dropped with a warning
+ *       - DAP_TransferAbort gets through a window full of commands stuck in
+ *         WAIT retries
+ *       - another host gets the DAP engine once the session has been idle
+ *         for 3 s
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_metrics.h"
+#include "main/wifi_configuration.h"
+#include "main/udp_server.h"
+
+#include "host/dap_test.h"
+#include "host/target_sim.h"
+
+#define UDP_TEST_HEADER_SIZE 4
+#define UDP_TEST_RETRY_MS 200
+#define UDP_TEST_RETRY_COUNT 25
+// No response within this time means the datagram was dropped
+#define UDP_TEST_SILENCE_MS 300
+#define UDP_TEST_WAIT_RETRY 0xFFFF
+#define UDP_TEST_ABORT_POLL_MS 2
+
+typedef struct
+{
+    uint32_t length;
+    uint8_t data[UDP_TEST_HEADER_SIZE + DAP_PACKET_SIZE];
+} udp_test_datagram_t;
+
+static int udp_test_fd_a; // the host of the session
+static int udp_test_fd_b; // another host
+static uint32_t udp_test_seq = 0;
+
+static int udp_test_open()
+{
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    DAP_TEST_CHECK(fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(DAP_UDP_PORT);
+    DAP_TEST_CHECK(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+static void udp_test_build(udp_test_datagram_t *datagram, uint32_t seq, const uint8_t *request, uint32_t length)
+{
+    datagram->data[0] = seq & 0xFF;
+    datagram->data[1] = (seq >> 8) & 0xFF;
+    datagram->data[2] = (seq >> 16) & 0xFF;
+    datagram->data[3] = (seq >> 24) & 0xFF;
+    memcpy(&datagram->data[UDP_TEST_HEADER_SIZE], request, length);
+    datagram->length = UDP_TEST_HEADER_SIZE + length;
+}
+
+static void udp_test_send(int fd, const udp_test_datagram_t *datagram)
+{
+    // a refused datagram, before the server is up, is lost like any other
+    send(fd, datagram->data, datagram->length, 0);
+}
+
+/**
+ * @brief Wait for the response of a command, the other ones are skipped
+ *
+ * @return Length of the DAP response, or -1 on timeout
+ */
+static int udp_test_recv(int fd, uint32_t seq, uint32_t timeout_ms, uint8_t *response)
+{
+    uint8_t data[UDP_TEST_HEADER_SIZE + DAP_PACKET_SIZE];
+    uint64_t deadline = dap_test_now_ms() + timeout_ms;
+    struct timeval timeout;
+    uint64_t now;
+    ssize_t ret;
+
+    while ((now = dap_test_now_ms()) < deadline)
+    {
+        timeout.tv_sec = (deadline - now) / 1000;
+        timeout.tv_usec = ((deadline - now) % 1000) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        ret = recv(fd, data, sizeof(data), 0);
+        if (ret < UDP_TEST_HEADER_SIZE)
+        {
+            continue;
+        }
+        if ((data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24)) != seq)
+        {
+            continue;
+        }
+        memcpy(response, &data[UDP_TEST_HEADER_SIZE], ret - UDP_TEST_HEADER_SIZE);
+        return ret - UDP_TEST_HEADER_SIZE;
+    }
+    return -1;
+}
+
+/**
+ * @brief Send the next command of the session, again until it is answered, as a host does
+ *
+ */
+static int udp_test_command(const uint8_t *request, uint32_t length, uint8_t *response)
+{
+    udp_test_datagram_t datagram;
+    uint32_t seq = udp_test_seq++;
+    int ret, i;
+
+    udp_test_build(&datagram, seq, request, length);
+    for (i = 0; i < UDP_TEST_RETRY_COUNT; i++)
+    {
+        udp_test_send(udp_test_fd_a, &datagram);
+        ret = udp_test_recv(udp_test_fd_a, seq, UDP_TEST_RETRY_MS, response);
+        if (ret >= 0)
+        {
+            return ret;
+        }
+    }
+    return -1;
+}
+
+static uint32_t udp_test_executed(uint8_t id)
+{
+    return __atomic_load_n(&kDAPMetricsCommand[dap_metrics_command_slot(id)], __ATOMIC_RELAXED);
+}
+
+static void udp_test_build_write(udp_test_datagram_t *datagram, uint32_t seq, uint32_t value)
+{
+    const uint8_t request[] = {
+        ID_DAP_Transfer, 0, 1,
+        DAP_TRANSFER_APnDP | DAP_TEST_AP_DRW,
+        value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24,
+    };
+
+    udp_test_build(datagram, seq, request, sizeof(request));
+}
+
+static uint32_t udp_test_ram_word(uint32_t index)
+{
+    const uint8_t *ram = target_sim_memory() + index * 4;
+
+    return ram[0] | (ram[1] << 8) | (ram[2] << 16) | ((uint32_t)ram[3] << 24);
+}
+
+// Kept for the stale retransmits
+static udp_test_datagram_t udp_test_info;
+static udp_test_datagram_t udp_test_write;
+static uint8_t udp_test_write_response[DAP_PACKET_SIZE];
+
+static void udp_test_cached_response()
+{
+    const uint8_t request[] = {ID_DAP_Info, DAP_ID_PACKET_SIZE};
+    uint8_t first[DAP_PACKET_SIZE], again[DAP_PACKET_SIZE];
+    uint32_t seq = udp_test_seq++;
+    uint32_t executed;
+    int length;
+
+    udp_test_build(&udp_test_info, seq, request, sizeof(request));
+    executed = udp_test_executed(ID_DAP_Info);
+    udp_test_send(udp_test_fd_a, &udp_test_info);
+    length = udp_test_recv(udp_test_fd_a, seq, UDP_TEST_SILENCE_MS, first);
+    DAP_TEST_CHECK(length == 4 && first[0] == ID_DAP_Info);
+
+    // the response is lost, the host sends the command again
+    udp_test_send(udp_test_fd_a, &udp_test_info);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_a, seq, UDP_TEST_SILENCE_MS, again) == length);
+    DAP_TEST_CHECK(memcmp(first, again, length) == 0);
+    DAP_TEST_CHECK(udp_test_executed(ID_DAP_Info) == executed + 1);
+}
+
+static void udp_test_write_once()
+{
+    uint8_t response[DAP_PACKET_SIZE];
+    uint32_t seq = udp_test_seq++;
+    uint32_t mem_write = target_sim_stats()->mem_write;
+    uint32_t executed = udp_test_executed(ID_DAP_Transfer);
+    int length, count = 0;
+
+    udp_test_build_write(&udp_test_write, seq, 0x11223344);
+
+    // duplicated on the way, the copy may find it executing or already answered
+    udp_test_send(udp_test_fd_a, &udp_test_write);
+    udp_test_send(udp_test_fd_a, &udp_test_write);
+    length = udp_test_recv(udp_test_fd_a, seq, UDP_TEST_SILENCE_MS, udp_test_write_response);
+    DAP_TEST_CHECK(length == 3 && udp_test_write_response[1] == 1 && udp_test_write_response[2] == DAP_TRANSFER_OK);
+    while (udp_test_recv(udp_test_fd_a, seq, UDP_TEST_SILENCE_MS, response) >= 0)
+    {
+        DAP_TEST_CHECK(memcmp(response, udp_test_write_response, length) == 0);
+        count++;
+    }
+    DAP_TEST_CHECK(count <= 1);
+
+    // then the response is lost
+    udp_test_send(udp_test_fd_a, &udp_test_write);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_a, seq, UDP_TEST_SILENCE_MS, response) == length);
+    DAP_TEST_CHECK(memcmp(response, udp_test_write_response, length) == 0);
+
+    DAP_TEST_CHECK(target_sim_stats()->mem_write == mem_write + 1);
+    DAP_TEST_CHECK(udp_test_executed(ID_DAP_Transfer) == executed + 1);
+    DAP_TEST_CHECK(udp_test_ram_word(0) == 0x11223344);
+}
+
+static void udp_test_lost_command()
+{
+    udp_test_datagram_t first, second;
+    uint8_t response[DAP_PACKET_SIZE];
+    uint32_t seq = udp_test_seq;
+    uint32_t mem_write = target_sim_stats()->mem_write;
+
+    udp_test_build_write(&first, seq, 0x55667788);
+    udp_test_build_write(&second, seq + 1, 0x99AABBCC);
+    udp_test_seq += 2;
+
+    // the first one is lost, the second one must wait for it
+    udp_test_send(udp_test_fd_a, &second);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_a, seq + 1, UDP_TEST_SILENCE_MS, response) < 0);
+    DAP_TEST_CHECK(target_sim_stats()->mem_write == mem_write);
+
+    // only the lost one is sent again, the second one was kept
+    udp_test_send(udp_test_fd_a, &first);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_a, seq, UDP_TEST_SILENCE_MS, response) == 3);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_a, seq + 1, UDP_TEST_SILENCE_MS, response) == 3);
+
+    // a retransmit of the held one, crossing the response, is not executed again
+    udp_test_send(udp_test_fd_a, &second);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_a, seq + 1, UDP_TEST_SILENCE_MS, response) == 3);
+
+    // executed in order, TAR increments after each write
+    DAP_TEST_CHECK(target_sim_stats()->mem_write == mem_write + 2);
+    DAP_TEST_CHECK(udp_test_ram_word(1) == 0x55667788);
+    DAP_TEST_CHECK(udp_test_ram_word(2) == 0x99AABBCC);
+}
+
+static void udp_test_stale_retransmit()
+{
+    const uint8_t request[] = {ID_DAP_Info, DAP_ID_PACKET_COUNT};
+    uint8_t response[DAP_PACKET_SIZE];
+    char warning[64];
+    uint32_t seq = udp_test_write.data[0] | (udp_test_write.data[1] << 8);
+    uint32_t mem_write, executed;
+    uint32_t i;
+
+    // push the write and the info out of the cache
+    for (i = 0; i < DAP_PACKET_WINDOW; i++)
+    {
+        DAP_TEST_CHECK(udp_test_command(request, sizeof(request), response) == 3);
+    }
+
+    mem_write = target_sim_stats()->mem_write;
+    udp_test_send(udp_test_fd_a, &udp_test_write);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_a, seq, UDP_TEST_SILENCE_MS, response) < 0);
+    DAP_TEST_CHECK(target_sim_stats()->mem_write == mem_write);
+    snprintf(warning, sizeof(warning), "can not replay seq %u\r", (unsigned)seq);
+    DAP_TEST_CHECK(dap_test_wait_log(warning, 1000));
+
+    // DAP_Info does not change the target, it is executed again
+    seq = udp_test_info.data[0] | (udp_test_info.data[1] << 8);
+    executed = udp_test_executed(ID_DAP_Info);
+    udp_test_send(udp_test_fd_a, &udp_test_info);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_a, seq, UDP_TEST_SILENCE_MS, response) == 4);
+    DAP_TEST_CHECK(udp_test_executed(ID_DAP_Info) == executed + 1);
+}
+
+/**
+ * @brief Fill the window with reads the target keeps answering with WAIT,
+ * then end each one with DAP_TransferAbort
+ *
+ */
+static void udp_test_abort()
+{
+    const uint8_t configure[] = {ID_DAP_TransferConfigure, 0, UDP_TEST_WAIT_RETRY & 0xFF,
+                                 UDP_TEST_WAIT_RETRY >> 8, 0, 0};
+    const uint8_t read[] = {ID_DAP_Transfer, 0, 1, DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TEST_AP_DRW};
+    const uint8_t abort[] = {ID_DAP_TransferAbort};
+    const uint8_t clear[] = {ID_DAP_Transfer, 0, 1, DP_ABORT, 0x1F, 0x00, 0x00, 0x00};
+    udp_test_datagram_t datagram;
+    uint8_t response[DAP_PACKET_SIZE];
+    uint32_t seq, waits;
+    uint32_t i;
+
+    DAP_TEST_CHECK(udp_test_command(configure, sizeof(configure), response) == 2 && response[1] == DAP_OK);
+
+    seq = udp_test_seq;
+    waits = target_sim_stats()->wait;
+    target_sim_inject(TARGET_SIM_WAIT, 0, 0xFFFFFFFF);
+    for (i = 0; i < DAP_PACKET_WINDOW; i++)
+    {
+        udp_test_build(&datagram, udp_test_seq++, read, sizeof(read));
+        udp_test_send(udp_test_fd_a, &datagram);
+    }
+
+    // An abort only ends the read being retried, one that lands between two
+    // commands is cleared by the next one: send a new one until the read ends.
+    for (i = 0; i < DAP_PACKET_WINDOW; i++)
+    {
+        do
+        {
+            udp_test_build(&datagram, udp_test_seq++, abort, sizeof(abort));
+            udp_test_send(udp_test_fd_a, &datagram);
+        } while (udp_test_recv(udp_test_fd_a, seq + i, UDP_TEST_ABORT_POLL_MS, response) < 0);
+        DAP_TEST_CHECK(response[0] == ID_DAP_Transfer && response[1] == 0 && response[2] == DAP_TRANSFER_WAIT);
+
+        // An abort dropped for want of a slot would let the first read run all its retries
+        DAP_TEST_CHECK(target_sim_stats()->wait - waits < UDP_TEST_WAIT_RETRY);
+        waits = target_sim_stats()->wait;
+    }
+
+    // DAPABORT gives up the stalled AP access, as a debugger does after the abort
+    DAP_TEST_CHECK(udp_test_command(clear, sizeof(clear), response) == 3 && response[2] == DAP_TRANSFER_OK);
+}
+
+static void udp_test_session_timeout()
+{
+    const uint8_t request[] = {ID_DAP_Info, DAP_ID_PACKET_COUNT};
+    udp_test_datagram_t datagram;
+    uint8_t response[DAP_PACKET_SIZE];
+    uint64_t idle_since;
+
+    // another host, while the session is in use
+    udp_test_build(&datagram, 0, request, sizeof(request));
+    udp_test_send(udp_test_fd_b, &datagram);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_b, 0, UDP_TEST_SILENCE_MS, response) < 0);
+
+    // the session has been idle since the last command
+    idle_since = dap_test_now_ms() - UDP_TEST_SILENCE_MS;
+    DAP_TEST_CHECK(dap_test_wait_log("DAP UDP session timeout", 6000));
+    DAP_TEST_CHECK(dap_test_now_ms() - idle_since >= 3000 - UDP_TEST_RETRY_MS);
+
+    udp_test_send(udp_test_fd_b, &datagram);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_b, 0, UDP_TEST_SILENCE_MS, response) == 3);
+
+    // and now the first host is the other one
+    udp_test_build(&datagram, udp_test_seq, request, sizeof(request));
+    udp_test_send(udp_test_fd_a, &datagram);
+    DAP_TEST_CHECK(udp_test_recv(udp_test_fd_a, udp_test_seq, UDP_TEST_SILENCE_MS, response) < 0);
+}
+
+int main(int argc, char **argv)
+{
+    const uint8_t request[] = {ID_DAP_Info, DAP_ID_PACKET_COUNT};
+    uint8_t response[DAP_PACKET_SIZE];
+
+    dap_test_start(udp_server_task, "udp_server");
+    udp_test_fd_a = udp_test_open();
+    udp_test_fd_b = udp_test_open();
+
+    // seq 0 starts the session, sent until the server is up
+    DAP_TEST_CHECK(udp_test_command(request, sizeof(request), response) == 3);
+    DAP_TEST_CHECK(response[2] == DAP_PACKET_WINDOW);
+    dap_test_target_setup(udp_test_command);
+
+    udp_test_cached_response();
+    udp_test_write_once();
+    udp_test_lost_command();
+    udp_test_stale_retransmit();
+    udp_test_abort();
+    udp_test_session_timeout();
+
+    printf("udp_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,894 @@
+/**
+ * @file usbip_bench.c
+ * @brief End-to-end USBIP throughput and latency benchmark
+ *
+ * A userspace USBIP client that imports the CMSIS-DAP device and pushes DAP
+ * commands through EP1 as pyOCD/OpenOCD would through the vhci driver: an OUT
+ * URB with the command and an IN URB for its response, with up to "depth"
+ * commands in flight. It reports packets/s, bytes/s and the p50/p99 time from
+ * the OUT URB being sent to the response being received.
+ *
+ * Without -c, the USBIP server of main/ is started in the process on the host
+ * build of the DAP core, against the target model of target_sim.c. With -c,
+ * a board is measured the same way.
+ *
+ * Latency and loss can be added on both directions of the link. A lost PDU is
+ * delivered after a retransmission timeout, and holds back everything behind
+ * it, as it would on a TCP stream.
+ *
+ * With -s, the latency is also broken down by stage from the histograms of
+ * the device, see dap_latency.h. They are cleared before each workload.
+ *
+ *   usbip_bench [-c host[:port]] [-w workload] [-n packets] [-d depth]
+ *               [-l latency_us] [-p loss_percent] [-r rto_us] [-k swj_clock_hz]
+ *               [-e events.bin] [-s]
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <arpa/inet.h>
+
+#include "components/USBIP/USBIP_defs.h"
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_event.h"
+#include "components/DAP/include/dap_latency.h"
+
+#include "host/target_sim.h"
+#include "host/usbip_client.h"
+#include "host/usbip_host.h"
+
+#define BENCH_PACKET_SIZE_MAX USBIP_CLIENT_DATA_SIZE_MAX
+#define BENCH_PDU_SIZE_MAX USBIP_CLIENT_PDU_SIZE_MAX
+#define BENCH_DEPTH_MAX 255
+
+// AP register addresses of DAP_Transfer requests
+#define BENCH_AP_CSW 0x00
+#define BENCH_AP_TAR 0x04
+#define BENCH_AP_DRW 0x0C
+
+typedef enum
+{
+    BENCH_BLOCK_READ = 0,
+    BENCH_BLOCK_WRITE,
+    BENCH_TRANSFER,
+    BENCH_WORKLOAD_NUM,
+} bench_workload_t;
+
+static const char *const kBenchWorkloadName[BENCH_WORKLOAD_NUM] = {
+    "block-read",
+    "block-write",
+    "transfer",
+};
+
+
+/**
+ * @brief One direction of the link, with latency and loss injected
+ * PDUs are delivered in order, each one no earlier than the one before it.
+ *
+ */
+#define DELAY_LINE_SIZE 64
+
+typedef struct
+{
+    uint64_t release; // ns, CLOCK_MONOTONIC
+    uint32_t length;
+    uint8_t data[BENCH_PDU_SIZE_MAX];
+} delay_line_item_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    delay_line_item_t item[DELAY_LINE_SIZE];
+    uint32_t head;
+    uint32_t count;
+    uint64_t last_release;
+    uint32_t rand_state;
+    uint32_t lost;
+} delay_line_t;
+
+typedef struct
+{
+    int fd;
+    uint32_t latency_us; // one way
+    uint32_t loss_permille;
+    uint32_t rto_us;
+    int impaired;
+    delay_line_t tx;
+    delay_line_t rx;
+    pthread_t tx_thread;
+    pthread_t rx_thread;
+} bench_link_t;
+
+typedef struct
+{
+    const char *host; // NULL to run the host build in the process
+    uint16_t port;
+    bench_workload_t workload;
+    int all_workloads;
+    uint32_t packets;
+    uint32_t depth;
+    uint32_t clock;
+    const char *events; // where to dump the event rings of the host build
+    int stages;
+} bench_options_t;
+
+static bench_link_t link_state;
+static uint32_t bench_seqnum = 1;
+static uint32_t dap_packet_size = 64;
+static uint32_t dap_packet_count = 1;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+static uint32_t bench_rand(uint32_t *state)
+{
+    // xorshift32, the runs are reproducible
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static uint32_t read_be32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+           ((uint32_t)data[2] << 8) | ((uint32_t)data[3] << 0);
+}
+
+static uint32_t read_le32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 0) | ((uint32_t)data[1] << 8) |
+           ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void write_le32(uint8_t *data, uint32_t value)
+{
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+    data[2] = (value >> 16) & 0xFF;
+    data[3] = (value >> 24) & 0xFF;
+}
+
+
+static void delay_line_init(delay_line_t *line, uint32_t seed)
+{
+    memset(line, 0, sizeof(*line));
+    line->rand_state = seed;
+    pthread_mutex_init(&line->lock, NULL);
+    pthread_cond_init(&line->cond, NULL);
+}
+
+static void delay_line_push(delay_line_t *line, const uint8_t *data, uint32_t length)
+{
+    delay_line_item_t *item;
+    uint64_t release;
+
+    release = now_ns() + (uint64_t)link_state.latency_us * 1000;
+    if (link_state.loss_permille > 0 && bench_rand(&line->rand_state) % 1000 < link_state.loss_permille)
+    {
+        release += (uint64_t)link_state.rto_us * 1000;
+        line->lost++;
+    }
+
+    pthread_mutex_lock(&line->lock);
+    while (line->count >= DELAY_LINE_SIZE)
+    {
+        pthread_cond_wait(&line->cond, &line->lock);
+    }
+
+    // in order, a late PDU holds back the ones behind it
+    if (release < line->last_release)
+    {
+        release = line->last_release;
+    }
+    line->last_release = release;
+
+    item = &line->item[(line->head + line->count) % DELAY_LINE_SIZE];
+    item->release = release;
+    item->length = length;
+    memcpy(item->data, data, length);
+    line->count++;
+    pthread_cond_broadcast(&line->cond);
+    pthread_mutex_unlock(&line->lock);
+}
+
+static uint32_t delay_line_pop(delay_line_t *line, uint8_t *data)
+{
+    delay_line_item_t *item;
+    uint64_t release;
+    uint32_t length;
+
+    pthread_mutex_lock(&line->lock);
+    while (line->count == 0)
+    {
+        pthread_cond_wait(&line->cond, &line->lock);
+    }
+    release = line->item[line->head].release;
+    pthread_mutex_unlock(&line->lock);
+
+    // only this thread pops, the item stays where it is
+    sleep_until_ns(release);
+
+    pthread_mutex_lock(&line->lock);
+    item = &line->item[line->head];
+    length = item->length;
+    memcpy(data, item->data, length);
+    line->head = (line->head + 1) % DELAY_LINE_SIZE;
+    line->count--;
+    pthread_cond_broadcast(&line->cond);
+    pthread_mutex_unlock(&line->lock);
+    return length;
+}
+
+static void *link_tx_thread(void *argument)
+{
+    static uint8_t pdu[BENCH_PDU_SIZE_MAX];
+    uint32_t length;
+
+    for (;;)
+    {
+        length = delay_line_pop(&link_state.tx, pdu);
+        if (usbip_client_write(link_state.fd, pdu, length) < 0)
+        {
+            fprintf(stderr, "link write failed\n");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+static void *link_rx_thread(void *argument)
+{
+    static uint8_t pdu[BENCH_PDU_SIZE_MAX];
+    int length;
+
+    for (;;)
+    {
+        length = usbip_client_read_pdu(link_state.fd, pdu);
+        if (length < 0)
+        {
+            fprintf(stderr, "link read failed\n");
+            exit(1);
+        }
+        delay_line_push(&link_state.rx, pdu, length);
+    }
+    return NULL;
+}
+
+static void link_start()
+{
+    link_state.impaired = link_state.latency_us > 0 || link_state.loss_permille > 0;
+    if (!link_state.impaired)
+    {
+        return;
+    }
+
+    delay_line_init(&link_state.tx, 0x12345678);
+    delay_line_init(&link_state.rx, 0x87654321);
+    pthread_create(&link_state.tx_thread, NULL, link_tx_thread, NULL);
+    pthread_create(&link_state.rx_thread, NULL, link_rx_thread, NULL);
+}
+
+static void link_send(const uint8_t *pdu, uint32_t length)
+{
+    if (link_state.impaired)
+    {
+        delay_line_push(&link_state.tx, pdu, length);
+        return;
+    }
+
+    if (usbip_client_write(link_state.fd, pdu, length) < 0)
+    {
+        fprintf(stderr, "link write failed\n");
+        exit(1);
+    }
+}
+
+static uint32_t link_recv(uint8_t *pdu)
+{
+    int length;
+
+    if (link_state.impaired)
+    {
+        return delay_line_pop(&link_state.rx, pdu);
+    }
+
+    length = usbip_client_read_pdu(link_state.fd, pdu);
+    if (length < 0)
+    {
+        fprintf(stderr, "link read failed\n");
+        exit(1);
+    }
+    return length;
+}
+
+
+
+static uint32_t usbip_submit(uint32_t direction, const uint8_t *data, uint32_t length)
+{
+    uint8_t pdu[BENCH_PDU_SIZE_MAX];
+    usbip_stage2_header *header = (usbip_stage2_header *)pdu;
+    uint32_t seqnum = bench_seqnum++;
+
+    memset(header, 0, sizeof(usbip_stage2_header));
+    header->base.command = htonl(USBIP_STAGE2_REQ_SUBMIT);
+    header->base.seqnum = htonl(seqnum);
+    header->base.devid = htonl((1 << 16) | 1);
+    header->base.direction = htonl(direction);
+    header->base.ep = htonl(1);
+    header->u.cmd_submit.data_length = htonl(direction == USBIP_DIR_OUT ? length : dap_packet_size);
+
+    if (direction == USBIP_DIR_OUT)
+    {
+        memcpy(&pdu[sizeof(usbip_stage2_header)], data, length);
+        link_send(pdu, sizeof(usbip_stage2_header) + length);
+    }
+    else
+    {
+        link_send(pdu, sizeof(usbip_stage2_header));
+    }
+    return seqnum;
+}
+
+/**
+ * @brief Wait for the response of the oldest command in flight
+ *
+ * @param seqnum seqnum of the IN URB of the command
+ * @param response Where the response is copied
+ * @return Length of the response, or -1 if the device failed the URB
+ */
+static int usbip_wait_response(uint32_t seqnum, uint8_t *response)
+{
+    uint8_t pdu[BENCH_PDU_SIZE_MAX];
+    usbip_stage2_header *header = (usbip_stage2_header *)pdu;
+    uint32_t length;
+
+    for (;;)
+    {
+        length = link_recv(pdu);
+        if (read_be32((const uint8_t *)&header->base.command) != USBIP_STAGE2_RSP_SUBMIT)
+        {
+            continue;
+        }
+        if ((int32_t)read_be32((const uint8_t *)&header->u.ret_submit.status) != 0)
+        {
+            fprintf(stderr, "URB %u failed: %d\n", read_be32((const uint8_t *)&header->base.seqnum),
+                    (int32_t)read_be32((const uint8_t *)&header->u.ret_submit.status));
+            return -1;
+        }
+        // The OUT URBs are given back as soon as the command is queued.
+        // The direction of ret_submit is not the one of the URB, match by seqnum.
+        if (read_be32((const uint8_t *)&header->base.seqnum) == seqnum)
+        {
+            memcpy(response, &pdu[sizeof(usbip_stage2_header)], length - sizeof(usbip_stage2_header));
+            return length - sizeof(usbip_stage2_header);
+        }
+    }
+}
+
+static int dap_command(const uint8_t *request, uint32_t length, uint8_t *response)
+{
+    uint32_t seqnum;
+
+    usbip_submit(USBIP_DIR_OUT, request, length);
+    seqnum = usbip_submit(USBIP_DIR_IN, NULL, 0);
+    return usbip_wait_response(seqnum, response);
+}
+
+#define DAP_COMMAND(response, ...)                                            \
+    do                                                                        \
+    {                                                                         \
+        const uint8_t _request[] = {__VA_ARGS__};                             \
+        if (dap_command(_request, sizeof(_request), response) < 0)            \
+        {                                                                     \
+            return -1;                                                        \
+        }                                                                     \
+    } while (0)
+
+/**
+ * @brief Connect to the target in SWD, power up the debug port and point TAR at the RAM
+ *
+ */
+static int dap_target_setup(uint32_t clock)
+{
+    uint8_t response[BENCH_PACKET_SIZE_MAX];
+
+    DAP_COMMAND(response, ID_DAP_Info, DAP_ID_PACKET_SIZE);
+    if (response[1] == 2)
+    {
+        dap_packet_size = response[2] | (response[3] << 8);
+    }
+    DAP_COMMAND(response, ID_DAP_Info, DAP_ID_PACKET_COUNT);
+    if (response[1] == 1)
+    {
+        dap_packet_count = response[2];
+    }
+    if (dap_packet_size > BENCH_PACKET_SIZE_MAX)
+    {
+        dap_packet_size = BENCH_PACKET_SIZE_MAX;
+    }
+
+    DAP_COMMAND(response, ID_DAP_Connect, DAP_PORT_SWD);
+    DAP_COMMAND(response, ID_DAP_SWJ_Clock, clock & 0xFF, (clock >> 8) & 0xFF, (clock >> 16) & 0xFF, clock >> 24);
+    // line reset, JTAG to SWD, line reset, idle
+    DAP_COMMAND(response, ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+    DAP_COMMAND(response, ID_DAP_SWJ_Sequence, 16, 0x9E, 0xE7);
+    DAP_COMMAND(response, ID_DAP_SWJ_Sequence, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+    DAP_COMMAND(response, ID_DAP_SWJ_Sequence, 8, 0x00);
+
+    // IDCODE, clear the sticky errors, power up, SELECT AP 0 bank 0
+    DAP_COMMAND(response, ID_DAP_Transfer, 0, 4,
+                DAP_TRANSFER_RnW | DP_IDCODE,
+                DP_ABORT, 0x1E, 0x00, 0x00, 0x00,
+                DP_CTRL_STAT, 0x00, 0x00, 0x00, 0x50,
+                DP_SELECT, 0x00, 0x00, 0x00, 0x00);
+    if (response[1] != 4 || response[2] != DAP_TRANSFER_OK)
+    {
+        fprintf(stderr, "No target: ack %d\n", response[2]);
+        return -1;
+    }
+    printf("IDCODE 0x%08X\n", read_le32(&response[3]));
+
+    // 32-bit accesses with auto-increment. TAR wraps in its 1KB page, so it is set only once.
+    DAP_COMMAND(response, ID_DAP_Transfer, 0, 2,
+                DAP_TRANSFER_APnDP | BENCH_AP_CSW, 0x12, 0x00, 0x00, 0x23,
+                DAP_TRANSFER_APnDP | BENCH_AP_TAR, 0x00, 0x00, 0x00, 0x20);
+    if (response[1] != 2 || response[2] != DAP_TRANSFER_OK)
+    {
+        fprintf(stderr, "MEM-AP setup failed: ack %d\n", response[2]);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Build the command of a workload
+ *
+ * @return Length of the command
+ */
+static uint32_t bench_build_request(bench_workload_t workload, uint8_t *request, uint32_t index)
+{
+    uint32_t count, i;
+
+    switch (workload)
+    {
+    case BENCH_BLOCK_READ:
+        // as many words as the response can hold, 1KB with 1024 byte packets
+        count = (dap_packet_size - 4) / 4;
+        request[0] = ID_DAP_TransferBlock;
+        request[1] = 0;
+        request[2] = count & 0xFF;
+        request[3] = count >> 8;
+        request[4] = DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | BENCH_AP_DRW;
+        return 5;
+
+    case BENCH_BLOCK_WRITE:
+        count = (dap_packet_size - 5) / 4;
+        request[0] = ID_DAP_TransferBlock;
+        request[1] = 0;
+        request[2] = count & 0xFF;
+        request[3] = count >> 8;
+        request[4] = DAP_TRANSFER_APnDP | BENCH_AP_DRW;
+        for (i = 0; i < count; i++)
+        {
+            write_le32(&request[5 + i * 4], index * 0x10000 + i);
+        }
+        return 5 + count * 4;
+
+    case BENCH_TRANSFER:
+    default:
+        // a single word read, as when polling a register
+        request[0] = ID_DAP_Transfer;
+        request[1] = 0;
+        request[2] = 1;
+        request[3] = DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | BENCH_AP_DRW;
+        return 4;
+    }
+}
+
+static int bench_check_response(const uint8_t *request, const uint8_t *response, int length)
+{
+    if (length < 4 || response[0] != request[0])
+    {
+        return -1;
+    }
+    if (request[0] == ID_DAP_TransferBlock)
+    {
+        return response[3] == DAP_TRANSFER_OK ? 0 : -1;
+    }
+    return response[2] == DAP_TRANSFER_OK ? 0 : -1;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int bench_run(bench_workload_t workload, uint32_t packets, uint32_t depth)
+{
+    static uint8_t request[BENCH_PACKET_SIZE_MAX];
+    static uint8_t response[BENCH_PACKET_SIZE_MAX];
+    uint64_t *sent_at = calloc(packets, sizeof(uint64_t));
+    uint32_t *in_seqnum = calloc(packets, sizeof(uint32_t));
+    uint64_t *latency = calloc(packets, sizeof(uint64_t));
+    uint64_t start, elapsed;
+    uint64_t bytes = 0;
+    uint32_t sent = 0, done = 0;
+    uint32_t length;
+    int response_length;
+
+    if (sent_at == NULL || in_seqnum == NULL || latency == NULL)
+    {
+        return -1;
+    }
+
+    start = now_ns();
+    while (done < packets)
+    {
+        while (sent < packets && sent - done < depth)
+        {
+            length = bench_build_request(workload, request, sent);
+            sent_at[sent] = now_ns();
+            usbip_submit(USBIP_DIR_OUT, request, length);
+            in_seqnum[sent] = usbip_submit(USBIP_DIR_IN, NULL, 0);
+            bytes += length;
+            sent++;
+        }
+
+        // commands are answered in order
+        response_length = usbip_wait_response(in_seqnum[done], response);
+        if (bench_check_response(request, response, response_length) < 0)
+        {
+            fprintf(stderr, "%s: command %u failed\n", kBenchWorkloadName[workload], done);
+            free(sent_at);
+            free(in_seqnum);
+            free(latency);
+            return -1;
+        }
+        latency[done] = now_ns() - sent_at[done];
+        bytes += response_length;
+        done++;
+    }
+    elapsed = now_ns() - start;
+
+    qsort(latency, packets, sizeof(uint64_t), compare_u64);
+    printf("%-12s %5u %8u %11.0f %12.0f %9.1f %9.1f\n",
+           kBenchWorkloadName[workload], depth, packets,
+           packets * 1e9 / elapsed,
+           bytes * 1e9 / elapsed,
+           latency[packets / 2] / 1e3,
+           latency[(uint64_t)packets * 99 / 100] / 1e3);
+
+    free(sent_at);
+    free(in_seqnum);
+    free(latency);
+    return 0;
+}
+
+static const char *const kBenchStageName[DAP_LATENCY_STAGE_COUNT] = {
+    [DAP_LATENCY_ARRIVAL] = "arrival",
+    [DAP_LATENCY_QUEUE_WAIT] = "queue wait",
+    [DAP_LATENCY_EXECUTE] = "execute",
+    [DAP_LATENCY_SEND] = "send",
+};
+
+static int bench_reset_stages()
+{
+    static uint8_t response[BENCH_PACKET_SIZE_MAX];
+
+    DAP_COMMAND(response, ID_DAP_Vendor_Latency, DAP_LATENCY_RESET, 0);
+    return response[1] == DAP_OK ? 0 : -1;
+}
+
+/**
+ * @brief Value below which a fraction of the histogram is, as the top of its bucket
+ *
+ */
+static uint32_t bench_stage_percentile(const uint32_t *count, uint32_t total, uint32_t max, double fraction)
+{
+    uint64_t rank = (uint64_t)(total * fraction);
+    uint64_t seen = 0;
+    uint32_t i;
+
+    for (i = 0; i < DAP_LATENCY_BUCKET_COUNT - 1U; i++)
+    {
+        seen += count[i];
+        if (seen > rank)
+        {
+            return MIN(dap_latency_bucket_floor(i + 1U), max);
+        }
+    }
+    return max;
+}
+
+static int bench_print_stages()
+{
+    static uint8_t response[BENCH_PACKET_SIZE_MAX];
+    uint32_t count[DAP_LATENCY_BUCKET_COUNT];
+    uint32_t stage, first, n, max, total;
+    int i;
+
+    for (stage = 0; stage < DAP_LATENCY_STAGE_COUNT; stage++)
+    {
+        first = 0;
+        total = 0;
+        max = 0;
+        do
+        {
+            DAP_COMMAND(response, ID_DAP_Vendor_Latency, stage, first);
+            if (response[1] != DAP_LATENCY_STAGE_COUNT || response[2] != DAP_LATENCY_BUCKET_COUNT)
+            {
+                fprintf(stderr, "The device has other latency histograms\n");
+                return -1;
+            }
+            n = response[3];
+            max = read_le32(&response[4]);
+            for (i = 0; i < (int)n; i++)
+            {
+                count[first + i] = read_le32(&response[8 + i * 4]);
+                total += count[first + i];
+            }
+            first += n;
+        } while (n > 0 && first < DAP_LATENCY_BUCKET_COUNT);
+
+        if (total == 0)
+        {
+            continue;
+        }
+        printf("  %-10s %8u %9u %9u %9u %9u\n", kBenchStageName[stage], total,
+               bench_stage_percentile(count, total, max, 0.5), bench_stage_percentile(count, total, max, 0.99),
+               bench_stage_percentile(count, total, max, 0.999), max);
+    }
+    return 0;
+}
+
+static int bench_write_events(const void *data, size_t length, void *context)
+{
+    return fwrite(data, 1, length, (FILE *)context) == length ? 0 : -1;
+}
+
+static int bench_dump_events(const char *path)
+{
+    FILE *file;
+    int ret;
+
+    file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return -1;
+    }
+    ret = dap_event_dump(bench_write_events, file);
+    if (fclose(file) != 0)
+    {
+        ret = -1;
+    }
+    return ret;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-c host[:port]] [-w workload] [-n packets] [-d depth]\n"
+            "          [-l latency_us] [-p loss_percent] [-r rto_us] [-k swj_clock_hz]\n"
+            "          [-e events.bin] [-s]\n"
+            "  -c  benchmark a board, instead of the host build against the target model\n"
+            "  -w  block-read, block-write or transfer, all of them by default\n"
+            "  -d  commands in flight, up to the packet count of the device\n"
+            "  -l  latency added to each direction of the link\n"
+            "  -p  PDUs delayed by -r, as a lost segment is by the TCP retransmission\n"
+            "  -e  dump the event rings of the host build, see dap_event_convert\n"
+            "  -s  break the latency down by stage on the device, see dap_latency.h\n",
+            name);
+}
+
+static int parse_options(int argc, char **argv, bench_options_t *options)
+{
+    char *colon;
+    int opt, i;
+
+    options->host = NULL;
+    options->port = USBIP_CLIENT_DEFAULT_PORT;
+    options->workload = BENCH_BLOCK_READ;
+    options->all_workloads = 1;
+    options->packets = 2000;
+    options->depth = 1;
+    options->clock = 10000000;
+    options->events = NULL;
+    options->stages = 0;
+    link_state.rto_us = 200000; // the minimum RTO of Linux
+
+    while ((opt = getopt(argc, argv, "c:w:n:d:l:p:r:k:e:sh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            options->host = optarg;
+            colon = strrchr(optarg, ':');
+            if (colon != NULL)
+            {
+                *colon = '\0';
+                options->port = atoi(colon + 1);
+            }
+            break;
+        case 'w':
+            for (i = 0; i < BENCH_WORKLOAD_NUM; i++)
+            {
+                if (strcmp(optarg, kBenchWorkloadName[i]) == 0)
+                {
+                    break;
+                }
+            }
+            if (i == BENCH_WORKLOAD_NUM)
+            {
+                return -1;
+            }
+            options->workload = i;
+            options->all_workloads = 0;
+            break;
+        case 'n':
+            options->packets = atoi(optarg);
+            break;
+        case 'd':
+            options->depth = atoi(optarg);
+            break;
+        case 'l':
+            link_state.latency_us = atoi(optarg);
+            break;
+        case 'p':
+            link_state.loss_permille = (uint32_t)(atof(optarg) * 10);
+            break;
+        case 'r':
+            link_state.rto_us = atoi(optarg);
+            break;
+        case 'k':
+            options->clock = atoi(optarg);
+            break;
+        case 'e':
+            options->events = optarg;
+            break;
+        case 's':
+            options->stages = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (options->packets == 0 || options->depth == 0 || options->depth > BENCH_DEPTH_MAX)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    bench_options_t options;
+    int port;
+    int i;
+
+    if (parse_options(argc, argv, &options) < 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (options.events != NULL && options.host != NULL)
+    {
+        fprintf(stderr, "-e dumps the host build only, the events of a board are at its /events\n");
+        return 2;
+    }
+
+    if (options.host == NULL)
+    {
+        target_sim_init(NULL);
+        dap_hal_set(&kTargetSimHal);
+        port = usbip_host_start(0);
+        if (port < 0)
+        {
+            fprintf(stderr, "Unable to start the USBIP server\n");
+            return 1;
+        }
+        options.host = "127.0.0.1";
+        options.port = port;
+    }
+
+    link_state.fd = usbip_client_connect(options.host, options.port);
+    if (link_state.fd < 0)
+    {
+        fprintf(stderr, "Unable to connect to %s:%u\n", options.host, options.port);
+        return 1;
+    }
+    if (usbip_client_import(link_state.fd) < 0)
+    {
+        fprintf(stderr, "OP_REQ_IMPORT failed\n");
+        return 1;
+    }
+    link_start();
+
+    if (dap_target_setup(options.clock) < 0)
+    {
+        return 1;
+    }
+
+    if (options.depth > dap_packet_count)
+    {
+        printf("depth limited to the packet count of the device: %u\n", dap_packet_count);
+        options.depth = dap_packet_count;
+    }
+    printf("packet size %u, latency %u us, loss %.1f%%\n",
+           dap_packet_size, link_state.latency_us, link_state.loss_permille / 10.0);
+    printf("%-12s %5s %8s %11s %12s %9s %9s\n",
+           "workload", "depth", "packets", "packets/s", "bytes/s", "p50(us)", "p99(us)");
+    if (options.stages)
+    {
+        printf("  %-10s %8s %9s %9s %9s %9s\n", "stage", "count", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+    }
+
+    for (i = 0; i < BENCH_WORKLOAD_NUM; i++)
+    {
+        if (!options.all_workloads && i != (int)options.workload)
+        {
+            continue;
+        }
+        if (options.stages && bench_reset_stages() < 0)
+        {
+            fprintf(stderr, "The device has no latency histograms\n");
+            return 1;
+        }
+        if (bench_run(i, options.packets, options.depth) < 0)
+        {
+            return 1;
+        }
+        if (options.stages && bench_print_stages() < 0)
+        {
+            return 1;
+        }
+    }
+
+    if (link_state.impaired)
+    {
+        printf("lost PDUs: %u out, %u in\n", link_state.tx.lost, link_state.rx.lost);
+    }
+
+    close(link_state.fd);
+
+    if (options.events != NULL && bench_dump_events(options.events) < 0)
+    {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file usbip_client.c
+ * @brief Userspace USBIP client of the host tools
+ *
+ * @version 0.1
+ * @date 2022-08-11
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "host/usbip_client.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+static uint32_t read_be32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+           ((uint32_t)data[2] << 8) | ((uint32_t)data[3] << 0);
+}
+
+int usbip_client_connect(const char *host, uint16_t port)
+{
+    struct addrinfo hints;
+    struct addrinfo *result, *ai;
+    char service[8];
+    int fd = -1;
+    int flag = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &result) != 0)
+    {
+        return -1;
+    }
+
+    for (ai = result; ai != NULL; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+        {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd >= 0)
+    {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+    return fd;
+}
+
+int usbip_client_import(int fd)
+{
+    uint8_t request[sizeof(usbip_stage1_header) + USBIP_BUSID_SIZE];
+    uint8_t reply[sizeof(usbip_stage1_header) + sizeof(usbip_stage1_usb_device)];
+    usbip_stage1_header *header = (usbip_stage1_header *)request;
+
+    memset(request, 0, sizeof(request));
+    header->version = htons(0x0111);
+    header->command = htons(0x8000 | USBIP_STAGE1_CMD_DEVICE_ATTACH);
+    header->status = 0;
+    strcpy((char *)&request[sizeof(usbip_stage1_header)], "1-1");
+
+    if (usbip_client_write(fd, request, sizeof(request)) < 0 ||
+        usbip_client_read(fd, reply, sizeof(reply)) < 0)
+    {
+        return -1;
+    }
+
+    header = (usbip_stage1_header *)reply;
+    return ntohl(header->status) == 0 ? 0 : -1;
+}
+
+int usbip_client_write(int fd, const void *data, uint32_t length)
+{
+    const uint8_t *p = data;
+    ssize_t ret;
+
+    while (length > 0)
+    {
+        ret = send(fd, p, length, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += ret;
+        length -= ret;
+    }
+    return 0;
+}
+
+int usbip_client_read(int fd, void *data, uint32_t length)
+{
+    uint8_t *p = data;
+    ssize_t ret;
+
+    while (length > 0)
+    {
+        ret = recv(fd, p, length, 0);
+        if (ret <= 0)
+        {
+            if (ret < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += ret;
+        length -= ret;
+    }
+    return 0;
+}
+
+int usbip_client_read_pdu(int fd, uint8_t *pdu)
+{
+    const usbip_stage2_header *header = (const usbip_stage2_header *)pdu;
+    uint32_t length = 0;
+
+    if (usbip_client_read(fd, pdu, sizeof(usbip_stage2_header)) < 0)
+    {
+        return -1;
+    }
+
+    // only ret_submit carries data, and only for an IN URB
+    if (read_be32((const uint8_t *)&header->base.command) == USBIP_STAGE2_RSP_SUBMIT)
+    {
+        length = read_be32((const uint8_t *)&header->u.ret_submit.data_length);
+        if (length > USBIP_CLIENT_DATA_SIZE_MAX)
+        {
+            fprintf(stderr, "ret_submit too large: %u\n", length);
+            return -1;
+        }
+    }
+    if (usbip_client_read(fd, pdu + sizeof(usbip_stage2_header), length) < 0)
+    {
+        return -1;
+    }
+    return sizeof(usbip_stage2_header) + length;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file usbip_client.h
+ * @brief Userspace USBIP client of the host tools
+ *
+ * Just enough of the vhci side of USBIP to import the CMSIS-DAP device and
+ * exchange stage 2 PDUs with it, on a blocking socket.
+ *
+ * @version 0.1
+ * @date 2022-08-11
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __USBIP_CLIENT_H__
+#define __USBIP_CLIENT_H__
+
+#include <stdint.h>
+
+#include "components/USBIP/USBIP_defs.h"
+
+#define USBIP_CLIENT_DEFAULT_PORT 3240
+// Largest data of a ret_submit, the largest DAP packet
+#define USBIP_CLIENT_DATA_SIZE_MAX 1024
+#define USBIP_CLIENT_PDU_SIZE_MAX (sizeof(usbip_stage2_header) + USBIP_CLIENT_DATA_SIZE_MAX)
+
+/**
+ * @brief Connect to a USBIP server, with TCP_NODELAY set
+ *
+ * @return The socket, or -1 on error
+ */
+int usbip_client_connect(const char *host, uint16_t port);
+
+/**
+ * @brief OP_REQ_IMPORT of bus 1-1, the only device of the server
+ *
+ * @return 0 on success, -1 on error
+ */
+int usbip_client_import(int fd);
+
+int usbip_client_write(int fd, const void *data, uint32_t length);
+int usbip_client_read(int fd, void *data, uint32_t length);
+
+/**
+ * @brief Read one stage 2 PDU sent by the server
+ *
+ * @param pdu Buffer of USBIP_CLIENT_PDU_SIZE_MAX bytes
+ * @return Length of the PDU, or -1 on error
+ */
+int usbip_client_read_pdu(int fd, uint8_t *pdu);
+
+#endif
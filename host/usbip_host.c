@@ -0,0 +1,305 @@
+/**
+ * @file usbip_host.c
+ * @brief tcp_server.c of the host build, on POSIX sockets
+ *
+ * Frames and dispatches the PDUs as tcp_server.c does, so that the session
+ * layer of dap_handle.c sees the same calls as on the board. The messages
+ * of dap_log.h are printed to stderr by a task, as log_server.c does.
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "host/usbip_host.h"
+#include "host/lwip_host.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "main/tcp_server.h"
+#include "main/usbip_server.h"
+#include "main/dap_handle.h"
+
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_event.h"
+#include "components/DAP/include/dap_log.h"
+
+extern void DAP_Thread(void *argument);
+extern void DAP_Reply_Thread(void *argument);
+
+uint8_t kState = ACCEPTING;
+SemaphoreHandle_t kConnMutex = NULL;
+TaskHandle_t kDAPTaskHandle = NULL;
+TaskHandle_t kDAPReplyTaskHandle = NULL;
+
+static int usbip_host_conn = -1;
+static int usbip_host_listen = -1;
+
+static dap_log_output_t usbip_host_log_hook = NULL;
+static void *usbip_host_log_context = NULL;
+
+#define USBIP_HOST_LOG_POLL_US 20000
+
+// Must be able to hold at least one complete PDU (header + DAP packet)
+#define TCP_RX_BUFFER_SIZE 2048
+// Received data that is not dispatched yet
+#define TCP_RX_STREAM_SIZE 16384
+
+static uint8_t tcp_rx_stream[TCP_RX_STREAM_SIZE];
+static uint32_t tcp_rx_stream_length = 0;
+// PDUs that do not go straight into the DAP queue are copied here
+static uint8_t tcp_rx_buffer[TCP_RX_BUFFER_SIZE] __attribute__((aligned(4)));
+
+static int tcp_rx_dispatch();
+
+/**
+ * @brief Send data on the USBIP connection
+ *
+ */
+int usbip_network_send(const void *data, size_t size)
+{
+    struct netvector vector = {data, size};
+
+    return usbip_network_writev(&vector, 1);
+}
+
+/**
+ * @brief Send several buffers on the USBIP connection as one write
+ *
+ */
+int usbip_network_writev(struct netvector *vectors, uint16_t count)
+{
+    int ret;
+
+    DAP_EVENT_BEGIN(DAP_EVENT_SEND, count);
+    ret = lwip_host_sendmsg(usbip_host_conn, vectors, count);
+    DAP_EVENT_END(DAP_EVENT_SEND, count);
+    return ret;
+}
+
+static void usbip_host_log_output(const char *text, size_t length, void *context)
+{
+    fwrite(text, 1, length, stderr);
+    if (usbip_host_log_hook != NULL)
+    {
+        usbip_host_log_hook(text, length, usbip_host_log_context);
+    }
+}
+
+static void usbip_host_log_task(void *argument)
+{
+    for (;;)
+    {
+        if (dap_log_drain(usbip_host_log_output, NULL) == 0)
+        {
+            usleep(USBIP_HOST_LOG_POLL_US);
+        }
+    }
+}
+
+static void usbip_host_task(void *argument)
+{
+    ssize_t ret;
+    int flag = 1;
+
+    while (1)
+    {
+        usbip_host_conn = accept(usbip_host_listen, NULL, NULL);
+        if (usbip_host_conn < 0)
+        {
+            printf("Unable to accept connection: errno %d\r\n", errno);
+            break;
+        }
+        setsockopt(usbip_host_conn, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+        xSemaphoreTake(kConnMutex, portMAX_DELAY);
+        ret = acquire_dap_session(&kUsbipDAPTransport);
+        xSemaphoreGive(kConnMutex);
+        if (ret != 0)
+        {
+            printf("DAP is used by another session\r\n");
+            close(usbip_host_conn);
+            usbip_host_conn = -1;
+            continue;
+        }
+
+        while (1)
+        {
+            ret = recv(usbip_host_conn, &tcp_rx_stream[tcp_rx_stream_length],
+                       sizeof(tcp_rx_stream) - tcp_rx_stream_length, 0);
+            if (ret <= 0)
+            {
+                if (ret < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            tcp_rx_stream_length += ret;
+
+            mark_dap_request_arrival();
+            DAP_EVENT_BEGIN(DAP_EVENT_RECV, ret);
+            ret = tcp_rx_dispatch();
+            DAP_EVENT_END(DAP_EVENT_RECV, 0);
+            if (ret < 0)
+            {
+                printf("USBIP framing error\r\n");
+                break;
+            }
+        }
+
+        xSemaphoreTake(kConnMutex, portMAX_DELAY);
+        close(usbip_host_conn);
+        usbip_host_conn = -1;
+        kState = ACCEPTING;
+        release_dap_session();
+        xSemaphoreGive(kConnMutex);
+
+        tcp_rx_stream_length = 0;
+    }
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Dispatch every complete PDU in the received data, see tcp_server.c
+ *
+ * @return 0 on success, -1 if the stream can not be framed
+ */
+static int tcp_rx_dispatch()
+{
+    uint32_t offset = 0;
+    uint32_t available;
+    uint32_t header_length;
+    uint32_t pdu_length;
+    uint8_t *payload;
+
+    while (offset < tcp_rx_stream_length)
+    {
+        available = tcp_rx_stream_length - offset;
+
+        // The handlers access the header as 32-bit words, so it is always parsed from the aligned buffer
+        header_length = MIN(available, sizeof(usbip_stage2_header));
+        memcpy(tcp_rx_buffer, &tcp_rx_stream[offset], header_length);
+
+        pdu_length = get_usbip_pdu_length(tcp_rx_buffer, header_length);
+        if (pdu_length > sizeof(tcp_rx_buffer))
+        {
+            printf("PDU too large: %d\r\n", (int)pdu_length);
+            return -1;
+        }
+        if (pdu_length == 0 || pdu_length > available)
+        {
+            break; // wait for the rest of the PDU
+        }
+
+        payload = NULL;
+        if (pdu_length > sizeof(usbip_stage2_header))
+        {
+            payload = get_usbip_pdu_payload_buffer(tcp_rx_buffer);
+            if (payload == NULL)
+            {
+                payload = &tcp_rx_buffer[sizeof(usbip_stage2_header)];
+            }
+            memcpy(payload, &tcp_rx_stream[offset + sizeof(usbip_stage2_header)],
+                   pdu_length - sizeof(usbip_stage2_header));
+        }
+
+        xSemaphoreTake(kConnMutex, portMAX_DELAY);
+        switch (kState)
+        {
+        case ACCEPTING:
+            kState = ATTACHING;
+            // fall through
+
+        case ATTACHING:
+            attach(tcp_rx_buffer, pdu_length);
+            break;
+
+        case EMULATING:
+            emulate(tcp_rx_buffer, pdu_length, payload);
+            break;
+        default:
+            printf("unkonw kstate!\r\n");
+        }
+        xSemaphoreGive(kConnMutex);
+
+        offset += pdu_length;
+    }
+
+    memmove(tcp_rx_stream, &tcp_rx_stream[offset], tcp_rx_stream_length - offset);
+    tcp_rx_stream_length -= offset;
+
+    // answer everything parsed from this read in one write
+    xSemaphoreTake(kConnMutex, portMAX_DELAY);
+    flush_usbip_tx();
+    xSemaphoreGive(kConnMutex);
+
+    return 0;
+}
+
+int usbip_host_start(uint16_t port)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_length = sizeof(addr);
+    int flag = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    usbip_host_listen = socket(AF_INET, SOCK_STREAM, 0);
+    if (usbip_host_listen < 0)
+    {
+        return -1;
+    }
+    setsockopt(usbip_host_listen, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(usbip_host_listen, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(usbip_host_listen, 1) < 0 ||
+        getsockname(usbip_host_listen, (struct sockaddr *)&addr, &addr_length) < 0)
+    {
+        close(usbip_host_listen);
+        usbip_host_listen = -1;
+        return -1;
+    }
+
+    DAP_Setup();
+
+    kConnMutex = xSemaphoreCreateMutex();
+
+    xTaskCreatePinnedToCore(usbip_host_log_task, "log_server", 3072, NULL, 2, NULL, 0);
+    // the session notifies both of them, start them first
+    xTaskCreatePinnedToCore(DAP_Thread, "DAP_Task", 2048, NULL, 10, &kDAPTaskHandle, 1);
+    xTaskCreatePinnedToCore(DAP_Reply_Thread, "DAP_Reply", 3072, NULL, 14, &kDAPReplyTaskHandle, 0);
+    xTaskCreatePinnedToCore(usbip_host_task, "tcp_server", 4096, NULL, 14, NULL, 0);
+
+    return ntohs(addr.sin_port);
+}
+
+void usbip_host_start_task(void (*task)(), const char *name)
+{
+    xTaskCreatePinnedToCore((TaskFunction_t)task, name, 4096, NULL, 14, NULL, 0);
+}
+
+void usbip_host_set_log_hook(dap_log_output_t hook, void *context)
+{
+    usbip_host_log_context = context;
+    usbip_host_log_hook = hook;
+}
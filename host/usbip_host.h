@@ -0,0 +1,44 @@
+/**
+ * @file usbip_host.h
+ * @brief USBIP server of main/ on POSIX sockets, for the host build
+ *
+ * usbip_server.c, dap_handle.c and USB_handle.c are built unchanged, on top
+ * of the FreeRTOS and lwIP headers in host/port. The DAP engine runs against
+ * whatever HAL is set with dap_hal_set() before the server is started.
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __USBIP_HOST_H__
+#define __USBIP_HOST_H__
+
+#include <stdint.h>
+
+#include "components/DAP/include/dap_log.h"
+
+/**
+ * @brief Start DAP_Thread, the reply task and the USBIP server, as app_main() does
+ *
+ * @param port TCP port to listen on, 0 for any free one
+ * @return The port the server listens on, or -1 on error
+ */
+int usbip_host_start(uint16_t port);
+
+/**
+ * @brief Start another server task of main/, such as udp_server_task, after usbip_host_start()
+ *
+ */
+void usbip_host_start_task(void (*task)(), const char *name);
+
+/**
+ * @brief Also give the log messages to a hook, after they are printed.
+ * Called from the log task.
+ *
+ */
+void usbip_host_set_log_hook(dap_log_output_t hook, void *context);
+
+#endif
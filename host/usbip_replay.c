@@ -0,0 +1,502 @@
+/**
+ * @file usbip_replay.c
+ * @brief Replay a USBIP capture against the host build, see main/usbip_capture.c
+ *
+ * The PDUs the debugger sent are sent again byte for byte, seqnums included.
+ * Each one waits until as many PDUs have come back as had in the capture, so
+ * the debugger's pipelining is kept, and no more commands are in flight than
+ * it had. The time of every DAP command is reported by command:
+ *       - latency: from its EP1 OUT URB being sent to its response
+ *       - exec: from the later of the URB and the previous response to its
+ *         response, the time the DAP engine and the stack spent on it alone
+ *
+ * Without -c, the capture is replayed on the host build against the target
+ * model of target_sim.c. With -c, against a board.
+ *
+ *   usbip_replay [-c host[:port]] [-t timeout_ms] capture
+ *
+ * @version 0.1
+ * @date 2022-08-11
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "components/USBIP/USBIP_defs.h"
+#include "components/DAP/include/DAP.h"
+#include "main/usbip_capture.h"
+
+#include "host/target_sim.h"
+#include "host/usbip_client.h"
+#include "host/usbip_host.h"
+
+// Commands and EP1 IN URBs in flight, far more than the packet count of the device
+#define REPLAY_PENDING_SIZE 1024
+
+typedef struct
+{
+    const uint8_t *pdu;
+    uint32_t timestamp;
+    uint16_t length;
+    uint8_t direction;
+    uint32_t answers_before; // PDUs from the device before this one in the capture
+} replay_record_t;
+
+typedef struct
+{
+    uint8_t id;
+    uint64_t sent; // ns
+} replay_command_t;
+
+typedef struct
+{
+    uint8_t id;
+    uint32_t latency; // ns
+    uint32_t exec;    // ns
+} replay_result_t;
+
+static int replay_fd = -1;
+static uint32_t replay_capture_answers = 0; // PDUs from the device in the capture
+
+// Shared with the receive thread
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t replay_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t replay_received = 0;
+static int replay_closed = 0;
+static replay_command_t replay_command[REPLAY_PENDING_SIZE];
+static uint32_t replay_command_head = 0;
+static uint32_t replay_command_count = 0;
+static uint32_t replay_in_seqnum[REPLAY_PENDING_SIZE];
+static uint32_t replay_in_head = 0;
+static uint32_t replay_in_count = 0;
+static uint64_t replay_last_response = 0;
+
+static replay_result_t *replay_result = NULL;
+static uint32_t replay_result_count = 0;
+static uint32_t replay_result_size = 0;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t read_be32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+           ((uint32_t)data[2] << 8) | ((uint32_t)data[3] << 0);
+}
+
+static const char *dap_command_name(uint8_t id)
+{
+    static char name[16];
+
+    switch (id)
+    {
+    case ID_DAP_Info: return "Info";
+    case ID_DAP_HostStatus: return "HostStatus";
+    case ID_DAP_Connect: return "Connect";
+    case ID_DAP_Disconnect: return "Disconnect";
+    case ID_DAP_TransferConfigure: return "TransferConfigure";
+    case ID_DAP_Transfer: return "Transfer";
+    case ID_DAP_TransferBlock: return "TransferBlock";
+    case ID_DAP_WriteABORT: return "WriteABORT";
+    case ID_DAP_Delay: return "Delay";
+    case ID_DAP_ResetTarget: return "ResetTarget";
+    case ID_DAP_SWJ_Pins: return "SWJ_Pins";
+    case ID_DAP_SWJ_Clock: return "SWJ_Clock";
+    case ID_DAP_SWJ_Sequence: return "SWJ_Sequence";
+    case ID_DAP_SWD_Configure: return "SWD_Configure";
+    case ID_DAP_SWD_Sequence: return "SWD_Sequence";
+    case ID_DAP_JTAG_Sequence: return "JTAG_Sequence";
+    case ID_DAP_JTAG_Configure: return "JTAG_Configure";
+    case ID_DAP_JTAG_IDCODE: return "JTAG_IDCODE";
+    case ID_DAP_SWO_Transport: return "SWO_Transport";
+    case ID_DAP_SWO_Mode: return "SWO_Mode";
+    case ID_DAP_SWO_Baudrate: return "SWO_Baudrate";
+    case ID_DAP_SWO_Control: return "SWO_Control";
+    case ID_DAP_SWO_Status: return "SWO_Status";
+    case ID_DAP_SWO_ExtendedStatus: return "SWO_ExtendedStatus";
+    case ID_DAP_SWO_Data: return "SWO_Data";
+    case ID_DAP_QueueCommands: return "QueueCommands";
+    case ID_DAP_ExecuteCommands: return "ExecuteCommands";
+    default:
+        snprintf(name, sizeof(name), "0x%02X", id);
+        return name;
+    }
+}
+
+/**
+ * @brief Load a capture and work out how many answers each PDU waited for
+ *
+ * @return Number of records, or -1 if the file is not a capture
+ */
+static int replay_load(const char *path, uint8_t **data, replay_record_t **records)
+{
+    const usbip_capture_file_header *file_header;
+    usbip_capture_record record;
+    FILE *file;
+    long size;
+    uint32_t offset;
+    uint32_t answers = 0;
+    int count = 0;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    *data = malloc(size > 0 ? size : 1);
+    if (*data == NULL || fread(*data, 1, size, file) != (size_t)size)
+    {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    file_header = (const usbip_capture_file_header *)*data;
+    if ((size_t)size < sizeof(usbip_capture_file_header) ||
+        file_header->magic != USBIP_CAPTURE_MAGIC || file_header->version != USBIP_CAPTURE_VERSION)
+    {
+        return -1;
+    }
+
+    // one record at least every sizeof(usbip_capture_record) bytes
+    *records = calloc(size / sizeof(usbip_capture_record) + 1, sizeof(replay_record_t));
+    if (*records == NULL)
+    {
+        return -1;
+    }
+
+    offset = sizeof(usbip_capture_file_header);
+    while (offset + sizeof(usbip_capture_record) <= (uint32_t)size)
+    {
+        memcpy(&record, *data + offset, sizeof(usbip_capture_record));
+        offset += sizeof(usbip_capture_record);
+        if (offset + record.length > (uint32_t)size || record.length < sizeof(usbip_stage2_header))
+        {
+            break; // cut off at the end of the stream
+        }
+
+        (*records)[count].pdu = *data + offset;
+        (*records)[count].timestamp = record.timestamp;
+        (*records)[count].length = record.length;
+        (*records)[count].direction = record.direction;
+        (*records)[count].answers_before = answers;
+        if (record.direction == USBIP_CAPTURE_DEVICE_TO_HOST)
+        {
+            answers++;
+        }
+        offset += record.length;
+        count++;
+    }
+    replay_capture_answers = answers;
+    return count;
+}
+
+static void replay_add_result(uint8_t id, uint64_t latency, uint64_t exec)
+{
+    if (replay_result_count == replay_result_size)
+    {
+        replay_result_size = replay_result_size ? replay_result_size * 2 : 1024;
+        replay_result = realloc(replay_result, replay_result_size * sizeof(replay_result_t));
+        if (replay_result == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    replay_result[replay_result_count].id = id;
+    replay_result[replay_result_count].latency = latency;
+    replay_result[replay_result_count].exec = exec;
+    replay_result_count++;
+}
+
+/**
+ * @brief Match the PDUs from the device with the commands in flight
+ *
+ */
+static void *replay_rx_thread(void *argument)
+{
+    static uint8_t pdu[USBIP_CLIENT_PDU_SIZE_MAX];
+    const usbip_stage2_header *header = (const usbip_stage2_header *)pdu;
+    replay_command_t *command;
+    uint64_t now, start;
+
+    while (usbip_client_read_pdu(replay_fd, pdu) >= 0)
+    {
+        now = now_ns();
+
+        pthread_mutex_lock(&replay_lock);
+        // DAP responses are given to the EP1 IN URBs in order
+        if (read_be32((const uint8_t *)&header->base.command) == USBIP_STAGE2_RSP_SUBMIT &&
+            replay_in_count > 0 && replay_in_seqnum[replay_in_head] == read_be32((const uint8_t *)&header->base.seqnum))
+        {
+            replay_in_head = (replay_in_head + 1) % REPLAY_PENDING_SIZE;
+            replay_in_count--;
+
+            if (replay_command_count > 0)
+            {
+                command = &replay_command[replay_command_head];
+                start = command->sent > replay_last_response ? command->sent : replay_last_response;
+                replay_add_result(command->id, now - command->sent, now - start);
+                replay_command_head = (replay_command_head + 1) % REPLAY_PENDING_SIZE;
+                replay_command_count--;
+            }
+            replay_last_response = now;
+        }
+        replay_received++;
+        pthread_cond_broadcast(&replay_cond);
+        pthread_mutex_unlock(&replay_lock);
+    }
+
+    pthread_mutex_lock(&replay_lock);
+    replay_closed = 1;
+    pthread_cond_broadcast(&replay_cond);
+    pthread_mutex_unlock(&replay_lock);
+    return NULL;
+}
+
+/**
+ * @brief Wait until the device has sent that many PDUs
+ *
+ * @return 0 on success, -1 on timeout or when the connection is closed
+ */
+static int replay_wait_received(uint32_t count, uint32_t timeout_ms)
+{
+    struct timespec deadline;
+    int ret = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&replay_lock);
+    while (replay_received < count && !replay_closed && ret == 0)
+    {
+        ret = pthread_cond_timedwait(&replay_cond, &replay_lock, &deadline);
+    }
+    ret = replay_received >= count ? 0 : -1;
+    pthread_mutex_unlock(&replay_lock);
+    return ret;
+}
+
+/**
+ * @brief Note the DAP command or the EP1 IN URB, then send the PDU
+ *
+ */
+static void replay_send(const replay_record_t *record)
+{
+    const usbip_stage2_header *header = (const usbip_stage2_header *)record->pdu;
+
+    pthread_mutex_lock(&replay_lock);
+    if (read_be32((const uint8_t *)&header->base.command) == USBIP_STAGE2_REQ_SUBMIT &&
+        read_be32((const uint8_t *)&header->base.ep) == 0x01)
+    {
+        if (read_be32((const uint8_t *)&header->base.direction) == USBIP_DIR_IN)
+        {
+            replay_in_seqnum[(replay_in_head + replay_in_count) % REPLAY_PENDING_SIZE] =
+                read_be32((const uint8_t *)&header->base.seqnum);
+            replay_in_count++;
+        }
+        // DAP_TransferAbort has no response
+        else if (record->length > sizeof(usbip_stage2_header) &&
+                 record->pdu[sizeof(usbip_stage2_header)] != ID_DAP_TransferAbort)
+        {
+            replay_command[(replay_command_head + replay_command_count) % REPLAY_PENDING_SIZE].id =
+                record->pdu[sizeof(usbip_stage2_header)];
+            replay_command[(replay_command_head + replay_command_count) % REPLAY_PENDING_SIZE].sent = now_ns();
+            replay_command_count++;
+        }
+    }
+    pthread_mutex_unlock(&replay_lock);
+
+    if (usbip_client_write(replay_fd, record->pdu, record->length) < 0)
+    {
+        fprintf(stderr, "Connection closed by the device\n");
+        exit(1);
+    }
+}
+
+static int compare_result(const void *a, const void *b)
+{
+    const replay_result_t *x = a;
+    const replay_result_t *y = b;
+
+    if (x->id != y->id)
+    {
+        return x->id < y->id ? -1 : 1;
+    }
+    return x->exec < y->exec ? -1 : x->exec > y->exec;
+}
+
+static void replay_report()
+{
+    uint32_t i, j, k, count;
+    uint64_t exec_sum, latency_sum, latency_max;
+
+    qsort(replay_result, replay_result_count, sizeof(replay_result_t), compare_result);
+
+    printf("%-18s %7s %10s %9s %9s %9s %9s %12s\n",
+           "command", "count", "exec(ms)", "mean(us)", "p50(us)", "p99(us)", "max(us)", "latency(us)");
+    for (i = 0; i < replay_result_count; i = j)
+    {
+        exec_sum = latency_sum = latency_max = 0;
+        for (j = i; j < replay_result_count && replay_result[j].id == replay_result[i].id; j++)
+        {
+            exec_sum += replay_result[j].exec;
+            latency_sum += replay_result[j].latency;
+            if (replay_result[j].latency > latency_max)
+            {
+                latency_max = replay_result[j].latency;
+            }
+        }
+        count = j - i;
+        k = i + (uint64_t)count * 99 / 100;
+
+        printf("%-18s %7u %10.3f %9.1f %9.1f %9.1f %9.1f %12.1f\n",
+               dap_command_name(replay_result[i].id), count,
+               exec_sum / 1e6,
+               exec_sum / 1e3 / count,
+               replay_result[i + count / 2].exec / 1e3,
+               replay_result[k].exec / 1e3,
+               replay_result[j - 1].exec / 1e3,
+               latency_sum / 1e3 / count);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-c host[:port]] [-t timeout_ms] capture\n"
+            "  -c  replay on a board, instead of the host build against the target model\n"
+            "  -t  how long to wait for an answer that does not come, 1000 ms by default\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = NULL;
+    uint16_t port = USBIP_CLIENT_DEFAULT_PORT;
+    uint32_t timeout_ms = 1000;
+    uint8_t *data = NULL;
+    replay_record_t *records = NULL;
+    pthread_t rx_thread;
+    uint64_t start, elapsed;
+    uint32_t sent = 0, stalls = 0;
+    char *colon;
+    int count, ret, opt, i;
+
+    while ((opt = getopt(argc, argv, "c:t:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            host = optarg;
+            colon = strrchr(optarg, ':');
+            if (colon != NULL)
+            {
+                *colon = '\0';
+                port = atoi(colon + 1);
+            }
+            break;
+        case 't':
+            timeout_ms = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    count = replay_load(argv[optind], &data, &records);
+    if (count < 0)
+    {
+        fprintf(stderr, "%s is not a USBIP capture\n", argv[optind]);
+        return 1;
+    }
+
+    if (host == NULL)
+    {
+        target_sim_init(NULL);
+        dap_hal_set(&kTargetSimHal);
+        ret = usbip_host_start(0);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Unable to start the USBIP server\n");
+            return 1;
+        }
+        host = "127.0.0.1";
+        port = ret;
+    }
+
+    replay_fd = usbip_client_connect(host, port);
+    if (replay_fd < 0 || usbip_client_import(replay_fd) < 0)
+    {
+        fprintf(stderr, "Unable to import the device of %s:%u\n", host, port);
+        return 1;
+    }
+    pthread_create(&rx_thread, NULL, replay_rx_thread, NULL);
+
+    start = now_ns();
+    for (i = 0; i < count; i++)
+    {
+        if (records[i].direction != USBIP_CAPTURE_HOST_TO_DEVICE)
+        {
+            continue;
+        }
+        if (replay_wait_received(records[i].answers_before, timeout_ms) < 0)
+        {
+            // the replay does not answer as the capture did, carry on
+            stalls++;
+        }
+        replay_send(&records[i]);
+        sent++;
+    }
+    // the answers to the last PDUs
+    if (replay_wait_received(replay_capture_answers, timeout_ms) < 0)
+    {
+        stalls++;
+    }
+    elapsed = now_ns() - start;
+
+    shutdown(replay_fd, SHUT_RDWR);
+    pthread_join(rx_thread, NULL);
+    close(replay_fd);
+
+    printf("%d PDUs in the capture, over %.3f ms\n", count,
+           count > 0 ? (uint32_t)(records[count - 1].timestamp - records[0].timestamp) / 1e3 : 0.0);
+    printf("%u PDUs replayed in %.3f ms, %u answers received, %u stalls\n",
+           sent, elapsed / 1e6, replay_received, stalls);
+    replay_report();
+
+    free(replay_result);
+    free(records);
+    free(data);
+    return 0;
+}
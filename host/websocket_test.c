@@ -0,0 +1,428 @@
+/**
+ * @file websocket_test.c
+ * @brief Host test of main/websocket_server.c, as a browser would use it
+ *
+ * Upgrades a connection on the loopback interface, then sends DAP commands as
+ * masked binary frames and checks that the responses come back unmasked, one
+ * message each, in the order of the commands:
+ *       - an upgrade request without Upgrade: websocket, Connection: Upgrade,
+ *         Sec-WebSocket-Version: 13 or Sec-WebSocket-Key is refused with 400
+ *       - the accept key is the one of the example of RFC 6455
+ *       - more commands than the packet count are sent at once
+ *       - a frame split across two writes, a response with a 16-bit length,
+ *         ping and close
+ *       - DAP_TransferAbort gets through a window full of commands stuck in
+ *         WAIT retries
+ *       - an empty binary frame closes the connection
+ *
+ * @version 0.1
+ * @date 2022-08-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "components/DAP/include/DAP.h"
+#include "main/wifi_configuration.h"
+#include "main/websocket_server.h"
+
+#include "host/dap_test.h"
+#include "host/target_sim.h"
+
+#define WS_TEST_TIMEOUT_MS 2000
+// The example of RFC 6455 1.3
+#define WS_TEST_KEY "dGhlIHNhbXBsZSBub25jZQ=="
+#define WS_TEST_ACCEPT "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="
+
+#define WS_TEST_OPCODE_BINARY 0x2
+#define WS_TEST_OPCODE_CLOSE 0x8
+#define WS_TEST_OPCODE_PING 0x9
+#define WS_TEST_OPCODE_PONG 0xA
+
+// Enough reads for several times the packet count
+#define WS_TEST_PIPELINE (DAP_PACKET_WINDOW * 3)
+#define WS_TEST_WAIT_RETRY 0xFFFF
+#define WS_TEST_ABORT_POLL_MS 2
+
+static int ws_test_fd = -1;
+static uint32_t ws_test_mask_seed = 0x12345678;
+
+static int ws_test_connect()
+{
+    struct sockaddr_in addr;
+    struct timeval timeout = {WS_TEST_TIMEOUT_MS / 1000, (WS_TEST_TIMEOUT_MS % 1000) * 1000};
+    uint64_t deadline = dap_test_now_ms() + WS_TEST_TIMEOUT_MS;
+    int flag = 1;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(WEBSOCKET_PORT);
+
+    // the server may not be listening yet
+    for (;;)
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        DAP_TEST_CHECK(fd >= 0);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            break;
+        }
+        close(fd);
+        DAP_TEST_CHECK(dap_test_now_ms() < deadline);
+        usleep(10000);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+static void ws_test_write(int fd, const void *data, size_t length)
+{
+    DAP_TEST_CHECK(send(fd, data, length, MSG_NOSIGNAL) == (ssize_t)length);
+}
+
+static void ws_test_read(int fd, uint8_t *data, size_t length)
+{
+    ssize_t ret;
+
+    while (length > 0)
+    {
+        ret = recv(fd, data, length, 0);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        DAP_TEST_CHECK(ret > 0);
+        data += ret;
+        length -= ret;
+    }
+}
+
+/**
+ * @brief Send an upgrade request and read the response head
+ *
+ * @return The HTTP status code
+ */
+static int ws_test_upgrade(int fd, const char *headers, char *response, size_t size)
+{
+    char request[512];
+    size_t length = 0;
+    int status;
+
+    snprintf(request, sizeof(request), "GET /dap HTTP/1.1\r\nHost: 127.0.0.1\r\n%s\r\n", headers);
+    ws_test_write(fd, request, strlen(request));
+
+    while (length < 4 || memcmp(&response[length - 4], "\r\n\r\n", 4) != 0)
+    {
+        DAP_TEST_CHECK(length < size - 1);
+        ws_test_read(fd, (uint8_t *)&response[length], 1);
+        length++;
+    }
+    response[length] = '\0';
+    DAP_TEST_CHECK(sscanf(response, "HTTP/1.1 %d", &status) == 1);
+    return status;
+}
+
+/**
+ * @brief Build a masked frame, as a client must send it
+ *
+ * @return Length of the frame
+ */
+static size_t ws_test_build_frame(uint8_t *frame, uint8_t opcode, const uint8_t *payload, size_t length)
+{
+    size_t header_length;
+    uint8_t *mask;
+    size_t i;
+
+    frame[0] = 0x80 | opcode;
+    if (length < 126)
+    {
+        frame[1] = 0x80 | length;
+        header_length = 2;
+    }
+    else
+    {
+        frame[1] = 0x80 | 126;
+        frame[2] = (length >> 8) & 0xFF;
+        frame[3] = length & 0xFF;
+        header_length = 4;
+    }
+
+    mask = &frame[header_length];
+    ws_test_mask_seed = ws_test_mask_seed * 1103515245 + 12345;
+    mask[0] = ws_test_mask_seed >> 24;
+    mask[1] = ws_test_mask_seed >> 16;
+    mask[2] = ws_test_mask_seed >> 8;
+    mask[3] = ws_test_mask_seed;
+    header_length += 4;
+
+    for (i = 0; i < length; i++)
+    {
+        frame[header_length + i] = payload[i] ^ mask[i & 0x3];
+    }
+    return header_length + length;
+}
+
+/**
+ * @brief Read a frame of the server, which must not be masked
+ *
+ * @return Length of the payload
+ */
+static int ws_test_read_frame(int fd, uint8_t *opcode, uint8_t *payload)
+{
+    uint8_t header[4];
+    int length;
+
+    ws_test_read(fd, header, 2);
+    DAP_TEST_CHECK(header[0] & 0x80);    // FIN
+    DAP_TEST_CHECK(!(header[1] & 0x80)); // not masked
+    *opcode = header[0] & 0x0F;
+    length = header[1] & 0x7F;
+    DAP_TEST_CHECK(length != 127);
+    if (length == 126)
+    {
+        ws_test_read(fd, &header[2], 2);
+        length = (header[2] << 8) | header[3];
+        DAP_TEST_CHECK(length >= 126);
+    }
+    ws_test_read(fd, payload, length);
+    return length;
+}
+
+static int ws_test_command(const uint8_t *request, uint32_t length, uint8_t *response)
+{
+    uint8_t frame[8 + DAP_PACKET_SIZE];
+    uint8_t opcode;
+    int ret;
+
+    ws_test_write(ws_test_fd, frame, ws_test_build_frame(frame, WS_TEST_OPCODE_BINARY, request, length));
+    ret = ws_test_read_frame(ws_test_fd, &opcode, response);
+    DAP_TEST_CHECK(opcode == WS_TEST_OPCODE_BINARY);
+    return ret;
+}
+
+static void ws_test_bad_upgrade(const char *headers)
+{
+    char response[256];
+    uint8_t data;
+    int fd = ws_test_connect();
+
+    DAP_TEST_CHECK(ws_test_upgrade(fd, headers, response, sizeof(response)) == 400);
+    // and the connection is closed
+    DAP_TEST_CHECK(recv(fd, &data, 1, 0) == 0);
+    close(fd);
+}
+
+static void ws_test_handshake()
+{
+    char response[256];
+
+    ws_test_bad_upgrade("Connection: Upgrade\r\nSec-WebSocket-Key: " WS_TEST_KEY "\r\nSec-WebSocket-Version: 13\r\n");
+    ws_test_bad_upgrade("Upgrade: h2c\r\nConnection: Upgrade\r\n"
+                        "Sec-WebSocket-Key: " WS_TEST_KEY "\r\nSec-WebSocket-Version: 13\r\n");
+    ws_test_bad_upgrade("Upgrade: websocket\r\nConnection: keep-alive\r\n"
+                        "Sec-WebSocket-Key: " WS_TEST_KEY "\r\nSec-WebSocket-Version: 13\r\n");
+    ws_test_bad_upgrade("Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                        "Sec-WebSocket-Key: " WS_TEST_KEY "\r\nSec-WebSocket-Version: 8\r\n");
+    ws_test_bad_upgrade("Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\n");
+
+    // as Firefox sends it, the names and tokens in other cases
+    ws_test_fd = ws_test_connect();
+    DAP_TEST_CHECK(ws_test_upgrade(ws_test_fd,
+                                   "upgrade: WebSocket\r\nConnection: keep-alive, Upgrade\r\n"
+                                   "sec-websocket-key: " WS_TEST_KEY "\r\nSec-WebSocket-Version: 13\r\n",
+                                   response, sizeof(response)) == 101);
+    DAP_TEST_CHECK(strstr(response, "\r\nSec-WebSocket-Accept: " WS_TEST_ACCEPT "\r\n") != NULL);
+}
+
+static uint32_t ws_test_word(uint32_t index)
+{
+    return 0xA5000000 | (index * 0x10101);
+}
+
+/**
+ * @brief Read back words put in the RAM, one command each, all sent at once
+ *
+ */
+static void ws_test_pipeline()
+{
+    static uint8_t frames[WS_TEST_PIPELINE * 16];
+    const uint8_t tar[] = {ID_DAP_Transfer, 0, 1, DAP_TRANSFER_APnDP | DAP_TEST_AP_TAR, 0x00, 0x00, 0x00, 0x20};
+    const uint8_t read[] = {ID_DAP_Transfer, 0, 1, DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TEST_AP_DRW};
+    uint8_t response[DAP_PACKET_SIZE];
+    uint8_t *ram = target_sim_memory();
+    size_t length = 0;
+    uint8_t opcode;
+    uint32_t value;
+    uint32_t i;
+
+    for (i = 0; i < WS_TEST_PIPELINE; i++)
+    {
+        value = ws_test_word(i);
+        memcpy(&ram[i * 4], &value, 4);
+    }
+    DAP_TEST_CHECK(ws_test_command(tar, sizeof(tar), response) == 3 && response[2] == DAP_TRANSFER_OK);
+
+    for (i = 0; i < WS_TEST_PIPELINE; i++)
+    {
+        length += ws_test_build_frame(&frames[length], WS_TEST_OPCODE_BINARY, read, sizeof(read));
+    }
+    ws_test_write(ws_test_fd, frames, length);
+
+    for (i = 0; i < WS_TEST_PIPELINE; i++)
+    {
+        DAP_TEST_CHECK(ws_test_read_frame(ws_test_fd, &opcode, response) == 7);
+        DAP_TEST_CHECK(opcode == WS_TEST_OPCODE_BINARY);
+        DAP_TEST_CHECK(response[0] == ID_DAP_Transfer && response[1] == 1 && response[2] == DAP_TRANSFER_OK);
+        value = response[3] | (response[4] << 8) | (response[5] << 16) | ((uint32_t)response[6] << 24);
+        DAP_TEST_CHECK(value == ws_test_word(i));
+    }
+}
+
+/**
+ * @brief A frame cut in two TCP segments, and a response too long for a 7-bit length
+ *
+ */
+static void ws_test_long_frames()
+{
+    const uint8_t tar[] = {ID_DAP_Transfer, 0, 1, DAP_TRANSFER_APnDP | DAP_TEST_AP_TAR, 0x00, 0x00, 0x00, 0x20};
+    const uint8_t block[] = {ID_DAP_TransferBlock, 0, 64, 0, DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TEST_AP_DRW};
+    uint8_t frame[64];
+    uint8_t response[DAP_PACKET_SIZE];
+    uint8_t opcode;
+    size_t length;
+    uint32_t value;
+    uint32_t i;
+
+    length = ws_test_build_frame(frame, WS_TEST_OPCODE_BINARY, tar, sizeof(tar));
+    ws_test_write(ws_test_fd, frame, 5);
+    usleep(50000);
+    ws_test_write(ws_test_fd, &frame[5], length - 5);
+    DAP_TEST_CHECK(ws_test_read_frame(ws_test_fd, &opcode, response) == 3);
+    DAP_TEST_CHECK(response[2] == DAP_TRANSFER_OK);
+
+    DAP_TEST_CHECK(ws_test_command(block, sizeof(block), response) == 4 + 64 * 4);
+    DAP_TEST_CHECK(response[1] == 64 && response[2] == 0 && response[3] == DAP_TRANSFER_OK);
+    for (i = 0; i < WS_TEST_PIPELINE; i++)
+    {
+        memcpy(&value, &response[4 + i * 4], 4);
+        DAP_TEST_CHECK(value == ws_test_word(i));
+    }
+}
+
+/**
+ * @brief Fill the window with reads the target keeps answering with WAIT,
+ * then end each one with DAP_TransferAbort
+ *
+ */
+static void ws_test_abort()
+{
+    static uint8_t frames[DAP_PACKET_WINDOW * 16];
+    const uint8_t configure[] = {ID_DAP_TransferConfigure, 0, WS_TEST_WAIT_RETRY & 0xFF,
+                                 WS_TEST_WAIT_RETRY >> 8, 0, 0};
+    const uint8_t read[] = {ID_DAP_Transfer, 0, 1, DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TEST_AP_DRW};
+    const uint8_t abort[] = {ID_DAP_TransferAbort};
+    const uint8_t clear[] = {ID_DAP_Transfer, 0, 1, DP_ABORT, 0x1F, 0x00, 0x00, 0x00};
+    struct pollfd ready = {ws_test_fd, POLLIN, 0};
+    uint8_t response[DAP_PACKET_SIZE];
+    uint8_t frame[16];
+    uint8_t opcode;
+    size_t length = 0;
+    uint32_t waits;
+    uint32_t i;
+
+    DAP_TEST_CHECK(ws_test_command(configure, sizeof(configure), response) == 2 && response[1] == DAP_OK);
+    for (i = 0; i < DAP_PACKET_WINDOW; i++)
+    {
+        length += ws_test_build_frame(&frames[length], WS_TEST_OPCODE_BINARY, read, sizeof(read));
+    }
+
+    waits = target_sim_stats()->wait;
+    target_sim_inject(TARGET_SIM_WAIT, 0, 0xFFFFFFFF);
+    ws_test_write(ws_test_fd, frames, length);
+
+    // An abort only ends the read being retried, one that lands between two
+    // commands is cleared by the next one: send it again until the read ends.
+    for (i = 0; i < DAP_PACKET_WINDOW; i++)
+    {
+        do
+        {
+            ws_test_write(ws_test_fd, frame, ws_test_build_frame(frame, WS_TEST_OPCODE_BINARY, abort, sizeof(abort)));
+        } while (poll(&ready, 1, WS_TEST_ABORT_POLL_MS) == 0);
+        DAP_TEST_CHECK(ws_test_read_frame(ws_test_fd, &opcode, response) == 3 && opcode == WS_TEST_OPCODE_BINARY);
+        DAP_TEST_CHECK(response[0] == ID_DAP_Transfer && response[1] == 0 && response[2] == DAP_TRANSFER_WAIT);
+
+        // An abort that waited for a free slot would let the first read run all its retries
+        DAP_TEST_CHECK(target_sim_stats()->wait - waits < WS_TEST_WAIT_RETRY);
+        waits = target_sim_stats()->wait;
+    }
+
+    // DAPABORT gives up the stalled AP access, as a debugger does after the abort
+    DAP_TEST_CHECK(ws_test_command(clear, sizeof(clear), response) == 3 && response[2] == DAP_TRANSFER_OK);
+}
+
+static void ws_test_control()
+{
+    const uint8_t ping[] = {'d', 'a', 'p'};
+    uint8_t frame[16];
+    uint8_t payload[128];
+    uint8_t opcode;
+    uint8_t data;
+
+    ws_test_write(ws_test_fd, frame, ws_test_build_frame(frame, WS_TEST_OPCODE_PING, ping, sizeof(ping)));
+    DAP_TEST_CHECK(ws_test_read_frame(ws_test_fd, &opcode, payload) == sizeof(ping));
+    DAP_TEST_CHECK(opcode == WS_TEST_OPCODE_PONG && memcmp(payload, ping, sizeof(ping)) == 0);
+
+    ws_test_write(ws_test_fd, frame, ws_test_build_frame(frame, WS_TEST_OPCODE_CLOSE, NULL, 0));
+    DAP_TEST_CHECK(ws_test_read_frame(ws_test_fd, &opcode, payload) == 0);
+    DAP_TEST_CHECK(opcode == WS_TEST_OPCODE_CLOSE);
+    DAP_TEST_CHECK(recv(ws_test_fd, &data, 1, 0) == 0);
+    close(ws_test_fd);
+}
+
+int main(int argc, char **argv)
+{
+    const uint8_t request[] = {ID_DAP_Info, DAP_ID_PACKET_COUNT};
+    uint8_t response[DAP_PACKET_SIZE];
+
+    dap_test_start(websocket_server_task, "websocket_server");
+
+    ws_test_handshake();
+    DAP_TEST_CHECK(ws_test_command(request, sizeof(request), response) == 3);
+    DAP_TEST_CHECK(response[2] == DAP_PACKET_WINDOW);
+    dap_test_target_setup(ws_test_command);
+
+    ws_test_pipeline();
+    ws_test_long_frames();
+    ws_test_abort();
+    ws_test_control();
+
+    // the session is given back with the connection
+    ws_test_fd = ws_test_connect();
+    DAP_TEST_CHECK(ws_test_upgrade(ws_test_fd,
+                                   "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                                   "Sec-WebSocket-Key: " WS_TEST_KEY "\r\nSec-WebSocket-Version: 13\r\n",
+                                   (char *)response, sizeof(response)) == 101);
+    DAP_TEST_CHECK(ws_test_command(request, sizeof(request), response) == 3);
+
+    // a command can not be empty
+    ws_test_write(ws_test_fd, response, ws_test_build_frame(response, WS_TEST_OPCODE_BINARY, NULL, 0));
+    DAP_TEST_CHECK(dap_test_wait_log("WebSocket empty DAP command", 1000));
+    DAP_TEST_CHECK(recv(ws_test_fd, response, 1, 0) == 0);
+    close(ws_test_fd);
+
+    printf("websocket_test: OK\n");
+    return 0;
+}
@@ -18,5 +18,62 @@
     #define DAP_PACKET_SIZE 255U // 255 for USB HID
 #endif
 
+/// Number of DAP packets that can be in flight between the host and the DAP task.
+/// It is reported to the host as the packet count, so the host can pipeline this many
+/// commands without waiting for their responses.
+/// Valid range is 1 .. 255.
+#define DAP_PACKET_WINDOW 8U
+
+/**
+ * @brief Fastest SWD clock of the SPI engine, see dap_clock.h
+ * 80000000U runs the SPI at the APB clock, which needs short wiring to the target.
+ *
+ */
+#define DAP_SPI_MAX_CLOCK 40000000U
+
+/**
+ * @brief Shift the JTAG scans through the SPI in full duplex, TMS staying on GPIO, see JTAG_DP.c.
+ * TDI and TDO reach the SPI through the GPIO matrix, which limits the clock to DAP_JTAG_SPI_MAX_CLOCK.
+ *
+ */
+#define USE_JTAG_SPI 1
+#define DAP_JTAG_SPI_MAX_CLOCK 20000000U
+
+/**
+ * @brief With the SPI engine, send the data of each write in the same transaction
+ * as the request of the next one, see SWD_WriteRun(). It is used for the writes of
+ * DAP_TransferBlock, and for runs of at least SWD_WRITE_RUN_MIN writes in DAP_Transfer.
+ *
+ */
+#define USE_SWD_WRITE_RUN 1
+#define SWD_WRITE_RUN_MIN 2U
+
+/**
+ * @brief Count URBs, DAP commands and ACKs, see dap_metrics.h
+ *
+ */
+#define USE_DAP_METRICS 1
+
+/**
+ * @brief Record the timeline of the DAP path, see dap_event.h
+ * Each core gets a ring of DAP_EVENT_RING_SIZE events of 12 bytes.
+ *
+ */
+#ifndef USE_DAP_EVENT_TRACE
+#define USE_DAP_EVENT_TRACE 0
+#endif
+#define DAP_EVENT_RING_SIZE 1024U
+
+/**
+ * @brief Messages logged through dap_log.h, see DAP_LOG_LEVEL_*
+ * The ones above this level are not compiled in. The ring holds
+ * DAP_LOG_RING_SIZE messages of 32 bytes until the log task formats them.
+ *
+ */
+#ifndef DAP_LOG_LEVEL
+#define DAP_LOG_LEVEL 3 // DAP_LOG_LEVEL_INFO
+#endif
+#define DAP_LOG_RING_SIZE 128U
+
 
 #endif
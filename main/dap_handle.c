@@ -1,29 +1,42 @@
 /**
  * @file DAP_handle.c
  * @brief Handle DAP packets and transaction push
- * @version 0.4
+ * @version 1.1
  * @change: 2020.02.04 first version
  *          2020.11.11 support WinUSB mode
  *          2021.02.17 support SWO
+ *          2022.07.20 match responses to URBs by seqnum
+ *          2022.07.22 complete IN URBs from a reply task
+ *          2022.07.24 support USBIP unlink
+ *          2022.07.26 batch the responses without copying them
+ *          2022.07.28 replace the ringbufs with lock-free slot queues
+ *          2022.07.30 receive commands straight into the queue
+ *          2022.08.02 let other transports own the DAP engine
+ *          2022.08.06 wake the session task when a request slot is freed
  *
  * @copyright Copyright (c) 2021
  *
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include "main/usbip_server.h"
-#include "main/DAP_handle.h"
+#include "main/dap_handle.h"
 #include "main/dap_configuration.h"
+#include "main/dap_queue.h"
 
 #include "components/USBIP/USB_descriptor.h"
 #include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_metrics.h"
+#include "components/DAP/include/dap_latency.h"
+#include "components/DAP/include/dap_log.h"
+#include "components/DAP/include/dap_event.h"
 //#include "swo.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/ringbuf.h"
 #include "freertos/semphr.h"
 
 #include "lwip/err.h"
@@ -31,32 +44,50 @@
 #include "lwip/sys.h"
 #include <lwip/netdb.h>
 
-extern int kSock;
+extern SemaphoreHandle_t kConnMutex;
 extern TaskHandle_t kDAPTaskHandle;
+extern TaskHandle_t kDAPReplyTaskHandle;
 
 static portMUX_TYPE my_mutex;
 
-int kRestartDAPHandle = 0;
 
+// Commands from the session task to DAP_Thread, and their responses back to the reply task.
+// Both are filled and read in place.
+static dap_queue_t dap_request_queue;
+static dap_queue_t dap_response_queue;
+
+// The transport of the session that owns the DAP engine, NULL if there is none.
+// Only one session at a time, so each queue keeps a single producer.
+static const dap_transport_t *dap_transport = NULL;
 
-#if (USE_WINUSB == 1)
-typedef struct
-{
-    uint32_t length;
-    uint8_t buf[DAP_PACKET_SIZE];
-} DAPPacetDataType;
-#else
-typedef struct
-{
-    uint8_t buf[DAP_PACKET_SIZE];
-} DAPPacetDataType;
-#endif
 
+// Commands in flight, protected by kConnMutex.
+// Commands are answered in the order they were submitted. For USBIP, each answer
+// is given to the oldest EP1 IN URB that is still waiting.
+static uint32_t dap_request_seqnum[DAP_PACKET_WINDOW]; // commands that have not been answered yet
+static uint32_t dap_request_head = 0;
+static uint32_t dap_request_count = 0;
 
-#define DAP_HANDLE_SIZE (sizeof(DAPPacetDataType))
+// The session task blocked in wait_dap_request_slot(), protected by kConnMutex
+static TaskHandle_t dap_request_waiter = NULL;
+
+// State of each command in the request list, shared with DAP_Thread.
+// Only changed with atomic operations, as DAP_Thread can not take kConnMutex.
+enum dap_request_state
+{
+    DAP_REQUEST_QUEUED = 0,
+    DAP_REQUEST_EXECUTING,
+    DAP_REQUEST_DONE,
+    DAP_REQUEST_CANCELLED,
+};
+static uint32_t dap_request_state[DAP_PACKET_WINDOW];
 
-static DAPPacetDataType DAPDataProcessed;
-static _Atomic int dap_respond = 0;
+static usbip_stage2_header dap_in_urb[DAP_PACKET_WINDOW]; // IN URBs waiting for a response
+static uint32_t dap_in_urb_head = 0;
+static uint32_t dap_in_urb_count = 0;
+
+// When the session task got the data it is dispatching, in us
+static uint32_t dap_request_arrival = 0;
 
 
 // SWO Trace
@@ -65,54 +96,391 @@ static uint32_t swo_data_num;
 
 
 
-// DAP handle
-static RingbufHandle_t dap_dataIN_handle = NULL;
-static RingbufHandle_t dap_dataOUT_handle = NULL;
-static SemaphoreHandle_t data_response_mux = NULL;
+static void cancel_dap_request(uint32_t offset);
+static int usbip_dap_ready();
+static void usbip_dap_reply(uint32_t seqnum, const uint8_t *buf, uint32_t length);
 
-static void unpack(void *data, int size);
+const dap_transport_t kUsbipDAPTransport = {
+    .ready = usbip_dap_ready,
+    .reply = usbip_dap_reply,
+    .flush = flush_usbip_tx,
+};
 
-void handle_dap_data_request(usbip_stage2_header *header, uint32_t length)
+/**
+ * @brief Take the DAP engine for a new session. Called with kConnMutex held.
+ *
+ * @param transport How the responses of the session are sent
+ * @return 0 on success, -1 if another session owns the DAP engine
+ */
+int acquire_dap_session(const dap_transport_t *transport)
 {
-    uint8_t *data_in = (uint8_t *)header;
-    data_in = &(data_in[sizeof(usbip_stage2_header)]);
-    // Point to the beginning of the URB packet
+    if (dap_transport != NULL)
+    {
+        return -1;
+    }
 
-#if (USE_WINUSB == 1)
-    send_stage2_submit(header, 0, 0);
+    dap_transport = transport;
+    dap_latency_reset();
+    return 0;
+}
+
+/**
+ * @brief Give the DAP engine back when the session is closed. Called with kConnMutex held.
+ * The commands still in flight are cancelled, their slots are released
+ * by the reply task as usual.
+ *
+ */
+void release_dap_session()
+{
+    uint32_t j;
+
+    for (j = 0; j < dap_request_count; j++)
+    {
+        cancel_dap_request(j);
+    }
+    dap_in_urb_head = dap_in_urb_count = 0;
+    dap_transport = NULL;
 
-    // always send constant size buf -> cuz we don't care about the IN packet size
-    // and to unify the style, we set aside the length of the section
-    xRingbufferSend(dap_dataIN_handle, data_in - sizeof(uint32_t), DAP_HANDLE_SIZE, portMAX_DELAY);
+    // it may be waiting for an IN URB that will never come
+    xTaskNotifyGive(kDAPReplyTaskHandle);
+}
+
+/**
+ * @brief Note that the session task got data from the network, the commands
+ * queued until the next call arrived with it.
+ *
+ */
+void mark_dap_request_arrival()
+{
+    dap_request_arrival = dap_metrics_time_us();
+}
+
+/**
+ * @brief Get the buffer the next command can be received in,
+ * so that it does not have to be copied again.
+ *
+ * @return The buffer of the next request slot, or NULL if the DAP queue is full
+ */
+uint8_t *get_dap_request_buffer()
+{
+    DAPPacetDataType *request = dap_queue_reserve(&dap_request_queue);
+
+    return request == NULL ? NULL : request->buf;
+}
+
+/**
+ * @brief Queue a command for DAP_Thread. Called with kConnMutex held.
+ *
+ * @param seqnum Identifies the command to the transport
+ * @param data_in The command, may already be in the buffer from get_dap_request_buffer()
+ * @param data_length Length of the command
+ * @return 0 if queued, 1 if the command has no response, -1 if the window is full
+ */
+int queue_dap_request(uint32_t seqnum, uint8_t *data_in, uint32_t data_length)
+{
+    DAPPacetDataType *request;
+
+    if (data_length == 0)
+    {
+        // Nothing to execute, a queued one would run whatever was left in its slot.
+        // The caller must not wait for a free slot either.
+        return 1;
+    }
+
+    if (data_in[0] == ID_DAP_TransferAbort)
+    {
+        // Has no response, and must not wait behind the command it aborts.
+        DAP_TransferAbort = 1U;
+        return 1;
+    }
+
+    request = dap_queue_reserve(&dap_request_queue);
+    if (dap_request_count >= DAP_PACKET_WINDOW || request == NULL)
+    {
+        return -1;
+    }
+
+    if (data_length > DAP_PACKET_SIZE)
+    {
+        data_length = DAP_PACKET_SIZE;
+    }
+
+    request->seqnum = seqnum;
+    request->slot = (dap_request_head + dap_request_count) % DAP_PACKET_WINDOW;
+    request->length = data_length;
+    request->time = dap_metrics_time_us();
+    if (data_in != request->buf)
+    {
+        // only the bytes of the command are copied
+        memcpy(request->buf, data_in, data_length);
+    }
+
+    dap_request_seqnum[request->slot] = seqnum;
+    __atomic_store_n(&dap_request_state[request->slot], DAP_REQUEST_QUEUED, __ATOMIC_RELEASE);
+    dap_request_count++;
+    dap_metrics_max(DAP_METRIC_REQUEST_QUEUE_MAX, dap_request_count);
+
+    dap_queue_commit(&dap_request_queue);
+    dap_latency_record(DAP_LATENCY_ARRIVAL, request->time - dap_request_arrival);
+    DAP_EVENT_INSTANT(DAP_EVENT_QUEUE_PUSH, seqnum);
     xTaskNotifyGive(kDAPTaskHandle);
+    return 0;
+}
+
+/**
+ * @brief Wait until the reply task frees a request slot, when queue_dap_request()
+ * found the window full. Called with kConnMutex held, which is given up while waiting.
+ *
+ */
+void wait_dap_request_slot()
+{
+    dap_request_waiter = xTaskGetCurrentTaskHandle();
+    xSemaphoreGive(kConnMutex);
+    // a slot freed since the check has already notified this task
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    xSemaphoreTake(kConnMutex, portMAX_DELAY);
+}
+
+void handle_dap_data_request(usbip_stage2_header *header, uint8_t *data_in, uint32_t data_length)
+{
+    if (data_length == 0)
+    {
+        // An empty OUT transfer carries no command, data_in may be NULL.
+        // A queued one would run whatever was left in its slot.
+        send_stage2_submit(header, 0, 0);
+        return;
+    }
+
+    if (queue_dap_request(header->base.seqnum, data_in, data_length) < 0)
+    {
+        // The host does not respect the packet count
+        DAP_LOGE("DAP packet window overflow!\r\n");
+        send_stage2_submit(header, -USBIP_EPIPE, 0);
+        return;
+    }
 
-#else
     send_stage2_submit(header, 0, 0);
+}
 
-    xRingbufferSend(dap_dataIN_handle, data_in, DAP_HANDLE_SIZE, portMAX_DELAY);
-    xTaskNotifyGive(kDAPTaskHandle);
+void handle_dap_data_response(usbip_stage2_header *header)
+{
+    if (dap_in_urb_count >= DAP_PACKET_WINDOW)
+    {
+        DAP_LOGE("Too many EP1 IN URBs!\r\n");
+        send_stage2_submit(header, -USBIP_EPIPE, 0);
+        return;
+    }
+
+    // park the URB until the response of the oldest command is ready
+    memcpy(&dap_in_urb[(dap_in_urb_head + dap_in_urb_count) % DAP_PACKET_WINDOW], header, sizeof(usbip_stage2_header));
+    dap_in_urb_count++;
+
+    // the response may already be waiting for this URB
+    xTaskNotifyGive(kDAPReplyTaskHandle);
+}
+
+/**
+ * @brief Cancel a command that has not been answered yet
+ *
+ * @param offset Position of the command in the request list
+ */
+static void cancel_dap_request(uint32_t offset)
+{
+    uint32_t slot = (dap_request_head + offset) % DAP_PACKET_WINDOW;
+    uint32_t state = __atomic_exchange_n(&dap_request_state[slot], DAP_REQUEST_CANCELLED, __ATOMIC_ACQ_REL);
+
+    if (state == DAP_REQUEST_EXECUTING)
+    {
+        // stop the WAIT retry loops on the other core
+        DAP_TransferAbort = 1U;
+    }
+    // The slot is released by the reply task once DAP_Thread is done with it.
+}
+
+/**
+ * @brief Unlink an EP1 URB
+ *
+ * @param seqnum seqnum of the URB to unlink
+ * @return status of ret_unlink: -ECONNRESET if the URB was still pending,
+ *         0 if it has already been given back, as the Linux stub does
+ */
+int handle_dap_unlink(uint32_t seqnum)
+{
+    uint32_t i, j, live;
+
+    for (i = 0; i < dap_in_urb_count; i++)
+    {
+        if (dap_in_urb[(dap_in_urb_head + i) % DAP_PACKET_WINDOW].base.seqnum != seqnum)
+        {
+            continue;
+        }
+
+        for (j = i + 1; j < dap_in_urb_count; j++)
+        {
+            memcpy(&dap_in_urb[(dap_in_urb_head + j - 1) % DAP_PACKET_WINDOW],
+                   &dap_in_urb[(dap_in_urb_head + j) % DAP_PACKET_WINDOW], sizeof(usbip_stage2_header));
+        }
+        dap_in_urb_count--;
+
+        // The i-th command that is still alive would have been answered to this URB.
+        // Nobody is waiting for it anymore.
+        live = 0;
+        for (j = 0; j < dap_request_count; j++)
+        {
+            if (__atomic_load_n(&dap_request_state[(dap_request_head + j) % DAP_PACKET_WINDOW],
+                                __ATOMIC_ACQUIRE) == DAP_REQUEST_CANCELLED)
+            {
+                continue;
+            }
+            if (live++ == i)
+            {
+                cancel_dap_request(j);
+                break;
+            }
+        }
+        return -USBIP_ECONNRESET;
+    }
+
+    // OUT URBs are given back as soon as they arrive, so the host already saw this
+    // command succeed. It is left to run: its response still goes to the next IN URB,
+    // and dropping it would shift every parked IN URB onto the wrong command.
+    return 0;
+}
 
+static int usbip_dap_ready()
+{
+    return dap_in_urb_count > 0;
+}
+
+/**
+ * @brief Give the response to the oldest parked IN URB
+ *
+ */
+static void usbip_dap_reply(uint32_t seqnum, const uint8_t *buf, uint32_t length)
+{
+    usbip_stage2_header *in_header = &dap_in_urb[dap_in_urb_head];
+
+    dap_in_urb_head = (dap_in_urb_head + 1) % DAP_PACKET_WINDOW;
+    dap_in_urb_count--;
+
+#if (USE_WINUSB == 1)
+    send_stage2_submit_data_fast(in_header, 0, buf, length);
+#else
+    send_stage2_submit_data_fast(in_header, 0, buf, DAP_PACKET_SIZE);
 #endif
+}
+
+/**
+ * @brief Take the oldest command off the request list. Called with kConnMutex held.
+ *
+ */
+static void free_dap_request()
+{
+    dap_request_head = (dap_request_head + 1) % DAP_PACKET_WINDOW;
+    dap_request_count--;
 
-    // dap_respond = DAP_ProcessCommand((uint8_t *)data_in, (uint8_t *)data_out);
-    // //handle_dap_data_response(header);
-    // send_stage2_submit(header, 0, 0);
+    if (dap_request_waiter != NULL)
+    {
+        xTaskNotifyGive(dap_request_waiter);
+        dap_request_waiter = NULL;
+    }
 }
 
-void handle_dap_data_response(usbip_stage2_header *header)
+/**
+ * @brief Send the queued replies and give the responses back to DAP_Thread
+ *
+ * @param count Number of responses referenced by the queued replies, cleared on return
+ */
+static void release_dap_response(uint32_t *count)
 {
-    return;
-    // int resLength = dap_respond & 0xFFFF;
-    // if (resLength)
-    // {
-
-    //     send_stage2_submit_data(header, 0, (void *)DAPDataProcessed.buf, resLength);
-    //     dap_respond = 0;
-    // }
-    // else
-    // {
-    //     send_stage2_submit(header, 0, 0);
-    // }
+    DAPPacetDataType *item;
+    uint32_t now;
+    uint32_t i;
+
+    DAP_EVENT_BEGIN(DAP_EVENT_REPLY, *count);
+    if (dap_transport != NULL)
+    {
+        dap_transport->flush();
+    }
+    DAP_EVENT_END(DAP_EVENT_REPLY, *count);
+
+    now = dap_metrics_time_us();
+    for (i = 0; i < *count; i++)
+    {
+        item = dap_queue_peek(&dap_response_queue, i);
+        if (item->length > 0) // the dropped ones are cleared
+        {
+            dap_latency_record(DAP_LATENCY_SEND, now - item->time);
+        }
+    }
+    dap_queue_release(&dap_response_queue, *count);
+    *count = 0;
+}
+
+/**
+ * @brief Send the responses to the session that owns the DAP engine.
+ * DAP_Thread wakes this task up as soon as a command has been processed, so
+ * neither the session task nor the DAP task has to wait for the other side.
+ * All the responses that are ready by then are sent in one TCP write, straight
+ * from their response slots. lwIP copies them into its segments (NETCONN_COPY):
+ * the slots go back to DAP_Thread as soon as the write returns, while lwIP keeps
+ * the data until the host acknowledges it, for retransmission.
+ *
+ */
+void DAP_Reply_Thread(void *argument)
+{
+    DAPPacetDataType *item;
+    uint32_t batch_count = 0;
+
+    for (;;)
+    {
+        if (dap_queue_peek(&dap_response_queue, 0) == NULL)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        xSemaphoreTake(kConnMutex, portMAX_DELAY);
+        while (batch_count < DAP_PACKET_WINDOW &&
+               (item = dap_queue_peek(&dap_response_queue, batch_count)) != NULL)
+        {
+            for (;;)
+            {
+                if (dap_request_count == 0 || item->seqnum != dap_request_seqnum[dap_request_head])
+                {
+                    // left over from a command that is no longer in flight
+                    DAP_LOGW("Drop DAP response, seqnum:%d\r\n", (int)item->seqnum);
+                    item->length = 0;
+                    break;
+                }
+
+                if (__atomic_load_n(&dap_request_state[dap_request_head], __ATOMIC_ACQUIRE) == DAP_REQUEST_CANCELLED)
+                {
+                    // unlinked, nobody is waiting for it
+                    free_dap_request();
+                    item->length = 0;
+                    break;
+                }
+
+                if (dap_transport != NULL && dap_transport->ready())
+                {
+                    free_dap_request();
+                    dap_transport->reply(item->seqnum, item->buf, item->length);
+                    break;
+                }
+
+                // Send what is ready, then wait for the host to ask for it, or to unlink it
+                release_dap_response(&batch_count);
+                xSemaphoreGive(kConnMutex);
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                xSemaphoreTake(kConnMutex, portMAX_DELAY);
+            }
+            batch_count++;
+        }
+
+        release_dap_response(&batch_count);
+        xSemaphoreGive(kConnMutex);
+    }
 }
 
 void handle_swo_trace_response(usbip_stage2_header *header)
@@ -121,7 +489,7 @@ void handle_swo_trace_response(usbip_stage2_header *header)
     if (kSwoTransferBusy)
     {
         // busy indicates that there is data to be send
-        printf("swo use data\r\n");
+        DAP_LOGD("swo use data\r\n");
         send_stage2_submit_data(header, 0, (void *)swo_data_to_send, swo_data_num);
         SWO_TransferComplete();
     }
@@ -150,142 +518,71 @@ IRAM_ATTR void DAP_Thread(void *argument)
     // portENTER_CRITICAL(&my_mutex);
     //portDISABLE_INTERRUPTS();
 
-    dap_dataIN_handle = xRingbufferCreate(DAP_HANDLE_SIZE * 20, RINGBUF_TYPE_BYTEBUF);
-    dap_dataOUT_handle = xRingbufferCreate(368 * 20, RINGBUF_TYPE_BYTEBUF);
-    data_response_mux = xSemaphoreCreateMutex();
-    size_t packetSize;
-    int resLength;
+    uint32_t resLength;
+    uint32_t state;
+    uint32_t start, end;
     DAPPacetDataType *item;
-
-    if (dap_dataIN_handle == NULL || dap_dataIN_handle == NULL ||
-        data_response_mux == NULL)
-    {
-        printf("Can not create DAP ringbuf/mux!\r\n");
-        vTaskDelete(NULL);
-    }
+    DAPPacetDataType *response;
 
     ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
     vPortCPUInitializeMutex(&my_mutex);
     portENTER_CRITICAL(&my_mutex);
-    goto start;
     for (;;)
     {
-
-        while (1)
+        item = dap_queue_peek(&dap_request_queue, 0);
+        if (item == NULL)
         {
-            if (kRestartDAPHandle)
-            {
-                vRingbufferDelete(dap_dataIN_handle);
-                vRingbufferDelete(dap_dataOUT_handle);
-                dap_dataIN_handle = dap_dataOUT_handle = NULL;
-
-                dap_dataIN_handle = xRingbufferCreate(DAP_HANDLE_SIZE * 20, RINGBUF_TYPE_BYTEBUF);
-                dap_dataOUT_handle = xRingbufferCreate(DAP_HANDLE_SIZE * 20, RINGBUF_TYPE_BYTEBUF);
-                if (dap_dataIN_handle == NULL || dap_dataIN_handle == NULL)
-                {
-                    printf("Can not create DAP ringbuf/mux!\r\n");
-                    vTaskDelete(NULL);
-                }
-                kRestartDAPHandle = 0;
-            }
-
-            ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
-start:
-            packetSize = 0;
-            item = (DAPPacetDataType *)xRingbufferReceiveUpTo(dap_dataIN_handle, &packetSize,
-                                                          0, DAP_HANDLE_SIZE);
-            if (packetSize == 0)
-            {
-                break;
-            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        DAP_EVENT_INSTANT(DAP_EVENT_QUEUE_POP, item->seqnum);
 
+        // There are never more responses than commands in flight,
+        // so this only waits for the reply task to drop stale ones.
+        while ((response = dap_queue_reserve(&dap_response_queue)) == NULL)
+        {
+        }
 
+        state = DAP_REQUEST_QUEUED;
+        if (!__atomic_compare_exchange_n(&dap_request_state[item->slot], &state, DAP_REQUEST_EXECUTING,
+                                         false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            // unlinked before it was started, the reply task still has to release the slot
+            resLength = 0;
+            end = 0;
+        }
+        else
+        {
             if (item->buf[0] == ID_DAP_QueueCommands)
             {
                 item->buf[0] = ID_DAP_ExecuteCommands;
             }
 
-            resLength = DAP_ProcessCommand((uint8_t *)item->buf, (uint8_t *)DAPDataProcessed.buf); // use first 4 byte to save length
+            // the response is written straight into the response slot
+            start = dap_metrics_time_us();
+            DAP_EVENT_BEGIN(DAP_EVENT_EXECUTE, item->seqnum);
+            resLength = DAP_ExecuteCommand(item->buf, response->buf);
             resLength &= 0xFFFF; // res length in lower 16 bits
-
-            vRingbufferReturnItem(dap_dataIN_handle, (void *)item); // process done.
-
-            // now prepare to reply
-        #if (USE_WINUSB == 1)
-            DAPDataProcessed.length = resLength;
-        #endif
-            xRingbufferSend(dap_dataOUT_handle, (void *)&DAPDataProcessed, 368, portMAX_DELAY);
-
-            // if (xSemaphoreTake(data_response_mux, portMAX_DELAY) == pdTRUE)
-            // {
-                ++dap_respond;
-            //     xSemaphoreGive(data_response_mux);
-            // }
+            DAP_EVENT_END(DAP_EVENT_EXECUTE, item->seqnum);
+            end = dap_metrics_time_us();
+            dap_metrics_add(SWD_TransferSpeed == kTransfer_SPI ? DAP_METRIC_ENGINE_SPI_US : DAP_METRIC_ENGINE_GPIO_US,
+                            end - start);
+            dap_latency_record(DAP_LATENCY_QUEUE_WAIT, start - item->time);
+            dap_latency_record(DAP_LATENCY_EXECUTE, end - start);
+
+            state = DAP_REQUEST_EXECUTING;
+            __atomic_compare_exchange_n(&dap_request_state[item->slot], &state, DAP_REQUEST_DONE,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
         }
-    }
-}
-
-int fast_reply(uint8_t *buf, uint32_t length)
-{
-    if (length == 48 && buf[3] == 1 && buf[15] == 1 && buf[19] == 1)
-    {
-        if (dap_respond > 0)
-        {
-            DAPPacetDataType *item;
-            size_t packetSize = 0;
-            item = (DAPPacetDataType *)xRingbufferReceiveUpTo(dap_dataOUT_handle, &packetSize,
-                                                     (10 / portTICK_RATE_MS), 368);
-            if (packetSize == 368)
-            {
-                unpack((uint32_t *)buf, sizeof(usbip_stage2_header));
-
-            #if (USE_WINUSB == 1)
-                uint32_t resLength = item->length;
-                send_stage2_submit_data_fast((usbip_stage2_header *)buf, 0, item->buf, resLength);
-            #else
-                send_stage2_submit_data_fast((usbip_stage2_header *)buf, 0, item->buf, DAP_HANDLE_SIZE);
-            #endif
 
+        response->seqnum = item->seqnum;
+        response->slot = item->slot;
+        response->length = resLength;
+        response->time = end;
+        dap_queue_release(&dap_request_queue, 1); // process done.
 
-                // if (xSemaphoreTake(data_response_mux, portMAX_DELAY) == pdTRUE)
-                // {
-                    --dap_respond;
-                //     xSemaphoreGive(data_response_mux);
-                // }
-
-                vRingbufferReturnItem(dap_dataOUT_handle, (void *)item);
-                return 1;
-            }
-            else if (packetSize > 0)
-            {
-                printf("Wrong data out packet size:%d!\r\n", packetSize);
-            }
-            ////TODO: fast reply
-        }
-        else
-        {
-            //// TODO: ep0 dir 0 ?
-            buf[0x3] = 0x3; // command
-            buf[0xF] = 0;  // direction
-            buf[0x16] = 0;
-            buf[0x17] = 0;
-            buf[27] = 0;
-            buf[39] = 0;
-            send(kSock, buf, 48, 0);
-            return 1;
-        }
+        dap_queue_commit(&dap_response_queue);
+        dap_metrics_max(DAP_METRIC_RESPONSE_QUEUE_MAX, dap_queue_count(&dap_response_queue));
+        xTaskNotifyGive(kDAPReplyTaskHandle);
     }
-    return 0;
 }
-
-static void unpack(void *data, int size)
-{
-    // Ignore the setup field
-    int sz = (size / sizeof(uint32_t)) - 2;
-    uint32_t *ptr = (uint32_t *)data;
-
-    for (int i = 0; i < sz; i++)
-    {
-        ptr[i] = ntohl(ptr[i]);
-    }
-}
\ No newline at end of file
@@ -1,12 +1,35 @@
 #ifndef __DAP_HANDLE_H__
 #define __DAP_HANDLE_H__
 
+#include <stdint.h>
+
 #include "components/USBIP/USBIP_defs.h"
 
-void handle_dap_data_request(usbip_stage2_header *header, uint32_t length);
+/**
+ * @brief A transport that feeds commands to the DAP engine.
+ * The callbacks are called by the reply task with kConnMutex held.
+ *
+ */
+typedef struct
+{
+    int (*ready)(void);                                                 // a response can be sent now
+    void (*reply)(uint32_t seqnum, const uint8_t *buf, uint32_t length); // queue a response, buf stays valid until flush
+    void (*flush)(void);                                                // send the queued responses
+} dap_transport_t;
+
+extern const dap_transport_t kUsbipDAPTransport;
+
+int acquire_dap_session(const dap_transport_t *transport);
+void release_dap_session();
+void mark_dap_request_arrival();
+uint8_t *get_dap_request_buffer();
+int queue_dap_request(uint32_t seqnum, uint8_t *data_in, uint32_t data_length);
+void wait_dap_request_slot();
+
+void handle_dap_data_request(usbip_stage2_header *header, uint8_t *data_in, uint32_t data_length);
 void handle_dap_data_response(usbip_stage2_header *header);
 void handle_swo_trace_response(usbip_stage2_header *header);
 
-int fast_reply(uint8_t *buf, uint32_t length);
+int handle_dap_unlink(uint32_t seqnum);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+#ifndef __DAP_QUEUE_H__
+#define __DAP_QUEUE_H__
+
+#include <stdint.h>
+
+#include "main/dap_configuration.h"
+
+/**
+ * @brief Single producer / single consumer queue of DAP packets
+ *
+ * Used between the tasks on core 0 and DAP_Thread on core 1. The producer
+ * fills the slot returned by dap_queue_reserve() in place and publishes it
+ * with dap_queue_commit(), the consumer reads the slot returned by
+ * dap_queue_peek() in place and frees it with dap_queue_release().
+ * The consumer may hold several packets before freeing them in order.
+ * The two sides only synchronize through the acquire/release of the indexes,
+ * no lock is taken.
+ *
+ * Indexes run from 0 to 2 * DAP_PACKET_WINDOW - 1, so that a full queue can be
+ * told apart from an empty one without wasting a slot. A zeroed queue is empty.
+ */
+
+#define DAP_QUEUE_ALIGN 32
+
+typedef struct
+{
+    uint32_t seqnum; // seqnum of the EP1 OUT URB that carried the command
+    uint32_t slot;   // index of the command in the request list
+    uint32_t length; // number of valid bytes in buf
+    uint32_t time;   // when the command was queued, or its response ready, in us
+    uint8_t buf[DAP_PACKET_SIZE];
+} DAPPacetDataType;
+
+typedef struct
+{
+    DAPPacetDataType packet[DAP_PACKET_WINDOW];
+    uint32_t head __attribute__((aligned(DAP_QUEUE_ALIGN))); // written by the producer
+    uint32_t tail __attribute__((aligned(DAP_QUEUE_ALIGN))); // written by the consumer
+} __attribute__((aligned(DAP_QUEUE_ALIGN))) dap_queue_t;
+
+static inline uint32_t dap_queue_advance(uint32_t index, uint32_t count)
+{
+    return (index + count) % (2 * DAP_PACKET_WINDOW);
+}
+
+/**
+ * @brief Number of packets in the queue, exact on either side
+ *
+ */
+static inline uint32_t dap_queue_count(dap_queue_t *queue)
+{
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    return (head + 2 * DAP_PACKET_WINDOW - tail) % (2 * DAP_PACKET_WINDOW);
+}
+
+/**
+ * @brief Get the next free slot, called by the producer
+ *
+ * @return The slot, or NULL if the queue is full
+ */
+static inline DAPPacetDataType *dap_queue_reserve(dap_queue_t *queue)
+{
+    uint32_t head = queue->head;
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    if ((head + 2 * DAP_PACKET_WINDOW - tail) % (2 * DAP_PACKET_WINDOW) == DAP_PACKET_WINDOW)
+    {
+        return NULL;
+    }
+    return &queue->packet[head % DAP_PACKET_WINDOW];
+}
+
+/**
+ * @brief Publish the slot returned by dap_queue_reserve(), called by the producer
+ *
+ */
+static inline void dap_queue_commit(dap_queue_t *queue)
+{
+    __atomic_store_n(&queue->head, dap_queue_advance(queue->head, 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Get a packet that has not been released yet, called by the consumer
+ *
+ * @param offset 0 for the oldest packet
+ * @return The packet, or NULL if there are not that many packets in the queue
+ */
+static inline DAPPacetDataType *dap_queue_peek(dap_queue_t *queue, uint32_t offset)
+{
+    uint32_t tail = queue->tail;
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    if ((head + 2 * DAP_PACKET_WINDOW - tail) % (2 * DAP_PACKET_WINDOW) <= offset)
+    {
+        return NULL;
+    }
+    return &queue->packet[dap_queue_advance(tail, offset) % DAP_PACKET_WINDOW];
+}
+
+/**
+ * @brief Free the oldest packets returned by dap_queue_peek(), called by the consumer
+ *
+ */
+static inline void dap_queue_release(dap_queue_t *queue, uint32_t count)
+{
+    __atomic_store_n(&queue->tail, dap_queue_advance(queue->tail, count), __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ * @file dap_tcp_server.c
+ * @brief CMSIS-DAP over a plain TCP connection
+ *
+ * Each command is sent as a 2 byte little-endian length followed by the DAP packet,
+ * and each response comes back the same way, in the order of the commands.
+ * Up to the packet count of commands may be in flight. DAP_TransferAbort has no
+ * response, as with USB.
+ *
+ * @version 0.1
+ * @date 2022-08-02
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main/dap_tcp_server.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "lwip/err.h"
+#include "lwip/api.h"
+#include "lwip/tcp.h"
+
+#include "main/wifi_configuration.h"
+#include "main/dap_configuration.h"
+#include "main/dap_handle.h"
+#include "main/dap_tx_batch.h"
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_event.h"
+#include "components/DAP/include/dap_log.h"
+
+extern SemaphoreHandle_t kConnMutex;
+
+#define DAP_TCP_HEADER_SIZE 2
+
+static struct netconn *dap_tcp_conn = NULL;
+// Received data that is not dispatched yet
+static struct pbuf *dap_tcp_rx_pbuf = NULL;
+static uint32_t dap_tcp_seqnum = 0;
+
+// Responses waiting for dap_tcp_flush()
+static dap_tx_batch_t dap_tcp_tx;
+
+static int dap_tcp_ready();
+static void dap_tcp_reply(uint32_t seqnum, const uint8_t *buf, uint32_t length);
+static void dap_tcp_flush();
+static int dap_tcp_rx_dispatch();
+
+static const dap_transport_t dap_tcp_transport = {
+    .ready = dap_tcp_ready,
+    .reply = dap_tcp_reply,
+    .flush = dap_tcp_flush,
+};
+
+
+static int dap_tcp_ready()
+{
+    // there is no IN request to wait for
+    return 1;
+}
+
+static void dap_tcp_reply(uint32_t seqnum, const uint8_t *buf, uint32_t length)
+{
+    uint8_t header[DAP_TCP_HEADER_SIZE];
+
+    header[0] = length & 0xFF;
+    header[1] = (length >> 8) & 0xFF;
+    dap_tx_batch_add(&dap_tcp_tx, header, DAP_TCP_HEADER_SIZE, buf, length);
+}
+
+static void dap_tcp_flush()
+{
+    dap_tx_batch_flush(&dap_tcp_tx);
+}
+
+void dap_tcp_server_task()
+{
+    struct netconn *listen_conn;
+    struct pbuf *p;
+    err_t err;
+
+    while (1)
+    {
+#ifdef CONFIG_EXAMPLE_IPV4
+        listen_conn = netconn_new(NETCONN_TCP);
+#else // IPV6
+        listen_conn = netconn_new(NETCONN_TCP_IPV6);
+#endif
+        if (listen_conn == NULL)
+        {
+            DAP_LOGE("Unable to create DAP netconn\r\n");
+            break;
+        }
+
+#ifdef CONFIG_EXAMPLE_IPV4
+        err = netconn_bind(listen_conn, IP_ADDR_ANY, DAP_TCP_PORT);
+#else // IPV6
+        err = netconn_bind(listen_conn, IP6_ADDR_ANY, DAP_TCP_PORT);
+#endif
+        if (err != ERR_OK)
+        {
+            DAP_LOGE("DAP socket unable to bind: err %d\r\n", err);
+            break;
+        }
+
+        err = netconn_listen(listen_conn);
+        if (err != ERR_OK)
+        {
+            DAP_LOGE("Error occured during DAP listen: err %d\r\n", err);
+            break;
+        }
+        DAP_LOGI("DAP socket listening\r\n");
+
+        while (1)
+        {
+            err = netconn_accept(listen_conn, &dap_tcp_conn);
+            if (err != ERR_OK)
+            {
+                DAP_LOGE("Unable to accept DAP connection: err %d\r\n", err);
+                break;
+            }
+            ip_set_option(dap_tcp_conn->pcb.tcp, SOF_KEEPALIVE);
+            tcp_nagle_disable(dap_tcp_conn->pcb.tcp);
+
+            xSemaphoreTake(kConnMutex, portMAX_DELAY);
+            dap_tx_batch_reset(&dap_tcp_tx, dap_tcp_conn);
+            err = acquire_dap_session(&dap_tcp_transport);
+            xSemaphoreGive(kConnMutex);
+            if (err != 0)
+            {
+                DAP_LOGW("DAP is used by another session\r\n");
+                netconn_close(dap_tcp_conn);
+                netconn_delete(dap_tcp_conn);
+                dap_tcp_conn = NULL;
+                continue;
+            }
+            DAP_LOGI("DAP socket accepted\r\n");
+
+            while (1)
+            {
+                err = netconn_recv_tcp_pbuf(dap_tcp_conn, &p);
+                if (err != ERR_OK)
+                {
+                    DAP_LOGI("DAP connection closed: err %d\r\n", err);
+                    break;
+                }
+
+                if (dap_tcp_rx_pbuf == NULL)
+                {
+                    dap_tcp_rx_pbuf = p;
+                }
+                else
+                {
+                    pbuf_cat(dap_tcp_rx_pbuf, p);
+                }
+
+                mark_dap_request_arrival();
+                DAP_EVENT_BEGIN(DAP_EVENT_RECV, p->tot_len);
+                err = dap_tcp_rx_dispatch() < 0 ? ERR_VAL : ERR_OK;
+                DAP_EVENT_END(DAP_EVENT_RECV, 0);
+                if (err != ERR_OK)
+                {
+                    DAP_LOGE("DAP framing error\r\n");
+                    break;
+                }
+            }
+
+            xSemaphoreTake(kConnMutex, portMAX_DELAY);
+            release_dap_session();
+            dap_tx_batch_reset(&dap_tcp_tx, NULL);
+            netconn_close(dap_tcp_conn);
+            netconn_delete(dap_tcp_conn);
+            dap_tcp_conn = NULL;
+            xSemaphoreGive(kConnMutex);
+
+            if (dap_tcp_rx_pbuf != NULL)
+            {
+                pbuf_free(dap_tcp_rx_pbuf);
+                dap_tcp_rx_pbuf = NULL;
+            }
+        }
+        netconn_delete(listen_conn);
+    }
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Queue every complete command in the received pbufs.
+ * The command is copied from the pbufs straight into its DAP queue slot.
+ *
+ * @return 0 on success, -1 if the stream can not be framed
+ */
+static int dap_tcp_rx_dispatch()
+{
+    uint8_t header[DAP_TCP_HEADER_SIZE];
+    uint8_t command;
+    uint32_t length;
+    uint8_t *buf;
+
+    while (dap_tcp_rx_pbuf != NULL && dap_tcp_rx_pbuf->tot_len >= DAP_TCP_HEADER_SIZE)
+    {
+        pbuf_copy_partial(dap_tcp_rx_pbuf, header, DAP_TCP_HEADER_SIZE, 0);
+        length = header[0] | (header[1] << 8);
+        if (length == 0 || length > DAP_PACKET_SIZE)
+        {
+            DAP_LOGE("Bad DAP packet length: %d\r\n", (int)length);
+            return -1;
+        }
+        if (dap_tcp_rx_pbuf->tot_len < DAP_TCP_HEADER_SIZE + length)
+        {
+            break; // wait for the rest of the command
+        }
+
+        xSemaphoreTake(kConnMutex, portMAX_DELAY);
+        pbuf_copy_partial(dap_tcp_rx_pbuf, &command, 1, DAP_TCP_HEADER_SIZE);
+        if (command == ID_DAP_TransferAbort)
+        {
+            // Takes no slot: it has to get through a window full of commands
+            // stuck in WAIT retries, which is what it is sent for
+            queue_dap_request(dap_tcp_seqnum, &command, 1);
+        }
+        else
+        {
+            for (;;)
+            {
+                buf = get_dap_request_buffer();
+                if (buf != NULL)
+                {
+                    pbuf_copy_partial(dap_tcp_rx_pbuf, buf, length, DAP_TCP_HEADER_SIZE);
+                    if (queue_dap_request(dap_tcp_seqnum, buf, length) >= 0)
+                    {
+                        break;
+                    }
+                }
+
+                // More commands than the packet count, wait for a response to go out.
+                // The unread data holds the host back through the TCP window.
+                wait_dap_request_slot();
+            }
+        }
+        dap_tcp_seqnum++;
+        xSemaphoreGive(kConnMutex);
+
+        dap_tcp_rx_pbuf = pbuf_free_header(dap_tcp_rx_pbuf, DAP_TCP_HEADER_SIZE + length);
+    }
+
+    return 0;
+}
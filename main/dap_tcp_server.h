@@ -0,0 +1,6 @@
+#ifndef __DAP_TCP_SERVER_H__
+#define __DAP_TCP_SERVER_H__
+
+void dap_tcp_server_task();
+
+#endif
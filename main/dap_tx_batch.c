@@ -0,0 +1,60 @@
+/**
+ * @file dap_tx_batch.c
+ * @brief Responses of a stream transport batched into one netconn write
+ *
+ * @version 0.1
+ * @date 2022-08-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main/dap_tx_batch.h"
+
+#include <string.h>
+
+#include "lwip/err.h"
+#include "lwip/api.h"
+
+#include "components/DAP/include/dap_event.h"
+
+void dap_tx_batch_reset(dap_tx_batch_t *batch, struct netconn *conn)
+{
+    batch->conn = conn;
+    batch->count = 0;
+    batch->vector_count = 0;
+}
+
+void dap_tx_batch_add(dap_tx_batch_t *batch, const uint8_t *header, uint32_t header_length,
+                      const uint8_t *buf, uint32_t length)
+{
+    if (batch->count >= DAP_PACKET_WINDOW)
+    {
+        dap_tx_batch_flush(batch);
+    }
+
+    memcpy(batch->header[batch->count], header, header_length);
+    batch->vector[batch->vector_count].ptr = batch->header[batch->count];
+    batch->vector[batch->vector_count].len = header_length;
+    batch->vector_count++;
+    if (length > 0)
+    {
+        batch->vector[batch->vector_count].ptr = buf;
+        batch->vector[batch->vector_count].len = length;
+        batch->vector_count++;
+    }
+    batch->count++;
+}
+
+void dap_tx_batch_flush(dap_tx_batch_t *batch)
+{
+    if (batch->vector_count == 0)
+    {
+        return;
+    }
+
+    DAP_EVENT_BEGIN(DAP_EVENT_SEND, batch->vector_count);
+    netconn_write_vectors_partly(batch->conn, batch->vector, batch->vector_count, NETCONN_COPY, NULL);
+    DAP_EVENT_END(DAP_EVENT_SEND, batch->vector_count);
+    batch->count = 0;
+    batch->vector_count = 0;
+}
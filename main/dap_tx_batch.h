@@ -0,0 +1,56 @@
+/**
+ * @file dap_tx_batch.h
+ * @brief Responses of a stream transport batched into one netconn write
+ *
+ * The reply task adds each response with its framing header, and the whole
+ * batch goes out in one scatter-gather write on flush. Only the headers are
+ * copied into the batch, the payloads stay in the DAP response queue until the
+ * flush. The write itself is NETCONN_COPY: the response slots are reused once
+ * it returns, before the host has acknowledged the data lwIP may retransmit.
+ * Used by dap_tcp_server.c and websocket_server.c, with kConnMutex held.
+ *
+ * @version 0.1
+ * @date 2022-08-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __DAP_TX_BATCH_H__
+#define __DAP_TX_BATCH_H__
+
+#include <stdint.h>
+
+#include "lwip/api.h"
+
+#include "main/dap_configuration.h"
+
+#define DAP_TX_BATCH_HEADER_MAX 4
+
+typedef struct
+{
+    struct netconn *conn;
+    uint8_t header[DAP_PACKET_WINDOW][DAP_TX_BATCH_HEADER_MAX];
+    struct netvector vector[DAP_PACKET_WINDOW * 2];
+    uint32_t count;
+    uint32_t vector_count;
+} dap_tx_batch_t;
+
+/**
+ * @brief Start a batch on a new connection, dropping what is left from the last one
+ *
+ */
+void dap_tx_batch_reset(dap_tx_batch_t *batch, struct netconn *conn);
+
+/**
+ * @brief Add a response to the batch, flushing it first if it is full
+ *
+ * @param header Framing of the response, up to DAP_TX_BATCH_HEADER_MAX bytes, copied
+ * @param buf The response, must stay valid until the flush
+ */
+void dap_tx_batch_add(dap_tx_batch_t *batch, const uint8_t *header, uint32_t header_length,
+                      const uint8_t *buf, uint32_t length);
+
+void dap_tx_batch_flush(dap_tx_batch_t *batch);
+
+#endif
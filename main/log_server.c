@@ -0,0 +1,130 @@
+/**
+ * @file log_server.c
+ * @brief Low priority task that prints the messages of dap_log.h
+ *
+ * Formats the messages logged by the other tasks and writes them to the
+ * console, so that only this task waits for the UART. With USE_LOG_SERVER,
+ * they are also sent to the client connected to LOG_PORT, a new client
+ * taking the place of the previous one:
+ *
+ *   nc <board> 3246
+ *
+ * @version 0.1
+ * @date 2022-08-17
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main/log_server.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lwip/err.h"
+#include "lwip/api.h"
+
+#include "main/wifi_configuration.h"
+#include "components/DAP/include/dap_log.h"
+
+#define LOG_POLL_MS 20
+
+#if (USE_LOG_SERVER == 1)
+static struct netconn *log_client = NULL;
+
+static void log_drop_client()
+{
+    netconn_close(log_client);
+    netconn_delete(log_client);
+    log_client = NULL;
+}
+
+static struct netconn *log_listen()
+{
+    struct netconn *listen_conn;
+    err_t err;
+
+#ifdef CONFIG_EXAMPLE_IPV4
+    listen_conn = netconn_new(NETCONN_TCP);
+#else // IPV6
+    listen_conn = netconn_new(NETCONN_TCP_IPV6);
+#endif
+    if (listen_conn == NULL)
+    {
+        DAP_LOGE("Unable to create log netconn\r\n");
+        return NULL;
+    }
+
+#ifdef CONFIG_EXAMPLE_IPV4
+    err = netconn_bind(listen_conn, IP_ADDR_ANY, LOG_PORT);
+#else // IPV6
+    err = netconn_bind(listen_conn, IP6_ADDR_ANY, LOG_PORT);
+#endif
+    if (err != ERR_OK || netconn_listen(listen_conn) != ERR_OK)
+    {
+        DAP_LOGE("Log socket unable to listen: err %d\r\n", err);
+        netconn_delete(listen_conn);
+        return NULL;
+    }
+    // accepting is how the task waits for new messages
+    netconn_set_recvtimeout(listen_conn, LOG_POLL_MS);
+    return listen_conn;
+}
+#endif
+
+static void log_output(const char *text, size_t length, void *context)
+{
+    fwrite(text, 1, length, stdout);
+
+#if (USE_LOG_SERVER == 1)
+    if (log_client != NULL && netconn_write(log_client, text, length, NETCONN_COPY) != ERR_OK)
+    {
+        log_drop_client();
+    }
+#endif
+}
+
+void log_server_task()
+{
+#if (USE_LOG_SERVER == 1)
+    struct netconn *listen_conn = log_listen();
+    struct netconn *conn;
+    err_t err;
+#endif
+
+    while (1)
+    {
+        if (dap_log_drain(log_output, NULL) > 0)
+        {
+            fflush(stdout);
+            continue;
+        }
+
+#if (USE_LOG_SERVER == 1)
+        if (listen_conn != NULL)
+        {
+            err = netconn_accept(listen_conn, &conn);
+            if (err == ERR_OK)
+            {
+                if (log_client != NULL)
+                {
+                    log_drop_client();
+                }
+                log_client = conn;
+            }
+            else if (err != ERR_TIMEOUT)
+            {
+                // keep logging to the console
+                DAP_LOGE("Unable to accept log connection: err %d\r\n", err);
+                netconn_delete(listen_conn);
+                listen_conn = NULL;
+            }
+            continue;
+        }
+#endif
+        vTaskDelay(pdMS_TO_TICKS(LOG_POLL_MS));
+    }
+}
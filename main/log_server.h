@@ -0,0 +1,6 @@
+#ifndef __LOG_SERVER_H__
+#define __LOG_SERVER_H__
+
+void log_server_task();
+
+#endif
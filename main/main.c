@@ -11,6 +11,7 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
@@ -26,14 +27,37 @@
 #include "main/wifi_connect.h"
 #include "main/wifi_configuration.h"
 #include "main/tcp_server.h"
+#include "main/dap_tcp_server.h"
+#include "main/udp_server.h"
+#include "main/websocket_server.h"
+#include "main/usbip_capture.h"
+#include "main/metrics_server.h"
+#include "main/log_server.h"
+#include "components/DAP/include/dap_bench.h"
+
+// Netconns of the servers: a listener and a client each, the log server may hold
+// a second client while it drops the first one, and the UDP server has only one.
+#define DAP_NETCONN_COUNT (2 + 2 +                      \
+                           USE_UDP_SERVER * 1 +         \
+                           USE_WEBSOCKET_SERVER * 2 +   \
+                           USE_USBIP_CAPTURE * 2 +      \
+                           USE_METRICS_SERVER * 2 +     \
+                           USE_LOG_SERVER * 3)
+#if (DAP_NETCONN_COUNT > CONFIG_LWIP_MAX_SOCKETS)
+#error "Raise CONFIG_LWIP_MAX_SOCKETS or turn off some servers in wifi_configuration.h"
+#endif
 
 extern void DAP_Setup(void);
 extern void DAP_Thread(void *argument);
+extern void DAP_Reply_Thread(void *argument);
 extern void SWO_Thread();
 
 extern void my_task();
 
+extern SemaphoreHandle_t kConnMutex;
+
 TaskHandle_t kDAPTaskHandle = NULL;
+TaskHandle_t kDAPReplyTaskHandle = NULL;
 
 void app_main(void)
 {
@@ -42,9 +66,33 @@ void app_main(void)
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     ESP_ERROR_CHECK(wifi_connect());
 
+    // the only task that waits for the UART, the others log through its ring
+    xTaskCreatePinnedToCore(log_server_task, "log_server", 3072, NULL, 2, NULL, 0);
+
     DAP_Setup();
+#if (USE_DAP_BENCH == 1)
+    // before the DAP task, nothing else may drive the pins while it runs
+    dap_bench_run(DAP_BENCH_ITERATIONS);
+#endif
 
+    // shared by all the DAP sessions, create it before any of them can start
+    kConnMutex = xSemaphoreCreateMutex();
 
     xTaskCreatePinnedToCore(tcp_server_task, "tcp_server", 4096, NULL, 14, NULL, 0);
+    xTaskCreatePinnedToCore(dap_tcp_server_task, "dap_tcp_server", 4096, NULL, 14, NULL, 0);
+#if (USE_UDP_SERVER == 1)
+    xTaskCreatePinnedToCore(udp_server_task, "udp_server", 4096, NULL, 14, NULL, 0);
+#endif
+#if (USE_WEBSOCKET_SERVER == 1)
+    xTaskCreatePinnedToCore(websocket_server_task, "websocket_server", 4096, NULL, 14, NULL, 0);
+#endif
+#if (USE_USBIP_CAPTURE == 1)
+    xTaskCreatePinnedToCore(usbip_capture_task, "usbip_capture", 3072, NULL, 5, NULL, 0);
+#endif
+#if (USE_METRICS_SERVER == 1)
+    xTaskCreatePinnedToCore(metrics_server_task, "metrics_server", 3072, NULL, 5, NULL, 0);
+#endif
     xTaskCreatePinnedToCore(DAP_Thread, "DAP_Task", 2048, NULL, 10, &kDAPTaskHandle, 1);
+    // sends on the socket, keep it on the same core as the tcp server
+    xTaskCreatePinnedToCore(DAP_Reply_Thread, "DAP_Reply", 3072, NULL, 14, &kDAPReplyTaskHandle, 0);
 }
@@ -0,0 +1,180 @@
+/**
+ * @file metrics_server.c
+ * @brief Prometheus text endpoint of the metrics of dap_metrics.h
+ *
+ * Answers any request on METRICS_PORT with the metrics, as a plain HTTP/1.0
+ * response, so that it can be scraped by Prometheus or read with
+ *
+ *   curl http://<board>:3245/metrics
+ *
+ * With USE_DAP_EVENT_TRACE, /events answers with a dump of the event rings
+ * of dap_event.h, for host/dap_event_convert:
+ *
+ *   curl -o events.bin http://<board>:3245/events
+ *
+ * The gauges that have to be sampled, the stack watermarks, are refreshed
+ * on each request and every second, so that the vendor command sees them too.
+ *
+ * @version 0.1
+ * @date 2022-08-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main/metrics_server.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lwip/err.h"
+#include "lwip/api.h"
+
+#include "main/wifi_configuration.h"
+#include "components/DAP/include/dap_metrics.h"
+#include "components/DAP/include/dap_event.h"
+#include "components/DAP/include/dap_log.h"
+
+#if (USE_METRICS_SERVER == 1)
+
+extern TaskHandle_t kDAPTaskHandle;
+extern TaskHandle_t kDAPReplyTaskHandle;
+
+#define METRICS_REFRESH_MS 1000
+#define METRICS_REQUEST_TIMEOUT_MS 2000
+#define METRICS_BUFFER_SIZE 4096
+
+static const char kMetricsHeader[] = "HTTP/1.0 200 OK\r\n"
+                                     "Content-Type: text/plain; version=0.0.4\r\n"
+                                     "Connection: close\r\n"
+                                     "\r\n";
+
+static const char kEventsHeader[] = "HTTP/1.0 200 OK\r\n"
+                                    "Content-Type: application/octet-stream\r\n"
+                                    "Connection: close\r\n"
+                                    "\r\n";
+
+static char metrics_buffer[METRICS_BUFFER_SIZE];
+
+
+static void metrics_refresh()
+{
+    // the ESP-IDF watermarks are in bytes
+    if (kDAPTaskHandle != NULL)
+    {
+        dap_metrics_set(DAP_METRIC_DAP_TASK_STACK_FREE, uxTaskGetStackHighWaterMark(kDAPTaskHandle));
+    }
+    if (kDAPReplyTaskHandle != NULL)
+    {
+        dap_metrics_set(DAP_METRIC_REPLY_TASK_STACK_FREE, uxTaskGetStackHighWaterMark(kDAPReplyTaskHandle));
+    }
+}
+
+#if (USE_DAP_EVENT_TRACE == 1)
+static int metrics_write_events(const void *data, size_t length, void *context)
+{
+    return netconn_write((struct netconn *)context, data, length, NETCONN_COPY) == ERR_OK ? 0 : -1;
+}
+#endif
+
+static void metrics_serve(struct netconn *conn)
+{
+    static const char kEventsRequest[] = "GET /events";
+    struct netbuf *request;
+    void *data;
+    uint16_t data_length;
+    int events = 0;
+    size_t length;
+
+    // Only the path of /events is looked at, anything else gets the metrics
+    netconn_set_recvtimeout(conn, METRICS_REQUEST_TIMEOUT_MS);
+    if (netconn_recv(conn, &request) == ERR_OK)
+    {
+        if (netbuf_data(request, &data, &data_length) == ERR_OK &&
+            data_length >= sizeof(kEventsRequest) - 1 &&
+            memcmp(data, kEventsRequest, sizeof(kEventsRequest) - 1) == 0)
+        {
+            events = 1;
+        }
+        netbuf_delete(request);
+    }
+
+#if (USE_DAP_EVENT_TRACE == 1)
+    if (events)
+    {
+        if (netconn_write(conn, kEventsHeader, sizeof(kEventsHeader) - 1, NETCONN_NOCOPY) == ERR_OK)
+        {
+            dap_event_dump(metrics_write_events, conn);
+        }
+        return;
+    }
+#else
+    (void)events;
+    (void)kEventsHeader;
+#endif
+
+    metrics_refresh();
+    length = dap_metrics_format(metrics_buffer, sizeof(metrics_buffer));
+
+    if (netconn_write(conn, kMetricsHeader, sizeof(kMetricsHeader) - 1, NETCONN_NOCOPY) == ERR_OK)
+    {
+        netconn_write(conn, metrics_buffer, length, NETCONN_COPY);
+    }
+}
+
+void metrics_server_task()
+{
+    struct netconn *listen_conn;
+    struct netconn *conn;
+    err_t err;
+
+#ifdef CONFIG_EXAMPLE_IPV4
+    listen_conn = netconn_new(NETCONN_TCP);
+#else // IPV6
+    listen_conn = netconn_new(NETCONN_TCP_IPV6);
+#endif
+    if (listen_conn == NULL)
+    {
+        DAP_LOGE("Unable to create metrics netconn\r\n");
+        vTaskDelete(NULL);
+    }
+
+#ifdef CONFIG_EXAMPLE_IPV4
+    err = netconn_bind(listen_conn, IP_ADDR_ANY, METRICS_PORT);
+#else // IPV6
+    err = netconn_bind(listen_conn, IP6_ADDR_ANY, METRICS_PORT);
+#endif
+    if (err != ERR_OK || netconn_listen(listen_conn) != ERR_OK)
+    {
+        DAP_LOGE("Metrics socket unable to listen: err %d\r\n", err);
+        netconn_delete(listen_conn);
+        vTaskDelete(NULL);
+    }
+    netconn_set_recvtimeout(listen_conn, METRICS_REFRESH_MS);
+
+    while (1)
+    {
+        err = netconn_accept(listen_conn, &conn);
+        if (err == ERR_TIMEOUT)
+        {
+            metrics_refresh();
+            continue;
+        }
+        if (err != ERR_OK)
+        {
+            DAP_LOGE("Unable to accept metrics connection: err %d\r\n", err);
+            break;
+        }
+
+        metrics_serve(conn);
+        netconn_close(conn);
+        netconn_delete(conn);
+    }
+    netconn_delete(listen_conn);
+    vTaskDelete(NULL);
+}
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef __METRICS_SERVER_H__
+#define __METRICS_SERVER_H__
+
+void metrics_server_task();
+
+#endif
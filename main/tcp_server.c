@@ -1,14 +1,16 @@
 /**
  * @file tcp_server.c
  * @brief Handle main tcp tasks
- * @version 0.1
+ * @version 0.2
  * @date 2020-01-22
+ * @change: 2022.07.30 receive with netconn, parse PDUs in the pbufs
  *
  * @copyright Copyright (c) 2020
  *
  */
 #include "tcp_server.h"
 
+#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <sys/param.h>
@@ -16,168 +18,265 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 
 
 #include "lwip/err.h"
-#include "lwip/sockets.h"
+#include "lwip/api.h"
+#include "lwip/tcp.h"
 #include "lwip/sys.h"
-#include <lwip/netdb.h>
 
 #include "main/wifi_configuration.h"
 #include "main/usbip_server.h"
+#include "main/dap_handle.h"
+
+#include "components/DAP/include/dap_event.h"
+#include "components/DAP/include/dap_log.h"
 
-extern TaskHandle_t kDAPTaskHandle;
-extern int kRestartDAPHandle;
 
 
 
 uint8_t kState = ACCEPTING;
-int kSock = -1;
+struct netconn *kConn = NULL;
+// Serializes the writes to the connection of the DAP session and the DAP session state
+SemaphoreHandle_t kConnMutex = NULL;
 
+// Must be able to hold at least one complete PDU (header + DAP packet)
+#define TCP_RX_BUFFER_SIZE 2048
 
-static uint8_t tcp_rx_buffer[2048];
-static char addr_str[128];
+// Received data that is not dispatched yet, kept in the pbufs lwIP gave us
+static struct pbuf *tcp_rx_pbuf = NULL;
+// PDUs that do not go straight into the DAP queue are copied here
+static uint8_t tcp_rx_buffer[TCP_RX_BUFFER_SIZE] __attribute__((aligned(4)));
 
-void tcp_server_task()
+static int tcp_rx_dispatch();
+
+/**
+ * @brief Send data on the USBIP connection
+ *
+ */
+int usbip_network_send(const void *data, size_t size)
 {
+    err_t err;
 
-    int addr_family;
-    int ip_protocol;
+    DAP_EVENT_BEGIN(DAP_EVENT_SEND, 1);
+    err = netconn_write(kConn, data, size, NETCONN_COPY);
+    DAP_EVENT_END(DAP_EVENT_SEND, 1);
+    return err;
+}
+
+/**
+ * @brief Send several buffers on the USBIP connection as one write
+ *
+ */
+int usbip_network_writev(struct netvector *vectors, uint16_t count)
+{
+    err_t err;
+
+    // Copied: the DAP response slots are reused once this returns, lwIP keeps the
+    // data until it is acknowledged
+    DAP_EVENT_BEGIN(DAP_EVENT_SEND, count);
+    err = netconn_write_vectors_partly(kConn, vectors, count, NETCONN_COPY, NULL);
+    DAP_EVENT_END(DAP_EVENT_SEND, count);
+    return err;
+}
+
+void tcp_server_task()
+{
+    struct netconn *listen_conn;
+    struct pbuf *p;
+    err_t err;
 
-    int on = 1;
     while (1)
     {
 
 #ifdef CONFIG_EXAMPLE_IPV4
-        struct sockaddr_in destAddr;
-        destAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-        destAddr.sin_family = AF_INET;
-        destAddr.sin_port = htons(PORT);
-        addr_family = AF_INET;
-        ip_protocol = IPPROTO_IP;
-        inet_ntoa_r(destAddr.sin_addr, addr_str, sizeof(addr_str) - 1);
+        listen_conn = netconn_new(NETCONN_TCP);
 #else // IPV6
-        struct sockaddr_in6 destAddr;
-        bzero(&destAddr.sin6_addr.un, sizeof(destAddr.sin6_addr.un));
-        destAddr.sin6_family = AF_INET6;
-        destAddr.sin6_port = htons(PORT);
-        addr_family = AF_INET6;
-        ip_protocol = IPPROTO_IPV6;
-        inet6_ntoa_r(destAddr.sin6_addr, addr_str, sizeof(addr_str) - 1);
+        listen_conn = netconn_new(NETCONN_TCP_IPV6);
 #endif
-
-        int listen_sock = socket(addr_family, SOCK_STREAM, ip_protocol);
-        if (listen_sock < 0)
+        if (listen_conn == NULL)
         {
-            printf("Unable to create socket: errno %d\r\n", errno);
+            DAP_LOGE("Unable to create netconn\r\n");
             break;
         }
-        printf("Socket created\r\n");
-
-        setsockopt(listen_sock, SOL_SOCKET, SO_KEEPALIVE, (void *)&on, sizeof(on));
-        setsockopt(listen_sock, IPPROTO_TCP, TCP_NODELAY, (void *)&on, sizeof(on));
+        DAP_LOGI("Socket created\r\n");
 
-        int err = bind(listen_sock, (struct sockaddr *)&destAddr, sizeof(destAddr));
-        if (err != 0)
+#ifdef CONFIG_EXAMPLE_IPV4
+        err = netconn_bind(listen_conn, IP_ADDR_ANY, PORT);
+#else // IPV6
+        err = netconn_bind(listen_conn, IP6_ADDR_ANY, PORT);
+#endif
+        if (err != ERR_OK)
         {
-            printf("Socket unable to bind: errno %d\r\n", errno);
+            DAP_LOGE("Socket unable to bind: err %d\r\n", err);
             break;
         }
-        printf("Socket binded\r\n");
+        DAP_LOGI("Socket binded\r\n");
 
-        err = listen(listen_sock, 1);
-        if (err != 0)
+        err = netconn_listen(listen_conn);
+        if (err != ERR_OK)
         {
-            printf("Error occured during listen: errno %d\r\n", errno);
+            DAP_LOGE("Error occured during listen: err %d\r\n", err);
             break;
         }
-        printf("Socket listening\r\n");
+        DAP_LOGI("Socket listening\r\n");
 
-#ifdef CONFIG_EXAMPLE_IPV6
-        struct sockaddr_in6 sourceAddr; // Large enough for both IPv4 or IPv6
-#else
-        struct sockaddr_in sourceAddr;
-#endif
-        uint32_t addrLen = sizeof(sourceAddr);
         while (1)
         {
-            kSock = accept(listen_sock, (struct sockaddr *)&sourceAddr, &addrLen);
-            if (kSock < 0)
+            err = netconn_accept(listen_conn, &kConn);
+            if (err != ERR_OK)
             {
-                printf("Unable to accept connection: errno %d\r\n", errno);
+                DAP_LOGE("Unable to accept connection: err %d\r\n", err);
                 break;
             }
-            setsockopt(kSock, SOL_SOCKET, SO_KEEPALIVE, (void *)&on, sizeof(on));
-            setsockopt(kSock, IPPROTO_TCP, TCP_NODELAY, (void *)&on, sizeof(on));
-            printf("Socket accepted\r\n");
+            ip_set_option(kConn->pcb.tcp, SOF_KEEPALIVE);
+            tcp_nagle_disable(kConn->pcb.tcp);
+            DAP_LOGI("Socket accepted\r\n");
+
+            xSemaphoreTake(kConnMutex, portMAX_DELAY);
+            err = acquire_dap_session(&kUsbipDAPTransport);
+            xSemaphoreGive(kConnMutex);
+            if (err != 0)
+            {
+                DAP_LOGW("DAP is used by another session\r\n");
+                netconn_close(kConn);
+                netconn_delete(kConn);
+                kConn = NULL;
+                continue;
+            }
 
             while (1)
             {
-                int len = recv(kSock, tcp_rx_buffer, sizeof(tcp_rx_buffer), 0);
-                // Error occured during receiving
-                if (len < 0)
-                {
-                    printf("recv failed: errno %d\r\n", errno);
-                    break;
-                }
-                // Connection closed
-                else if (len == 0)
+                err = netconn_recv_tcp_pbuf(kConn, &p);
+                // Connection closed or error occured during receiving
+                if (err != ERR_OK)
                 {
-                    printf("Connection closed\r\n");
+                    DAP_LOGI("Connection closed: err %d\r\n", err);
                     break;
                 }
                 // Data received
                 else
                 {
-                    // #ifdef CONFIG_EXAMPLE_IPV6
-                    //                     // Get the sender's ip address as string
-                    //                     if (sourceAddr.sin6_family == PF_INET)
-                    //                     {
-                    //                         inet_ntoa_r(((struct sockaddr_in *)&sourceAddr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
-                    //                     }
-                    //                     else if (sourceAddr.sin6_family == PF_INET6)
-                    //                     {
-                    //                         inet6_ntoa_r(sourceAddr.sin6_addr, addr_str, sizeof(addr_str) - 1);
-                    //                     }
-                    // #else
-                    //                     inet_ntoa_r(((struct sockaddr_in *)&sourceAddr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
-                    // #endif
-
-                    switch (kState)
+                    if (tcp_rx_pbuf == NULL)
                     {
-                    case ACCEPTING:
-                        kState = ATTACHING;
-
-                    case ATTACHING:
-                        attach(tcp_rx_buffer, len);
-                        break;
+                        tcp_rx_pbuf = p;
+                    }
+                    else
+                    {
+                        pbuf_cat(tcp_rx_pbuf, p);
+                    }
 
-                    case EMULATING:
-                        emulate(tcp_rx_buffer, len);
+                    mark_dap_request_arrival();
+                    DAP_EVENT_BEGIN(DAP_EVENT_RECV, p->tot_len);
+                    err = tcp_rx_dispatch() < 0 ? ERR_VAL : ERR_OK;
+                    DAP_EVENT_END(DAP_EVENT_RECV, 0);
+                    if (err != ERR_OK)
+                    {
+                        DAP_LOGE("USBIP framing error\r\n");
                         break;
-                    default:
-                        printf("unkonw kstate!\r\n");
                     }
                 }
             }
             // kState = ACCEPTING;
-            if (kSock != -1)
+            if (kConn != NULL)
             {
-                printf("Shutting down socket and restarting...\r\n");
-                //shutdown(kSock, 0);
-                close(kSock);
+                DAP_LOGI("Shutting down socket and restarting...\r\n");
+                xSemaphoreTake(kConnMutex, portMAX_DELAY);
+                netconn_close(kConn);
+                netconn_delete(kConn);
+                kConn = NULL;
                 if (kState == EMULATING)
                     kState = ACCEPTING;
 
-                // Restart DAP Handle
-                kRestartDAPHandle = 1;
-                xTaskNotifyGive(kDAPTaskHandle);
+                release_dap_session();
+                xSemaphoreGive(kConnMutex);
 
-                //shutdown(listen_sock, 0);
-                //close(listen_sock);
-                //vTaskDelay(5);
+                if (tcp_rx_pbuf != NULL)
+                {
+                    pbuf_free(tcp_rx_pbuf);
+                    tcp_rx_pbuf = NULL;
+                }
             }
         }
+        netconn_delete(listen_conn);
     }
     vTaskDelete(NULL);
-}
\ No newline at end of file
+}
+
+
+/**
+ * @brief Dispatch every complete PDU in the received pbufs.
+ * A segment may end in the middle of a PDU or hold several pipelined PDUs,
+ * the incomplete tail is kept in the pbuf chain until the rest arrives.
+ * Only the header is copied out to be parsed, the payload of a DAP command
+ * is copied from the pbufs straight into its DAP queue slot.
+ *
+ * @return 0 on success, -1 if the stream can not be framed
+ */
+static int tcp_rx_dispatch()
+{
+    uint32_t available;
+    uint32_t header_length;
+    uint32_t pdu_length;
+    uint8_t *payload;
+
+    while (tcp_rx_pbuf != NULL)
+    {
+        available = tcp_rx_pbuf->tot_len;
+
+        // The handlers access the header as 32-bit words, so it is always parsed from the aligned buffer
+        header_length = MIN(available, sizeof(usbip_stage2_header));
+        pbuf_copy_partial(tcp_rx_pbuf, tcp_rx_buffer, header_length, 0);
+
+        pdu_length = get_usbip_pdu_length(tcp_rx_buffer, header_length);
+        if (pdu_length > sizeof(tcp_rx_buffer))
+        {
+            DAP_LOGE("PDU too large: %d\r\n", (int)pdu_length);
+            return -1;
+        }
+        if (pdu_length == 0 || pdu_length > available)
+        {
+            break; // wait for the rest of the PDU
+        }
+
+        payload = NULL;
+        if (pdu_length > sizeof(usbip_stage2_header))
+        {
+            payload = get_usbip_pdu_payload_buffer(tcp_rx_buffer);
+            if (payload == NULL)
+            {
+                payload = &tcp_rx_buffer[sizeof(usbip_stage2_header)];
+            }
+            pbuf_copy_partial(tcp_rx_pbuf, payload, pdu_length - sizeof(usbip_stage2_header),
+                              sizeof(usbip_stage2_header));
+        }
+
+        xSemaphoreTake(kConnMutex, portMAX_DELAY);
+        switch (kState)
+        {
+        case ACCEPTING:
+            kState = ATTACHING;
+
+        case ATTACHING:
+            attach(tcp_rx_buffer, pdu_length);
+            break;
+
+        case EMULATING:
+            emulate(tcp_rx_buffer, pdu_length, payload);
+            break;
+        default:
+            DAP_LOGW("unkonw kstate!\r\n");
+        }
+        xSemaphoreGive(kConnMutex);
+
+        tcp_rx_pbuf = pbuf_free_header(tcp_rx_pbuf, pdu_length);
+    }
+
+    // answer everything parsed from this segment in one write
+    xSemaphoreTake(kConnMutex, portMAX_DELAY);
+    flush_usbip_tx();
+    xSemaphoreGive(kConnMutex);
+
+    return 0;
+}
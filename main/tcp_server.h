@@ -1,6 +1,13 @@
 #ifndef __TCP_SERVER_H__
 #define __TCP_SERVER_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lwip/api.h"
+
 void tcp_server_task();
+int usbip_network_send(const void *data, size_t size);
+int usbip_network_writev(struct netvector *vectors, uint16_t count);
 
 #endif
\ No newline at end of file
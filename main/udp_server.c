@@ -0,0 +1,439 @@
+/**
+ * @file udp_server.c
+ * @brief CMSIS-DAP over UDP
+ *
+ * Each datagram carries a 4 byte little-endian sequence number followed by one
+ * DAP packet, and is answered by a datagram with the same sequence number followed
+ * by the response. The host numbers its commands 0, 1, 2 ... and may have up to
+ * the packet count of them in flight. When a command or its response is lost,
+ * the host sends the same datagram again:
+ *       - the command is not executed again if its response is still in the
+ *         response cache, the cached response is sent instead
+ *       - a command that is still being executed is ignored
+ *       - a command that is too old to be in the cache is executed again only
+ *         if that can not change the target, see dap_udp_can_replay()
+ * Commands are executed in order. A command from beyond a lost one is kept in
+ * its cache entry until the lost one arrives, only the lost datagram has to be
+ * sent again. DAP_TransferAbort is not held back, it ends the command being
+ * executed as soon as it arrives.
+ *
+ * A new session starts when the current host sends sequence number 0, or when
+ * another host sends a command after the current one has been idle for
+ * DAP_UDP_SESSION_TIMEOUT ms. The first command of a session sets the sequence.
+ *
+ * @version 0.1
+ * @date 2022-08-04
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main/udp_server.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "lwip/err.h"
+#include "lwip/api.h"
+
+#include "main/wifi_configuration.h"
+#include "main/dap_configuration.h"
+#include "main/dap_handle.h"
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_event.h"
+#include "components/DAP/include/dap_log.h"
+
+extern SemaphoreHandle_t kConnMutex;
+
+#define DAP_UDP_HEADER_SIZE 4
+#define DAP_UDP_SESSION_TIMEOUT 3000 // ms
+#define DAP_UDP_CACHE_SIZE DAP_PACKET_WINDOW
+
+enum dap_udp_cache_state
+{
+    DAP_UDP_CACHE_EMPTY = 0,
+    DAP_UDP_CACHE_PENDING, // queued, not answered yet
+    DAP_UDP_CACHE_DONE,
+    DAP_UDP_CACHE_HELD, // received after a lost command, not queued yet
+};
+
+// Command seq is kept in entry seq % DAP_UDP_CACHE_SIZE
+typedef struct
+{
+    uint32_t seq;
+    uint32_t state;
+    uint32_t length; // length of data, including the sequence number
+    uint8_t data[DAP_UDP_HEADER_SIZE + DAP_PACKET_SIZE];
+} dap_udp_cache_t;
+
+static struct netconn *dap_udp_conn = NULL;
+static struct netbuf *dap_udp_tx_netbuf = NULL;
+
+// The session, protected by kConnMutex
+static int dap_udp_session_active = 0;
+static ip_addr_t dap_udp_peer_addr;
+static uint16_t dap_udp_peer_port;
+static TickType_t dap_udp_last_tick;
+static uint32_t dap_udp_expected_seq; // the next new command
+static dap_udp_cache_t dap_udp_cache[DAP_UDP_CACHE_SIZE];
+// For the responses of replayed commands, which do not go into the cache
+static uint8_t dap_udp_tx_buffer[DAP_UDP_HEADER_SIZE + DAP_PACKET_SIZE];
+
+static int dap_udp_ready();
+static void dap_udp_reply(uint32_t seqnum, const uint8_t *buf, uint32_t length);
+static void dap_udp_flush();
+static void dap_udp_handle_datagram(struct netbuf *buf);
+
+static const dap_transport_t dap_udp_transport = {
+    .ready = dap_udp_ready,
+    .reply = dap_udp_reply,
+    .flush = dap_udp_flush,
+};
+
+
+static void write_le32(uint8_t *data, uint32_t value)
+{
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+    data[2] = (value >> 16) & 0xFF;
+    data[3] = (value >> 24) & 0xFF;
+}
+
+static void dap_udp_send(const uint8_t *data, uint32_t length)
+{
+    netbuf_ref(dap_udp_tx_netbuf, data, length);
+    DAP_EVENT_BEGIN(DAP_EVENT_SEND, 1);
+    netconn_sendto(dap_udp_conn, dap_udp_tx_netbuf, &dap_udp_peer_addr, dap_udp_peer_port);
+    DAP_EVENT_END(DAP_EVENT_SEND, 1);
+}
+
+static int dap_udp_ready()
+{
+    return 1;
+}
+
+static void dap_udp_reply(uint32_t seqnum, const uint8_t *buf, uint32_t length)
+{
+    dap_udp_cache_t *entry = &dap_udp_cache[seqnum % DAP_UDP_CACHE_SIZE];
+    uint8_t *data;
+
+    if (entry->seq == seqnum && entry->state == DAP_UDP_CACHE_PENDING)
+    {
+        data = entry->data;
+        entry->length = DAP_UDP_HEADER_SIZE + length;
+        entry->state = DAP_UDP_CACHE_DONE;
+    }
+    else
+    {
+        // a replayed command, its entry has been reused
+        data = dap_udp_tx_buffer;
+    }
+
+    write_le32(data, seqnum);
+    if (length > 0)
+    {
+        memcpy(&data[DAP_UDP_HEADER_SIZE], buf, length);
+    }
+    dap_udp_send(data, DAP_UDP_HEADER_SIZE + length);
+}
+
+static void dap_udp_flush()
+{
+    // every response is sent as its own datagram
+}
+
+/**
+ * @brief Whether a command can be executed a second time without changing the target
+ *
+ */
+static int dap_udp_can_replay(const uint8_t *request)
+{
+    switch (request[0])
+    {
+    case ID_DAP_Info:
+    case ID_DAP_HostStatus:
+    case ID_DAP_TransferConfigure:
+    case ID_DAP_SWJ_Clock:
+    case ID_DAP_SWD_Configure:
+    case ID_DAP_JTAG_Configure:
+    case ID_DAP_SWO_Status:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void dap_udp_start_session(struct netbuf *buf, uint32_t seq)
+{
+    if (dap_udp_session_active)
+    {
+        release_dap_session();
+        dap_udp_session_active = 0;
+    }
+
+    if (acquire_dap_session(&dap_udp_transport) != 0)
+    {
+        return;
+    }
+
+    dap_udp_session_active = 1;
+    ip_addr_copy(dap_udp_peer_addr, *netbuf_fromaddr(buf));
+    dap_udp_peer_port = netbuf_fromport(buf);
+    dap_udp_expected_seq = seq;
+    memset(dap_udp_cache, 0, sizeof(dap_udp_cache));
+    DAP_LOGI("DAP UDP session started\r\n");
+}
+
+/**
+ * @brief Queue a command for DAP_Thread. Called with kConnMutex held.
+ * The cache entry of a command that is not a replay is marked as pending,
+ * and the commands before it in the sequence must have been queued already.
+ *
+ * @param seq Sequence number of the command
+ * @param buf The datagram, or NULL for a command held in its cache entry
+ * @param length Length of the command
+ * @return 0 on success, -1 if the window is full
+ */
+static int dap_udp_queue(uint32_t seq, struct netbuf *buf, uint32_t length)
+{
+    dap_udp_cache_t *entry = &dap_udp_cache[seq % DAP_UDP_CACHE_SIZE];
+    uint8_t command;
+    uint8_t *request;
+    int ret;
+
+    if (buf != NULL)
+    {
+        netbuf_copy_partial(buf, &command, 1, DAP_UDP_HEADER_SIZE);
+    }
+    else
+    {
+        command = entry->data[DAP_UDP_HEADER_SIZE];
+    }
+
+    if (command == ID_DAP_TransferAbort)
+    {
+        // Takes no slot: it has to get through a window full of commands
+        // stuck in WAIT retries, which is what it is sent for
+        request = &command;
+        length = 1;
+    }
+    else
+    {
+        request = get_dap_request_buffer();
+        if (request == NULL)
+        {
+            return -1;
+        }
+        if (buf != NULL)
+        {
+            netbuf_copy_partial(buf, request, length, DAP_UDP_HEADER_SIZE);
+        }
+        else
+        {
+            memcpy(request, &entry->data[DAP_UDP_HEADER_SIZE], length);
+        }
+    }
+
+    ret = queue_dap_request(seq, request, length);
+    if (ret < 0)
+    {
+        return -1;
+    }
+
+    // the reply task needs kConnMutex, it can not answer before this
+    if (seq - dap_udp_expected_seq < DAP_UDP_CACHE_SIZE)
+    {
+        entry->seq = seq;
+        entry->state = DAP_UDP_CACHE_PENDING;
+    }
+    if (ret == 1)
+    {
+        // DAP_TransferAbort, acknowledged with an empty response
+        dap_udp_reply(seq, NULL, 0);
+    }
+    return 0;
+}
+
+/**
+ * @brief Queue the held commands that are next in the sequence, and move the
+ * sequence past the commands that have been queued. Called with kConnMutex held.
+ *
+ */
+static void dap_udp_run_held()
+{
+    dap_udp_cache_t *entry;
+
+    for (;;)
+    {
+        entry = &dap_udp_cache[dap_udp_expected_seq % DAP_UDP_CACHE_SIZE];
+        if (entry->seq != dap_udp_expected_seq || entry->state == DAP_UDP_CACHE_EMPTY)
+        {
+            return; // missing
+        }
+        if (entry->state == DAP_UDP_CACHE_HELD &&
+            dap_udp_queue(dap_udp_expected_seq, NULL, entry->length - DAP_UDP_HEADER_SIZE) < 0)
+        {
+            return; // the window is full, tried again with the next datagram
+        }
+        dap_udp_expected_seq++;
+    }
+}
+
+/**
+ * @brief Handle one datagram. Called with kConnMutex held.
+ *
+ */
+static void dap_udp_handle_datagram(struct netbuf *buf)
+{
+    uint8_t header[DAP_UDP_HEADER_SIZE];
+    uint8_t command;
+    uint32_t seq, length;
+    dap_udp_cache_t *entry;
+    int same_peer;
+
+    length = netbuf_len(buf);
+    if (length <= DAP_UDP_HEADER_SIZE || length > DAP_UDP_HEADER_SIZE + DAP_PACKET_SIZE)
+    {
+        return;
+    }
+    length -= DAP_UDP_HEADER_SIZE;
+    netbuf_copy_partial(buf, header, DAP_UDP_HEADER_SIZE, 0);
+    seq = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+
+    same_peer = dap_udp_session_active &&
+                ip_addr_cmp(&dap_udp_peer_addr, netbuf_fromaddr(buf)) &&
+                dap_udp_peer_port == netbuf_fromport(buf);
+    if (!same_peer || (seq == 0 && dap_udp_expected_seq != 0))
+    {
+        if (!same_peer && dap_udp_session_active &&
+            (xTaskGetTickCount() - dap_udp_last_tick) < pdMS_TO_TICKS(DAP_UDP_SESSION_TIMEOUT))
+        {
+            return; // another host is using it
+        }
+        dap_udp_start_session(buf, seq);
+        if (!dap_udp_session_active)
+        {
+            return;
+        }
+    }
+    dap_udp_last_tick = xTaskGetTickCount();
+
+    entry = &dap_udp_cache[seq % DAP_UDP_CACHE_SIZE];
+    if ((int32_t)(seq - dap_udp_expected_seq) < 0)
+    {
+        if (entry->seq == seq && entry->state == DAP_UDP_CACHE_DONE)
+        {
+            // the response was lost
+            dap_udp_send(entry->data, entry->length);
+            return;
+        }
+        if (entry->seq == seq && entry->state == DAP_UDP_CACHE_PENDING)
+        {
+            return; // still being executed
+        }
+        netbuf_copy_partial(buf, &command, 1, DAP_UDP_HEADER_SIZE);
+        if (!dap_udp_can_replay(&command))
+        {
+            DAP_LOGW("DAP UDP: can not replay seq %d\r\n", (int)seq);
+            return;
+        }
+        dap_udp_queue(seq, buf, length); // the host will retry if the window is full
+        return;
+    }
+
+    if (seq - dap_udp_expected_seq >= DAP_UDP_CACHE_SIZE)
+    {
+        return; // more commands in flight than the packet count
+    }
+    if (entry->seq == seq && entry->state != DAP_UDP_CACHE_EMPTY)
+    {
+        if (entry->state == DAP_UDP_CACHE_DONE)
+        {
+            // an abort answered while an earlier command was missing
+            dap_udp_send(entry->data, entry->length);
+        }
+        return; // already held or queued
+    }
+
+    netbuf_copy_partial(buf, &command, 1, DAP_UDP_HEADER_SIZE);
+    if ((seq == dap_udp_expected_seq || command == ID_DAP_TransferAbort) &&
+        dap_udp_queue(seq, buf, length) == 0)
+    {
+        return;
+    }
+
+    // An earlier command is missing, or the window is full:
+    // keep it until dap_udp_run_held() can queue it in order
+    netbuf_copy_partial(buf, &entry->data[DAP_UDP_HEADER_SIZE], length, DAP_UDP_HEADER_SIZE);
+    entry->seq = seq;
+    entry->length = DAP_UDP_HEADER_SIZE + length;
+    entry->state = DAP_UDP_CACHE_HELD;
+}
+
+void udp_server_task()
+{
+    struct netbuf *buf;
+    err_t err;
+
+#ifdef CONFIG_EXAMPLE_IPV4
+    dap_udp_conn = netconn_new(NETCONN_UDP);
+#else // IPV6
+    dap_udp_conn = netconn_new(NETCONN_UDP_IPV6);
+#endif
+    dap_udp_tx_netbuf = netbuf_new();
+    if (dap_udp_conn == NULL || dap_udp_tx_netbuf == NULL)
+    {
+        DAP_LOGE("Unable to create DAP UDP netconn\r\n");
+        vTaskDelete(NULL);
+    }
+
+#ifdef CONFIG_EXAMPLE_IPV4
+    err = netconn_bind(dap_udp_conn, IP_ADDR_ANY, DAP_UDP_PORT);
+#else // IPV6
+    err = netconn_bind(dap_udp_conn, IP6_ADDR_ANY, DAP_UDP_PORT);
+#endif
+    if (err != ERR_OK)
+    {
+        DAP_LOGE("DAP UDP unable to bind: err %d\r\n", err);
+        vTaskDelete(NULL);
+    }
+    // wake up from time to time to end idle sessions
+    netconn_set_recvtimeout(dap_udp_conn, 1000);
+    DAP_LOGI("DAP UDP listening\r\n");
+
+    while (1)
+    {
+        err = netconn_recv(dap_udp_conn, &buf);
+        if (err == ERR_OK)
+        {
+            mark_dap_request_arrival();
+        }
+
+        xSemaphoreTake(kConnMutex, portMAX_DELAY);
+        if (err == ERR_OK)
+        {
+            DAP_EVENT_BEGIN(DAP_EVENT_RECV, netbuf_len(buf));
+            dap_udp_handle_datagram(buf);
+            DAP_EVENT_END(DAP_EVENT_RECV, 0);
+            netbuf_delete(buf);
+        }
+        else if (dap_udp_session_active &&
+                 (xTaskGetTickCount() - dap_udp_last_tick) >= pdMS_TO_TICKS(DAP_UDP_SESSION_TIMEOUT))
+        {
+            // let the other transports have the DAP engine
+            release_dap_session();
+            dap_udp_session_active = 0;
+            DAP_LOGW("DAP UDP session timeout\r\n");
+        }
+
+        if (dap_udp_session_active)
+        {
+            dap_udp_run_held();
+        }
+        xSemaphoreGive(kConnMutex);
+    }
+}
@@ -0,0 +1,6 @@
+#ifndef __UDP_SERVER_H__
+#define __UDP_SERVER_H__
+
+void udp_server_task();
+
+#endif
@@ -0,0 +1,234 @@
+/**
+ * @file usbip_capture.c
+ * @brief Capture of the USBIP stage 2 PDUs, for replay on the host build
+ *
+ * emulate() and the reply path record every PDU with a timestamp into a RAM
+ * ring. When the ring is full, the oldest records are dropped, so it always
+ * holds the end of the session. A client connecting to USBIP_CAPTURE_PORT
+ * gets a capture file: what is in the ring, then the PDUs as they come, e.g.
+ *
+ *   nc <board> 3244 > session.cap
+ *
+ * and host/usbip_replay replays it against the host build.
+ *
+ * @version 0.1
+ * @date 2022-08-11
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main/usbip_capture.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+#include "lwip/err.h"
+#include "lwip/api.h"
+#include "lwip/tcp.h"
+
+#include "main/wifi_configuration.h"
+#include "main/dap_configuration.h"
+#include "components/USBIP/USBIP_defs.h"
+#include "components/DAP/include/dap_log.h"
+
+#if (USE_USBIP_CAPTURE == 1)
+
+extern SemaphoreHandle_t kConnMutex;
+
+// Must be able to hold the largest record
+#define USBIP_CAPTURE_TX_SIZE 2048
+
+// The ring is protected by kConnMutex, as the PDUs are recorded with it held.
+// head and tail run freely, the ring size is a power of 2.
+_Static_assert((USBIP_CAPTURE_RING_SIZE & (USBIP_CAPTURE_RING_SIZE - 1)) == 0,
+               "USBIP_CAPTURE_RING_SIZE must be a power of 2");
+static uint8_t capture_ring[USBIP_CAPTURE_RING_SIZE];
+static uint32_t capture_head = 0;
+static uint32_t capture_tail = 0;
+static uint32_t capture_dropped = 0;
+
+static TaskHandle_t capture_task_handle = NULL;
+static int capture_sink_connected = 0;
+
+static uint8_t capture_tx_buffer[USBIP_CAPTURE_TX_SIZE];
+
+
+static void capture_ring_write(const void *data, uint32_t length)
+{
+    uint32_t offset = capture_head % USBIP_CAPTURE_RING_SIZE;
+    uint32_t first = USBIP_CAPTURE_RING_SIZE - offset;
+
+    if (first > length)
+    {
+        first = length;
+    }
+    memcpy(&capture_ring[offset], data, first);
+    memcpy(capture_ring, (const uint8_t *)data + first, length - first);
+    capture_head += length;
+}
+
+static void capture_ring_read(uint32_t position, void *data, uint32_t length)
+{
+    uint32_t offset = position % USBIP_CAPTURE_RING_SIZE;
+    uint32_t first = USBIP_CAPTURE_RING_SIZE - offset;
+
+    if (first > length)
+    {
+        first = length;
+    }
+    memcpy(data, &capture_ring[offset], first);
+    memcpy((uint8_t *)data + first, capture_ring, length - first);
+}
+
+/**
+ * @brief Record a PDU. Called with kConnMutex held.
+ *
+ */
+void usbip_capture_pdu(uint8_t direction, const void *header, uint32_t length, const void *payload)
+{
+    usbip_capture_record record;
+    uint32_t header_length = length < sizeof(usbip_stage2_header) ? length : sizeof(usbip_stage2_header);
+    uint32_t size = sizeof(usbip_capture_record) + length;
+
+    if (size > USBIP_CAPTURE_RING_SIZE)
+    {
+        capture_dropped++;
+        return;
+    }
+
+    // make room by dropping the oldest records
+    while (USBIP_CAPTURE_RING_SIZE - (capture_head - capture_tail) < size)
+    {
+        capture_ring_read(capture_tail, &record, sizeof(usbip_capture_record));
+        capture_tail += sizeof(usbip_capture_record) + record.length;
+        capture_dropped++;
+    }
+
+    record.timestamp = (uint32_t)esp_timer_get_time();
+    record.length = length;
+    record.direction = direction;
+    record.reserved = 0;
+    capture_ring_write(&record, sizeof(usbip_capture_record));
+    capture_ring_write(header, header_length);
+    if (payload == NULL)
+    {
+        payload = (const uint8_t *)header + header_length;
+    }
+    capture_ring_write(payload, length - header_length);
+
+    if (capture_sink_connected)
+    {
+        xTaskNotifyGive(capture_task_handle);
+    }
+}
+
+/**
+ * @brief Take the oldest records out of the ring
+ *
+ * @return Number of bytes copied to capture_tx_buffer, whole records only
+ */
+static uint32_t capture_take_records()
+{
+    usbip_capture_record record;
+    uint32_t length = 0;
+    uint32_t size;
+
+    xSemaphoreTake(kConnMutex, portMAX_DELAY);
+    while (capture_head != capture_tail)
+    {
+        capture_ring_read(capture_tail, &record, sizeof(usbip_capture_record));
+        size = sizeof(usbip_capture_record) + record.length;
+        if (length + size > sizeof(capture_tx_buffer))
+        {
+            break;
+        }
+        capture_ring_read(capture_tail, &capture_tx_buffer[length], size);
+        capture_tail += size;
+        length += size;
+    }
+    xSemaphoreGive(kConnMutex);
+
+    return length;
+}
+
+/**
+ * @brief Stream the capture to the clients of USBIP_CAPTURE_PORT, one at a time
+ *
+ */
+void usbip_capture_task()
+{
+    const usbip_capture_file_header file_header = {
+        .magic = USBIP_CAPTURE_MAGIC,
+        .version = USBIP_CAPTURE_VERSION,
+        .reserved = 0,
+    };
+    struct netconn *listen_conn;
+    struct netconn *conn;
+    uint32_t length;
+    err_t err;
+
+    capture_task_handle = xTaskGetCurrentTaskHandle();
+
+#ifdef CONFIG_EXAMPLE_IPV4
+    listen_conn = netconn_new(NETCONN_TCP);
+#else // IPV6
+    listen_conn = netconn_new(NETCONN_TCP_IPV6);
+#endif
+    if (listen_conn == NULL)
+    {
+        DAP_LOGE("Unable to create capture netconn\r\n");
+        vTaskDelete(NULL);
+    }
+
+#ifdef CONFIG_EXAMPLE_IPV4
+    err = netconn_bind(listen_conn, IP_ADDR_ANY, USBIP_CAPTURE_PORT);
+#else // IPV6
+    err = netconn_bind(listen_conn, IP6_ADDR_ANY, USBIP_CAPTURE_PORT);
+#endif
+    if (err != ERR_OK || netconn_listen(listen_conn) != ERR_OK)
+    {
+        DAP_LOGE("Capture socket unable to listen: err %d\r\n", err);
+        netconn_delete(listen_conn);
+        vTaskDelete(NULL);
+    }
+
+    while (1)
+    {
+        err = netconn_accept(listen_conn, &conn);
+        if (err != ERR_OK)
+        {
+            DAP_LOGE("Unable to accept capture connection: err %d\r\n", err);
+            break;
+        }
+        DAP_LOGI("Capture socket accepted, %d records dropped so far\r\n", (int)capture_dropped);
+
+        capture_sink_connected = 1;
+        err = netconn_write(conn, &file_header, sizeof(file_header), NETCONN_COPY);
+        while (err == ERR_OK)
+        {
+            length = capture_take_records();
+            if (length == 0)
+            {
+                // a closed connection is noticed by the next write
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                continue;
+            }
+            err = netconn_write(conn, capture_tx_buffer, length, NETCONN_COPY);
+        }
+        capture_sink_connected = 0;
+
+        DAP_LOGI("Capture connection closed: err %d\r\n", err);
+        netconn_close(conn);
+        netconn_delete(conn);
+    }
+    netconn_delete(listen_conn);
+    vTaskDelete(NULL);
+}
+
+#endif
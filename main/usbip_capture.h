@@ -0,0 +1,57 @@
+/**
+ * @file usbip_capture.h
+ * @brief Capture of the USBIP stage 2 PDUs, for replay on the host build
+ *
+ * A capture is a usbip_capture_file_header followed by records, each one a
+ * usbip_capture_record followed by the PDU as it was on the wire. All the
+ * fields are little-endian.
+ *
+ * @version 0.1
+ * @date 2022-08-11
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __USBIP_CAPTURE_H__
+#define __USBIP_CAPTURE_H__
+
+#include <stdint.h>
+
+#define USBIP_CAPTURE_MAGIC 0x41435055 // "UPCA"
+#define USBIP_CAPTURE_VERSION 1
+
+enum usbip_capture_direction
+{
+    USBIP_CAPTURE_HOST_TO_DEVICE = 0, // cmd_submit / cmd_unlink
+    USBIP_CAPTURE_DEVICE_TO_HOST,     // ret_submit / ret_unlink
+};
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+} __attribute__((packed)) usbip_capture_file_header;
+
+typedef struct
+{
+    uint32_t timestamp; // us, wraps around
+    uint16_t length;    // of the PDU
+    uint8_t direction;
+    uint8_t reserved;
+} __attribute__((packed)) usbip_capture_record;
+
+/**
+ * @brief Record a PDU
+ *
+ * @param direction usbip_capture_direction
+ * @param header The stage 2 header, in network byte order
+ * @param length Total length of the PDU
+ * @param payload The data behind the header, or NULL if it follows the header
+ */
+void usbip_capture_pdu(uint8_t direction, const void *header, uint32_t length, const void *payload);
+
+void usbip_capture_task();
+
+#endif
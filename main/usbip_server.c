@@ -10,7 +10,14 @@
 #include "components/USBIP/USB_descriptor.h"
 
 #include "main/usbip_server.h"
+#include "main/tcp_server.h"
 #include "main/dap_handle.h"
+#include "main/dap_configuration.h"
+#include "main/wifi_configuration.h"
+#include "main/usbip_capture.h"
+
+#include "components/DAP/include/dap_metrics.h"
+#include "components/DAP/include/dap_log.h"
 
 
 // attach helper function
@@ -25,14 +32,99 @@ static void send_interface_info();
 // emulate helper function
 static void pack(void *data, int size);
 static void unpack(void *data, int size);
-static int handle_submit(usbip_stage2_header *header, uint32_t length);
+static int handle_submit(usbip_stage2_header *header, uint32_t length, uint8_t *payload);
 static int read_stage2_command(usbip_stage2_header *header, uint32_t length);
 
 static void handle_unlink(usbip_stage2_header *header);
 // unlink helper function
-static void send_stage2_unlink(usbip_stage2_header *req_header);
+static void send_stage2_unlink(usbip_stage2_header *req_header, int32_t status);
+
+// framing helper function
+static uint32_t read_be32(const uint8_t *data);
+
+// tx batching helper function
+static void queue_stage2_header(usbip_stage2_header *req_header, const void *const data, int32_t data_length);
 
 
+// Stage 2 replies are gathered here and written to the socket in one go by flush_usbip_tx().
+// Headers are copied into the pool, payloads are only referenced.
+#define USBIP_TX_HEADER_NUM (DAP_PACKET_WINDOW * 2)
+static usbip_stage2_header usbip_tx_header[USBIP_TX_HEADER_NUM];
+static struct netvector usbip_tx_iov[USBIP_TX_HEADER_NUM * 2];
+static uint32_t usbip_tx_header_count = 0;
+static uint32_t usbip_tx_iov_count = 0;
+
+
+
+static uint32_t read_be32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+           ((uint32_t)data[2] << 8) | ((uint32_t)data[3] << 0);
+}
+
+/**
+ * @brief Get the length of the PDU at the beginning of the buffer
+ *       - stage 1: OP_REQ_DEVLIST / OP_REQ_IMPORT
+ *       - stage 2: cmd_submit (with OUT data) / cmd_unlink
+ *
+ * @param buffer Point to the first byte of the PDU (still in network byte order)
+ * @param length Number of bytes available in the buffer
+ * @return Total length of the PDU, or 0 if the header itself is not complete yet
+ */
+uint32_t get_usbip_pdu_length(const uint8_t *buffer, uint32_t length)
+{
+    if (kState != EMULATING)
+    {
+        if (length < sizeof(usbip_stage1_header))
+        {
+            return 0;
+        }
+        // OP_REQ_IMPORT carries the bus id of the device to be attached
+        if (buffer[3] == USBIP_STAGE1_CMD_DEVICE_ATTACH)
+        {
+            return sizeof(usbip_stage1_header) + USBIP_BUSID_SIZE;
+        }
+        return sizeof(usbip_stage1_header);
+    }
+
+    if (length < sizeof(usbip_stage2_header))
+    {
+        return 0;
+    }
+
+    const usbip_stage2_header *header = (const usbip_stage2_header *)buffer;
+    if (read_be32((const uint8_t *)&header->base.command) == USBIP_STAGE2_REQ_SUBMIT &&
+        read_be32((const uint8_t *)&header->base.direction) == USBIP_DIR_OUT)
+    {
+        // transfer_buffer_length
+        return sizeof(usbip_stage2_header) + read_be32((const uint8_t *)&header->u.cmd_submit.data_length);
+    }
+
+    return sizeof(usbip_stage2_header);
+}
+
+/**
+ * @brief Get where the OUT data of a stage 2 PDU should be received.
+ * The commands for the DAP endpoint are received straight into the DAP queue.
+ *
+ * @param buffer Point to the complete PDU header (still in network byte order)
+ * @return The buffer to receive the data in, or NULL to keep it behind the header
+ */
+uint8_t *get_usbip_pdu_payload_buffer(const uint8_t *buffer)
+{
+    const usbip_stage2_header *header = (const usbip_stage2_header *)buffer;
+
+    if (kState != EMULATING ||
+        read_be32((const uint8_t *)&header->base.command) != USBIP_STAGE2_REQ_SUBMIT ||
+        read_be32((const uint8_t *)&header->base.direction) != USBIP_DIR_OUT ||
+        read_be32((const uint8_t *)&header->base.ep) != 0x01 ||
+        read_be32((const uint8_t *)&header->u.cmd_submit.data_length) > DAP_PACKET_SIZE)
+    {
+        return NULL;
+    }
+
+    return get_dap_request_buffer();
+}
 
 int attach(uint8_t *buffer, uint32_t length)
 {
@@ -53,7 +145,7 @@ int attach(uint8_t *buffer, uint32_t length)
         break;
 
     default:
-        printf("attach Unknown command: %d\r\n", command);
+        DAP_LOGW("attach Unknown command: %d\r\n", command);
         break;
     }
     return 0;
@@ -71,19 +163,19 @@ static int read_stage1_command(uint8_t *buffer, uint32_t length)
 
 static void handle_device_list(uint8_t *buffer, uint32_t length)
 {
-    printf("Handling dev list request...\r\n");
+    DAP_LOGD("Handling dev list request...\r\n");
     send_stage1_header(USBIP_STAGE1_CMD_DEVICE_LIST, 0);
     send_device_list();
 }
 
 static void handle_device_attach(uint8_t *buffer, uint32_t length)
 {
-    printf("Handling dev attach request...\r\n");
+    DAP_LOGD("Handling dev attach request...\r\n");
 
     //char bus[USBIP_BUSID_SIZE];
     if (length < sizeof(USBIP_BUSID_SIZE))
     {
-        printf("handle device attach failed!\r\n");
+        DAP_LOGE("handle device attach failed!\r\n");
         return;
     }
     //client.readBytes((uint8_t *)bus, USBIP_BUSID_SIZE);
@@ -97,7 +189,7 @@ static void handle_device_attach(uint8_t *buffer, uint32_t length)
 
 static void send_stage1_header(uint16_t command, uint32_t status)
 {
-    printf("Sending header...\r\n");
+    DAP_LOGD("Sending header...\r\n");
     usbip_stage1_header header;
     header.version = htons(273); ////TODO:  273???
     // may be : https://github.com/Oxalin/usbip_windows/issues/4
@@ -105,21 +197,21 @@ static void send_stage1_header(uint16_t command, uint32_t status)
     header.command = htons(command);
     header.status = htonl(status);
 
-    send(kSock, (uint8_t *)&header, sizeof(usbip_stage1_header), 0);
+    usbip_network_send((uint8_t *)&header, sizeof(usbip_stage1_header));
 }
 
 static void send_device_list()
 {
-    printf("Sending device list...\r\n");
+    DAP_LOGD("Sending device list...\r\n");
 
     // send device list size:
-    printf("Sending device list size...\r\n");
+    DAP_LOGD("Sending device list size...\r\n");
     usbip_stage1_response_devlist response_devlist;
 
     // we have only 1 device, so:
     response_devlist.list_size = htonl(1);
 
-    send(kSock, (uint8_t *)&response_devlist, sizeof(usbip_stage1_response_devlist), 0);
+    usbip_network_send((uint8_t *)&response_devlist, sizeof(usbip_stage1_response_devlist));
 
     // may be foreach:
 
@@ -133,7 +225,7 @@ static void send_device_list()
 
 static void send_device_info()
 {
-    printf("Sending device info...\r\n");
+    DAP_LOGD("Sending device info...\r\n");
     usbip_stage1_usb_device device;
 
     strcpy(device.path, "/sys/devices/pci0000:00/0000:00:01.2/usb1/1-1");
@@ -155,19 +247,19 @@ static void send_device_info()
     device.bNumConfigurations = 1;
     device.bNumInterfaces = 1;
 
-    send(kSock, (uint8_t *)&device, sizeof(usbip_stage1_usb_device), 0);
+    usbip_network_send((uint8_t *)&device, sizeof(usbip_stage1_usb_device));
 }
 
 static void send_interface_info()
 {
-    printf("Sending interface info...\r\n");
+    DAP_LOGD("Sending interface info...\r\n");
     usbip_stage1_usb_interface interface;
     interface.bInterfaceClass = USBD_CUSTOM_CLASS0_IF0_CLASS;
     interface.bInterfaceSubClass = USBD_CUSTOM_CLASS0_IF0_SUBCLASS;
     interface.bInterfaceProtocol = USBD_CUSTOM_CLASS0_IF0_PROTOCOL;
     interface.padding = 0; // shall be set to zero
 
-    send(kSock, (uint8_t *)&interface, sizeof(usbip_stage1_usb_interface), 0);
+    usbip_network_send((uint8_t *)&interface, sizeof(usbip_stage1_usb_interface));
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -179,20 +271,22 @@ static void send_interface_info()
 ///////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////
 
-int emulate(uint8_t *buffer, uint32_t length)
+/**
+ * @brief Handle a stage 2 PDU
+ *
+ * @param buffer The PDU header, followed by the rest of the PDU
+ * @param length Total length of the PDU
+ * @param payload Where the OUT data of the PDU has been received,
+ *                see get_usbip_pdu_payload_buffer(). NULL if there is none.
+ */
+int emulate(uint8_t *buffer, uint32_t length, uint8_t *payload)
 {
-    if (length < 48)
-    {
-        for (int i = 0; i < 100; i++)
-        {
-            printf("TCP issue!\r\n");
-        }
-    }
-
-    if(fast_reply(buffer, length))
-    {
-        return 0;
-    }
+#if (USE_USBIP_CAPTURE == 1)
+    // before the header is unpacked in place
+    usbip_capture_pdu(USBIP_CAPTURE_HOST_TO_DEVICE, buffer, length, payload);
+#endif
+    dap_metrics_add(DAP_METRIC_URB_RX, 1);
+    dap_metrics_add(DAP_METRIC_BYTES_RX, length);
 
     int command = read_stage2_command((usbip_stage2_header *)buffer, length);
     if (command < 0)
@@ -203,7 +297,7 @@ int emulate(uint8_t *buffer, uint32_t length)
     switch (command)
     {
     case USBIP_STAGE2_REQ_SUBMIT:
-        handle_submit((usbip_stage2_header *)buffer , length);
+        handle_submit((usbip_stage2_header *)buffer, length, payload);
         break;
 
     case USBIP_STAGE2_REQ_UNLINK:
@@ -211,7 +305,7 @@ int emulate(uint8_t *buffer, uint32_t length)
         break;
 
     default:
-        printf("emulate unknown command:%d\r\n", command);
+        DAP_LOGW("emulate unknown command:%d\r\n", command);
         //handle_submit((usbip_stage2_header *)buffer, length);
         return -1;
     }
@@ -281,7 +375,7 @@ static void unpack(void *data, int size)
  * @brief USB transaction processing
  *
  */
-static int handle_submit(usbip_stage2_header *header, uint32_t length)
+static int handle_submit(usbip_stage2_header *header, uint32_t length, uint8_t *payload)
 {
     switch (header->base.ep)
     {
@@ -296,7 +390,7 @@ static int handle_submit(usbip_stage2_header *header, uint32_t length)
         if (header->base.direction == 0)
         {
             //printf("EP 01 DATA FROM HOST");
-            handle_dap_data_request(header ,length);
+            handle_dap_data_request(header, payload, length - sizeof(usbip_stage2_header));
         }
         else
         {
@@ -322,21 +416,71 @@ static int handle_submit(usbip_stage2_header *header, uint32_t length)
     case 0x81:
         if (header->base.direction == 0)
         {
-            printf("*** WARN! EP 81 DATA TX");
+            DAP_LOGW("*** WARN! EP 81 DATA TX\r\n");
         }
         else
         {
-            printf("*** WARN! EP 81 DATA RX");
+            DAP_LOGW("*** WARN! EP 81 DATA RX\r\n");
         }
         return -1;
 
     default:
-        printf("*** WARN ! UNKNOWN ENDPOINT: %d\r\n", (int)header->base.ep);
+        DAP_LOGW("*** WARN ! UNKNOWN ENDPOINT: %d\r\n", (int)header->base.ep);
         return -1;
     }
     return 0;
 }
 
+/**
+ * @brief Append a packed stage 2 header and its payload to the tx batch
+ *
+ * @param req_header Packed header, copied into the pool
+ * @param data Payload, must stay valid until the batch is flushed
+ * @param data_length Payload length
+ */
+static void queue_stage2_header(usbip_stage2_header *req_header, const void *const data, int32_t data_length)
+{
+    if (usbip_tx_header_count >= USBIP_TX_HEADER_NUM)
+    {
+        flush_usbip_tx();
+    }
+
+#if (USE_USBIP_CAPTURE == 1)
+    usbip_capture_pdu(USBIP_CAPTURE_DEVICE_TO_HOST, req_header, sizeof(usbip_stage2_header) + data_length, data);
+#endif
+    dap_metrics_add(DAP_METRIC_URB_TX, 1);
+    dap_metrics_add(DAP_METRIC_BYTES_TX, sizeof(usbip_stage2_header) + data_length);
+
+    memcpy(&usbip_tx_header[usbip_tx_header_count], req_header, sizeof(usbip_stage2_header));
+    usbip_tx_iov[usbip_tx_iov_count].ptr = &usbip_tx_header[usbip_tx_header_count];
+    usbip_tx_iov[usbip_tx_iov_count].len = sizeof(usbip_stage2_header);
+    usbip_tx_header_count++;
+    usbip_tx_iov_count++;
+
+    if (data_length > 0)
+    {
+        usbip_tx_iov[usbip_tx_iov_count].ptr = data;
+        usbip_tx_iov[usbip_tx_iov_count].len = data_length;
+        usbip_tx_iov_count++;
+    }
+}
+
+/**
+ * @brief Write all the queued stage 2 replies as one TCP write
+ *
+ */
+void flush_usbip_tx()
+{
+    if (usbip_tx_iov_count == 0)
+    {
+        return;
+    }
+
+    usbip_network_writev(usbip_tx_iov, usbip_tx_iov_count);
+    usbip_tx_header_count = 0;
+    usbip_tx_iov_count = 0;
+}
+
 void send_stage2_submit(usbip_stage2_header *req_header, int32_t status, int32_t data_length)
 {
 
@@ -349,24 +493,25 @@ void send_stage2_submit(usbip_stage2_header *req_header, int32_t status, int32_t
     req_header->u.ret_submit.data_length = data_length;
 
     pack(req_header, sizeof(usbip_stage2_header));
-    send(kSock, req_header, sizeof(usbip_stage2_header), 0);
+    queue_stage2_header(req_header, NULL, 0);
 }
 
 void send_stage2_submit_data(usbip_stage2_header *req_header, int32_t status, const void *const data, int32_t data_length)
 {
+    send_stage2_submit_data_fast(req_header, status, data, data_length);
 
-    send_stage2_submit(req_header, status, data_length);
-
-    if (data_length)
-    {
-        send(kSock, data, data_length, 0);
-    }
+    // data may be on the stack of the caller
+    flush_usbip_tx();
 }
 
+/**
+ * @brief Queue a ret_submit without copying the payload into a staging buffer
+ * The payload must stay valid until flush_usbip_tx() is called, which gives
+ * it to lwIP with NETCONN_COPY.
+ *
+ */
 void send_stage2_submit_data_fast(usbip_stage2_header *req_header, int32_t status, const void *const data, int32_t data_length)
 {
-    const uint8_t * send_buf = (uint8_t *)req_header;
-
     req_header->base.command = USBIP_STAGE2_RSP_SUBMIT;
     req_header->base.direction = !(req_header->base.direction);
 
@@ -376,18 +521,20 @@ void send_stage2_submit_data_fast(usbip_stage2_header *req_header, int32_t statu
     req_header->u.ret_submit.data_length = data_length;
 
     pack(req_header, sizeof(usbip_stage2_header));
-
-    // payload
-    memcpy(&send_buf[sizeof(usbip_stage2_header)], data, data_length);
-    send(kSock, send_buf, sizeof(usbip_stage2_header) + data_length, 0);
+    queue_stage2_header(req_header, data, data_length);
 }
 
 static void handle_unlink(usbip_stage2_header *header)
 {
-    printf("s2 handling cmd unlink...\r\n");
-    send_stage2_unlink(header);
+    int32_t status = 0;
+
+    DAP_LOGD("s2 handling cmd unlink...\r\n");
+    // Only the DAP endpoint keeps URBs pending, the others are given back at once.
+    // The host does not fill in the ep of cmd_unlink, look the URB up by seqnum.
+    status = handle_dap_unlink(header->u.cmd_unlink.seqnum);
+    send_stage2_unlink(header, status);
 }
-static void send_stage2_unlink(usbip_stage2_header *req_header)
+static void send_stage2_unlink(usbip_stage2_header *req_header, int32_t status)
 {
 
     req_header->base.command = USBIP_STAGE2_RSP_UNLINK;
@@ -395,9 +542,9 @@ static void send_stage2_unlink(usbip_stage2_header *req_header)
 
     memset(&(req_header->u.ret_unlink), 0, sizeof(usbip_stage2_header_ret_unlink));
 
-    // req_header.u.ret_unlink.status = 0;
+    req_header->u.ret_unlink.status = status;
 
     pack(req_header, sizeof(usbip_stage2_header));
 
-    send(kSock, req_header, sizeof(usbip_stage2_header), 0);
+    queue_stage2_header(req_header, NULL, 0);
 }
\ No newline at end of file
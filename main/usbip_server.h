@@ -13,13 +13,15 @@ enum state_t
     EMULATING
 };
 extern uint8_t kState;
-extern int kSock;
 
+uint32_t get_usbip_pdu_length(const uint8_t *buffer, uint32_t length);
+uint8_t *get_usbip_pdu_payload_buffer(const uint8_t *buffer);
 int attach(uint8_t *buffer, uint32_t length);
-int emulate(uint8_t *buffer, uint32_t length);
+int emulate(uint8_t *buffer, uint32_t length, uint8_t *payload);
 void send_stage2_submit_data(usbip_stage2_header *req_header, int32_t status, const void * const data, int32_t data_length);
 void send_stage2_submit(usbip_stage2_header *req_header, int32_t status, int32_t data_length);
 void send_stage2_submit_data_fast(usbip_stage2_header *req_header, int32_t status, const void *const data, int32_t data_length);
+void flush_usbip_tx();
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,515 @@
+/**
+ * @file websocket_server.c
+ * @brief CMSIS-DAP over WebSocket, for browser based tools
+ *
+ * After the HTTP upgrade, each binary message from the client carries one DAP
+ * command, and each response is sent back as one binary message, in the order
+ * of the commands. Up to the packet count of commands may be in flight.
+ * DAP_TransferAbort has no response, as with USB. Fragmented messages are not
+ * supported.
+ *
+ * @version 0.1
+ * @date 2022-08-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "main/websocket_server.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "lwip/err.h"
+#include "lwip/api.h"
+#include "lwip/tcp.h"
+
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+
+#include "main/wifi_configuration.h"
+#include "main/dap_configuration.h"
+#include "main/dap_handle.h"
+#include "main/dap_tx_batch.h"
+#include "components/DAP/include/DAP.h"
+#include "components/DAP/include/dap_event.h"
+#include "components/DAP/include/dap_log.h"
+
+extern SemaphoreHandle_t kConnMutex;
+
+#define WS_HANDSHAKE_SIZE 1024
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+enum ws_opcode
+{
+    WS_OPCODE_CONTINUATION = 0x0,
+    WS_OPCODE_TEXT = 0x1,
+    WS_OPCODE_BINARY = 0x2,
+    WS_OPCODE_CLOSE = 0x8,
+    WS_OPCODE_PING = 0x9,
+    WS_OPCODE_PONG = 0xA,
+};
+
+static struct netconn *ws_conn = NULL;
+// Received data that is not dispatched yet
+static struct pbuf *ws_rx_pbuf = NULL;
+static int ws_upgraded = 0;
+static uint32_t ws_seqnum = 0;
+
+// Responses waiting for ws_flush()
+static dap_tx_batch_t ws_tx;
+
+// Control frames and the handshake
+static char ws_handshake[WS_HANDSHAKE_SIZE];
+static uint8_t ws_control[2 + 125];
+
+static int ws_ready();
+static void ws_reply(uint32_t seqnum, const uint8_t *buf, uint32_t length);
+static void ws_flush();
+static int ws_handle_handshake();
+static int ws_rx_dispatch();
+
+static const dap_transport_t ws_transport = {
+    .ready = ws_ready,
+    .reply = ws_reply,
+    .flush = ws_flush,
+};
+
+
+static int ws_ready()
+{
+    return 1;
+}
+
+static uint32_t ws_frame_header(uint8_t *header, uint8_t opcode, uint32_t length)
+{
+    header[0] = 0x80 | opcode; // FIN
+    if (length < 126)
+    {
+        header[1] = length;
+        return 2;
+    }
+    header[1] = 126;
+    header[2] = (length >> 8) & 0xFF;
+    header[3] = length & 0xFF;
+    return 4;
+}
+
+static void ws_reply(uint32_t seqnum, const uint8_t *buf, uint32_t length)
+{
+    uint8_t header[DAP_TX_BATCH_HEADER_MAX];
+
+    dap_tx_batch_add(&ws_tx, header, ws_frame_header(header, WS_OPCODE_BINARY, length), buf, length);
+}
+
+static void ws_flush()
+{
+    dap_tx_batch_flush(&ws_tx);
+}
+
+/**
+ * @brief Send a control frame. Called with kConnMutex held.
+ *
+ */
+static void ws_send_control(uint8_t opcode, const uint8_t *data, uint32_t length)
+{
+    uint32_t header_length = ws_frame_header(ws_control, opcode, length);
+
+    memcpy(&ws_control[header_length], data, length);
+    ws_flush(); // keep the order of the messages
+    DAP_EVENT_BEGIN(DAP_EVENT_SEND, 1);
+    netconn_write(ws_conn, ws_control, header_length + length, NETCONN_COPY);
+    DAP_EVENT_END(DAP_EVENT_SEND, 1);
+}
+
+void websocket_server_task()
+{
+    struct netconn *listen_conn;
+    struct pbuf *p;
+    err_t err;
+    int ret;
+
+    while (1)
+    {
+#ifdef CONFIG_EXAMPLE_IPV4
+        listen_conn = netconn_new(NETCONN_TCP);
+#else // IPV6
+        listen_conn = netconn_new(NETCONN_TCP_IPV6);
+#endif
+        if (listen_conn == NULL)
+        {
+            DAP_LOGE("Unable to create WebSocket netconn\r\n");
+            break;
+        }
+
+#ifdef CONFIG_EXAMPLE_IPV4
+        err = netconn_bind(listen_conn, IP_ADDR_ANY, WEBSOCKET_PORT);
+#else // IPV6
+        err = netconn_bind(listen_conn, IP6_ADDR_ANY, WEBSOCKET_PORT);
+#endif
+        if (err != ERR_OK)
+        {
+            DAP_LOGE("WebSocket unable to bind: err %d\r\n", err);
+            break;
+        }
+
+        err = netconn_listen(listen_conn);
+        if (err != ERR_OK)
+        {
+            DAP_LOGE("Error occured during WebSocket listen: err %d\r\n", err);
+            break;
+        }
+        DAP_LOGI("WebSocket listening\r\n");
+
+        while (1)
+        {
+            err = netconn_accept(listen_conn, &ws_conn);
+            if (err != ERR_OK)
+            {
+                DAP_LOGE("Unable to accept WebSocket connection: err %d\r\n", err);
+                break;
+            }
+            tcp_nagle_disable(ws_conn->pcb.tcp);
+            ws_upgraded = 0;
+
+            while (1)
+            {
+                err = netconn_recv_tcp_pbuf(ws_conn, &p);
+                if (err != ERR_OK)
+                {
+                    DAP_LOGI("WebSocket closed: err %d\r\n", err);
+                    break;
+                }
+
+                if (ws_rx_pbuf == NULL)
+                {
+                    ws_rx_pbuf = p;
+                }
+                else
+                {
+                    pbuf_cat(ws_rx_pbuf, p);
+                }
+
+                mark_dap_request_arrival();
+                DAP_EVENT_BEGIN(DAP_EVENT_RECV, p->tot_len);
+                ret = ws_upgraded ? ws_rx_dispatch() : ws_handle_handshake();
+                DAP_EVENT_END(DAP_EVENT_RECV, 0);
+                if (ret < 0)
+                {
+                    break;
+                }
+            }
+
+            xSemaphoreTake(kConnMutex, portMAX_DELAY);
+            if (ws_upgraded)
+            {
+                release_dap_session();
+                dap_tx_batch_reset(&ws_tx, NULL);
+            }
+            netconn_close(ws_conn);
+            netconn_delete(ws_conn);
+            ws_conn = NULL;
+            xSemaphoreGive(kConnMutex);
+
+            if (ws_rx_pbuf != NULL)
+            {
+                pbuf_free(ws_rx_pbuf);
+                ws_rx_pbuf = NULL;
+            }
+        }
+        netconn_delete(listen_conn);
+    }
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Find a header of the upgrade request in ws_handshake
+ *
+ * @return The value, without the leading spaces, or NULL if the header is missing
+ */
+static char *ws_header_value(const char *name)
+{
+    size_t name_length = strlen(name);
+    char *line;
+
+    // the request line is skipped
+    for (line = strstr(ws_handshake, "\r\n"); line != NULL; line = strstr(line, "\r\n"))
+    {
+        line += 2;
+        if (strncasecmp(line, name, name_length) == 0 && line[name_length] == ':')
+        {
+            line += name_length + 1;
+            while (*line == ' ')
+            {
+                line++;
+            }
+            return line;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Length of a header value, without the trailing spaces
+ *
+ */
+static size_t ws_value_length(const char *value)
+{
+    const char *end = strstr(value, "\r\n");
+
+    while (end > value && end[-1] == ' ')
+    {
+        end--;
+    }
+    return end - value;
+}
+
+/**
+ * @brief Whether a comma separated header value holds a token, ignoring the case
+ *
+ */
+static int ws_value_has_token(const char *value, const char *token)
+{
+    const char *end = value + ws_value_length(value);
+    size_t token_length = strlen(token);
+    const char *item;
+    size_t item_length;
+
+    while (value < end)
+    {
+        while (value < end && (*value == ' ' || *value == ','))
+        {
+            value++;
+        }
+        item = value;
+        while (value < end && *value != ',')
+        {
+            value++;
+        }
+        item_length = value - item;
+        while (item_length > 0 && item[item_length - 1] == ' ')
+        {
+            item_length--;
+        }
+        if (item_length == token_length && strncasecmp(item, token, token_length) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Answer the HTTP upgrade request and take the DAP engine
+ *
+ * @return 0 to go on, -1 to close the connection
+ */
+static int ws_handle_handshake()
+{
+    static const char *response =
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n"
+        "\r\n";
+    uint8_t sha1[20];
+    uint8_t accept[32];
+    size_t accept_length;
+    uint16_t end;
+    char *value, *key, *key_end;
+    int ret;
+
+    end = pbuf_memfind(ws_rx_pbuf, "\r\n\r\n", 4, 0);
+    if (end == 0xFFFF)
+    {
+        // wait for the rest of the request
+        return ws_rx_pbuf->tot_len < WS_HANDSHAKE_SIZE - 1 ? 0 : -1;
+    }
+    if (end + 4 > WS_HANDSHAKE_SIZE - 1)
+    {
+        return -1;
+    }
+    pbuf_copy_partial(ws_rx_pbuf, ws_handshake, end + 4, 0);
+    ws_handshake[end + 4] = '\0';
+    ws_rx_pbuf = pbuf_free_header(ws_rx_pbuf, end + 4);
+
+    // Only a WebSocket upgrade of version 13 (RFC 6455) is answered
+    value = ws_header_value("Upgrade");
+    ret = value != NULL && ws_value_has_token(value, "websocket");
+    value = ws_header_value("Connection");
+    ret = ret && value != NULL && ws_value_has_token(value, "Upgrade");
+    value = ws_header_value("Sec-WebSocket-Version");
+    ret = ret && value != NULL && ws_value_length(value) == 2 && strncmp(value, "13", 2) == 0;
+    key = ws_header_value("Sec-WebSocket-Key");
+    if (!ret || key == NULL || ws_value_length(key) == 0)
+    {
+        DAP_LOGW("WebSocket bad upgrade request\r\n");
+        netconn_write(ws_conn, "HTTP/1.1 400 Bad Request\r\n\r\n", 28, NETCONN_COPY);
+        return -1;
+    }
+    key_end = key + ws_value_length(key);
+
+    // accept = base64(sha1(key + GUID)), built after the key in the same buffer
+    if (key_end + sizeof(WS_GUID) > &ws_handshake[WS_HANDSHAKE_SIZE])
+    {
+        return -1;
+    }
+    memcpy(key_end, WS_GUID, sizeof(WS_GUID));
+    mbedtls_sha1_ret((const unsigned char *)key, strlen(key), sha1);
+    mbedtls_base64_encode(accept, sizeof(accept), &accept_length, sha1, sizeof(sha1));
+
+    xSemaphoreTake(kConnMutex, portMAX_DELAY);
+    dap_tx_batch_reset(&ws_tx, ws_conn);
+    ret = acquire_dap_session(&ws_transport);
+    xSemaphoreGive(kConnMutex);
+    if (ret != 0)
+    {
+        DAP_LOGW("DAP is used by another session\r\n");
+        netconn_write(ws_conn, "HTTP/1.1 503 Service Unavailable\r\n\r\n", 36, NETCONN_COPY);
+        return -1;
+    }
+
+    ret = snprintf(ws_handshake, sizeof(ws_handshake), response, accept);
+    netconn_write(ws_conn, ws_handshake, ret, NETCONN_COPY);
+    ws_upgraded = 1;
+    DAP_LOGI("WebSocket accepted\r\n");
+
+    return ws_rx_pbuf == NULL ? 0 : ws_rx_dispatch();
+}
+
+/**
+ * @brief Handle every complete frame in the received pbufs.
+ * The payload of a binary frame is copied straight into its DAP queue slot,
+ * and unmasked there.
+ *
+ * @return 0 on success, -1 to close the connection
+ */
+static int ws_rx_dispatch()
+{
+    uint8_t header[8];
+    uint32_t header_length, length, i;
+    uint8_t opcode;
+    uint8_t command;
+    uint8_t *mask;
+    uint8_t *buf;
+
+    while (ws_rx_pbuf != NULL && ws_rx_pbuf->tot_len >= 2)
+    {
+        pbuf_copy_partial(ws_rx_pbuf, header, MIN(ws_rx_pbuf->tot_len, sizeof(header)), 0);
+        opcode = header[0] & 0x0F;
+        if (!(header[0] & 0x80) || !(header[1] & 0x80))
+        {
+            DAP_LOGW("WebSocket fragmented or unmasked frame\r\n");
+            return -1;
+        }
+
+        length = header[1] & 0x7F;
+        header_length = 2;
+        if (length == 126)
+        {
+            if (ws_rx_pbuf->tot_len < 4)
+            {
+                break;
+            }
+            length = (header[2] << 8) | header[3];
+            header_length = 4;
+        }
+        else if (length == 127)
+        {
+            DAP_LOGE("WebSocket frame too large\r\n");
+            return -1;
+        }
+        mask = &header[header_length];
+        header_length += 4;
+
+        if (length > DAP_PACKET_SIZE)
+        {
+            DAP_LOGE("WebSocket frame too large: %d\r\n", (int)length);
+            return -1;
+        }
+        if (ws_rx_pbuf->tot_len < header_length + length)
+        {
+            break; // wait for the rest of the frame
+        }
+        if (opcode == WS_OPCODE_BINARY && length == 0)
+        {
+            DAP_LOGE("WebSocket empty DAP command\r\n");
+            return -1;
+        }
+
+        xSemaphoreTake(kConnMutex, portMAX_DELAY);
+        switch (opcode)
+        {
+        case WS_OPCODE_BINARY:
+            pbuf_copy_partial(ws_rx_pbuf, &command, 1, header_length);
+            command ^= mask[0];
+            if (command == ID_DAP_TransferAbort)
+            {
+                // Takes no slot: it has to get through a window full of commands
+                // stuck in WAIT retries, which is what it is sent for
+                queue_dap_request(ws_seqnum, &command, 1);
+                ws_seqnum++;
+                break;
+            }
+
+            for (;;)
+            {
+                buf = get_dap_request_buffer();
+                if (buf != NULL)
+                {
+                    pbuf_copy_partial(ws_rx_pbuf, buf, length, header_length);
+                    for (i = 0; i < length; i++)
+                    {
+                        buf[i] ^= mask[i & 0x3];
+                    }
+                    if (queue_dap_request(ws_seqnum, buf, length) >= 0)
+                    {
+                        break;
+                    }
+                }
+
+                // More commands than the packet count, wait for a response to go out
+                wait_dap_request_slot();
+            }
+            ws_seqnum++;
+            break;
+
+        case WS_OPCODE_PING:
+            if (length > sizeof(ws_control) - 2)
+            {
+                break;
+            }
+            pbuf_copy_partial(ws_rx_pbuf, ws_handshake, length, header_length);
+            for (i = 0; i < length; i++)
+            {
+                ws_handshake[i] ^= mask[i & 0x3];
+            }
+            ws_send_control(WS_OPCODE_PONG, (uint8_t *)ws_handshake, length);
+            break;
+
+        case WS_OPCODE_PONG:
+            break;
+
+        case WS_OPCODE_CLOSE:
+            ws_send_control(WS_OPCODE_CLOSE, NULL, 0);
+            xSemaphoreGive(kConnMutex);
+            return -1;
+
+        default:
+            DAP_LOGW("WebSocket unsupported opcode: %d\r\n", opcode);
+            xSemaphoreGive(kConnMutex);
+            return -1;
+        }
+        xSemaphoreGive(kConnMutex);
+
+        ws_rx_pbuf = pbuf_free_header(ws_rx_pbuf, header_length + length);
+    }
+
+    return 0;
+}
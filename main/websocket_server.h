@@ -0,0 +1,6 @@
+#ifndef __WEBSOCKET_SERVER_H__
+#define __WEBSOCKET_SERVER_H__
+
+void websocket_server_task();
+
+#endif
@@ -14,6 +14,27 @@
 #define WIFI_PASS "12345678"
 
 #define PORT 3240
+// CMSIS-DAP over plain TCP, see dap_tcp_server.c
+#define DAP_TCP_PORT 3241
+// CMSIS-DAP over UDP, see udp_server.c
+#define USE_UDP_SERVER 1
+#define DAP_UDP_PORT 3242
+// CMSIS-DAP over WebSocket, see websocket_server.c
+#define USE_WEBSOCKET_SERVER 1
+#define WEBSOCKET_PORT 3243
+// Capture of the USBIP PDUs for usbip_replay, see usbip_capture.c
+#define USE_USBIP_CAPTURE 0
+#define USBIP_CAPTURE_PORT 3244
+#define USBIP_CAPTURE_RING_SIZE 32768
+// Prometheus text endpoint of the metrics, see metrics_server.c
+#define USE_METRICS_SERVER 1
+#define METRICS_PORT 3245
+// Log messages are also sent to the clients of this port, see log_server.c
+#define USE_LOG_SERVER 1
+#define LOG_PORT 3246
+// Print the DAP command microbenchmarks at boot, see dap_bench.c
+#define USE_DAP_BENCH 0
+#define DAP_BENCH_ITERATIONS 100
 
 #define CONFIG_EXAMPLE_IPV4 1
 